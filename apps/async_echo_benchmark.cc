@@ -0,0 +1,135 @@
+#include "async_tcp_stack.hh"
+#include "util.hh"
+
+#include <chrono>
+#include <cstdlib>
+#include <exception>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace std;
+using namespace std::chrono;
+
+using Stack = AsyncTCPOverUDPStack;
+
+constexpr size_t MESSAGE_SIZE = 1000;
+
+//! Windows small enough that a burst from every connection fits in the server's socket buffer
+static TCPConfig echo_config() {
+    TCPConfig config;
+    config.send_capacity = config.recv_capacity = 16000;
+    config.rt_timeout = 100;
+    return config;
+}
+
+static Stack::Task echo(Stack::Stream stream) {
+    for (auto data = co_await stream.read(); not data.empty(); data = co_await stream.read()) {
+        co_await stream.write(move(data));
+    }
+    stream.end_input();
+}
+
+static Stack::Task serve(Stack &stack, const uint16_t port, const size_t connections) {
+    for (size_t i = 0; i < connections; i++) {
+        stack.spawn(echo(co_await stack.accept(port)));
+    }
+}
+
+//! \brief The clients: `rounds` messages on each of `connections` connections, each sent once the previous
+//! one's echo has come back
+//! \details Over UDP, a connection is identified by the UDP addresses, so each connection gets its own
+//! socket and TCPStack, and one thread polls them in turn.
+static void client_loop(const Address &server, const size_t connections, const size_t rounds) {
+    vector<unique_ptr<TCPOverUDPStack>> stacks;
+    vector<TCPOverUDPStack::Stream> streams;
+    for (size_t i = 0; i < connections; i++) {
+        UDPSocket sock;
+        sock.bind(Address("127.0.0.1", 0));
+        FdAdapterConfig config;
+        config.source = sock.local_address();
+        stacks.push_back(make_unique<TCPOverUDPStack>(TCPOverUDPSocketAdapter(move(sock)), echo_config(), config));
+        streams.push_back(stacks.back()->connect(server));
+    }
+
+    const string message(MESSAGE_SIZE, 'x');
+    vector<size_t> sent(connections, 0), received(connections, 0);
+    size_t finished = 0;
+    while (finished < connections) {
+        finished = 0;
+        for (size_t i = 0; i < connections; i++) {
+            auto &stream = streams[i];
+            stacks[i]->wait_next_event(0);
+            received[i] += stream.read().size();
+            if (sent[i] == received[i] and sent[i] < rounds * MESSAGE_SIZE and
+                stream.state() != TCPState::State::SYN_SENT) {
+                sent[i] += stream.write(message);
+                if (sent[i] == rounds * MESSAGE_SIZE) {
+                    stream.end_input();
+                }
+            }
+            finished += stream.eof();
+        }
+    }
+}
+
+int main(int argc, char *argv[]) {
+    try {
+        if (argc <= 0) {
+            abort();  // For sticklers: don't try to access argv[0] if argc <= 0.
+        }
+        if (argc > 3) {
+            cerr << "Usage: " << argv[0] << " [CONNECTIONS [ROUNDS]]\n";
+            return EXIT_FAILURE;
+        }
+        const size_t connections = argc > 1 ? stoul(argv[1]) : 100;
+        const size_t rounds = argc > 2 ? stoul(argv[2]) : 100;
+
+        UDPSocket sock;
+        sock.bind(Address("127.0.0.1", 0));
+        const Address server_address = sock.local_address();
+        FdAdapterConfig server_config;
+        server_config.source = server_address;
+        Stack server{TCPOverUDPSocketAdapter(move(sock)), echo_config(), server_config};
+        server.listen(server_address.port(), connections);
+        server.spawn(serve(server, server_address.port(), connections));
+
+        const auto first_time = high_resolution_clock::now();
+
+        exception_ptr server_error{};
+        thread server_thread([&] {
+            try {
+                server.run();
+            } catch (...) {
+                server_error = current_exception();
+            }
+        });
+        client_loop(server_address, connections, rounds);
+        server_thread.join();
+        if (server_error) {
+            rethrow_exception(server_error);
+        }
+
+        const auto final_time = high_resolution_clock::now();
+
+        const double seconds = duration_cast<nanoseconds>(final_time - first_time).count() / 1e9;
+        const double messages = double(connections * rounds);
+
+        cout << fixed << setprecision(2);
+        cout << "Echo server (one thread, one coroutine per connection), " << connections << " connection"
+             << (connections == 1 ? "" : "s") << " x " << rounds << " round trips of " << MESSAGE_SIZE
+             << " bytes: " << messages / seconds << " round trips/s, "
+             << 2 * messages * MESSAGE_SIZE * 8 / seconds / 1e6 << " Mbit/s\n";
+        const auto &counters = server.stack().counters();
+        cout << "  server: " << counters.connections_accepted << " connections, " << counters.segments_received
+             << " segments received, " << counters.segments_sent << " sent\n";
+    } catch (const exception &e) {
+        cerr << e.what() << "\n";
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,325 @@
+#include "allocation_counter.hh"
+#include "arp_message.hh"
+#include "byte_stream.hh"
+#include "ipv4_datagram.hh"
+#include "logger.hh"
+#include "lpm_table.hh"
+#include "network_interface.hh"
+#include "parser.hh"
+#include "stream_reassembler.hh"
+#include "tcp_header.hh"
+#include "util.hh"
+#include "wrapping_integers.hh"
+
+#include <algorithm>
+#include <benchmark/benchmark.h>
+#include <cstdint>
+#include <random>
+#include <string>
+#include <utility>
+#include <vector>
+
+using namespace std;
+
+// Microbenchmarks of each component in isolation. Build the `bench` target to run them all and write the results
+// to bench_sponge.json, or run bench_sponge with Google Benchmark's options (e.g. --benchmark_filter=Reassembler).
+// Each benchmark also reports its allocations per iteration, as the counter `allocs`.
+
+//! \brief Reports the allocations per iteration of a benchmark's loop, as the counter `allocs`
+//! \details Constructed just before the loop, it reports when the benchmark returns.
+class AllocationsPerIteration {
+  private:
+    benchmark::State &_state;
+    AllocationPhase _phase{};
+
+  public:
+    explicit AllocationsPerIteration(benchmark::State &state) : _state(state) {}
+    ~AllocationsPerIteration() {
+        _state.counters["allocs"] =
+            benchmark::Counter(static_cast<double>(_phase.count().allocations), benchmark::Counter::kAvgIterations);
+    }
+
+    AllocationsPerIteration(const AllocationsPerIteration &other) = delete;
+    AllocationsPerIteration &operator=(const AllocationsPerIteration &other) = delete;
+};
+
+//! A string of `size` pseudo-random bytes
+static string random_bytes(const size_t size, const unsigned seed = 0) {
+    mt19937 rd{seed};
+    string ret(size, 0);
+    generate(ret.begin(), ret.end(), [&] { return static_cast<char>(rd()); });
+    return ret;
+}
+
+// ByteStream: write a chunk and read it back, through a stream with room for 64 KiB
+static void ByteStream_write_read(benchmark::State &state) {
+    const string chunk = random_bytes(state.range(0));
+    ByteStream stream{64 * 1024};
+    const AllocationsPerIteration allocations{state};
+    for (auto _ : state) {
+        stream.write(chunk);
+        benchmark::DoNotOptimize(stream.read(chunk.size()));
+    }
+    state.SetBytesProcessed(state.iterations() * chunk.size());
+}
+BENCHMARK(ByteStream_write_read)->Arg(1)->Arg(64)->Arg(1000)->Arg(16 * 1024);
+
+//! How the segments of a stream reach the reassembler
+enum class Arrival { InOrder, Reversed, Random, Overlapping };
+
+// StreamReassembler: reassemble 64 KiB sent as 1000-byte segments, arriving in the given pattern
+static void StreamReassembler_push(benchmark::State &state, const Arrival arrival) {
+    constexpr size_t stream_size = 64 * 1024;
+    constexpr size_t segment_size = 1000;
+    const string data = random_bytes(stream_size);
+
+    // (index, length) of each segment, in the order they arrive; overlapping segments are half again as long
+    vector<pair<size_t, size_t>> segments;
+    const size_t length = arrival == Arrival::Overlapping ? segment_size * 3 / 2 : segment_size;
+    for (size_t index = 0; index < stream_size; index += segment_size) {
+        segments.emplace_back(index, min(length, stream_size - index));
+    }
+    if (arrival == Arrival::Reversed) {
+        reverse(segments.begin(), segments.end());
+    } else if (arrival == Arrival::Random or arrival == Arrival::Overlapping) {
+        shuffle(segments.begin(), segments.end(), mt19937{1});
+    }
+    vector<string> payloads;
+    for (const auto &[index, size] : segments) {
+        payloads.push_back(data.substr(index, size));
+    }
+
+    const AllocationsPerIteration allocations{state};
+    for (auto _ : state) {
+        StreamReassembler reassembler{stream_size};
+        for (size_t i = 0; i < segments.size(); i++) {
+            reassembler.push_substring(payloads[i], segments[i].first, false);
+        }
+        if (reassembler.stream_out().buffer_size() != stream_size) {
+            state.SkipWithError("stream not reassembled");
+            break;
+        }
+    }
+    state.SetBytesProcessed(state.iterations() * stream_size);
+}
+BENCHMARK_CAPTURE(StreamReassembler_push, in_order, Arrival::InOrder);
+BENCHMARK_CAPTURE(StreamReassembler_push, reversed, Arrival::Reversed);
+BENCHMARK_CAPTURE(StreamReassembler_push, random, Arrival::Random);
+BENCHMARK_CAPTURE(StreamReassembler_push, overlapping, Arrival::Overlapping);
+
+// InternetChecksum over a header, a full-sized datagram and a 64 KiB buffer
+static void InternetChecksum_add(benchmark::State &state) {
+    const string data = random_bytes(state.range(0));
+    const AllocationsPerIteration allocations{state};
+    for (auto _ : state) {
+        InternetChecksum checksum;
+        checksum.add(data);
+        benchmark::DoNotOptimize(checksum.value());
+    }
+    state.SetBytesProcessed(state.iterations() * data.size());
+}
+BENCHMARK(InternetChecksum_add)->Arg(20)->Arg(1500)->Arg(64 * 1024);
+
+//! A TCP header with every field set
+static TCPHeader sample_tcp_header() {
+    TCPHeader header;
+    header.sport = 1234;
+    header.dport = 80;
+    header.seqno = WrappingInt32{0x12345678};
+    header.ackno = WrappingInt32{0x9abcdef0};
+    header.ack = true;
+    header.win = 65535;
+    return header;
+}
+
+static void TCPHeader_serialize(benchmark::State &state) {
+    const TCPHeader header = sample_tcp_header();
+    const AllocationsPerIteration allocations{state};
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(header.serialize());
+    }
+}
+BENCHMARK(TCPHeader_serialize);
+
+static void TCPHeader_parse(benchmark::State &state) {
+    const Buffer serialized{sample_tcp_header().serialize()};
+    const AllocationsPerIteration allocations{state};
+    for (auto _ : state) {
+        TCPHeader header;
+        NetParser parser{serialized};
+        benchmark::DoNotOptimize(header.parse(parser));
+    }
+}
+BENCHMARK(TCPHeader_parse);
+
+//! An IPv4 header of a datagram with a 1000-byte payload
+static IPv4Header sample_ipv4_header() {
+    IPv4Header header;
+    header.len = header.hlen * 4 + 1000;
+    header.src = 0x0a000001;
+    header.dst = 0x0a000002;
+    return header;
+}
+
+static void IPv4Header_serialize(benchmark::State &state) {
+    const IPv4Header header = sample_ipv4_header();
+    const AllocationsPerIteration allocations{state};
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(header.serialize());
+    }
+}
+BENCHMARK(IPv4Header_serialize);
+
+static void IPv4Header_parse(benchmark::State &state) {
+    const Buffer serialized{sample_ipv4_header().serialize()};
+    const AllocationsPerIteration allocations{state};
+    for (auto _ : state) {
+        IPv4Header header;
+        NetParser parser{serialized};
+        benchmark::DoNotOptimize(header.parse(parser));
+    }
+}
+BENCHMARK(IPv4Header_parse);
+
+//! Pseudo-random absolute sequence numbers, each within 2^31 of the one before (as unwrap() expects)
+static vector<uint64_t> sequence_numbers() {
+    mt19937_64 rd{2};
+    vector<uint64_t> ret{uint64_t(1) << 40};
+    while (ret.size() < 4096) {
+        ret.push_back(ret.back() + rd() % (uint64_t(1) << 31) - (uint64_t(1) << 30));
+    }
+    return ret;
+}
+
+static void wrap(benchmark::State &state) {
+    const auto absolute = sequence_numbers();
+    const WrappingInt32 isn{0xdeadbeef};
+    size_t i = 0;
+    const AllocationsPerIteration allocations{state};
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(wrap(absolute[i++ % absolute.size()], isn));
+    }
+}
+BENCHMARK(wrap);
+
+static void unwrap(benchmark::State &state) {
+    const auto absolute = sequence_numbers();
+    const WrappingInt32 isn{0xdeadbeef};
+    vector<WrappingInt32> wrapped;
+    for (const uint64_t n : absolute) {
+        wrapped.push_back(wrap(n, isn));
+    }
+    size_t i = 0;
+    const AllocationsPerIteration allocations{state};
+    for (auto _ : state) {
+        const size_t j = i++ % absolute.size();
+        benchmark::DoNotOptimize(unwrap(wrapped[j], isn, absolute[j == 0 ? 0 : j - 1]));
+    }
+}
+BENCHMARK(unwrap);
+
+//! A table of `count` random prefixes, mostly /24s, and random addresses to look up in it
+static pair<LPMTable, vector<uint32_t>> lpm_table(const size_t count) {
+    mt19937 rd{3};
+    pair<LPMTable, vector<uint32_t>> ret;
+    const uint8_t lengths[] = {8, 16, 20, 22, 24, 24, 24, 24, 32};
+    for (size_t i = 0; i < count; i++) {
+        ret.first.add(rd(), lengths[i % size(lengths)], i % 256);
+    }
+    for (size_t i = 0; i < 4096; i++) {
+        ret.second.push_back(rd());
+    }
+    return ret;
+}
+
+// Router LPM: one lookup at a time, and in bursts of 32 as Router::route does
+static void LPMTable_lookup(benchmark::State &state) {
+    const auto [table, addresses] = lpm_table(state.range(0));
+    size_t i = 0;
+    const AllocationsPerIteration allocations{state};
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(table.lookup(addresses[i++ % addresses.size()]));
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(LPMTable_lookup)->Arg(1000)->Arg(100000);
+
+static void LPMTable_lookup_batch(benchmark::State &state) {
+    constexpr size_t batch = 32;
+    const auto [table, addresses] = lpm_table(state.range(0));
+    uint32_t results[batch];
+    size_t i = 0;
+    const AllocationsPerIteration allocations{state};
+    for (auto _ : state) {
+        table.lookup_batch(&addresses[i], static_cast<uint32_t *>(results), batch);
+        benchmark::DoNotOptimize(results);
+        i = (i + batch) % addresses.size();
+    }
+    state.SetItemsProcessed(state.iterations() * batch);
+}
+BENCHMARK(LPMTable_lookup_batch)->Arg(1000)->Arg(100000);
+
+const EthernetAddress local_ethernet{0x02, 0, 0, 0, 0, 1};
+const EthernetAddress remote_ethernet{0x02, 0, 0, 0, 0, 2};
+const Address local_ip{"10.0.0.1", 0};
+const Address remote_ip{"10.0.0.2", 0};
+
+//! A datagram from the local to the remote address, with a 1000-byte payload
+static InternetDatagram sample_datagram() {
+    InternetDatagram dgram;
+    dgram.header().src = local_ip.ipv4_numeric();
+    dgram.header().dst = remote_ip.ipv4_numeric();
+    dgram.payload() = random_bytes(1000);
+    dgram.header().len = dgram.header().hlen * 4 + dgram.payload().size();
+    return dgram;
+}
+
+// NetworkInterface: send a datagram to a neighbor whose address is in the ARP cache
+static void NetworkInterface_send(benchmark::State &state) {
+    NetworkInterface interface{local_ethernet, local_ip};
+    ARPMessage reply;
+    reply.opcode = ARPMessage::OPCODE_REPLY;
+    reply.sender_ethernet_address = remote_ethernet;
+    reply.sender_ip_address = remote_ip.ipv4_numeric();
+    reply.target_ethernet_address = local_ethernet;
+    reply.target_ip_address = local_ip.ipv4_numeric();
+    EthernetFrame frame;
+    frame.header() = {local_ethernet, remote_ethernet, EthernetHeader::TYPE_ARP};
+    frame.payload() = reply.serialize();
+    interface.recv_frame(frame);
+
+    const InternetDatagram dgram = sample_datagram();
+    const AllocationsPerIteration allocations{state};
+    for (auto _ : state) {
+        interface.send_datagram(dgram, remote_ip);
+        benchmark::DoNotOptimize(interface.frames_out().front());
+        interface.frames_out().pop();
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(NetworkInterface_send);
+
+// NetworkInterface: receive a frame holding a datagram
+static void NetworkInterface_recv(benchmark::State &state) {
+    NetworkInterface interface{local_ethernet, local_ip};
+    EthernetFrame frame;
+    frame.header() = {local_ethernet, remote_ethernet, EthernetHeader::TYPE_IPv4};
+    frame.payload() = sample_datagram().serialize().concatenate();
+    const AllocationsPerIteration allocations{state};
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(interface.recv_frame(frame));
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(NetworkInterface_recv);
+
+int main(int argc, char *argv[]) {
+    Logger::set_level(LogLevel::Warning);
+    benchmark::Initialize(&argc, argv);
+    if (benchmark::ReportUnrecognizedArguments(argc, argv)) {
+        return EXIT_FAILURE;
+    }
+    benchmark::RunSpecifiedBenchmarks();
+    benchmark::Shutdown();
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,168 @@
+#include "network_emulator.hh"
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+
+using namespace std;
+using namespace std::chrono;
+
+// Emulates TCP flows across a dumbbell: senders on the left and receivers on the right, each host on its own
+// access link to its side's router, and the two routers joined by a bottleneck link. The emulation runs in
+// virtual time, and is timed to show how much faster than real time it ran.
+
+//! The topology and traffic of an emulation
+struct Dumbbell {
+    size_t flows = 16;            //!< Flows, each from its own sender to its own receiver
+    uint64_t bytes = 1000000;     //!< Bytes each flow sends
+    uint64_t stagger_us = 0;      //!< Time between one flow's start and the next's
+    double bandwidth = 100;       //!< Bottleneck rate, in Mbit/s
+    double access = 1000;         //!< Access links' rate, in Mbit/s
+    uint64_t delay_us = 10000;    //!< Bottleneck's propagation delay (access links add 100 us)
+    size_t queue = LinkConfig::DEFAULT_QUEUE_BYTES;  //!< Bottleneck's queue size
+    bool red = false;             //!< Is the bottleneck's queue RED, rather than drop-tail?
+    double loss = 0;              //!< Bottleneck's loss probability
+    unsigned seed = 1;            //!< Seed of the losses and drops
+    bool quiet = false;           //!< Print only the summary, not each flow
+};
+
+//! Print the options
+static void usage(const char *argv0) {
+    const Dumbbell defaults;
+    cerr << "Usage: " << argv0 << " [--option VALUE]...\n\n"
+         << "   --flows N        flows, each between its own pair of hosts " << defaults.flows << "\n"
+         << "   --bytes N        bytes each flow sends                     " << defaults.bytes << "\n"
+         << "   --stagger US     time between the flows' starts            " << defaults.stagger_us << "\n"
+         << "   --bandwidth MBPS bottleneck rate                           " << defaults.bandwidth << "\n"
+         << "   --access MBPS    access links' rate                        " << defaults.access << "\n"
+         << "   --delay US       bottleneck propagation delay              " << defaults.delay_us << "\n"
+         << "   --queue N        bottleneck queue, in bytes                " << defaults.queue << "\n"
+         << "   --red 0|1        RED rather than drop-tail at the bottleneck " << defaults.red << "\n"
+         << "   --loss P         bottleneck loss probability (0-1)         " << defaults.loss << "\n"
+         << "   --seed N         seed of the losses and drops              " << defaults.seed << "\n"
+         << "   --quiet 0|1      print only the summary                    " << defaults.quiet << "\n";
+}
+
+//! Parse the options
+static Dumbbell parse_options(const int argc, char *argv[]) {
+    Dumbbell dumbbell;
+    for (int i = 1; i < argc; i += 2) {
+        const string option = argv[i];
+        if (i + 1 >= argc) {
+            throw runtime_error("missing value for " + option);
+        }
+        const string value = argv[i + 1];
+        if (option == "--flows") {
+            dumbbell.flows = stoul(value);
+        } else if (option == "--bytes") {
+            dumbbell.bytes = stoull(value);
+        } else if (option == "--stagger") {
+            dumbbell.stagger_us = stoull(value);
+        } else if (option == "--bandwidth") {
+            dumbbell.bandwidth = stod(value);
+        } else if (option == "--access") {
+            dumbbell.access = stod(value);
+        } else if (option == "--delay") {
+            dumbbell.delay_us = stoull(value);
+        } else if (option == "--queue") {
+            dumbbell.queue = stoul(value);
+        } else if (option == "--red") {
+            dumbbell.red = stoul(value) != 0;
+        } else if (option == "--loss") {
+            dumbbell.loss = stod(value);
+        } else if (option == "--seed") {
+            dumbbell.seed = stoul(value);
+        } else if (option == "--quiet") {
+            dumbbell.quiet = stoul(value) != 0;
+        } else {
+            throw runtime_error("unknown option " + option);
+        }
+    }
+    if (dumbbell.flows == 0 or dumbbell.flows > 60000) {
+        throw runtime_error("need from 1 to 60000 flows");
+    }
+    return dumbbell;
+}
+
+//! Build the dumbbell, run its flows, and report on them
+static void emulate(const Dumbbell &dumbbell) {
+    NetworkEmulator net{dumbbell.seed};
+
+    // left hosts are 10.1.x.x and right hosts 10.2.x.x, each with a /32 route on its side's router
+    constexpr uint32_t left_net = 0x0a010000, right_net = 0x0a020000;
+    const size_t left = net.add_router(), right = net.add_router();
+    const size_t left_uplink = net.add_router_interface(left, Address{"10.0.0.1"});
+    const size_t right_uplink = net.add_router_interface(right, Address{"10.0.0.2"});
+    net.add_route(left, right_net, 16, Address{"10.0.0.2"}, left_uplink);
+    net.add_route(right, left_net, 16, Address{"10.0.0.1"}, right_uplink);
+
+    LinkConfig bottleneck;
+    bottleneck.bandwidth = dumbbell.bandwidth;
+    bottleneck.delay_us = dumbbell.delay_us;
+    bottleneck.queue_bytes = dumbbell.queue;
+    bottleneck.discipline = dumbbell.red ? LinkConfig::QueueDiscipline::RED : LinkConfig::QueueDiscipline::DropTail;
+    bottleneck.loss = dumbbell.loss;
+    net.connect_routers(left, left_uplink, right, right_uplink, bottleneck);
+
+    LinkConfig access;
+    access.bandwidth = dumbbell.access;
+    access.delay_us = 100;
+    access.queue_bytes = 1024 * 1024;  // deep enough that only the bottleneck drops
+    for (size_t i = 0; i < dumbbell.flows; i++) {
+        const uint32_t host = static_cast<uint32_t>(i) + 2;
+        const size_t sender = net.add_host(Address::from_ipv4_numeric(left_net + host));
+        const size_t receiver = net.add_host(Address::from_ipv4_numeric(right_net + host));
+        const size_t left_port = net.add_router_interface(left, Address::from_ipv4_numeric(left_net + 1));
+        const size_t right_port = net.add_router_interface(right, Address::from_ipv4_numeric(right_net + 1));
+        net.add_route(left, left_net + host, 32, {}, left_port);
+        net.add_route(right, right_net + host, 32, {}, right_port);
+        net.connect_host(sender, left, left_port, access);
+        net.connect_host(receiver, right, right_port, access);
+        net.add_flow(sender, receiver, dumbbell.bytes, i * dumbbell.stagger_us * 1000);
+    }
+
+    const auto start = steady_clock::now();
+    const bool finished = net.run();
+    const double wall_s = duration_cast<duration<double>>(steady_clock::now() - start).count();
+    const double virtual_s = static_cast<double>(net.now_ns()) / 1e9;
+
+    if (not dumbbell.quiet) {
+        cout << net.report() << "\n";
+    }
+    uint64_t delivered = 0, retransmissions = 0;
+    for (const auto &flow : net.flow_reports()) {
+        delivered += flow.bytes_delivered;
+        retransmissions += flow.retransmissions;
+    }
+    const EmulatedLinkStats &stats = net.link(0).stats();
+    cout << dumbbell.flows << " flows " << (finished ? "finished" : "did not finish") << " in " << virtual_s
+         << " s of virtual time (" << wall_s << " s of real time, " << virtual_s / wall_s << "x real time)\n"
+         << "  goodput:    " << static_cast<double>(delivered) * 8 / virtual_s / 1e6 << " Mbit/s over a "
+         << dumbbell.bandwidth << " Mbit/s bottleneck\n"
+         << "  bottleneck: " << stats.frames_sent << " frames sent, " << stats.queue_drops << " dropped at the tail, "
+         << stats.early_drops << " dropped early, " << stats.losses << " lost; queueing delay p50 "
+         << static_cast<double>(stats.queueing_delay_ns.percentile(0.5)) / 1000 << " us, p99 "
+         << static_cast<double>(stats.queueing_delay_ns.percentile(0.99)) / 1000 << " us\n"
+         << "  TCP:        " << retransmissions << " segments retransmitted\n";
+}
+
+int main(int argc, char *argv[]) {
+    try {
+        if (argc <= 0) {
+            abort();  // For sticklers: don't try to access argv[0] if argc <= 0.
+        }
+        if (argc > 1 and string(argv[1]) == "--help") {
+            usage(argv[0]);
+            return EXIT_SUCCESS;
+        }
+        emulate(parse_options(argc, argv));
+    } catch (const exception &e) {
+        cerr << e.what() << "\n";
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,85 @@
+#include "eventloop.hh"
+#include "socket.hh"
+#include "util.hh"
+
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <sys/resource.h>
+#include <vector>
+
+using namespace std;
+using namespace std::chrono;
+
+constexpr size_t n_rules = 4000;
+constexpr size_t n_wakeups = 20000;
+
+//! Raise the soft limit on open files as far as the hard limit allows; returns the number of usable rules
+static size_t max_rules() {
+    rlimit limit{};
+    SystemCall("getrlimit", getrlimit(RLIMIT_NOFILE, &limit));
+    limit.rlim_cur = limit.rlim_max;
+    SystemCall("setrlimit", setrlimit(RLIMIT_NOFILE, &limit));
+    return min(n_rules, size_t(limit.rlim_cur / 2) - 16);  // two fds per rule, plus a few to spare
+}
+
+//! Each wakeup writes a byte into one of `rule_count` socket pairs and waits for the EventLoop to read it.
+void main_loop(const EventLoop::Backend backend, const bool with_interest, const size_t rule_count) {
+    EventLoop loop{backend};
+    vector<pair<LocalStreamSocket, LocalStreamSocket>> pairs;
+    pairs.reserve(rule_count);
+
+    for (size_t i = 0; i < rule_count; i++) {
+        int fds[2];
+        SystemCall("socketpair", ::socketpair(AF_UNIX, SOCK_STREAM, 0, static_cast<int *>(fds)));
+        pairs.emplace_back(LocalStreamSocket{FileDescriptor{fds[0]}}, LocalStreamSocket{FileDescriptor{fds[1]}});
+
+        auto &reader = pairs.back().second;
+        if (with_interest) {
+            loop.add_rule(reader, Direction::In, [&reader] { reader.read(1); }, [] { return true; });
+        } else {
+            loop.add_rule(reader, Direction::In, [&reader] { reader.read(1); });
+        }
+    }
+
+    auto rd = get_random_generator();
+    const auto first_time = high_resolution_clock::now();
+
+    for (size_t i = 0; i < n_wakeups; i++) {
+        pairs.at(rd() % rule_count).first.write("x");
+        if (loop.wait_next_event(-1) != EventLoop::Result::Success) {
+            throw runtime_error("EventLoop did not dispatch the ready rule");
+        }
+    }
+
+    const auto final_time = high_resolution_clock::now();
+
+    const auto duration = duration_cast<nanoseconds>(final_time - first_time).count();
+
+    const char *const backend_name = backend == EventLoop::Backend::Poll    ? "poll    "
+                                     : backend == EventLoop::Backend::Epoll ? "epoll   "
+                                                                            : "io_uring";
+
+    cout << fixed << setprecision(2);
+    cout << "Wakeup cost with " << rule_count << " rules, " << backend_name
+         << (with_interest ? ", interest callbacks: " : ", no interest:        ")
+         << double(duration) / n_wakeups / 1000.0 << " us\n";
+}
+
+int main() {
+    try {
+        const size_t rule_count = max_rules();
+        for (const auto with_interest : {false, true}) {
+            main_loop(EventLoop::Backend::Poll, with_interest, rule_count);
+            main_loop(EventLoop::Backend::Epoll, with_interest, rule_count);
+            main_loop(EventLoop::Backend::IoUring, with_interest, rule_count);
+        }
+    } catch (const exception &e) {
+        cerr << e.what() << "\n";
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -1,6 +1,7 @@
 #include "address.hh"
 #include "arp_message.hh"
 #include "bidirectional_stream_copy.hh"
+#include "logger.hh"
 #include "router.hh"
 #include "tcp_over_ip.hh"
 #include "tcp_sponge_socket.cc"
@@ -106,10 +107,22 @@ class NetworkInterfaceAdapter : public TCPOverIPv4Adapter {
 
         return {};
     }
+    void read_batch(vector<TCPSegment> &segments) {
+        auto seg = read();
+        if (seg) {
+            segments.push_back(move(seg.value()));
+        }
+    }
     void write(TCPSegment &seg) {
         _interface.send_datagram(wrap_tcp_in_ip(seg), _next_hop);
         send_pending();
     }
+    void write_batch(queue<TCPSegment> &segments) {
+        for (; not segments.empty(); segments.pop()) {
+            _interface.send_datagram(wrap_tcp_in_ip(segments.front()), _next_hop);
+        }
+        send_pending();
+    }
     void tick(const size_t ms_since_last_tick) {
         _interface.tick(ms_since_last_tick);
         send_pending();
@@ -133,7 +146,7 @@ class TCPSocketLab7 : public TCPSpongeSocket<NetworkInterfaceAdapter> {
         FdAdapterConfig multiplexer_config;
 
         _local_address = Address{_local_address.ip(), uint16_t(random_device()())};
-        cerr << "DEBUG: Connecting from " << _local_address.to_string() << "...\n";
+        LOG_DEBUG("Connecting from " << _local_address.to_string() << "...");
         multiplexer_config.source = _local_address;
         multiplexer_config.destination = address;
 
@@ -0,0 +1,161 @@
+#include "lpm_table.hh"
+#include "util.hh"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <random>
+#include <string>
+#include <utility>
+#include <vector>
+
+using namespace std;
+using namespace std::chrono;
+
+constexpr size_t n_prefixes = 900000;
+constexpr size_t n_lookups = 10000000;
+constexpr size_t n_map_lookups = 200000;  //!< The std::map baseline is much slower, so it does fewer lookups
+
+//! \brief Prefix lengths roughly in the proportions of a full IPv4 BGP table (most are /24, a few are longer)
+static uint8_t random_prefix_length(mt19937 &rd) {
+    static const vector<pair<uint8_t, double>> lengths = {{8, 0.02},  {12, 0.1},  {14, 0.3},  {16, 1.5}, {17, 0.8},
+                                                          {18, 1.5},  {19, 3.0},  {20, 4.5},  {21, 5.0}, {22, 12.0},
+                                                          {23, 10.0}, {24, 60.0}, {28, 0.6},  {32, 0.68}};
+    static discrete_distribution<size_t> pick = [] {
+        vector<double> weights;
+        for (const auto &[length, weight] : lengths) {
+            weights.push_back(weight);
+        }
+        return discrete_distribution<size_t>(weights.begin(), weights.end());
+    }();
+    return lengths[pick(rd)].first;
+}
+
+//! The router's original table: a std::map from (prefix, length), probed once per length from 32 down to 0
+class MapTable {
+    map<pair<uint32_t, uint8_t>, uint32_t> _table{};
+
+  public:
+    void add(const uint32_t prefix, const uint8_t length, const uint32_t value) {
+        _table.emplace(make_pair(length == 0 ? 0 : prefix & (0xffffffff << (32 - length)), length), value);
+    }
+
+    uint32_t lookup(const uint32_t address) const {
+        uint32_t mask = 0xffffffff;
+        for (int length = 32; length >= 0; length--) {
+            const auto it = _table.find(make_pair(address & mask, length));
+            if (it != _table.end()) {
+                return it->second;
+            }
+            mask <<= 1;
+        }
+        return LPMTable::NO_MATCH;
+    }
+};
+
+//! Print the rate of `count` lookups that started at `first_time`
+static void report(const string &name,
+                   const size_t count,
+                   const uint64_t checksum,
+                   const high_resolution_clock::time_point first_time) {
+    const auto final_time = high_resolution_clock::now();
+    const double ns = duration_cast<nanoseconds>(final_time - first_time).count();
+
+    cout << fixed << setprecision(2);
+    cout << "  " << setw(10) << left << name << right << setw(8) << count / ns * 1e3 << " Mlookups/s ("
+         << ns / count << " ns per lookup, checksum " << checksum << ")\n";
+}
+
+//! Batch size for LPMTable::lookup_batch (the burst size of Router::route)
+constexpr size_t batch_size = 32;
+
+//! Look up the first `count` addresses
+template <typename Table>
+void measure(const string &name, const Table &table, const vector<uint32_t> &addresses, const size_t count) {
+    uint64_t checksum = 0;
+    const auto first_time = high_resolution_clock::now();
+    for (size_t i = 0; i < count; i++) {
+        checksum += table.lookup(addresses[i]);
+    }
+    report(name, count, checksum, first_time);
+}
+
+//! Look up the first `count` addresses, a batch at a time
+static void measure_batched(const string &name,
+                            const LPMTable &table,
+                            const vector<uint32_t> &addresses,
+                            const size_t count) {
+    uint64_t checksum = 0;
+    uint32_t results[batch_size];
+    const auto first_time = high_resolution_clock::now();
+    for (size_t i = 0; i < count; i += batch_size) {
+        const size_t n = min(batch_size, count - i);
+        table.lookup_batch(&addresses[i], results, n);
+        for (size_t j = 0; j < n; j++) {
+            checksum += results[j];
+        }
+    }
+    report(name, count, checksum, first_time);
+}
+
+int main(int argc, char *argv[]) {
+    try {
+        if (argc <= 0) {
+            abort();  // For sticklers: don't try to access argv[0] if argc <= 0.
+        }
+        const bool with_map = not(argc > 1 and string(argv[1]) == "--no-map");
+
+        auto rd = get_random_generator();
+        vector<pair<uint32_t, uint8_t>> prefixes;
+        for (size_t i = 0; i < n_prefixes; i++) {
+            prefixes.emplace_back(rd(), random_prefix_length(rd));
+        }
+        prefixes.emplace_back(0, 0);  // default route
+
+        LPMTable table;
+        auto first_time = high_resolution_clock::now();
+        for (size_t i = 0; i < prefixes.size(); i++) {
+            table.add(prefixes[i].first, prefixes[i].second, i % 4096);
+        }
+        auto final_time = high_resolution_clock::now();
+        cout << fixed << setprecision(2);
+        cout << "LPMTable: " << table.size() << " prefixes in " << table.memory_usage() / 1048576.0 << " MiB, built in "
+             << duration_cast<milliseconds>(final_time - first_time).count() << " ms\n";
+
+        MapTable map_table;
+        if (with_map) {
+            for (size_t i = 0; i < prefixes.size(); i++) {
+                map_table.add(prefixes[i].first, prefixes[i].second, i % 4096);
+            }
+        }
+
+        vector<uint32_t> random_addresses(n_lookups), routed_addresses(n_lookups);
+        for (auto &address : random_addresses) {
+            address = rd();
+        }
+        for (auto &address : routed_addresses) {
+            const auto &[prefix, length] = prefixes[rd() % prefixes.size()];
+            const uint32_t mask = length == 0 ? 0 : 0xffffffff << (32 - length);
+            address = (prefix & mask) | (rd() & ~mask);
+        }
+
+        for (const auto &[name, addresses] : {make_pair("uniformly random addresses", &random_addresses),
+                                              make_pair("addresses inside the prefixes", &routed_addresses)}) {
+            cout << name << ":\n";
+            measure("LPMTable", table, *addresses, n_lookups);
+            measure_batched("batched", table, *addresses, n_lookups);
+            if (with_map) {
+                measure("std::map", map_table, *addresses, n_map_lookups);
+            }
+        }
+    } catch (const exception &e) {
+        cerr << e.what() << "\n";
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
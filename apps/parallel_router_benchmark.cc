@@ -0,0 +1,116 @@
+#include "arp_message.hh"
+#include "logger.hh"
+#include "parallel_router.hh"
+#include "util.hh"
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace std;
+using namespace std::chrono;
+
+constexpr size_t max_interfaces = 8;
+constexpr size_t datagrams_per_interface = 500000;  //!< Datagrams that each interface receives
+constexpr size_t datagrams_per_call = 64;           //!< Datagrams that a driver hands its interface per call
+
+static EthernetAddress ethernet_address(const uint8_t host) { return {0x02, 0, 0, 0, 0, host}; }
+
+static uint32_t interface_ip(const size_t interface) { return (10U << 24) | (uint32_t(interface) << 8) | 1; }
+
+static uint32_t next_hop_ip(const size_t interface) { return interface_ip(interface) + 1; }
+
+//! The network behind an interface: 10.(interface + 1).0.0/16
+static uint32_t network(const size_t interface) { return (10U << 24) | (uint32_t(interface + 1) << 16); }
+
+//! Teach an interface the Ethernet address of its next hop, with an ARP reply from it
+static void learn_next_hop(AsyncNetworkInterface &interface, const size_t interface_num) {
+    ARPMessage arp;
+    arp.opcode = ARPMessage::OPCODE_REPLY;
+    arp.sender_ethernet_address = ethernet_address(0x80 + interface_num);
+    arp.sender_ip_address = next_hop_ip(interface_num);
+    arp.target_ethernet_address = ethernet_address(interface_num);
+    arp.target_ip_address = interface_ip(interface_num);
+
+    EthernetFrame frame;
+    frame.header() = {arp.target_ethernet_address, arp.sender_ethernet_address, EthernetHeader::TYPE_ARP};
+    frame.payload() = arp.serialize();
+    interface.recv_frame(frame);
+}
+
+//! \brief Forwards datagrams between `n_interfaces` interfaces, each with its own worker, and returns the
+//! aggregate rate in datagrams per second
+static double measure(const size_t n_interfaces) {
+    ParallelRouter router;
+    for (size_t i = 0; i < n_interfaces; i++) {
+        router.add_interface({ethernet_address(i), Address::from_ipv4_numeric(interface_ip(i))});
+        router.add_route(network(i), 16, Address::from_ipv4_numeric(next_hop_ip(i)), i);
+        learn_next_hop(router.interface(i), i);
+    }
+
+    // every interface gets the same synthetic traffic, spread over all the networks
+    vector<InternetDatagram> traffic(datagrams_per_call * 16);
+    auto rd = get_random_generator();
+    for (auto &dgram : traffic) {
+        dgram.header().ttl = 64;
+        dgram.header().src = next_hop_ip(0);
+        dgram.header().dst = network(rd() % n_interfaces) | (rd() & 0xffff);
+        dgram.payload() = string(64, 'x');
+        dgram.header().len = dgram.header().hlen * 4 + dgram.payload().size();
+    }
+
+    vector<size_t> generated(n_interfaces);
+    const auto first_time = high_resolution_clock::now();
+    router.start([&](const size_t interface_num, AsyncNetworkInterface &interface) {
+        interface.frames_out() = {};
+        size_t &count = generated[interface_num];
+        for (size_t i = 0; i < datagrams_per_call and count < datagrams_per_interface; i++, count++) {
+            interface.datagrams_out().push(traffic[count % traffic.size()]);
+        }
+    });
+
+    const size_t total = n_interfaces * datagrams_per_interface;
+    for (size_t done = 0; done < total;) {
+        this_thread::sleep_for(microseconds(100));
+        done = 0;
+        for (size_t i = 0; i < n_interfaces; i++) {
+            done += router.forwarded(i) + router.dropped(i);
+        }
+    }
+    const auto final_time = high_resolution_clock::now();
+    router.stop();
+
+    return total / (duration_cast<nanoseconds>(final_time - first_time).count() / 1e9);
+}
+
+//! Measures the aggregate forwarding rate of a ParallelRouter with 1, 2, 4 and 8 interfaces
+int main() {
+    try {
+        // the interfaces log a line per datagram at Debug level; keep that out of the measurement
+        Logger::set_level(LogLevel::Warning);
+
+        vector<pair<size_t, double>> rates;
+        for (size_t n_interfaces = 1; n_interfaces <= max_interfaces; n_interfaces *= 2) {
+            rates.emplace_back(n_interfaces, measure(n_interfaces));
+        }
+
+        cout << fixed << setprecision(2);
+        cout << "ParallelRouter on " << thread::hardware_concurrency() << " cores:\n";
+        for (const auto &[n_interfaces, rate] : rates) {
+            cout << "  " << n_interfaces << " interfaces (" << n_interfaces << " workers): " << rate / 1e6
+                 << " Mpps in aggregate, " << rate / n_interfaces / 1e6 << " Mpps per worker\n";
+        }
+    } catch (const exception &e) {
+        cerr << e.what() << "\n";
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
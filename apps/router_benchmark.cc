@@ -0,0 +1,152 @@
+#include "arp_message.hh"
+#include "logger.hh"
+#include "router.hh"
+#include "util.hh"
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace std;
+using namespace std::chrono;
+
+constexpr size_t n_prefixes = 900000;
+constexpr size_t n_interfaces = 4;          //!< Interface 0 receives; the routes go out the others
+constexpr size_t n_datagrams = 1000000;     //!< Datagrams routed in total
+constexpr size_t datagrams_per_route = 4096;  //!< Datagrams queued on interface 0 before each Router::route
+constexpr size_t updates_per_commit = 1000;   //!< With --churn: route updates in each RouteTable::commit
+
+static EthernetAddress ethernet_address(const uint8_t host) { return {0x02, 0, 0, 0, 0, host}; }
+
+static uint32_t interface_ip(const size_t interface) { return (10U << 24) | (uint32_t(interface) << 8) | 1; }
+
+static uint32_t next_hop_ip(const size_t interface) { return interface_ip(interface) + 1; }
+
+//! Teach an interface the Ethernet address of its next hop, with an ARP reply from it
+static void learn_next_hop(AsyncNetworkInterface &interface, const size_t interface_num) {
+    ARPMessage arp;
+    arp.opcode = ARPMessage::OPCODE_REPLY;
+    arp.sender_ethernet_address = ethernet_address(0x80 + interface_num);
+    arp.sender_ip_address = next_hop_ip(interface_num);
+    arp.target_ethernet_address = ethernet_address(interface_num);
+    arp.target_ip_address = interface_ip(interface_num);
+
+    EthernetFrame frame;
+    frame.header() = {arp.target_ethernet_address, arp.sender_ethernet_address, EthernetHeader::TYPE_ARP};
+    frame.payload() = arp.serialize();
+    interface.recv_frame(frame);
+}
+
+//! \brief With --churn, a control thread keeps withdrawing, re-announcing and moving routes (as a BGP feed
+//! would) while the router forwards
+static void churn(RouteTable &table, const vector<pair<uint32_t, uint8_t>> &routes, const atomic<bool> &done,
+                  size_t &updates) {
+    auto rd = get_random_generator();
+    vector<bool> withdrawn(routes.size());
+    while (not done) {
+        for (size_t i = 0; i < updates_per_commit; i++) {
+            const size_t route = rd() % routes.size();
+            const auto &[prefix, length] = routes[route];
+            const size_t out = 1 + rd() % (n_interfaces - 1);
+            if (withdrawn[route]) {
+                table.add(prefix, length, next_hop_ip(out), out);
+            } else if (rd() % 2) {
+                table.remove(prefix, length);
+            } else {
+                table.replace(prefix, length, next_hop_ip(out), out);
+                continue;
+            }
+            withdrawn[route] = not withdrawn[route];
+        }
+        table.commit();
+        updates += updates_per_commit;
+    }
+}
+
+//! Routes datagrams from interface 0 through a router with a full-size table, and prints the rate
+int main(int argc, char *argv[]) {
+    try {
+        if (argc <= 0) {
+            abort();  // For sticklers: don't try to access argv[0] if argc <= 0.
+        }
+        const bool with_churn = argc > 1 and string(argv[1]) == "--churn";
+
+        auto rd = get_random_generator();
+
+        // the router logs a line per route and per datagram at Debug level; keep that out of the measurement
+        Logger::set_level(LogLevel::Warning);
+
+        Router router;
+        for (size_t i = 0; i < n_interfaces; i++) {
+            router.add_interface({ethernet_address(i), Address::from_ipv4_numeric(interface_ip(i))});
+            learn_next_hop(router.interface(i), i);
+        }
+
+        // one commit for the whole table, rather than one per Router::add_route
+        vector<pair<uint32_t, uint8_t>> routes;
+        for (size_t i = 0; i < n_prefixes; i++) {
+            const uint8_t length = uniform_int_distribution<unsigned>{16, 24}(rd);
+            const uint32_t prefix = rd() & (0xffffffff << (32 - length));
+            const size_t out = 1 + i % (n_interfaces - 1);
+            if (router.route_table().add(prefix, length, next_hop_ip(out), out)) {
+                routes.emplace_back(prefix, length);
+            }
+        }
+        router.route_table().commit();
+
+        InternetDatagram dgram;
+        dgram.header().ttl = 64;
+        dgram.header().src = interface_ip(0) + 1;
+        dgram.payload() = string(64, 'x');
+        dgram.header().len = dgram.header().hlen * 4 + dgram.payload().size();
+        AsyncNetworkInterface &ingress = router.interface(0);
+
+        atomic<bool> done{false};
+        size_t updates = 0;
+        thread control;
+        if (with_churn) {
+            control = thread([&] { churn(router.route_table(), routes, done, updates); });
+        }
+
+        size_t frames = 0, routed = 0;
+        const auto first_time = high_resolution_clock::now();
+        for (; routed < n_datagrams; routed += datagrams_per_route) {
+            for (size_t i = 0; i < datagrams_per_route; i++) {
+                dgram.header().dst = routes[rd() % routes.size()].first | (rd() & 0xff);
+                ingress.datagrams_out().push(dgram);
+            }
+            router.route();
+            for (size_t i = 0; i < n_interfaces; i++) {
+                auto &frames_out = router.interface(i).frames_out();
+                frames += frames_out.size();
+                frames_out = {};
+            }
+        }
+        const auto final_time = high_resolution_clock::now();
+        done = true;
+        if (control.joinable()) {
+            control.join();
+        }
+
+        const double seconds = duration_cast<nanoseconds>(final_time - first_time).count() / 1e9;
+        cout << fixed << setprecision(2);
+        cout << "Router with " << n_prefixes << " routes: " << routed / seconds / 1e6 << " Mpps (" << frames
+             << " frames sent for " << routed << " datagrams)\n";
+        if (with_churn) {
+            cout << "  while committing " << updates / seconds << " route updates per second, " << updates_per_commit
+                 << " per commit\n";
+        }
+    } catch (const exception &e) {
+        cerr << e.what() << "\n";
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -1,10 +1,23 @@
+#include "allocation_counter.hh"
+#include "latency_histogram.hh"
+#include "sharded_tcp_stack.hh"
 #include "tcp_connection.hh"
+#include "util.hh"
 
+#include <algorithm>
+#include <atomic>
 #include <chrono>
 #include <cstdlib>
 #include <iomanip>
 #include <iostream>
+#include <memory>
+#include <optional>
+#include <queue>
+#include <random>
 #include <string>
+#include <thread>
+#include <tuple>
+#include <vector>
 
 using namespace std;
 using namespace std::chrono;
@@ -103,10 +116,454 @@ void main_loop(const bool reorder) {
     }
 }
 
-int main() {
+//! Windows small enough that a burst from every connection fits in the server's socket buffers
+static TCPConfig sharded_config() {
+    TCPConfig config;
+    config.send_capacity = config.recv_capacity = 16000;
+    return config;
+}
+
+//! \brief One client thread, sending `per_connection` bytes on each of `connections` connections to `server`
+//! \details Over UDP, a connection is identified by the UDP addresses, so each connection gets its own
+//! socket and TCPStack. The thread polls them in turn.
+static void client_loop(const Address &server, const size_t connections, const size_t per_connection) {
+    vector<unique_ptr<TCPOverUDPStack>> stacks;
+    vector<TCPOverUDPStack::Stream> streams;
+    for (size_t i = 0; i < connections; i++) {
+        UDPSocket sock;
+        sock.bind(Address("127.0.0.1", 0));
+        FdAdapterConfig config;
+        config.source = sock.local_address();
+        stacks.push_back(make_unique<TCPOverUDPStack>(TCPOverUDPSocketAdapter(move(sock)), sharded_config(), config));
+        streams.push_back(stacks.back()->connect(server));
+    }
+
+    const string chunk(TCPConfig::DEFAULT_CAPACITY, 'x');
+    vector<size_t> remaining(connections, per_connection);
+    size_t finished = 0;
+    while (finished < connections) {
+        finished = 0;
+        for (size_t i = 0; i < connections; i++) {
+            auto &stream = streams[i];
+            stacks[i]->wait_next_event(0);
+            if (remaining[i] > 0) {
+                remaining[i] -= stream.write(chunk.substr(0, min(remaining[i], stream.remaining_outbound_capacity())));
+                if (remaining[i] == 0) {
+                    stream.end_input();
+                }
+            }
+            finished += stream.eof();
+        }
+    }
+}
+
+//! \brief Many connections over loopback UDP into a ShardedTCPStack with one thread per shard
+//! \details Each shard has its own SO_REUSEPORT socket and discards what it receives; the clients run on
+//! as many threads again, each with its own TCPStack and socket.
+static void sharded_loop(const size_t shards, const size_t connections) {
+    const size_t per_connection = len / connections;
+
+    Address server_address{"127.0.0.1", 0};
+    vector<TCPOverUDPSocketAdapter> adapters;
+    for (size_t i = 0; i < shards; i++) {
+        UDPSocket sock;
+        sock.set_reuseport();
+        sock.bind(server_address);
+        server_address = sock.local_address();
+        adapters.emplace_back(move(sock));
+    }
+    FdAdapterConfig server_config;
+    server_config.source = server_address;
+    TCPOverUDPShardedStack server{move(adapters), sharded_config(), server_config};
+    server.listen(server_address.port());
+
+    atomic<size_t> finished{0};
+    auto live_connections = [&] {
+        size_t live = 0;
+        for (size_t shard = 0; shard < shards; shard++) {
+            live += server.counters(shard).connections_accepted - server.counters(shard).connections_removed;
+        }
+        return live;
+    };
+
+    const auto first_time = high_resolution_clock::now();
+
+    thread server_thread([&] {
+        server.run([&](TCPOverUDPShardedStack::Stack &stack, const size_t) {
+            vector<TCPOverUDPStack::Stream> streams;
+            while (finished.load() < connections or live_connections() > 0) {
+                stack.wait_next_event(10);
+                while (auto stream = stack.accept(server_address.port())) {
+                    streams.push_back(move(stream.value()));
+                }
+                for (auto it = streams.begin(); it != streams.end();) {
+                    it->read();
+                    if (it->eof()) {
+                        it = streams.erase(it);
+                        finished++;
+                    } else {
+                        ++it;
+                    }
+                }
+            }
+        });
+    });
+
+    vector<thread> clients;
+    for (size_t i = 0; i < shards; i++) {
+        const size_t count = connections / shards + (i < connections % shards);
+        clients.emplace_back(client_loop, server_address, count, per_connection);
+    }
+    for (auto &client : clients) {
+        client.join();
+    }
+    server_thread.join();
+
+    const auto final_time = high_resolution_clock::now();
+
+    const auto duration = duration_cast<nanoseconds>(final_time - first_time).count();
+
+    const auto gigabits_per_second = per_connection * connections * 8.0 / double(duration);
+
+    cout << fixed << setprecision(2);
+    cout << "Throughput with " << shards << " shard" << (shards == 1 ? "" : "s") << " and " << connections
+         << " connection" << (connections == 1 ? "" : "s") << ": " << gigabits_per_second << " Gbit/s\n";
+    for (size_t shard = 0; shard < shards; shard++) {
+        const auto &counters = server.counters(shard);
+        cout << "  shard " << shard << ": " << counters.connections_accepted << " connections, "
+             << counters.segments_received << " segments received, " << counters.segments_forwarded
+             << " forwarded to other shards, " << counters.segments_sent << " sent\n";
+    }
+}
+
+//! \brief A transfer over a simulated network, chosen on the command line
+struct Scenario {
+    size_t bytes = 16 * 1024 * 1024;                //!< Bytes that each flow sends
+    size_t flows = 1;                               //!< Concurrent connection pairs, sharing the links
+    double loss = 0;                                //!< Probability that a segment (either way) is lost
+    size_t reorder = 0;                             //!< How many later segments may overtake a segment
+    uint64_t rtt_ms = 0;                            //!< Round-trip propagation delay
+    double bandwidth = 0;                           //!< Rate of each direction in Mbit/s (0 for unlimited)
+    size_t capacity = TCPConfig::DEFAULT_CAPACITY;  //!< Send and receive capacity of each connection
+    size_t mss = TCPConfig::MAX_PAYLOAD_SIZE;       //!< Largest payload of a segment
+    uint16_t rto_ms = TCPConfig::TIMEOUT_DFLT;      //!< Initial retransmission timeout
+    unsigned seed = 1;                              //!< Seed of the losses and reordering
+};
+
+//! Bytes of IPv4 and TCP headers on each segment, which count against the bandwidth
+constexpr size_t header_bytes = 40;
+
+//! \brief One direction of the simulated path: a bottleneck that sends one segment at a time at the
+//! scenario's rate, then the propagation delay
+//! \details A lost segment still uses the bottleneck. With reordering, each segment is held back a random
+//! number of "slots" (the time a full-sized segment takes at the bottleneck, or 1 us if the bandwidth is
+//! unlimited), from 0 to the reordering depth, so that at most that many later segments overtake it.
+class Link {
+  public:
+    //! A segment on its way through the link
+    struct InFlight {
+        uint64_t arrival_ns;  //!< When it reaches the far end
+        uint64_t order;       //!< Segments that arrive at the same time are delivered in the order they were sent
+        size_t flow;          //!< Index of the flow it belongs to
+        TCPSegment segment;
+    };
+
+  private:
+    //! Orders the priority queue so that the first arrival is on top
+    struct ArrivesLater {
+        bool operator()(const InFlight &a, const InFlight &b) const {
+            return tie(a.arrival_ns, a.order) > tie(b.arrival_ns, b.order);
+        }
+    };
+
+    const Scenario &_scenario;
+    mt19937 &_rd;
+    priority_queue<InFlight, vector<InFlight>, ArrivesLater> _in_flight{};
+    double _free_ns{0};  //!< When the bottleneck will have sent everything given to it
+    uint64_t _sent{0};
+    uint64_t _lost{0};
+
+    //! Time to send `bytes` through the bottleneck
+    double transmission_ns(const size_t bytes) const {
+        return _scenario.bandwidth > 0 ? bytes * 8 * 1000 / _scenario.bandwidth : 1000;
+    }
+
+  public:
+    Link(const Scenario &scenario, mt19937 &rd) : _scenario(scenario), _rd(rd) {}
+
+    //! Send a segment at time `now_ns`
+    void send(const uint64_t now_ns, const size_t flow, TCPSegment &&segment) {
+        _free_ns = max(_free_ns, double(now_ns)) + transmission_ns(segment.payload().size() + header_bytes);
+        _sent++;
+        if (_scenario.loss > 0 and bernoulli_distribution{_scenario.loss}(_rd)) {
+            _lost++;
+            return;
+        }
+        uint64_t arrival_ns = uint64_t(_free_ns) + _scenario.rtt_ms * 1000000 / 2;
+        if (_scenario.reorder > 0) {
+            const auto slots = uniform_int_distribution<size_t>{0, _scenario.reorder}(_rd);
+            arrival_ns += uint64_t(slots * transmission_ns(_scenario.mss + header_bytes));
+        }
+        _in_flight.push({arrival_ns, _sent, flow, move(segment)});
+    }
+
+    //! Hand each segment that has arrived by `now_ns` to `receive(flow, segment)`
+    template <typename Receive>
+    void deliver(const uint64_t now_ns, Receive &&receive) {
+        while (not _in_flight.empty() and _in_flight.top().arrival_ns <= now_ns) {
+            // the queue only gives const access to its top, but the segment is about to be popped
+            InFlight &top = const_cast<InFlight &>(_in_flight.top());
+            const size_t flow = top.flow;
+            TCPSegment segment = move(top.segment);
+            _in_flight.pop();
+            receive(flow, segment);
+        }
+    }
+
+    //! When the next segment arrives, if any is in flight
+    optional<uint64_t> next_arrival() const {
+        return _in_flight.empty() ? optional<uint64_t>{} : _in_flight.top().arrival_ns;
+    }
+
+    uint64_t sent() const { return _sent; }  //!< Segments sent, including those lost
+    uint64_t lost() const { return _lost; }  //!< Segments lost
+};
+
+//! \brief Run a scenario and report its goodput and costs
+//! \details Time is simulated: the loop delivers each segment when it arrives and ticks the connections
+//! once per simulated millisecond, so the goodput is what the scenario would see on a real network (with a
+//! CPU fast enough to keep up), while the CPU costs are measured for real.
+static void scenario_loop(const Scenario &scenario) {
+    TCPConfig config;
+    config.send_capacity = config.recv_capacity = scenario.capacity;
+    config.max_payload_size = scenario.mss;
+    config.rt_timeout = scenario.rto_ms;
+
+    //! A connection pair and how far its transfer has got
+    struct Flow {
+        TCPConnection sender, receiver;
+        size_t written{0}, received{0};
+        explicit Flow(const TCPConfig &cfg) : sender(cfg), receiver(cfg) {}
+    };
+    vector<unique_ptr<Flow>> flows;
+    for (size_t i = 0; i < scenario.flows; i++) {
+        flows.push_back(make_unique<Flow>(config));
+        flows.back()->sender.connect();
+        flows.back()->receiver.end_input_stream();
+    }
+
+    // every flow sends the same pseudo-random bytes, repeated, which the receiver checks
+    mt19937 rd{scenario.seed};
+    string pattern(1024 * 1024, 0);
+    generate(pattern.begin(), pattern.end(), [&] { return static_cast<char>(rd()); });
+
+    Link forward{scenario, rd}, reverse{scenario, rd};
+    uint64_t now_ns = 0, ticked_ms = 0;
+
+    const AllocationPhase allocations;
+    const uint64_t first_cycles = read_cycles();
+    const auto first_time = high_resolution_clock::now();
+
+    size_t finished = 0;
+    while (finished < flows.size()) {
+        for (size_t i = 0; i < flows.size(); i++) {
+            Flow &flow = *flows[i];
+            while (flow.written < scenario.bytes and flow.sender.remaining_outbound_capacity() > 0) {
+                const size_t offset = flow.written % pattern.size();
+                const size_t want = min({flow.sender.remaining_outbound_capacity(),
+                                         scenario.bytes - flow.written,
+                                         pattern.size() - offset});
+                flow.written += flow.sender.write(pattern.substr(offset, want));
+                if (flow.written == scenario.bytes) {
+                    flow.sender.end_input_stream();
+                }
+            }
+            for (auto [from, link] : {make_pair(&flow.sender, &forward), make_pair(&flow.receiver, &reverse)}) {
+                while (not from->segments_out().empty()) {
+                    link->send(now_ns, i, move(from->segments_out().front()));
+                    from->segments_out().pop();
+                }
+            }
+        }
+
+        forward.deliver(now_ns, [&](const size_t i, const TCPSegment &seg) {
+            flows[i]->receiver.segment_received(seg);
+        });
+        reverse.deliver(now_ns, [&](const size_t i, const TCPSegment &seg) {
+            flows[i]->sender.segment_received(seg);
+        });
+
+        finished = 0;
+        bool sending = false;
+        for (size_t i = 0; i < flows.size(); i++) {
+            Flow &flow = *flows[i];
+            ByteStream &inbound = flow.receiver.inbound_stream();
+            if (inbound.buffer_size() > 0) {
+                const string data = inbound.read(inbound.buffer_size());
+                for (size_t j = 0; j < data.size(); j++) {
+                    if (data[j] != pattern[(flow.received + j) % pattern.size()]) {
+                        throw runtime_error("flow " + to_string(i) + " received the wrong bytes");
+                    }
+                }
+                flow.received += data.size();
+            }
+            // (a finished flow's sender goes inactive when it stops lingering, which is not a reset)
+            if (inbound.error() or flow.sender.inbound_stream().error()) {
+                throw runtime_error("flow " + to_string(i) + " was reset");
+            }
+            finished += inbound.eof();
+            sending |= not flow.sender.segments_out().empty() or not flow.receiver.segments_out().empty();
+        }
+        if (sending) {
+            continue;  // send what the deliveries provoked before time moves on
+        }
+
+        // move time on to the next arrival, or the next millisecond (for the retransmission timers)
+        uint64_t next_ns = (now_ns / 1000000 + 1) * 1000000;
+        for (const auto arrival : {forward.next_arrival(), reverse.next_arrival()}) {
+            if (arrival.has_value()) {
+                next_ns = min(next_ns, max(arrival.value(), now_ns));
+            }
+        }
+        now_ns = next_ns;
+        if (now_ns / 1000000 > ticked_ms) {
+            const size_t ms = now_ns / 1000000 - ticked_ms;
+            ticked_ms += ms;
+            for (auto &flow : flows) {
+                flow->sender.tick(ms);
+                flow->receiver.tick(ms);
+            }
+        }
+    }
+
+    const double cycles = read_cycles() - first_cycles;
+    const auto duration = duration_cast<nanoseconds>(high_resolution_clock::now() - first_time).count();
+    const double allocated = allocations.count().allocations;
+
+    StatsSnapshot snapshot;
+    for (const auto &flow : flows) {
+        flow->sender.collect_stats(snapshot);
+        flow->receiver.collect_stats(snapshot);
+    }
+    const double total_bytes = double(scenario.bytes) * scenario.flows;
+    const double segments = snapshot.total("sponge_tcp_segments_sent_total");
+
+    cout << fixed << setprecision(2);
+    cout << scenario.flows << " flow" << (scenario.flows == 1 ? "" : "s") << " of " << scenario.bytes / 1048576.0
+         << " MiB, loss " << scenario.loss * 100 << "%, reordering depth " << scenario.reorder << ", RTT "
+         << scenario.rtt_ms << " ms, bandwidth ";
+    if (scenario.bandwidth > 0) {
+        cout << scenario.bandwidth << " Mbit/s";
+    } else {
+        cout << "unlimited";
+    }
+    cout << ", capacity " << scenario.capacity << ", MSS " << scenario.mss << "\n";
+    cout << "  goodput:     " << total_bytes * 8 / double(now_ns) * 1000 << " Mbit/s (" << now_ns / 1e9
+         << " s simulated)\n";
+    cout << "  segments:    " << uint64_t(segments) << " sent, " << forward.lost() + reverse.lost() << " lost, "
+         << snapshot.total("sponge_tcp_retransmissions_total") << " retransmitted\n";
+    cout << "  CPU:         " << total_bytes * 8 / double(duration) << " Gbit/s, " << cycles / total_bytes
+         << " cycles/byte, " << allocated / segments << " allocations/segment\n";
+}
+
+//! Print the options of the scenario mode
+static void usage(const char *argv0) {
+    const Scenario defaults;
+    cerr << "Usage: " << argv0 << " [SHARDS CONNECTIONS]\n"
+         << "   or: " << argv0 << " [--option VALUE]...   (a scenario over a simulated network)\n\n"
+         << "   --bytes N        bytes each flow sends             " << defaults.bytes << "\n"
+         << "   --flows N        concurrent connection pairs       " << defaults.flows << "\n"
+         << "   --loss P         segment loss probability (0-1)    " << defaults.loss << "\n"
+         << "   --reorder N      segments that may overtake one    " << defaults.reorder << "\n"
+         << "   --rtt MS         round-trip propagation delay      " << defaults.rtt_ms << "\n"
+         << "   --bandwidth MBPS rate of each direction (0: none)  " << defaults.bandwidth << "\n"
+         << "   --capacity N     send and receive capacity         " << defaults.capacity << "\n"
+         << "                    (the window is at most 65535, since there is no window scaling)\n"
+         << "   --mss N          largest segment payload           " << defaults.mss << "\n"
+         << "   --rto MS         initial retransmission timeout    " << defaults.rto_ms << "\n"
+         << "   --seed N         seed of the losses and reordering " << defaults.seed << "\n";
+}
+
+//! Parse the scenario's options
+static Scenario parse_scenario(const int argc, char *argv[]) {
+    Scenario scenario;
+    for (int i = 1; i < argc; i += 2) {
+        const string option = argv[i];
+        if (i + 1 >= argc) {
+            throw runtime_error("missing value for " + option);
+        }
+        const string value = argv[i + 1];
+        if (option == "--bytes") {
+            scenario.bytes = stoull(value);
+        } else if (option == "--flows") {
+            scenario.flows = stoul(value);
+        } else if (option == "--loss") {
+            scenario.loss = stod(value);
+        } else if (option == "--reorder") {
+            scenario.reorder = stoul(value);
+        } else if (option == "--rtt") {
+            scenario.rtt_ms = stoull(value);
+        } else if (option == "--bandwidth") {
+            scenario.bandwidth = stod(value);
+        } else if (option == "--capacity") {
+            scenario.capacity = stoul(value);
+        } else if (option == "--mss") {
+            scenario.mss = stoul(value);
+        } else if (option == "--rto") {
+            scenario.rto_ms = stoul(value);
+        } else if (option == "--seed") {
+            scenario.seed = stoul(value);
+        } else {
+            throw runtime_error("unknown option " + option);
+        }
+    }
+    if (scenario.flows == 0 or scenario.mss == 0 or scenario.loss < 0 or scenario.loss >= 1) {
+        throw runtime_error("need at least one flow, a positive MSS, and a loss probability below 1");
+    }
+    return scenario;
+}
+
+int main(int argc, char *argv[]) {
     try {
+        if (argc <= 0) {
+            abort();  // For sticklers: don't try to access argv[0] if argc <= 0.
+        }
+
+        if (argc > 1 and string(argv[1]).substr(0, 2) == "--") {
+            if (string(argv[1]) == "--help") {
+                usage(argv[0]);
+                return EXIT_SUCCESS;
+            }
+            scenario_loop(parse_scenario(argc, argv));
+            if (LatencyHistograms::enabled()) {
+                cout << "\n" << LatencyHistograms::report();
+            }
+            return EXIT_SUCCESS;
+        }
+
+        if (argc == 3) {
+            const size_t shards = stoul(argv[1]), connections = stoul(argv[2]);
+            if (shards == 0 or connections < shards) {
+                throw runtime_error("need at least one shard, and at least one connection per shard");
+            }
+            sharded_loop(shards, connections);
+            if (LatencyHistograms::enabled()) {
+                cout << "\n" << LatencyHistograms::report();
+            }
+            return EXIT_SUCCESS;
+        }
+
+        if (argc != 1) {
+            usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+
         main_loop(false);
         main_loop(true);
+        if (LatencyHistograms::enabled()) {
+            // set SPONGE_LATENCY=1 to see where the time goes
+            cout << "\n" << LatencyHistograms::report();
+        }
     } catch (const exception &e) {
         cerr << e.what() << "\n";
         return EXIT_FAILURE;
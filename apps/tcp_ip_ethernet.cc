@@ -31,7 +31,8 @@ static void show_usage(const char *argv0, const char *msg) {
 
          << "   -t <tmout>      Set rt_timeout to tmout                         " << TCPConfig::TIMEOUT_DFLT << "\n\n"
 
-         << "   -d <tapdev>     Connect to tap <tapdev>                         " << TAP_DFLT << "\n\n"
+         << "   -d <tapdev>     Connect to tap <tapdev>                         " << TAP_DFLT << "\n"
+         << "   -g              Use TCP segmentation offload (TSO)              (no offload)\n\n"
 
          << "   -h              Show this message.\n\n";
 
@@ -48,10 +49,11 @@ static void check_argc(int argc, char **argv, int curr, const char *err) {
     }
 }
 
-static tuple<TCPConfig, FdAdapterConfig, Address, string> get_config(int argc, char **argv) {
+static tuple<TCPConfig, FdAdapterConfig, Address, string, bool> get_config(int argc, char **argv) {
     TCPConfig c_fsm{};
     FdAdapterConfig c_filt{};
     string tapdev = TAP_DFLT;
+    bool offload = false;
 
     int curr = 1;
 
@@ -90,6 +92,10 @@ static tuple<TCPConfig, FdAdapterConfig, Address, string> get_config(int argc, c
             tapdev = argv[curr + 1];
             curr += 2;
 
+        } else if (strncmp("-g", argv[curr], 3) == 0) {
+            offload = true;
+            curr += 1;
+
         } else if (strncmp("-h", argv[curr], 3) == 0) {
             show_usage(argv[0], nullptr);
             exit(0);
@@ -106,7 +112,7 @@ static tuple<TCPConfig, FdAdapterConfig, Address, string> get_config(int argc, c
 
     Address next_hop{next_hop_address, "0"};
 
-    return make_tuple(c_fsm, c_filt, next_hop, tapdev);
+    return make_tuple(c_fsm, c_filt, next_hop, tapdev, offload);
 }
 
 int main(int argc, char **argv) {
@@ -124,10 +130,10 @@ int main(int argc, char **argv) {
         local_ethernet_address.at(0) |= 0x02;  // "10" in last two binary digits marks a private Ethernet address
         local_ethernet_address.at(0) &= 0xfe;
 
-        auto [c_fsm, c_filt, next_hop, tap_dev_name] = get_config(argc, argv);
+        auto [c_fsm, c_filt, next_hop, tap_dev_name, offload] = get_config(argc, argv);
 
-        TCPOverIPv4OverEthernetSpongeSocket tcp_socket(TCPOverIPv4OverEthernetAdapter(
-            TCPOverIPv4OverEthernetAdapter(TapFD(tap_dev_name), local_ethernet_address, c_filt.source, next_hop)));
+        TCPOverIPv4OverEthernetSpongeSocket tcp_socket(TCPOverIPv4OverEthernetAdapter(TCPOverIPv4OverEthernetAdapter(
+            TapFD(tap_dev_name, false, offload), local_ethernet_address, c_filt.source, next_hop)));
 
         tcp_socket.connect(c_fsm, c_filt);
 
@@ -1,6 +1,13 @@
 find_library (LIBPCAP pcap)
 find_library (LIBPTHREAD pthread)
+find_package (benchmark QUIET)
 macro (add_sponge_exec exec_name)
     add_executable ("${exec_name}" "${exec_name}.cc")
     target_link_libraries ("${exec_name}" ${ARGN} sponge ${LIBPTHREAD})
 endmacro (add_sponge_exec)
+
+# Executables that use C++20 coroutines (e.g., async_tcp_stack.hh); the library itself stays C++17
+macro (add_sponge_coroutine_exec exec_name)
+    add_sponge_exec ("${exec_name}" ${ARGN})
+    set_target_properties ("${exec_name}" PROPERTIES CXX_STANDARD 20)
+endmacro (add_sponge_coroutine_exec)
@@ -18,3 +18,10 @@ endif ()
 set (CMAKE_CXX_FLAGS_DEBUG "${CMAKE_CXX_FLAGS_DEBUG} -ggdb3 -Og")
 set (CMAKE_CXX_FLAGS_DEBUGASAN "${CMAKE_CXX_FLAGS_DEBUG} -fsanitize=undefined -fsanitize=address")
 set (CMAKE_CXX_FLAGS_RELASAN "${CMAKE_CXX_FLAGS_RELEASE} -fsanitize=undefined -fsanitize=address")
+
+# does the compiler support C++20 coroutines? (only the targets that use them are built as C++20)
+include (CheckCXXSourceCompiles)
+set (CMAKE_REQUIRED_FLAGS "-std=c++20")
+check_cxx_source_compiles ("#include <coroutine>
+int main() { return __cpp_impl_coroutine > 0 ? 0 : 1; }" HAVE_COROUTINES)
+unset (CMAKE_REQUIRED_FLAGS)
@@ -13,6 +13,7 @@ add_test(NAME t_recv_window          COMMAND recv_window)
 add_test(NAME t_recv_reorder         COMMAND recv_reorder)
 add_test(NAME t_recv_close           COMMAND recv_close)
 add_test(NAME t_recv_special         COMMAND recv_special)
+add_test(NAME t_recv_allocations     COMMAND recv_allocations)
 
 add_test(NAME t_send_connect         COMMAND send_connect)
 add_test(NAME t_send_transmit        COMMAND send_transmit)
@@ -63,6 +64,25 @@ add_test(NAME t_loopback             COMMAND fsm_loopback)
 add_test(NAME t_loopback_win         COMMAND fsm_loopback_win)
 add_test(NAME t_reorder              COMMAND fsm_reorder)
 
+add_test(NAME t_udp_offload          COMMAND udp_offload)
+add_test(NAME t_tcp_stack            COMMAND tcp_stack)
+add_test(NAME t_rss_hash             COMMAND rss_hash)
+add_test(NAME t_sharded_tcp_stack    COMMAND sharded_tcp_stack)
+add_test(NAME t_spsc_ring            COMMAND spsc_ring)
+add_test(NAME t_eventloop            COMMAND eventloop)
+add_test(NAME t_lpm_table            COMMAND lpm_table)
+add_test(NAME t_route_table          COMMAND route_table)
+add_test(NAME t_parallel_router      COMMAND parallel_router)
+add_test(NAME t_arp_cache            COMMAND arp_cache)
+add_test(NAME t_ipv4_datagram        COMMAND ipv4_datagram)
+add_test(NAME t_logger               COMMAND logger)
+add_test(NAME t_stats                COMMAND stats)
+add_test(NAME t_latency_histogram    COMMAND latency_histogram)
+add_test(NAME t_network_emulator     COMMAND network_emulator)
+if (HAVE_COROUTINES)
+    add_test(NAME t_async_tcp_stack  COMMAND async_tcp_stack)
+endif ()
+
 add_test(NAME t_address_dt           COMMAND address_dt)
 add_test(NAME t_parser_dt            COMMAND parser_dt)
 add_test(NAME t_socket_dt            COMMAND socket_dt)
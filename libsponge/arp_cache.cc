@@ -0,0 +1,248 @@
+#include "arp_cache.hh"
+
+#include <stdexcept>
+#include <utility>
+
+using namespace std;
+
+//! \param[in] config is the capacity, the limits on waiting datagrams, and the drop policy
+ARPCache::ARPCache(const ARPCacheConfig &config)
+    : _nodes(config.capacity), _slots(), _slot_mask(0), _slot_shift(32), _config(config) {
+    const size_t capacity = config.capacity;
+    if (capacity == 0 or capacity >= NONE / 2) {
+        throw runtime_error("ARPCache: capacity " + to_string(capacity) + " is out of range");
+    }
+
+    // at least twice as many slots as nodes, so that probe sequences stay short
+    size_t slots = 2;
+    _slot_shift = 31;
+    while (slots < 2 * capacity) {
+        slots <<= 1;
+        _slot_shift--;
+    }
+    _slots.resize(slots);
+    _slot_mask = slots - 1;
+
+    for (uint32_t i = 0; i < capacity; i++) {
+        _nodes[i].lru_next = i + 1 < capacity ? i + 1 : NONE;
+    }
+    _free = 0;
+    _wheel.fill(NONE);
+}
+
+//! \param[in] ip is the IP address
+size_t ARPCache::find_slot(const uint32_t ip) const {
+    size_t slot = home_slot(ip);
+    while (_slots[slot].node != NONE and _slots[slot].ip != ip) {
+        slot = (slot + 1) & _slot_mask;
+    }
+    return slot;
+}
+
+//! \param[in] ip is the IP address
+uint32_t ARPCache::find(const uint32_t ip) {
+    const uint32_t node = _slots[find_slot(ip)].node;
+    if (node != NONE and _now > _nodes[node].deadline) {
+        remove(node);
+        return NONE;
+    }
+    return node;
+}
+
+//! \param[in] ip is the IP address, which must not be in the cache
+//! \param[in] deadline is the time after which the new neighbor expires
+uint32_t ARPCache::insert(const uint32_t ip, const size_t deadline) {
+    if (_free == NONE) {
+        remove(_lru_tail);
+    }
+    const uint32_t node = _free;
+    _free = _nodes[node].lru_next;
+
+    _slots[find_slot(ip)] = {ip, node};
+    _nodes[node].ip = ip;
+    _nodes[node].deadline = deadline;
+    lru_push_front(node);
+    wheel_link(node);
+    _size++;
+    return node;
+}
+
+//! \param[in] node is the neighbor's node
+//! \details Deletion shifts the rest of the probe run back over the hole, so lookups never need tombstones:
+//! an entry moves into the hole unless its home slot lies (cyclically) after the hole.
+void ARPCache::remove(const uint32_t node) {
+    size_t hole = find_slot(_nodes[node].ip);
+    for (size_t slot = (hole + 1) & _slot_mask; _slots[slot].node != NONE; slot = (slot + 1) & _slot_mask) {
+        const size_t home = home_slot(_slots[slot].ip);
+        if (((slot - home) & _slot_mask) >= ((slot - hole) & _slot_mask)) {
+            _slots[hole] = _slots[slot];
+            hole = slot;
+        }
+    }
+    _slots[hole] = {};
+
+    lru_unlink(node);
+    wheel_unlink(node);
+    Node &n = _nodes[node];
+    while (n.pending_first < n.pending.size()) {
+        drop_oldest(n);
+    }
+    n.ethernet_address.reset();
+    n.lru_next = _free;
+    _free = node;
+    _size--;
+}
+
+//! \param[in] n is the neighbor's node, which must have a datagram waiting
+//! \details Dropping from the front only advances `pending_first`; the vector is compacted once the dropped
+//! prefix is at least half of it, so each datagram is moved O(1) times.
+void ARPCache::drop_oldest(Node &n) {
+    const size_t bytes = n.pending[n.pending_first].size();
+    n.pending[n.pending_first] = {};
+    n.pending_first++;
+    n.pending_bytes -= bytes;
+    _pending_bytes -= bytes;
+    count_drop(bytes);
+
+    if (n.pending_first == n.pending.size()) {
+        n.pending.clear();
+        n.pending_first = 0;
+    } else if (n.pending_first * 2 >= n.pending.size()) {
+        n.pending.erase(n.pending.begin(), n.pending.begin() + n.pending_first);
+        n.pending_first = 0;
+    }
+}
+
+//! \param[in] node is the neighbor's node
+void ARPCache::touch(const uint32_t node) {
+    if (_lru_head != node) {
+        lru_unlink(node);
+        lru_push_front(node);
+    }
+}
+
+//! \param[in] node is the node
+void ARPCache::lru_unlink(const uint32_t node) {
+    Node &n = _nodes[node];
+    (n.lru_prev == NONE ? _lru_head : _nodes[n.lru_prev].lru_next) = n.lru_next;
+    (n.lru_next == NONE ? _lru_tail : _nodes[n.lru_next].lru_prev) = n.lru_prev;
+    n.lru_prev = n.lru_next = NONE;
+}
+
+//! \param[in] node is the node
+void ARPCache::lru_push_front(const uint32_t node) {
+    Node &n = _nodes[node];
+    n.lru_prev = NONE;
+    n.lru_next = _lru_head;
+    (_lru_head == NONE ? _lru_tail : _nodes[_lru_head].lru_prev) = node;
+    _lru_head = node;
+}
+
+//! \param[in] node is the node, with its deadline set
+void ARPCache::wheel_link(const uint32_t node) {
+    Node &n = _nodes[node];
+    uint32_t &head = _wheel[(n.deadline / WHEEL_GRANULARITY) % WHEEL_SLOTS];
+    n.wheel_prev = NONE;
+    n.wheel_next = head;
+    if (head != NONE) {
+        _nodes[head].wheel_prev = node;
+    }
+    head = node;
+}
+
+//! \param[in] node is the node
+void ARPCache::wheel_unlink(const uint32_t node) {
+    Node &n = _nodes[node];
+    uint32_t &head = _wheel[(n.deadline / WHEEL_GRANULARITY) % WHEEL_SLOTS];
+    (n.wheel_prev == NONE ? head : _nodes[n.wheel_prev].wheel_next) = n.wheel_next;
+    if (n.wheel_next != NONE) {
+        _nodes[n.wheel_next].wheel_prev = n.wheel_prev;
+    }
+    n.wheel_prev = n.wheel_next = NONE;
+}
+
+//! \param[in] wheel_slot is the index of the slot
+void ARPCache::sweep(const size_t wheel_slot) {
+    while (_wheel[wheel_slot] != NONE) {
+        remove(_wheel[wheel_slot]);
+    }
+}
+
+//! \param[in] ip is the neighbor's IP address
+optional<EthernetAddress> ARPCache::lookup(const uint32_t ip) {
+    const uint32_t node = find(ip);
+    if (node == NONE or not _nodes[node].ethernet_address.has_value()) {
+        return nullopt;
+    }
+    touch(node);
+    return _nodes[node].ethernet_address;
+}
+
+//! \param[in] ip is the neighbor's IP address
+//! \param[in] ethernet_address is the neighbor's Ethernet address
+vector<BufferList> ARPCache::learn(const uint32_t ip, const EthernetAddress &ethernet_address) {
+    uint32_t node = find(ip);
+    if (node == NONE) {
+        node = insert(ip, _now + ENTRY_TIMEOUT);
+    } else {
+        wheel_unlink(node);
+        _nodes[node].deadline = _now + ENTRY_TIMEOUT;
+        wheel_link(node);
+        touch(node);
+    }
+
+    Node &n = _nodes[node];
+    n.ethernet_address = ethernet_address;
+    n.pending.erase(n.pending.begin(), n.pending.begin() + n.pending_first);
+    _pending_bytes -= n.pending_bytes;
+    n.pending_first = n.pending_bytes = 0;
+    return exchange(n.pending, {});
+}
+
+//! \param[in] ip is the neighbor's IP address
+//! \param[in] dgram is the serialized datagram, which is moved into the queue (or dropped)
+bool ARPCache::enqueue(const uint32_t ip, BufferList &&dgram) {
+    uint32_t node = find(ip);
+    const bool new_request = node == NONE;
+    if (new_request) {
+        node = insert(ip, _now + REQUEST_TIMEOUT);
+    } else {
+        touch(node);
+    }
+
+    Node &n = _nodes[node];
+    const size_t bytes = dgram.size();
+    const auto fits = [&] {
+        return n.pending_bytes + bytes <= _config.max_pending_bytes and
+               _pending_bytes + bytes <= _config.max_total_pending_bytes;
+    };
+    // dropping the neighbor's own datagrams helps only if the new one would fit without them
+    const bool can_fit = bytes <= _config.max_pending_bytes and
+                         _pending_bytes - n.pending_bytes + bytes <= _config.max_total_pending_bytes;
+    if (_config.drop_policy == ARPCacheConfig::DropPolicy::DropOldest and can_fit) {
+        while (not fits()) {
+            drop_oldest(n);
+        }
+    }
+    if (not fits()) {
+        count_drop(bytes);
+        return new_request;
+    }
+
+    n.pending.push_back(move(dgram));
+    n.pending_bytes += bytes;
+    _pending_bytes += bytes;
+    return new_request;
+}
+
+//! \param[in] ms_since_last_tick the number of milliseconds since the last call to this method
+//! \details Every neighbor in a slot that has ended has a deadline before the current time. When the cache
+//! was idle for a whole turn of the wheel or more, every slot has ended, and each is swept once.
+void ARPCache::tick(const size_t ms_since_last_tick) {
+    _now += ms_since_last_tick;
+    const size_t slots_ended = (_now - _wheel_time) / WHEEL_GRANULARITY;
+    for (size_t i = 0; i < min(slots_ended, WHEEL_SLOTS); i++) {
+        sweep((_wheel_time / WHEEL_GRANULARITY + i) % WHEEL_SLOTS);
+    }
+    _wheel_time += slots_ended * WHEEL_GRANULARITY;
+}
@@ -0,0 +1,169 @@
+#ifndef SPONGE_LIBSPONGE_ARP_CACHE_HH
+#define SPONGE_LIBSPONGE_ARP_CACHE_HH
+
+#include "buffer.hh"
+#include "ethernet_header.hh"
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <vector>
+
+//! Config for ARPCache
+class ARPCacheConfig {
+  public:
+    static constexpr size_t DEFAULT_CAPACITY = 1024;                     //!< Default maximum number of neighbors
+    static constexpr size_t DEFAULT_MAX_PENDING_BYTES = 64 * 1024;       //!< Default limit per neighbor
+    static constexpr size_t DEFAULT_MAX_TOTAL_PENDING_BYTES = 1 << 20;  //!< Default limit for all the neighbors
+
+    //! Which datagram to drop when a new one would go over a limit
+    enum class DropPolicy {
+        DropOldest,  //!< Drop the neighbor's oldest waiting datagrams to make room (as Linux's ARP queue does)
+        DropNewest   //!< Drop the new datagram (tail drop)
+    };
+
+    size_t capacity = DEFAULT_CAPACITY;                              //!< Maximum number of neighbors
+    size_t max_pending_bytes = DEFAULT_MAX_PENDING_BYTES;            //!< Bytes waiting for one neighbor, at most
+    size_t max_total_pending_bytes = DEFAULT_MAX_TOTAL_PENDING_BYTES;  //!< Bytes waiting in all, at most
+    DropPolicy drop_policy = DropPolicy::DropOldest;                 //!< What goes when a limit is reached
+};
+
+//! \brief A NetworkInterface's neighbors: the Ethernet addresses it has learned, and the (serialized)
+//! datagrams waiting for the addresses it has asked for
+class ARPCache {
+  public:
+    static constexpr size_t ENTRY_TIMEOUT = 30000;   //!< How long (ms) a learned mapping lasts
+    static constexpr size_t REQUEST_TIMEOUT = 5000;  //!< How long (ms) to wait for a reply before asking again
+
+  private:
+    static constexpr uint32_t NONE = UINT32_MAX;  //!< Null node index
+
+    //! \brief A neighbor: resolved (with an Ethernet address) or waiting for a reply to an ARP request
+    struct Node {
+        uint32_t ip{};
+        std::optional<EthernetAddress> ethernet_address{};  //!< Empty while waiting for a reply
+        size_t deadline{};                                  //!< Time after which the neighbor expires
+        std::vector<BufferList> pending{};                  //!< Datagrams waiting for the reply, oldest first
+        size_t pending_first{};                             //!< Index of the first datagram still in `pending`
+        size_t pending_bytes{};                             //!< Bytes waiting in `pending`
+        uint32_t lru_prev{NONE}, lru_next{NONE};            //!< Neighbors used just before and after this one
+        uint32_t wheel_prev{NONE}, wheel_next{NONE};        //!< Neighbors in the same timer wheel slot
+    };
+
+    //! \brief A slot of the hash table: an IP address and the index of its node
+    struct Slot {
+        uint32_t ip{};
+        uint32_t node{NONE};
+    };
+
+    static constexpr size_t WHEEL_SLOTS = 256;        //!< Slots of the timer wheel
+    static constexpr size_t WHEEL_GRANULARITY = 256;  //!< Milliseconds covered by each slot of the timer wheel
+
+    std::vector<Node> _nodes;  //!< All the nodes, in use or free
+    std::vector<Slot> _slots;  //!< Open-addressing hash table (linear probing) from IP address to node
+    size_t _slot_mask;         //!< Size of `_slots` (a power of two), minus one
+    unsigned _slot_shift;      //!< 32 minus the number of bits in `_slot_mask`
+    ARPCacheConfig _config;    //!< Capacity, limits and drop policy
+    uint32_t _free{NONE};      //!< First free node, linked through `lru_next`
+    uint32_t _lru_head{NONE};  //!< Most recently used neighbor
+    uint32_t _lru_tail{NONE};  //!< Least recently used neighbor
+    size_t _size{0};           //!< Neighbors in use
+    size_t _pending_bytes{0};  //!< Bytes waiting for all the neighbors
+    size_t _dropped{0};        //!< Datagrams dropped by expiry, eviction or a limit
+    size_t _dropped_bytes{0};  //!< Bytes in those datagrams
+
+    std::array<uint32_t, WHEEL_SLOTS> _wheel{};  //!< First neighbor of each timer wheel slot
+    size_t _now{0};                              //!< Current time (ms)
+    size_t _wheel_time{0};                       //!< Start of the first timer wheel slot that has not expired
+
+    //! Hash table slot where the search for `ip` starts (Fibonacci hashing: the top bits of a multiplication)
+    size_t home_slot(const uint32_t ip) const { return uint32_t(ip * 0x9e3779b1U) >> _slot_shift; }
+
+    //! Index of the hash table slot that holds `ip`, or the empty slot where it would go
+    size_t find_slot(const uint32_t ip) const;
+
+    //! The node of a neighbor that has not expired (an expired one is removed), or NONE
+    uint32_t find(const uint32_t ip);
+
+    //! Make a node for `ip`, evicting the least recently used neighbor if the cache is full
+    uint32_t insert(const uint32_t ip, const size_t deadline);
+
+    //! Remove a neighbor, dropping its waiting datagrams
+    void remove(const uint32_t node);
+
+    //! Drop a neighbor's oldest waiting datagram
+    void drop_oldest(Node &n);
+
+    //! Count a dropped datagram
+    void count_drop(const size_t bytes) {
+        _dropped++;
+        _dropped_bytes += bytes;
+    }
+
+    //! Make a neighbor the most recently used one
+    void touch(const uint32_t node);
+
+    void lru_unlink(const uint32_t node);      //!< Take a node out of the LRU list
+    void lru_push_front(const uint32_t node);  //!< Put a node at the front of the LRU list
+
+    void wheel_link(const uint32_t node);    //!< Put a node in the timer wheel slot of its deadline
+    void wheel_unlink(const uint32_t node);  //!< Take a node out of its timer wheel slot
+
+    //! Remove every neighbor in a timer wheel slot (whose deadlines have all passed)
+    void sweep(const size_t wheel_slot);
+
+  public:
+    //! Construct an empty cache
+    explicit ARPCache(const ARPCacheConfig &config = {});
+
+    //! The Ethernet address of a neighbor whose mapping has not expired
+    std::optional<EthernetAddress> lookup(const uint32_t ip);
+
+    //! \brief Learn (or refresh) a neighbor's Ethernet address
+    //! \returns the datagrams that were waiting for it, oldest first
+    std::vector<BufferList> learn(const uint32_t ip, const EthernetAddress &ethernet_address);
+
+    //! \brief Queue a serialized datagram for a neighbor whose Ethernet address lookup() did not find, unless
+    //! the limits and drop policy say to drop it
+    //! \returns `true` if the caller should send an ARP request: none went out in the last REQUEST_TIMEOUT
+    bool enqueue(const uint32_t ip, BufferList &&dgram);
+
+    //! Advance time, expiring the neighbors whose deadlines have passed
+    void tick(const size_t ms_since_last_tick);
+
+    //! Number of neighbors (resolved or not)
+    size_t size() const { return _size; }
+
+    //! Maximum number of neighbors
+    size_t capacity() const { return _nodes.size(); }
+
+    //! Bytes waiting for all the neighbors
+    size_t pending_bytes() const { return _pending_bytes; }
+
+    //! Number of datagrams dropped because their neighbor expired or was evicted, or a limit was reached
+    size_t dropped() const { return _dropped; }
+
+    //! Bytes in the dropped datagrams
+    size_t dropped_bytes() const { return _dropped_bytes; }
+};
+
+//! \class ARPCache
+//! Neighbors live in a fixed pool of nodes, so memory stays flat however many addresses a busy segment
+//! throws at the interface. An open-addressing hash table with linear probing (and backward-shift deletion,
+//! so no tombstones build up) maps IP addresses to nodes in O(1). When the pool is full, a new neighbor
+//! evicts the least recently used one.
+//!
+//! Waiting datagrams are bounded in bytes, per neighbor and for the whole cache. Under DropOldest, a new
+//! datagram pushes out its own neighbor's oldest ones until it fits, unless it could not fit even then (it is
+//! bigger than a limit, or the other neighbors hold the rest of the global budget): then, as under
+//! DropNewest, it is dropped itself. Either way, a
+//! burst to an unresolvable host costs at most `max_pending_bytes`.
+//!
+//! Each neighbor has a deadline: ENTRY_TIMEOUT after its address was learned, or REQUEST_TIMEOUT after the
+//! ARP request for it went out (at which point its waiting datagrams are dropped, and the next datagram for
+//! it sends a new request). Lookups compare deadlines exactly; the timer wheel only reclaims expired
+//! neighbors. tick() sweeps each slot of the wheel (WHEEL_GRANULARITY ms wide) once its time has passed, so
+//! expiry costs O(1) per neighbor, however long the cache has been idle.
+
+#endif  // SPONGE_LIBSPONGE_ARP_CACHE_HH
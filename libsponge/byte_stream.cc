@@ -15,7 +15,7 @@ ByteStream::ByteStream(const size_t capacity)
 
 size_t ByteStream::next(size_t i, size_t step = 1) const { return (i + step) % buffer.size(); }
 
-size_t ByteStream::write(const string &data) {
+size_t ByteStream::write(const string_view data) {
     size_t old_write_cnt = write_cnt;
     for (auto x : data) {
         if (remaining > 0) {
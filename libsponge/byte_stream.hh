@@ -2,6 +2,7 @@
 #define SPONGE_LIBSPONGE_BYTE_STREAM_HH
 
 #include <string>
+#include <string_view>
 #include <vector>
 
 //! \brief An in-order byte stream.
@@ -34,7 +35,7 @@ class ByteStream {
     //! Write a string of bytes into the stream. Write as many
     //! as will fit, and return how many were written.
     //! \returns the number of bytes accepted into the stream
-    size_t write(const std::string &data);
+    size_t write(const std::string_view data);
 
     //! \returns the number of additional bytes that the stream has space for
     size_t remaining_capacity() const;
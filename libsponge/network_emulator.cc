@@ -0,0 +1,573 @@
+#include "network_emulator.hh"
+
+#include "ipv4_datagram.hh"
+#include "parser.hh"
+#include "router.hh"
+
+#include <algorithm>
+#include <iomanip>
+#include <sstream>
+#include <stdexcept>
+
+using namespace std;
+
+//! \param[in] time_ns is when the action happens
+//! \param[in] action is what happens
+void EventQueue::at(const uint64_t time_ns, Action action) {
+    if (time_ns < _now_ns) {
+        throw runtime_error("EventQueue: cannot schedule an event in the past");
+    }
+    _events.push({time_ns, _scheduled++, move(action)});
+}
+
+bool EventQueue::run_next() {
+    if (_events.empty()) {
+        return false;
+    }
+    // the action may schedule more events, so take it off the queue first
+    Event event = _events.top();
+    _events.pop();
+    _now_ns = event.time_ns;
+    event.action();
+    return true;
+}
+
+//! \param[in] end_ns is the time to run to
+void EventQueue::run_until(const uint64_t end_ns) {
+    while (not _events.empty() and _events.top().time_ns <= end_ns) {
+        run_next();
+    }
+    _now_ns = max(_now_ns, end_ns);
+}
+
+//! \param[in] events is the queue to schedule the link's transmissions and deliveries in
+//! \param[in] config is the link's rate, delay, queue and loss
+//! \param[in] rd is the generator to draw losses and RED's drops from
+//! \param[in] deliver hands a frame to the interface at the far end
+EmulatedLink::EmulatedLink(EventQueue &events, const LinkConfig &config, mt19937 &rd, Deliver deliver)
+    : _events(events), _config(config), _rd(rd), _deliver(move(deliver)) {
+    if (_config.bandwidth < 0 or _config.loss < 0 or _config.loss > 1) {
+        throw runtime_error("EmulatedLink: bandwidth must not be negative, and loss must be from 0 to 1");
+    }
+    if (_config.discipline == LinkConfig::QueueDiscipline::RED and
+        not(_config.red_min_threshold < _config.red_max_threshold)) {
+        throw runtime_error("EmulatedLink: RED's min threshold must be below its max threshold");
+    }
+}
+
+//! \details The average queue size is updated on each arrival, as in RFC 2309's RED (without the correction for
+//! time the queue spends empty). Below the min threshold nothing is dropped; between the thresholds a frame is
+//! dropped with a probability rising linearly to the max probability; above the max threshold every frame is.
+bool EmulatedLink::red_drops() {
+    _red_average = (1 - _config.red_weight) * _red_average + _config.red_weight * static_cast<double>(_queued_bytes);
+    const double min_bytes = _config.red_min_threshold * static_cast<double>(_config.queue_bytes);
+    const double max_bytes = _config.red_max_threshold * static_cast<double>(_config.queue_bytes);
+    if (_red_average < min_bytes) {
+        return false;
+    }
+    if (_red_average >= max_bytes) {
+        return true;
+    }
+    const double probability = _config.red_max_probability * (_red_average - min_bytes) / (max_bytes - min_bytes);
+    return uniform_real_distribution<double>{0, 1}(_rd) < probability;
+}
+
+//! \param[in] frame is the frame to send
+void EmulatedLink::send(EthernetFrame &&frame) {
+    _stats.frames_offered++;
+    const size_t bytes = EthernetHeader::LENGTH + frame.payload().size();
+    if (_config.discipline == LinkConfig::QueueDiscipline::RED and red_drops()) {
+        _stats.early_drops++;
+        return;
+    }
+    if (_busy and _queued_bytes + bytes > _config.queue_bytes) {
+        _stats.queue_drops++;
+        return;
+    }
+
+    if (frame.payload().buffers().size() > 1) {
+        frame.payload() = frame.payload().concatenate();
+    }
+    _queue.push_back({move(frame), _events.now_ns(), bytes});
+    _queued_bytes += bytes;
+    if (not _busy) {
+        transmit();
+    }
+}
+
+void EmulatedLink::transmit() {
+    if (_queue.empty()) {
+        _busy = false;
+        return;
+    }
+    _busy = true;
+    Queued queued = move(_queue.front());
+    _queue.pop_front();
+    _queued_bytes -= queued.bytes;
+
+    const uint64_t now = _events.now_ns();
+    const uint64_t queueing_delay = now - queued.enqueued_ns;
+    _stats.frames_sent++;
+    _stats.bytes_sent += queued.bytes;
+    _stats.queueing_delay_ns.record(queueing_delay);
+    if (_dequeued) {
+        _dequeued(queued.frame, queueing_delay);
+    }
+
+    // bits divided by Mbit/s is microseconds
+    const uint64_t transmission_ns =
+        _config.bandwidth > 0 ? static_cast<uint64_t>(queued.bytes * 8000.0 / _config.bandwidth + 0.5) : 0;
+    _stats.busy_ns += transmission_ns;
+    if (_config.loss > 0 and uniform_real_distribution<double>{0, 1}(_rd) < _config.loss) {
+        _stats.losses++;
+    } else {
+        _events.at(now + transmission_ns + _config.delay_us * 1000,
+                   [this, frame = move(queued.frame)]() mutable { _deliver(move(frame)); });
+    }
+    _events.at(now + transmission_ns, [this] { transmit(); });
+}
+
+//! A host: one interface, and the next hop of every datagram it sends
+struct NetworkEmulator::Host {
+    Address address;
+    AsyncNetworkInterface interface;
+    optional<Address> next_hop{};
+    EmulatedLink *link{nullptr};  //!< The link out of the interface, once it is connected
+};
+
+//! A router, with the address of each of its interfaces and the link out of it
+struct NetworkEmulator::RouterNode {
+    Router router{};
+    vector<Address> addresses{};
+    vector<EmulatedLink *> links{};
+};
+
+//! A flow: the connection that sends its bytes, the one that receives them, and their progress
+struct NetworkEmulator::Flow {
+    size_t source;
+    size_t destination;
+    uint64_t bytes;
+    uint64_t start_ns;
+    FourTuple tuple;       //!< As the sender sees it
+    TCPConnection client;  //!< The sender
+    TCPConnection server;  //!< The receiver
+    uint64_t written{0};
+    uint64_t delivered{0};
+    bool started{false};
+    bool ended{false};  //!< Has the sender ended its outbound stream?
+    optional<uint64_t> finish_ns{};
+    uint64_t frames_queued{0};
+    uint64_t queueing_delay_ns{0};
+    uint64_t max_queueing_delay_ns{0};
+
+    Flow(const size_t src,
+         const size_t dst,
+         const uint64_t n,
+         const uint64_t start,
+         const FourTuple &t,
+         const TCPConfig &config)
+        : source(src), destination(dst), bytes(n), start_ns(start), tuple(t), client(config), server(config) {}
+};
+
+//! \param[in] seed seeds the generator of losses and drops
+NetworkEmulator::NetworkEmulator(const unsigned seed) : _rd(seed) {}
+
+NetworkEmulator::~NetworkEmulator() = default;
+
+EthernetAddress NetworkEmulator::next_ethernet_address() {
+    const uint32_t n = ++_ethernet_addresses;
+    return {0x02, 0, static_cast<uint8_t>(n >> 24), static_cast<uint8_t>(n >> 16), static_cast<uint8_t>(n >> 8),
+            static_cast<uint8_t>(n)};
+}
+
+//! \param[in] address is the host's IP address
+size_t NetworkEmulator::add_host(const Address &address) {
+    _hosts.push_back(make_unique<Host>(Host{address, AsyncNetworkInterface{next_ethernet_address(), address}}));
+    return _hosts.size() - 1;
+}
+
+size_t NetworkEmulator::add_router() {
+    _routers.push_back(make_unique<RouterNode>());
+    return _routers.size() - 1;
+}
+
+//! \param[in] router is the router's index
+//! \param[in] address is the interface's IP address
+size_t NetworkEmulator::add_router_interface(const size_t router, const Address &address) {
+    RouterNode &node = *_routers.at(router);
+    node.addresses.push_back(address);
+    node.links.push_back(nullptr);
+    return node.router.add_interface(AsyncNetworkInterface{next_ethernet_address(), address});
+}
+
+//! \param[in] router is the router's index
+//! \param[in] route_prefix is the prefix to match
+//! \param[in] prefix_length is the number of bits of the prefix that must match
+//! \param[in] next_hop is the next hop, or empty if the destination is on the interface's network
+//! \param[in] interface_num is the interface to send the matching datagrams out of
+void NetworkEmulator::add_route(const size_t router,
+                                const uint32_t route_prefix,
+                                const uint8_t prefix_length,
+                                const optional<Address> next_hop,
+                                const size_t interface_num) {
+    _routers.at(router)->router.add_route(route_prefix, prefix_length, next_hop, interface_num);
+}
+
+//! \param[in] config is the link's config
+//! \param[in] deliver hands a frame to the interface at the far end
+EmulatedLink &NetworkEmulator::add_link(const LinkConfig &config, EmulatedLink::Deliver deliver) {
+    _links.push_back(make_unique<EmulatedLink>(_events, config, _rd, move(deliver)));
+    _links.back()->set_dequeued(
+        [this](const EthernetFrame &frame, const uint64_t queueing_delay_ns) { dequeued(frame, queueing_delay_ns); });
+    return *_links.back();
+}
+
+//! \param[in] host_a is one host's index
+//! \param[in] host_b is the other's
+//! \param[in] config is the config of the link each way
+void NetworkEmulator::connect_hosts(const size_t host_a, const size_t host_b, const LinkConfig &config) {
+    Host &a = *_hosts.at(host_a), &b = *_hosts.at(host_b);
+    a.next_hop = b.address;
+    b.next_hop = a.address;
+    a.link = &add_link(config, [this, host_b](EthernetFrame &&frame) { host_receive(host_b, move(frame)); });
+    b.link = &add_link(config, [this, host_a](EthernetFrame &&frame) { host_receive(host_a, move(frame)); });
+}
+
+//! \param[in] host is the host's index
+//! \param[in] router is the router's index
+//! \param[in] interface is the index of the router's interface
+//! \param[in] config is the config of the link each way
+void NetworkEmulator::connect_host(const size_t host,
+                                   const size_t router,
+                                   const size_t interface,
+                                   const LinkConfig &config) {
+    Host &h = *_hosts.at(host);
+    RouterNode &r = *_routers.at(router);
+    h.next_hop = r.addresses.at(interface);
+    h.link = &add_link(config, [this, router, interface](EthernetFrame &&frame) {
+        router_receive(router, interface, move(frame));
+    });
+    r.links.at(interface) = &add_link(config, [this, host](EthernetFrame &&frame) { host_receive(host, move(frame)); });
+}
+
+//! \param[in] router_a is one router's index
+//! \param[in] interface_a is the index of its interface
+//! \param[in] router_b is the other router's index
+//! \param[in] interface_b is the index of its interface
+//! \param[in] config is the config of the link each way
+void NetworkEmulator::connect_routers(const size_t router_a,
+                                      const size_t interface_a,
+                                      const size_t router_b,
+                                      const size_t interface_b,
+                                      const LinkConfig &config) {
+    _routers.at(router_a)->links.at(interface_a) =
+        &add_link(config, [this, router_b, interface_b](EthernetFrame &&frame) {
+            router_receive(router_b, interface_b, move(frame));
+        });
+    _routers.at(router_b)->links.at(interface_b) =
+        &add_link(config, [this, router_a, interface_a](EthernetFrame &&frame) {
+            router_receive(router_a, interface_a, move(frame));
+        });
+}
+
+//! \param[in] source is the sending host's index
+//! \param[in] destination is the receiving host's index
+//! \param[in] bytes is the number of bytes to send
+//! \param[in] start_ns is when to connect (or now, if that has passed)
+//! \param[in] config is the config of both connections
+//! \details The sender's port is 1024 plus the flow's index (modulo 64512), so the flows between two hosts
+//! are told apart by their ports.
+size_t NetworkEmulator::add_flow(const size_t source,
+                                 const size_t destination,
+                                 const uint64_t bytes,
+                                 const uint64_t start_ns,
+                                 const TCPConfig &config) {
+    const size_t index = _flows.size();
+    const FourTuple tuple{_hosts.at(source)->address.ipv4_numeric(),
+                          _hosts.at(destination)->address.ipv4_numeric(),
+                          static_cast<uint16_t>(1024 + index % 64512),
+                          static_cast<uint16_t>(80 + index / 64512)};
+    if (not _flow_by_tuple.emplace(tuple, index).second) {
+        throw runtime_error("NetworkEmulator: flow " + tuple.to_string() + " already exists");
+    }
+    const uint64_t start = max(start_ns, now_ns());
+    _flows.push_back(make_unique<Flow>(source, destination, bytes, start, tuple, config));
+    _unfinished++;
+    _events.at(start, [this, index] { start_flow(*_flows[index]); });
+    return index;
+}
+
+//! \param[in] flow is the flow to start
+void NetworkEmulator::start_flow(Flow &flow) {
+    flow.started = true;
+    flow.client.connect();
+    pump(flow);
+}
+
+//! \param[in] connection is the connection whose segments to send
+//! \param[in] host is the connection's host
+//! \param[in] tuple is the connection's addresses and ports, as it sees them
+void NetworkEmulator::send_segments(TCPConnection &connection, Host &host, const FourTuple &tuple) {
+    auto &segments = connection.segments_out();
+    while (not segments.empty()) {
+        TCPSegment &seg = segments.front();
+        seg.header().sport = tuple.local_port;
+        seg.header().dport = tuple.remote_port;
+
+        InternetDatagram dgram;
+        dgram.header().src = tuple.local_ip;
+        dgram.header().dst = tuple.remote_ip;
+        dgram.header().len = dgram.header().hlen * 4 + seg.header().doff * 4 + seg.payload().size();
+        dgram.payload() = seg.serialize(dgram.header().pseudo_cksum());
+        host.interface.send_datagram(dgram, host.next_hop.value());
+        segments.pop();
+    }
+}
+
+//! \param[in] flow is the flow to make progress on
+void NetworkEmulator::pump(Flow &flow) {
+    static const string data(64 * 1024, 'x');
+    while (flow.written < flow.bytes and flow.client.remaining_outbound_capacity() > 0) {
+        const size_t n = min({flow.bytes - flow.written, flow.client.remaining_outbound_capacity(), data.size()});
+        flow.written += flow.client.write(n == data.size() ? data : data.substr(0, n));
+    }
+    if (flow.written == flow.bytes and not flow.ended) {
+        flow.ended = true;
+        flow.client.end_input_stream();
+    }
+
+    ByteStream &inbound = flow.server.inbound_stream();
+    if (inbound.buffer_size() > 0) {
+        flow.delivered += inbound.buffer_size();
+        inbound.pop_output(inbound.buffer_size());
+        flow.server.window_update();
+    }
+    if (inbound.eof() and not flow.finish_ns.has_value()) {
+        flow.finish_ns = now_ns();
+        _unfinished--;
+        flow.server.end_input_stream();
+    }
+
+    Host &source = *_hosts[flow.source], &destination = *_hosts[flow.destination];
+    send_segments(flow.client, source, flow.tuple);
+    send_segments(flow.server,
+                  destination,
+                  {flow.tuple.remote_ip, flow.tuple.local_ip, flow.tuple.remote_port, flow.tuple.local_port});
+    drain_host(source);
+    drain_host(destination);
+}
+
+//! \param[in] host is the host whose interface's frames to send
+void NetworkEmulator::drain_host(Host &host) {
+    auto &frames = host.interface.frames_out();
+    while (not frames.empty()) {
+        if (host.link != nullptr) {
+            host.link->send(move(frames.front()));
+        }
+        frames.pop();
+    }
+}
+
+//! \param[in] router is the router whose interfaces' frames to send
+void NetworkEmulator::drain_router(RouterNode &router) {
+    for (size_t i = 0; i < router.links.size(); i++) {
+        auto &frames = router.router.interface(i).frames_out();
+        while (not frames.empty()) {
+            if (router.links[i] != nullptr) {
+                router.links[i]->send(move(frames.front()));
+            }
+            frames.pop();
+        }
+    }
+}
+
+//! \param[in] host is the receiving host's index
+//! \param[in] frame is the frame that arrived
+void NetworkEmulator::host_receive(const size_t host, EthernetFrame &&frame) {
+    Host &h = *_hosts[host];
+    h.interface.recv_frame(frame);
+    auto &datagrams = h.interface.datagrams_out();
+    while (not datagrams.empty()) {
+        const InternetDatagram dgram = move(datagrams.front());
+        datagrams.pop();
+        TCPSegment seg;
+        if (dgram.header().proto != IPv4Header::PROTO_TCP or
+            seg.parse(dgram.payload(), dgram.header().pseudo_cksum()) != ParseResult::NoError) {
+            continue;
+        }
+
+        // a segment to the receiver has the flow's tuple; one to the sender has it reversed
+        const IPv4Header &ip = dgram.header();
+        const TCPHeader &tcp = seg.header();
+        auto it = _flow_by_tuple.find({ip.src, ip.dst, tcp.sport, tcp.dport});
+        if (it != _flow_by_tuple.end() and _flows[it->second]->destination == host) {
+            _flows[it->second]->server.segment_received(seg);
+            pump(*_flows[it->second]);
+            continue;
+        }
+        it = _flow_by_tuple.find({ip.dst, ip.src, tcp.dport, tcp.sport});
+        if (it != _flow_by_tuple.end() and _flows[it->second]->source == host) {
+            _flows[it->second]->client.segment_received(seg);
+            pump(*_flows[it->second]);
+        }
+    }
+    drain_host(h);
+}
+
+//! \param[in] router is the receiving router's index
+//! \param[in] interface is the index of the interface the frame arrived at
+//! \param[in] frame is the frame that arrived
+void NetworkEmulator::router_receive(const size_t router, const size_t interface, EthernetFrame &&frame) {
+    RouterNode &node = *_routers[router];
+    node.router.interface(interface).recv_frame(frame);
+    node.router.route();
+    drain_router(node);
+}
+
+void NetworkEmulator::tick() {
+    _ticking = false;
+    // the interfaces' ARP timers count seconds, so they are ticked less often than the connections
+    if (++_ticks % INTERFACE_TICK_MS == 0) {
+        for (auto &host : _hosts) {
+            host->interface.tick(INTERFACE_TICK_MS);
+            drain_host(*host);
+        }
+        for (auto &router : _routers) {
+            for (size_t i = 0; i < router->links.size(); i++) {
+                router->router.interface(i).tick(INTERFACE_TICK_MS);
+            }
+            drain_router(*router);
+        }
+    }
+    // a finished flow is ticked only while it has segments to retransmit, not through its lingering
+    for (auto &flow : _flows) {
+        if (flow->started and (not flow->finish_ns.has_value() or flow->client.bytes_in_flight() > 0 or
+                               flow->server.bytes_in_flight() > 0)) {
+            flow->client.tick(1);
+            flow->server.tick(1);
+            pump(*flow);
+        }
+    }
+    if (_unfinished > 0) {
+        _ticking = true;
+        _events.after(1000 * 1000, [this] { tick(); });
+    }
+}
+
+//! \param[in] frame is the frame that started to be sent
+//! \param[in] queueing_delay_ns is how long it waited in the link's queue
+//! \details Only the sender's frames are accounted to a flow: the receiver's acknowledgments are not its data.
+void NetworkEmulator::dequeued(const EthernetFrame &frame, const uint64_t queueing_delay_ns) {
+    if (frame.header().type != EthernetHeader::TYPE_IPv4 or frame.payload().buffers().empty()) {
+        return;
+    }
+    // peek at the addresses and ports, rather than parse the whole datagram
+    const string_view ip = frame.payload().buffers().front().str();
+    if (ip.size() < 20 or static_cast<uint8_t>(ip[9]) != IPv4Header::PROTO_TCP) {
+        return;
+    }
+    const size_t header_length = (static_cast<uint8_t>(ip[0]) & 0xf) * 4;
+    if (ip.size() < header_length + 4) {
+        return;
+    }
+    const auto read = [&ip](const size_t offset, const size_t size) {
+        uint32_t ret = 0;
+        for (size_t i = 0; i < size; i++) {
+            ret = (ret << 8) | static_cast<uint8_t>(ip[offset + i]);
+        }
+        return ret;
+    };
+    const FourTuple tuple{read(12, 4),
+                          read(16, 4),
+                          static_cast<uint16_t>(read(header_length, 2)),
+                          static_cast<uint16_t>(read(header_length + 2, 2))};
+    const auto it = _flow_by_tuple.find(tuple);
+    if (it == _flow_by_tuple.end()) {
+        return;
+    }
+    Flow &flow = *_flows[it->second];
+    flow.frames_queued++;
+    flow.queueing_delay_ns += queueing_delay_ns;
+    flow.max_queueing_delay_ns = max(flow.max_queueing_delay_ns, queueing_delay_ns);
+}
+
+//! \param[in] limit_ns is the virtual time to stop at, if the flows have not finished
+bool NetworkEmulator::run(const uint64_t limit_ns) {
+    if (_unfinished > 0 and not _ticking) {
+        _ticking = true;
+        _events.after(1000 * 1000, [this] { tick(); });
+    }
+    while (_unfinished > 0 and not _events.empty() and _events.next_ns() <= limit_ns) {
+        _events.run_next();
+    }
+    return _unfinished == 0;
+}
+
+vector<NetworkEmulator::FlowReport> NetworkEmulator::flow_reports() const {
+    vector<FlowReport> ret;
+    ret.reserve(_flows.size());
+    for (const auto &flow : _flows) {
+        FlowReport report;
+        report.source = flow->source;
+        report.destination = flow->destination;
+        report.bytes = flow->bytes;
+        report.bytes_delivered = flow->delivered;
+        report.start_ns = flow->start_ns;
+        report.finish_ns = flow->finish_ns;
+        const uint64_t end_ns = flow->finish_ns.value_or(now_ns());
+        if (end_ns > flow->start_ns) {
+            // bits per microsecond is Mbit/s
+            report.throughput =
+                static_cast<double>(flow->delivered) * 8000 / static_cast<double>(end_ns - flow->start_ns);
+        }
+        StatsSnapshot snapshot;
+        flow->client.collect_stats(snapshot);
+        report.retransmissions = snapshot.total("sponge_tcp_retransmissions_total");
+        report.frames_queued = flow->frames_queued;
+        if (flow->frames_queued > 0) {
+            report.mean_queueing_delay_us =
+                static_cast<double>(flow->queueing_delay_ns) / static_cast<double>(flow->frames_queued) / 1000;
+        }
+        report.max_queueing_delay_us = static_cast<double>(flow->max_queueing_delay_ns) / 1000;
+        ret.push_back(report);
+    }
+    return ret;
+}
+
+string NetworkEmulator::report() const {
+    ostringstream ret;
+    ret << fixed << setprecision(2);
+    ret << right << setw(6) << "flow" << setw(6) << "src" << setw(6) << "dst" << setw(12) << "bytes" << setw(12)
+        << "finish ms" << setw(10) << "Mbit/s" << setw(8) << "retx" << setw(14) << "mean q us" << setw(12)
+        << "max q us" << "\n";
+    const auto flows = flow_reports();
+    for (size_t i = 0; i < flows.size(); i++) {
+        const FlowReport &flow = flows[i];
+        ret << setw(6) << i << setw(6) << flow.source << setw(6) << flow.destination << setw(12)
+            << flow.bytes_delivered << setw(12);
+        if (flow.finish_ns.has_value()) {
+            ret << static_cast<double>(flow.finish_ns.value()) / 1e6;
+        } else {
+            ret << "-";
+        }
+        ret << setw(10) << flow.throughput << setw(8) << flow.retransmissions << setw(14)
+            << flow.mean_queueing_delay_us << setw(12) << flow.max_queueing_delay_us << "\n";
+    }
+
+    ret << "\n"
+        << setw(6) << "link" << setw(10) << "sent" << setw(10) << "q drops" << setw(10) << "red drops" << setw(10)
+        << "losses" << setw(8) << "util %" << setw(12) << "p50 q us" << setw(12) << "p99 q us" << "\n";
+    for (size_t i = 0; i < _links.size(); i++) {
+        const EmulatedLinkStats &stats = _links[i]->stats();
+        if (stats.frames_offered == 0) {
+            continue;
+        }
+        const double utilization =
+            now_ns() > 0 ? 100 * static_cast<double>(stats.busy_ns) / static_cast<double>(now_ns()) : 0;
+        ret << setw(6) << i << setw(10) << stats.frames_sent << setw(10) << stats.queue_drops << setw(10)
+            << stats.early_drops << setw(10) << stats.losses << setw(8) << utilization << setw(12)
+            << static_cast<double>(stats.queueing_delay_ns.percentile(0.5)) / 1000 << setw(12)
+            << static_cast<double>(stats.queueing_delay_ns.percentile(0.99)) / 1000 << "\n";
+    }
+    return ret.str();
+}
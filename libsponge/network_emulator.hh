@@ -0,0 +1,328 @@
+#ifndef SPONGE_LIBSPONGE_NETWORK_EMULATOR_HH
+#define SPONGE_LIBSPONGE_NETWORK_EMULATOR_HH
+
+#include "ethernet_frame.hh"
+#include "four_tuple.hh"
+#include "latency_histogram.hh"
+#include "tcp_config.hh"
+#include "tcp_connection.hh"
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <queue>
+#include <random>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+//! \brief The virtual clock of a discrete-event simulation, and the events waiting for it
+class EventQueue {
+  public:
+    using Action = std::function<void()>;  //!< What happens at an event
+
+  private:
+    struct Event {
+        uint64_t time_ns;   //!< When the event happens
+        uint64_t sequence;  //!< Events at the same time happen in the order they were scheduled
+        Action action;
+    };
+
+    //! Orders the priority queue so that the next event is on top
+    struct Later {
+        bool operator()(const Event &a, const Event &b) const {
+            return a.time_ns != b.time_ns ? a.time_ns > b.time_ns : a.sequence > b.sequence;
+        }
+    };
+
+    std::priority_queue<Event, std::vector<Event>, Later> _events{};
+    uint64_t _now_ns{0};
+    uint64_t _scheduled{0};
+
+  public:
+    //! The current virtual time, in nanoseconds
+    uint64_t now_ns() const { return _now_ns; }
+
+    //! Schedule an action at a virtual time (no earlier than now)
+    void at(const uint64_t time_ns, Action action);
+
+    //! Schedule an action some time from now
+    void after(const uint64_t delay_ns, Action action) { at(_now_ns + delay_ns, std::move(action)); }
+
+    //! \brief Advance the clock to the next event and run it
+    //! \returns `false` if there was none
+    bool run_next();
+
+    //! Run the events up to `end_ns`, then advance the clock to it (if no event has passed it)
+    void run_until(const uint64_t end_ns);
+
+    //! Are no events waiting?
+    bool empty() const { return _events.empty(); }
+
+    //! The time of the next event (which must exist)
+    uint64_t next_ns() const { return _events.top().time_ns; }
+};
+
+//! Config for an EmulatedLink
+class LinkConfig {
+  public:
+    //! How the queue decides to drop a frame
+    enum class QueueDiscipline {
+        DropTail,  //!< Drop frames that do not fit
+        RED        //!< Random Early Detection: also drop at random as the average queue grows (RFC 2309)
+    };
+
+    static constexpr size_t DEFAULT_QUEUE_BYTES = 64 * 1024;  //!< Default queue size
+
+    double bandwidth = 0;                      //!< Rate in Mbit/s, or 0 for unlimited (frames take no time)
+    uint64_t delay_us = 0;                     //!< Propagation delay, in microseconds
+    size_t queue_bytes = DEFAULT_QUEUE_BYTES;  //!< Bytes of frames that can wait behind the one being sent
+    QueueDiscipline discipline = QueueDiscipline::DropTail;  //!< What to drop when the queue grows
+    double red_min_threshold = 0.25;  //!< RED drops nothing while the average queue is below this fraction
+    double red_max_threshold = 0.75;  //!< RED drops everything while the average queue is above this fraction
+    double red_max_probability = 0.1;  //!< RED's drop probability as the average reaches the max threshold
+    double red_weight = 0.002;         //!< Weight of each new sample in RED's average queue size
+    double loss = 0;                   //!< Probability that a frame sent is lost on the wire
+};
+
+//! Counters of an EmulatedLink
+struct EmulatedLinkStats {
+    uint64_t frames_offered{0};    //!< Frames given to the link
+    uint64_t frames_sent{0};       //!< Frames the link sent (including those then lost)
+    uint64_t bytes_sent{0};        //!< Bytes in those frames
+    uint64_t queue_drops{0};       //!< Frames dropped because the queue was full
+    uint64_t early_drops{0};       //!< Frames that RED dropped before the queue was full
+    uint64_t losses{0};            //!< Frames lost on the wire
+    uint64_t busy_ns{0};           //!< Time spent sending
+    LatencyHistogram queueing_delay_ns{};  //!< Time each frame sent waited in the queue
+};
+
+//! \brief One direction of a point-to-point link: a queue, a transmitter at a fixed rate, and a propagation delay
+class EmulatedLink {
+  public:
+    //! Hands a frame to the interface at the far end
+    using Deliver = std::function<void(EthernetFrame &&frame)>;
+
+    //! Told of each frame as it starts to be sent, and how long it waited in the queue
+    using Dequeued = std::function<void(const EthernetFrame &frame, const uint64_t queueing_delay_ns)>;
+
+  private:
+    struct Queued {
+        EthernetFrame frame;
+        uint64_t enqueued_ns;
+        size_t bytes;
+    };
+
+    EventQueue &_events;
+    LinkConfig _config;
+    std::mt19937 &_rd;
+    Deliver _deliver;
+    Dequeued _dequeued{};
+    std::deque<Queued> _queue{};
+    size_t _queued_bytes{0};
+    double _red_average{0};  //!< RED's average queue size, in bytes
+    bool _busy{false};       //!< Is a frame being sent?
+    EmulatedLinkStats _stats{};
+
+    //! Should RED drop a frame that arrives now?
+    bool red_drops();
+
+    //! Start sending the next frame in the queue
+    void transmit();
+
+  public:
+    //! A link that draws its losses and drops from `rd`, and delivers frames through `deliver`
+    EmulatedLink(EventQueue &events, const LinkConfig &config, std::mt19937 &rd, Deliver deliver);
+
+    //! \name
+    //! Not copyable: the events that it schedules refer to it
+    //!@{
+    EmulatedLink(const EmulatedLink &other) = delete;
+    EmulatedLink &operator=(const EmulatedLink &other) = delete;
+    //!@}
+
+    //! Set a function to call as each frame starts to be sent
+    void set_dequeued(Dequeued dequeued) { _dequeued = std::move(dequeued); }
+
+    //! Queue a frame to send, or drop it
+    void send(EthernetFrame &&frame);
+
+    const LinkConfig &config() const { return _config; }  //!< The link's config
+    const EmulatedLinkStats &stats() const { return _stats; }  //!< The link's counters
+    size_t queued_bytes() const { return _queued_bytes; }  //!< Bytes waiting in the queue
+};
+
+//! \class EmulatedLink
+//! A frame is sized as its Ethernet header and payload. Its payload is flattened into one Buffer as it is
+//! queued, as if serialized onto the wire, so that the far end can parse it.
+
+//! \brief A deterministic discrete-event emulation of hosts, routers and links, running TCP flows
+class NetworkEmulator {
+  public:
+    //! What a flow achieved
+    struct FlowReport {
+        size_t source{};                       //!< Index of the sending host
+        size_t destination{};                  //!< Index of the receiving host
+        uint64_t bytes{};                      //!< Bytes the flow is to send
+        uint64_t bytes_delivered{};            //!< Bytes received so far
+        uint64_t start_ns{};                   //!< When the flow started
+        std::optional<uint64_t> finish_ns{};   //!< When the last byte arrived, if it has
+        double throughput{};                   //!< Mbit/s delivered from the start to the finish (or to now)
+        uint64_t retransmissions{};            //!< Segments retransmitted
+        uint64_t frames_queued{};              //!< Data frames that passed through a queue
+        double mean_queueing_delay_us{};       //!< Average wait of the data frames in each queue they passed
+        double max_queueing_delay_us{};        //!< Longest such wait
+    };
+
+  private:
+    struct Host;
+    struct RouterNode;
+    struct Flow;
+
+    EventQueue _events{};
+    std::mt19937 _rd;
+    std::vector<std::unique_ptr<Host>> _hosts{};
+    std::vector<std::unique_ptr<RouterNode>> _routers{};
+    std::vector<std::unique_ptr<EmulatedLink>> _links{};
+    std::vector<std::unique_ptr<Flow>> _flows{};
+    std::unordered_map<FourTuple, size_t, FourTupleHash> _flow_by_tuple{};  //!< From the sender's view of a flow
+    size_t _unfinished{0};  //!< Flows that have not delivered all their bytes
+    bool _ticking{false};   //!< Is the 1 ms tick scheduled?
+    uint64_t _ticks{0};     //!< Ticks so far
+
+    //! Milliseconds between ticks of the hosts' and routers' interfaces
+    static constexpr size_t INTERFACE_TICK_MS = 10;
+    uint32_t _ethernet_addresses{0};  //!< Ethernet addresses handed out to interfaces
+
+    //! A new private Ethernet address
+    EthernetAddress next_ethernet_address();
+
+    //! Make the link from an interface to the one that receives through `deliver`
+    EmulatedLink &add_link(const LinkConfig &config, EmulatedLink::Deliver deliver);
+
+    //! Send what a host's interface has queued, and what its connections have queued
+    void drain_host(Host &host);
+
+    //! Send what a router's interfaces have queued
+    void drain_router(RouterNode &router);
+
+    //! A frame arrives at a host
+    void host_receive(const size_t host, EthernetFrame &&frame);
+
+    //! A frame arrives at one of a router's interfaces
+    void router_receive(const size_t router, const size_t interface, EthernetFrame &&frame);
+
+    //! Wrap the segments that a connection has queued in datagrams, and give them to its host's interface
+    void send_segments(TCPConnection &connection, Host &host, const FourTuple &tuple);
+
+    //! Write a flow's data, read what arrived, and send what its connections have queued
+    void pump(Flow &flow);
+
+    //! Start a flow
+    void start_flow(Flow &flow);
+
+    //! Tick every running flow by 1 ms (and the interfaces every INTERFACE_TICK_MS), and schedule the next tick
+    //! while flows are unfinished
+    void tick();
+
+    //! Account a frame's wait in a queue to its flow
+    void dequeued(const EthernetFrame &frame, const uint64_t queueing_delay_ns);
+
+  public:
+    //! An empty network, whose losses and drops come from a generator seeded with `seed`
+    explicit NetworkEmulator(const unsigned seed = 1);
+    ~NetworkEmulator();
+
+    //! \name
+    //! Not copyable: the events and links refer to it
+    //!@{
+    NetworkEmulator(const NetworkEmulator &other) = delete;
+    NetworkEmulator &operator=(const NetworkEmulator &other) = delete;
+    //!@}
+
+    //! \brief Add a host, with one interface
+    //! \returns its index
+    size_t add_host(const Address &address);
+
+    //! \brief Add a router, with no interfaces
+    //! \returns its index
+    size_t add_router();
+
+    //! \brief Add an interface to a router
+    //! \returns the interface's index
+    size_t add_router_interface(const size_t router, const Address &address);
+
+    //! Add a route to a router (as Router::add_route)
+    void add_route(const size_t router,
+                   const uint32_t route_prefix,
+                   const uint8_t prefix_length,
+                   const std::optional<Address> next_hop,
+                   const size_t interface_num);
+
+    //! Connect two hosts' interfaces, each being the other's next hop, with a link each way
+    void connect_hosts(const size_t host_a, const size_t host_b, const LinkConfig &config);
+
+    //! Connect a host's interface to a router's, which becomes the host's next hop, with a link each way
+    void connect_host(const size_t host, const size_t router, const size_t interface, const LinkConfig &config);
+
+    //! Connect two routers' interfaces, with a link each way
+    void connect_routers(const size_t router_a,
+                         const size_t interface_a,
+                         const size_t router_b,
+                         const size_t interface_b,
+                         const LinkConfig &config);
+
+    //! \brief Add a TCP flow that sends `bytes` from one host to another, starting at `start_ns`
+    //! \returns its index
+    size_t add_flow(const size_t source,
+                    const size_t destination,
+                    const uint64_t bytes,
+                    const uint64_t start_ns = 0,
+                    const TCPConfig &config = {});
+
+    //! \brief Run until every flow has delivered its bytes, or until the virtual time `limit_ns`
+    //! \returns `true` if every flow finished
+    bool run(const uint64_t limit_ns = UINT64_MAX);
+
+    //! The current virtual time, in nanoseconds
+    uint64_t now_ns() const { return _events.now_ns(); }
+
+    //! What each flow has achieved so far
+    std::vector<FlowReport> flow_reports() const;
+
+    //! Number of links (two per connection, the first from the first node named)
+    size_t link_count() const { return _links.size(); }
+
+    //! A link, by index in the order they were made
+    const EmulatedLink &link(const size_t index) const { return *_links.at(index); }
+
+    //! A table of the flows and the links that carried traffic
+    std::string report() const;
+};
+
+//! \class NetworkEmulator
+//! Everything happens in virtual time, on one thread: a frame given to a link arrives at the far end
+//! after its queueing, transmission and propagation delays, and every connection is ticked once per virtual
+//! millisecond. Nothing waits in real time, so an emulation runs as fast as the stack can process its
+//! segments, whatever the link delays. Given the same seed, an emulation always runs the same way.
+//!
+//! Hosts and routers are the repository's own NetworkInterface and Router, so ARP and forwarding are
+//! emulated too. A flow is a pair of TCPConnections: the sending host's connects to the receiving host's,
+//! sends its bytes and closes. Its throughput and the time its data frames wait in each queue are reported.
+//! ~~~{.cpp}
+//! NetworkEmulator net;
+//! const size_t a = net.add_host(Address{"10.0.0.1"}), b = net.add_host(Address{"10.0.0.2"});
+//! LinkConfig link;
+//! link.bandwidth = 100;
+//! link.delay_us = 5000;
+//! net.connect_hosts(a, b, link);
+//! net.add_flow(a, b, 1000000);
+//! net.run();
+//! std::cout << net.report();
+//! ~~~
+
+#endif  // SPONGE_LIBSPONGE_NETWORK_EMULATOR_HH
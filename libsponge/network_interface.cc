@@ -2,9 +2,9 @@
 
 #include "arp_message.hh"
 #include "ethernet_frame.hh"
+#include "logger.hh"
 
 #include <cassert>
-#include <iostream>
 
 // Dummy implementation of a network interface
 // Translates from {IP datagram, next hop address} to link-layer frame, and from link-layer frame to IP datagram
@@ -21,10 +21,13 @@ using namespace std;
 
 //! \param[in] ethernet_address Ethernet (what ARP calls "hardware") address of the interface
 //! \param[in] ip_address IP (what ARP calls "protocol") address of the interface
-NetworkInterface::NetworkInterface(const EthernetAddress &ethernet_address, const Address &ip_address)
-    : _ethernet_address(ethernet_address), _ip_address(ip_address) {
-    cerr << "DEBUG: Network interface has Ethernet address " << to_string(_ethernet_address) << " and IP address "
-         << ip_address.ip() << "\n";
+//! \param[in] arp_config limits on the ARP cache, and on the datagrams waiting in it
+NetworkInterface::NetworkInterface(const EthernetAddress &ethernet_address,
+                                   const Address &ip_address,
+                                   const ARPCacheConfig &arp_config)
+    : _ethernet_address(ethernet_address), _ip_address(ip_address), _arp_cache(arp_config) {
+    LOG_DEBUG("Network interface has Ethernet address " << to_string(_ethernet_address) << " and IP address "
+                                                        << ip_address.ip());
 }
 
 //! \param[in] dgram the IPv4 datagram to be sent
@@ -33,47 +36,36 @@ NetworkInterface::NetworkInterface(const EthernetAddress &ethernet_address, cons
 void NetworkInterface::send_datagram(const InternetDatagram &dgram, const Address &next_hop) {
     // convert IP address of next hop to raw 32-bit representation (used in ARP header)
     const uint32_t next_hop_ip = next_hop.ipv4_numeric();
-    auto addr_entry = _arp_table.find(next_hop_ip);
-    if (addr_entry == _arp_table.end() || addr_entry->second.second < _timer) {
-        auto it = _dgram_queue_map.find(next_hop_ip);
-        if (it == _dgram_queue_map.end())
-            _dgram_queue_map[next_hop_ip] = queue<InternetDatagram>();
-        _dgram_queue_map[next_hop_ip].push(dgram);
-        _arp_request(next_hop_ip);
+    const auto eth_addr = _arp_cache.lookup(next_hop_ip);
+    if (not eth_addr.has_value()) {
+        _stats.arp_misses.add();
+        // the datagram waits serialized, so that the ARP reply only has to frame it
+        if (_arp_cache.enqueue(next_hop_ip, dgram.serialize()))
+            _arp_request(next_hop_ip);
+        _stats.arp_queue_drops.set(_arp_cache.dropped());
         return;
     }
-    EthernetAddress eth_addr = addr_entry->second.first;
-    _send_datagram(dgram, eth_addr);
+    _send_datagram(dgram.serialize(), eth_addr.value());
 }
 
-void NetworkInterface::_send_datagram(const InternetDatagram &dgram, const EthernetAddress &dst) {
-    cerr << "send datagram\n";
-    EthernetHeader header{dst, _ethernet_address, EthernetHeader::TYPE_IPv4};
+void NetworkInterface::_send_datagram(BufferList &&dgram, const EthernetAddress &dst) {
+    LOG_DEBUG("send datagram");
+    _stats.datagrams_sent.add();
     EthernetFrame frame;
-    frame.header() = header;
-    frame.payload() = dgram.serialize();
-    _frames_out.push(frame);
+    frame.header() = {dst, _ethernet_address, EthernetHeader::TYPE_IPv4};
+    frame.payload() = move(dgram);
+    _frames_out.push(move(frame));
 }
 
-void NetworkInterface::_send_queued_datagram(const EthernetAddress &eth_addr, uint32_t ip_addr) {
-    auto it = _dgram_queue_map.find(ip_addr);
-    if (it == _dgram_queue_map.end())
-        return;
-    auto &dgram_queue = it->second;
-    while (!dgram_queue.empty()) {
-        const InternetDatagram &dgram = dgram_queue.front();
-        _send_datagram(dgram, eth_addr);
-        dgram_queue.pop();
-    }
-    _dgram_queue_map.erase(it);
+//! \param[in] eth_addr the Ethernet address that the datagrams were waiting for
+//! \param[in] dgrams the serialized datagrams, oldest first, which become the payloads of the frames
+void NetworkInterface::_send_queued_datagram(const EthernetAddress &eth_addr, vector<BufferList> &&dgrams) {
+    for (auto &dgram : dgrams)
+        _send_datagram(move(dgram), eth_addr);
 }
 
 void NetworkInterface::_arp_request(uint32_t ip_addr) {
     //    cerr << "arg request\n";
-    auto arp_entry = _arp_sent_at.find(ip_addr);
-    if (arp_entry != _arp_sent_at.end() && _timer - arp_entry->second <= ARP_REQUEST_TIMEOUT)
-        return;
-    _arp_sent_at[ip_addr] = _timer;
     EthernetHeader header{ETHERNET_BROADCAST, _ethernet_address, EthernetHeader::TYPE_ARP};
     EthernetFrame frame;
     frame.header() = header;
@@ -85,6 +77,7 @@ void NetworkInterface::_arp_request(uint32_t ip_addr) {
     arp_msg.opcode = ARPMessage::OPCODE_REQUEST;
     frame.payload() = arp_msg.serialize();
     _frames_out.push(frame);
+    _stats.arp_requests_sent.add();
 }
 
 void NetworkInterface::_arp_reply(const EthernetAddress &dst_eth_addr, uint32_t dst_ip_addr) {
@@ -100,6 +93,7 @@ void NetworkInterface::_arp_reply(const EthernetAddress &dst_eth_addr, uint32_t
     arp_msg.opcode = ARPMessage::OPCODE_REPLY;
     frame.payload() = arp_msg.serialize();
     _frames_out.push(frame);
+    _stats.arp_replies_sent.add();
 }
 
 //! \param[in] frame the incoming Ethernet frame
@@ -107,36 +101,87 @@ optional<InternetDatagram> NetworkInterface::recv_frame(const EthernetFrame &fra
     //    cerr << "recv_frame\n";
     EthernetHeader header = frame.header();
     bool is_target_address = header.dst == _ethernet_address || header.dst == ETHERNET_BROADCAST;
-    if (!is_target_address)
+    if (!is_target_address) {
+        _stats.frames_ignored.add();
         return {};
+    }
     if (header.type == EthernetHeader::TYPE_ARP) {
         ARPMessage arp_msg;
         ParseResult parse_result = arp_msg.parse(frame.payload());
-        if (parse_result != ParseResult::NoError)
+        if (parse_result != ParseResult::NoError) {
+            _stats.frames_ignored.add();
             return {};
+        }
         auto src_ip_addr = arp_msg.sender_ip_address;
         auto src_eth_addr = arp_msg.sender_ethernet_address;
         auto dst_ip_addr = arp_msg.target_ip_address;
-        _arp_table.insert(make_pair(src_ip_addr, make_pair(src_eth_addr, _timer + ARP_ENTRY_TIMEOUT)));
-        _arp_sent_at.erase(src_ip_addr);
+        auto queued = _arp_cache.learn(src_ip_addr, src_eth_addr);
         if (arp_msg.opcode == ARPMessage::OPCODE_REQUEST && dst_ip_addr == _ip_address.ipv4_numeric()) {
             _arp_reply(src_eth_addr, src_ip_addr);
-        } else if (arp_msg.opcode == ARPMessage::OPCODE_REPLY) {
-            _send_queued_datagram(src_eth_addr, src_ip_addr);
         }
+        _send_queued_datagram(src_eth_addr, move(queued));
+        _stats.arp_queue_drops.set(_arp_cache.dropped());
         return {};
     }
 
     if (header.type == EthernetHeader::TYPE_IPv4) {
         InternetDatagram dgram;
         ParseResult parse_result = dgram.parse(frame.payload());
-        if (parse_result != ParseResult::NoError)
+        if (parse_result != ParseResult::NoError) {
+            _stats.frames_ignored.add();
             return {};
+        }
+        _stats.datagrams_received.add();
         return dgram;
     }
 
+    _stats.frames_ignored.add();
     return {};
 }
 
 //! \param[in] ms_since_last_tick the number of milliseconds since the last call to this method
-void NetworkInterface::tick(const size_t ms_since_last_tick) { _timer += ms_since_last_tick; }
+void NetworkInterface::tick(const size_t ms_since_last_tick) {
+    _arp_cache.tick(ms_since_last_tick);
+    _stats.arp_queue_drops.set(_arp_cache.dropped());
+}
+
+//! \param[in] snapshot is the snapshot to add to
+//! \param[in] labels are the labels to add the counters under
+void NetworkInterfaceStats::collect(StatsSnapshot &snapshot, const string &labels) const {
+    using Type = StatsSnapshot::Type;
+    snapshot.add("sponge_interface_datagrams_sent_total",
+                 "Datagrams sent by a network interface",
+                 Type::Counter,
+                 datagrams_sent.value(),
+                 labels);
+    snapshot.add("sponge_interface_datagrams_received_total",
+                 "Datagrams received by a network interface",
+                 Type::Counter,
+                 datagrams_received.value(),
+                 labels);
+    snapshot.add("sponge_interface_frames_ignored_total",
+                 "Frames for another address, or that did not parse",
+                 Type::Counter,
+                 frames_ignored.value(),
+                 labels);
+    snapshot.add("sponge_interface_arp_misses_total",
+                 "Datagrams whose next hop was not in the ARP cache",
+                 Type::Counter,
+                 arp_misses.value(),
+                 labels);
+    snapshot.add("sponge_interface_arp_requests_sent_total",
+                 "ARP requests sent",
+                 Type::Counter,
+                 arp_requests_sent.value(),
+                 labels);
+    snapshot.add("sponge_interface_arp_replies_sent_total",
+                 "ARP replies sent",
+                 Type::Counter,
+                 arp_replies_sent.value(),
+                 labels);
+    snapshot.add("sponge_interface_arp_queue_drops_total",
+                 "Datagrams dropped while waiting for ARP",
+                 Type::Counter,
+                 arp_queue_drops.value(),
+                 labels);
+}
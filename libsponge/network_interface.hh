@@ -1,14 +1,30 @@
 #ifndef SPONGE_LIBSPONGE_NETWORK_INTERFACE_HH
 #define SPONGE_LIBSPONGE_NETWORK_INTERFACE_HH
 
+#include "arp_cache.hh"
 #include "ethernet_frame.hh"
+#include "stats.hh"
 #include "tcp_over_ip.hh"
 #include "tun.hh"
 
 #include <optional>
 #include <queue>
-#include <map>
-#include <set>
+#include <string>
+#include <vector>
+
+//! \brief Counters of a NetworkInterface
+struct alignas(STATS_CACHE_LINE) NetworkInterfaceStats {
+    StatCounter datagrams_sent{};      //!< Datagrams framed and sent (now or after ARP resolved their next hop)
+    StatCounter datagrams_received{};  //!< Datagrams received
+    StatCounter frames_ignored{};      //!< Frames for another address, or that did not parse
+    StatCounter arp_misses{};          //!< Datagrams whose next hop's Ethernet address was not in the ARP cache
+    StatCounter arp_requests_sent{};   //!< ARP requests sent
+    StatCounter arp_replies_sent{};    //!< ARP replies sent
+    StatCounter arp_queue_drops{};     //!< Datagrams dropped while waiting for ARP (see ARPCache::dropped())
+
+    //! Add the counters to a snapshot
+    void collect(StatsSnapshot &snapshot, const std::string &labels) const;
+};
 
 //! \brief A "network interface" that connects IP (the internet layer, or network layer)
 //! with Ethernet (the network access layer, or link layer).
@@ -34,35 +50,32 @@
 class NetworkInterface {
   private:
     //! Ethernet (known as hardware, network-access-layer, or link-layer) address of the interface
-    static constexpr size_t ARP_REQUEST_TIMEOUT = 5000; // ms
-    static constexpr size_t ARP_ENTRY_TIMEOUT = 30000;  // ms
     EthernetAddress _ethernet_address;
 
-    size_t _timer{0};
-
     //! IP (known as internet-layer or network-layer) address of the interface
     Address _ip_address;
 
     //! outbound queue of Ethernet frames that the NetworkInterface wants sent
     std::queue<EthernetFrame> _frames_out{};
 
-    std::map<uint32_t, std::pair<EthernetAddress, size_t>> _arp_table{}; // ip -> (hardware, expired time)
-
-    std::map<uint32_t, size_t> _arp_sent_at{}; // ip -> time sent
+    //! Learned Ethernet addresses, and the datagrams waiting for the ones being asked for
+    ARPCache _arp_cache{};
 
-    std::map<uint32_t, std::queue<InternetDatagram>> _dgram_queue_map{};
+    NetworkInterfaceStats _stats{};
 
     void _arp_request(uint32_t ip_addr);
 
     void _arp_reply(const EthernetAddress& dst_eth_addr, uint32_t dst_ip_addr);
 
-    void _send_datagram(const InternetDatagram &dgram, const EthernetAddress &dst);
+    void _send_datagram(BufferList &&dgram, const EthernetAddress &dst);
 
-    void _send_queued_datagram(const EthernetAddress& eth_addr, uint32_t ip_addr);
+    void _send_queued_datagram(const EthernetAddress &eth_addr, std::vector<BufferList> &&dgrams);
 
   public:
     //! \brief Construct a network interface with given Ethernet (network-access-layer) and IP (internet-layer) addresses
-    NetworkInterface(const EthernetAddress &ethernet_address, const Address &ip_address);
+    NetworkInterface(const EthernetAddress &ethernet_address,
+                     const Address &ip_address,
+                     const ARPCacheConfig &arp_config = {});
 
     //! \brief Access queue of Ethernet frames awaiting transmission
     std::queue<EthernetFrame> &frames_out() { return _frames_out; }
@@ -82,6 +95,12 @@ class NetworkInterface {
 
     //! \brief Called periodically when time elapses
     void tick(const size_t ms_since_last_tick);
+
+    //! \brief Access the ARP cache (for its statistics, such as the datagrams dropped while waiting for ARP)
+    const ARPCache &arp_cache() const { return _arp_cache; }
+
+    //! \brief Counters of datagrams, frames and ARP traffic (which any thread may read)
+    const NetworkInterfaceStats &stats() const { return _stats; }
 };
 
 #endif  // SPONGE_LIBSPONGE_NETWORK_INTERFACE_HH
@@ -0,0 +1,168 @@
+#include "parallel_router.hh"
+
+#include "latency_histogram.hh"
+#include "logger.hh"
+
+#include <stdexcept>
+
+using namespace std;
+
+//! \param[in] iface is the interface
+//! \param[in] table is the route table that the worker reads
+ParallelRouter::Worker::Worker(AsyncNetworkInterface &&iface, RouteTable &table)
+    : interface(move(iface)), egress(EGRESS_CAPACITY), route_reader(table) {}
+
+ParallelRouter::~ParallelRouter() { stop(); }
+
+//! \param[in] interface an already-constructed network interface
+size_t ParallelRouter::add_interface(AsyncNetworkInterface &&interface) {
+    if (running()) {
+        throw runtime_error("ParallelRouter: cannot add an interface while the workers run");
+    }
+    _workers.push_back(make_unique<Worker>(move(interface), _route_table));
+    return _workers.size() - 1;
+}
+
+//! \param[in] route_prefix is the prefix to match the datagram's destination address against
+//! \param[in] prefix_length is the number of significant bits in `route_prefix`
+//! \param[in] next_hop is the IP address of the next hop, or empty if the network is directly attached
+//! \param[in] interface_num is the index of the interface to send the datagram out on
+void ParallelRouter::add_route(const uint32_t route_prefix,
+                               const uint8_t prefix_length,
+                               const optional<Address> next_hop,
+                               const size_t interface_num) {
+    optional<uint32_t> next_hop_ip{};
+    if (next_hop.has_value()) {
+        next_hop_ip = next_hop->ipv4_numeric();
+    }
+    if (not _route_table.add(route_prefix, prefix_length, next_hop_ip, interface_num)) {
+        LOG_DEBUG("route already existed");
+        return;
+    }
+    if (running()) {
+        _route_table.commit();
+    }
+}
+
+//! \param[in] worker is the worker, on its own thread
+//! \details Like Router::route_burst, except that the datagrams go to the egress rings rather than straight
+//! to the interfaces, and a datagram for an interface that does not exist is dropped.
+bool ParallelRouter::route_burst(Worker &worker) {
+    auto &queue = worker.interface.datagrams_out();
+    if (queue.empty()) {
+        return false;
+    }
+    SPONGE_LATENCY_SCOPE(RouteBurst);
+
+    worker.burst.clear();
+    worker.destinations.clear();
+    while (not queue.empty() and worker.burst.size() < BURST_SIZE) {
+        worker.destinations.push_back(queue.front().header().dst);
+        worker.burst.push_back(move(queue.front()));
+        queue.pop();
+    }
+    const size_t count = worker.burst.size();
+    worker.routes.resize(count);
+
+    // resolve every route within one read section, keeping the egress interface and next hop in `routes`
+    // and `destinations`
+    const RouteTable::Snapshot &routes = worker.route_reader.lock();
+    routes.lookup_batch(worker.destinations.data(), worker.routes.data(), count);
+    for (size_t i = 0; i < count; i++) {
+        if (worker.routes[i] == RouteTable::Snapshot::NO_ROUTE) {
+            continue;
+        }
+        const RouteTable::Action &action = routes.action(worker.routes[i]);
+        const bool exists = action.interface_num < _workers.size();
+        worker.routes[i] = exists ? action.interface_num : RouteTable::Snapshot::NO_ROUTE;
+        worker.destinations[i] = action.next_hop.value_or(worker.destinations[i]);
+    }
+    worker.route_reader.unlock();
+
+    for (size_t i = 0; i < count; i++) {
+        InternetDatagram &dgram = worker.burst[i];
+        if (dgram.header().ttl <= 1) {
+            worker.stats.ttl_drops.add();
+            continue;
+        }
+        if (worker.routes[i] == RouteTable::Snapshot::NO_ROUTE) {
+            worker.stats.no_route_drops.add();
+            continue;
+        }
+        worker.stats.datagrams_routed.add();
+        dgram.decrement_ttl();
+        Worker &egress = *_workers[worker.routes[i]];
+        if (not egress.egress.push({move(dgram), worker.destinations[i]})) {
+            egress.dropped.fetch_add(1, memory_order_relaxed);
+        }
+    }
+    return true;
+}
+
+//! \param[in] worker is the worker, on its own thread
+bool ParallelRouter::send_egress(Worker &worker) {
+    size_t sent = 0;
+    while (sent < BURST_SIZE and worker.egress.pop(worker.popped)) {
+        worker.interface.send_datagram(worker.popped.datagram, Address::from_ipv4_numeric(worker.popped.next_hop));
+        sent++;
+    }
+    worker.forwarded.fetch_add(sent, memory_order_relaxed);
+    return sent > 0;
+}
+
+//! \param[in] interface_num is the index of the worker's interface
+//! \param[in] driver exchanges the interface's frames with the outside world
+void ParallelRouter::work(const size_t interface_num, const Driver &driver) {
+    Worker &worker = *_workers[interface_num];
+    while (not _stopping.load(memory_order_relaxed)) {
+        driver(interface_num, worker.interface);
+        const bool routed = route_burst(worker);
+        const bool sent = send_egress(worker);
+        if (not routed and not sent) {
+            this_thread::yield();
+        }
+    }
+}
+
+//! \param[in] driver exchanges each interface's frames with the outside world; it is called from all the
+//! workers' threads at once, with their own interfaces
+void ParallelRouter::start(const Driver &driver) {
+    stop();
+    _route_table.commit();  // the routes that add_route() staged while the workers were stopped
+    _stopping = false;
+    for (size_t i = 0; i < _workers.size(); i++) {
+        _workers[i]->thread = thread([this, i, driver] { work(i, driver); });
+    }
+}
+
+void ParallelRouter::stop() {
+    _stopping = true;
+    for (auto &worker : _workers) {
+        if (worker->thread.joinable()) {
+            worker->thread.join();
+        }
+    }
+}
+
+//! \param[in] snapshot is the snapshot to add to
+//! \param[in] labels are the labels to add the counters under
+void ParallelRouter::collect_stats(StatsSnapshot &snapshot, const string &labels) const {
+    for (size_t i = 0; i < _workers.size(); i++) {
+        const Worker &worker = *_workers[i];
+        worker.stats.collect(snapshot, labels);
+
+        const string interface_label = StatsSnapshot::label("interface", to_string(i));
+        const string worker_labels = labels.empty() ? interface_label : labels + "," + interface_label;
+        worker.interface.stats().collect(snapshot, worker_labels);
+        snapshot.add("sponge_router_forwarded_total",
+                     "Datagrams sent out of an interface",
+                     StatsSnapshot::Type::Counter,
+                     forwarded(i),
+                     worker_labels);
+        snapshot.add("sponge_router_egress_drops_total",
+                     "Datagrams dropped because an interface's egress ring was full",
+                     StatsSnapshot::Type::Counter,
+                     dropped(i),
+                     worker_labels);
+    }
+}
@@ -0,0 +1,138 @@
+#ifndef SPONGE_LIBSPONGE_PARALLEL_ROUTER_HH
+#define SPONGE_LIBSPONGE_PARALLEL_ROUTER_HH
+
+#include "mpsc_ring.hh"
+#include "route_table.hh"
+#include "router.hh"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <thread>
+#include <vector>
+
+//! \brief A router that forwards with one thread per interface
+class ParallelRouter {
+  public:
+    //! \brief Exchanges frames between an interface and the outside world: called over and over by the
+    //! interface's worker, it should feed received frames to the interface and take the frames it sends
+    using Driver = std::function<void(const size_t interface_num, AsyncNetworkInterface &interface)>;
+
+    //! Capacity of each interface's egress ring, in datagrams
+    static constexpr size_t EGRESS_CAPACITY = 4096;
+
+  private:
+    //! A routed datagram on its way to the egress interface
+    struct Forwarded {
+        InternetDatagram datagram{};
+        uint32_t next_hop{};
+    };
+
+    //! Datagrams that a worker takes from its interface's queue and routes together
+    static constexpr size_t BURST_SIZE = 32;
+
+    //! \brief An interface and the thread that owns it
+    struct Worker {
+        AsyncNetworkInterface interface;          //!< Only the worker's thread touches it once started
+        MPSCRing<Forwarded> egress;               //!< Datagrams that the workers route to this interface
+        RouteTable::Reader route_reader;          //!< The worker's registration with the route table
+        std::atomic<uint64_t> forwarded{0};       //!< Datagrams sent out of this interface
+        std::atomic<uint64_t> dropped{0};         //!< Datagrams dropped because `egress` was full
+        RouterStats stats{};                      //!< Counters of the datagrams this worker routed
+        std::vector<InternetDatagram> burst{};    //!< The datagrams being routed
+        std::vector<uint32_t> destinations{};     //!< Destination address of each datagram in the burst
+        std::vector<uint32_t> routes{};           //!< Action index of each datagram's route
+        Forwarded popped{};                       //!< The last datagram taken from `egress`
+        std::thread thread{};                     //!< Runs the worker
+
+        Worker(AsyncNetworkInterface &&iface, RouteTable &table);
+    };
+
+    //! The routes, which a control thread may update through route_table() while the workers run
+    RouteTable _route_table{};
+
+    //! One worker per interface
+    std::vector<std::unique_ptr<Worker>> _workers{};
+
+    //! Tells the workers to return
+    std::atomic<bool> _stopping{false};
+
+    //! \brief Route a burst of the datagrams that the worker's interface received, into the egress rings
+    //! \returns `false` if there were none
+    bool route_burst(Worker &worker);
+
+    //! \brief Send the datagrams in the worker's egress ring out of its interface
+    //! \returns `false` if there were none
+    bool send_egress(Worker &worker);
+
+    //! The loop of a worker's thread
+    void work(const size_t interface_num, const Driver &driver);
+
+    //! Whether the workers run
+    bool running() const { return _workers.size() > 0 and _workers.front()->thread.joinable(); }
+
+  public:
+    //! Construct a router with no interfaces
+    ParallelRouter() = default;
+
+    //! Stops the workers
+    ~ParallelRouter();
+
+    //! \name
+    //! Not copyable: the workers' threads refer to the router
+    //!@{
+    ParallelRouter(const ParallelRouter &other) = delete;
+    ParallelRouter &operator=(const ParallelRouter &other) = delete;
+    //!@}
+
+    //! \brief Add an interface to the router (only while the workers are stopped)
+    //! \returns The index of the interface after it has been added to the router
+    size_t add_interface(AsyncNetworkInterface &&interface);
+
+    //! \brief Access an interface by index (only while the workers are stopped: each worker owns its interface)
+    AsyncNetworkInterface &interface(const size_t N) { return _workers.at(N)->interface; }
+
+    //! \brief Add a route (a forwarding rule)
+    //! \details Routes added while the workers are stopped take effect together at start(); while they run,
+    //! each takes effect at once (batch updates through route_table() instead).
+    void add_route(const uint32_t route_prefix,
+                   const uint8_t prefix_length,
+                   const std::optional<Address> next_hop,
+                   const size_t interface_num);
+
+    //! Access the route table, to add, replace and remove routes in batches (see Router::route_table())
+    RouteTable &route_table() { return _route_table; }
+
+    //! Start one worker thread per interface, which calls `driver` and routes until stop()
+    void start(const Driver &driver);
+
+    //! Stop the workers, leaving undelivered datagrams in the egress rings for the next start()
+    void stop();
+
+    //! Number of datagrams sent out of an interface since it was added
+    uint64_t forwarded(const size_t N) const { return _workers.at(N)->forwarded.load(std::memory_order_relaxed); }
+
+    //! Number of datagrams dropped on their way to an interface because its egress ring was full
+    uint64_t dropped(const size_t N) const { return _workers.at(N)->dropped.load(std::memory_order_relaxed); }
+
+    //! \brief Add the workers' routing counters (summed), and each interface's (labelled `interface="<index>"`,
+    //! with its forwarded and dropped counts), to a snapshot
+    //! \note Safe to call from any thread while the workers run
+    void collect_stats(StatsSnapshot &snapshot, const std::string &labels = "") const;
+};
+
+//! \class ParallelRouter
+//! Each interface has a worker thread that owns it: the thread runs the interface's Driver, routes the
+//! datagrams that the interface receives, and is the only one to send datagrams out of it, so each
+//! NetworkInterface's ARP state is only ever touched by one thread. A worker routes a burst of received
+//! datagrams with one RouteTable read section (as Router::route does), then pushes each datagram into the
+//! egress interface's MPSCRing, where that interface's worker picks it up. Nothing is shared between workers
+//! but the rings and the route table, and neither takes a lock, so the forwarding rate grows with the number
+//! of cores until the interfaces outnumber them.
+//!
+//! A full egress ring drops the datagram, like an output queue on a real router.
+
+#endif  // SPONGE_LIBSPONGE_PARALLEL_ROUTER_HH
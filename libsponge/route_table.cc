@@ -0,0 +1,168 @@
+#include "route_table.hh"
+
+#include <algorithm>
+#include <stdexcept>
+#include <thread>
+
+using namespace std;
+
+//! \param[in] table is the table that the reader reads
+RouteTable::Reader::Reader(RouteTable &table) : _table(table) {
+    lock_guard<mutex> lock(_table._readers_mutex);
+    _table._readers.push_back(this);
+}
+
+RouteTable::Reader::~Reader() {
+    lock_guard<mutex> lock(_table._readers_mutex);
+    auto &readers = _table._readers;
+    readers.erase(find(readers.begin(), readers.end(), this));
+}
+
+//! \details The epoch is stored before the snapshot pointer is loaded: a reader that gets the old snapshot
+//! therefore read an epoch from before the grace period began, and the writer waits for it.
+const RouteTable::Snapshot &RouteTable::Reader::lock() {
+    _epoch.store(_table._epoch.load());
+    return *_table._current.load();
+}
+
+RouteTable::RouteTable() {
+    for (auto &snapshot : _snapshots) {
+        snapshot = make_unique<Snapshot>();
+    }
+    _current = _snapshots[0].get();
+}
+
+//! \param[in] action is the action
+uint32_t RouteTable::action_index(const Action &action) {
+    const auto [it, inserted] =
+        _action_indices.emplace(make_pair(action.next_hop, action.interface_num), _actions.size());
+    if (inserted) {
+        if (_actions.size() > LPMTable::MAX_VALUE) {
+            _action_indices.erase(it);
+            throw runtime_error("RouteTable: too many distinct actions");
+        }
+        _actions.push_back(action);
+    }
+    return it->second;
+}
+
+//! \param[in] prefix is the prefix, with the bits after `prefix_length` cleared
+//! \param[in] prefix_length is the number of significant bits in `prefix`
+//! \returns the action index and prefix length of the route, or nothing if no route covers the prefix
+optional<pair<uint32_t, uint8_t>> RouteTable::covering_route(const uint32_t prefix,
+                                                             const uint8_t prefix_length) const {
+    for (int length = prefix_length - 1; length >= 0; length--) {
+        const uint32_t mask = length == 0 ? 0 : 0xffffffff << (32 - length);
+        const auto it = _routes.find(make_pair(uint8_t(length), prefix & mask));
+        if (it != _routes.end()) {
+            return make_pair(it->second, uint8_t(length));
+        }
+    }
+    return nullopt;
+}
+
+//! \param[in] prefix is the prefix; bits after `prefix_length` are ignored
+//! \param[in] prefix_length is the number of significant bits in `prefix` (0 to 32)
+//! \param[in] next_hop is the IPv4 address of the next hop, or empty if the network is directly attached
+//! \param[in] interface_num is the index of the interface to send the datagrams out of
+bool RouteTable::add(const uint32_t prefix,
+                     const uint8_t prefix_length,
+                     const optional<uint32_t> next_hop,
+                     const size_t interface_num) {
+    if (prefix_length > 32) {
+        throw runtime_error("RouteTable: prefix length " + to_string(prefix_length) + " is more than 32");
+    }
+    const uint32_t masked = prefix_length == 0 ? 0 : prefix & (0xffffffff << (32 - prefix_length));
+    const auto key = make_pair(prefix_length, masked);
+    if (_routes.count(key) > 0) {
+        return false;  // before action_index(), so that a rejected route does not use up an action
+    }
+    const uint32_t value = action_index({next_hop, interface_num});
+    _routes.emplace(key, value);
+    _pending.push_back({Operation::Add, masked, prefix_length, value, Snapshot::NO_ROUTE, 0});
+    return true;
+}
+
+//! \param[in] prefix is the prefix; bits after `prefix_length` are ignored
+//! \param[in] prefix_length is the number of significant bits in `prefix` (0 to 32)
+//! \param[in] next_hop is the IPv4 address of the new next hop, or empty if the network is directly attached
+//! \param[in] interface_num is the index of the new interface
+bool RouteTable::replace(const uint32_t prefix,
+                         const uint8_t prefix_length,
+                         const optional<uint32_t> next_hop,
+                         const size_t interface_num) {
+    const uint32_t masked = prefix_length == 0 ? 0 : prefix & (0xffffffff << (32 - prefix_length));
+    const auto it = _routes.find(make_pair(prefix_length, masked));
+    if (it == _routes.end()) {
+        return false;
+    }
+    it->second = action_index({next_hop, interface_num});
+    _pending.push_back({Operation::Replace, masked, prefix_length, it->second, Snapshot::NO_ROUTE, 0});
+    return true;
+}
+
+//! \param[in] prefix is the prefix; bits after `prefix_length` are ignored
+//! \param[in] prefix_length is the number of significant bits in `prefix` (0 to 32)
+bool RouteTable::remove(const uint32_t prefix, const uint8_t prefix_length) {
+    const uint32_t masked = prefix_length == 0 ? 0 : prefix & (0xffffffff << (32 - prefix_length));
+    const auto it = _routes.find(make_pair(prefix_length, masked));
+    if (it == _routes.end()) {
+        return false;
+    }
+    _routes.erase(it);
+
+    const auto covering = covering_route(masked, prefix_length);
+    if (covering.has_value()) {
+        _pending.push_back({Operation::Remove, masked, prefix_length, 0, covering->first, covering->second});
+    } else {
+        _pending.push_back({Operation::Remove, masked, prefix_length, 0, Snapshot::NO_ROUTE, 0});
+    }
+    return true;
+}
+
+//! \param[in] snapshot is the snapshot, which must be the one that readers do not see
+void RouteTable::apply_pending(Snapshot &snapshot) const {
+    snapshot._actions = _actions;  // actions are only ever added, so this is a superset of what it had
+    for (const auto &update : _pending) {
+        switch (update.operation) {
+            case Operation::Add:
+                snapshot._prefixes.add(update.prefix, update.prefix_length, update.value);
+                break;
+            case Operation::Replace:
+                snapshot._prefixes.replace(update.prefix, update.prefix_length, update.value);
+                break;
+            case Operation::Remove:
+                snapshot._prefixes.remove(
+                    update.prefix, update.prefix_length, update.covering_value, update.covering_length);
+                break;
+        }
+    }
+}
+
+//! \details The caller must have published the new snapshot before calling: a reader that is idle, or
+//! whose read section began at the new epoch or later, loaded the snapshot pointer after it changed.
+void RouteTable::wait_for_readers() {
+    const uint64_t epoch = _epoch.fetch_add(1) + 1;
+
+    lock_guard<mutex> lock(_readers_mutex);
+    for (const Reader *reader : _readers) {
+        for (uint64_t reader_epoch = reader->_epoch.load(); reader_epoch != IDLE and reader_epoch < epoch;
+             reader_epoch = reader->_epoch.load()) {
+            this_thread::yield();
+        }
+    }
+}
+
+void RouteTable::commit() {
+    if (_pending.empty()) {
+        return;
+    }
+
+    const size_t spare = _current.load() == _snapshots[0].get() ? 1 : 0;
+    apply_pending(*_snapshots[spare]);
+    _current.store(_snapshots[spare].get());
+
+    wait_for_readers();
+    apply_pending(*_snapshots[1 - spare]);
+    _pending.clear();
+}
@@ -0,0 +1,187 @@
+#ifndef SPONGE_LIBSPONGE_ROUTE_TABLE_HH
+#define SPONGE_LIBSPONGE_ROUTE_TABLE_HH
+
+#include "lpm_table.hh"
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <utility>
+#include <vector>
+
+//! \brief A routing table that one control thread updates while any number of forwarding threads look
+//! routes up, without locks
+class RouteTable {
+  public:
+    //! Where a route sends a datagram
+    struct Action {
+        std::optional<uint32_t> next_hop{};  //!< IPv4 address of the next hop (empty for an attached network)
+        size_t interface_num{};              //!< Index of the interface to send the datagram out of
+    };
+
+    //! \brief One version of the table, which does not change while a Reader has it locked
+    class Snapshot {
+        friend class RouteTable;
+
+        LPMTable _prefixes{};            //!< Longest-prefix-match table from the routes to indices in `_actions`
+        std::vector<Action> _actions{};  //!< Actions of the routes
+
+      public:
+        //! lookup() result for an address that no route matches
+        static constexpr uint32_t NO_ROUTE = LPMTable::NO_MATCH;
+
+        //! The index of the action of the longest route that matches `address`, or NO_ROUTE
+        uint32_t lookup(const uint32_t address) const { return _prefixes.lookup(address); }
+
+        //! Look up `count` addresses at once (see LPMTable::lookup_batch)
+        void lookup_batch(const uint32_t *addresses, uint32_t *results, const size_t count) const {
+            _prefixes.lookup_batch(addresses, results, count);
+        }
+
+        //! The action at an index that lookup() returned
+        const Action &action(const uint32_t index) const { return _actions[index]; }
+    };
+
+    //! \brief A forwarding thread's handle on the table, registered for as long as it exists
+    class Reader {
+        RouteTable &_table;
+
+        //! The table's epoch when the current read section began, or IDLE outside of read sections
+        alignas(64) std::atomic<uint64_t> _epoch{IDLE};
+
+        friend class RouteTable;
+
+      public:
+        //! Register a reader of `table`
+        explicit Reader(RouteTable &table);
+
+        //! Unregister the reader
+        ~Reader();
+
+        //! \name
+        //! Not copyable: the table keeps the reader's address
+        //!@{
+        Reader(const Reader &other) = delete;
+        Reader &operator=(const Reader &other) = delete;
+        //!@}
+
+        //! \brief Begin a read section (they do not nest)
+        //! \returns the current snapshot, which stays valid and unchanged until unlock()
+        const Snapshot &lock();
+
+        //! End the read section
+        void unlock() { _epoch.store(IDLE); }
+    };
+
+  private:
+    static constexpr uint64_t IDLE = 0;  //!< Reader epoch outside of read sections
+
+    //! The kinds of staged update
+    enum class Operation { Add, Replace, Remove };
+
+    //! A staged update, resolved to a change of an LPMTable
+    struct Update {
+        Operation operation;
+        uint32_t prefix;
+        uint8_t prefix_length;
+        uint32_t value;           //!< Action index of an added or replaced route
+        uint32_t covering_value;  //!< Action index of the route that covers a removed one (or NO_ROUTE)
+        uint8_t covering_length;  //!< Prefix length of that route
+    };
+
+    //! \name Control side: only the thread that updates the table touches these
+    //!@{
+
+    //! The routes, from (prefix length, prefix) to the index of the route's action
+    std::map<std::pair<uint8_t, uint32_t>, uint32_t> _routes{};
+
+    //! Every action that a route has used; each is stored once, so routes share indices
+    std::vector<Action> _actions{};
+
+    //! The index of each action in `_actions`
+    std::map<std::pair<std::optional<uint32_t>, size_t>, uint32_t> _action_indices{};
+
+    //! Updates since the last commit()
+    std::vector<Update> _pending{};
+
+    //! The two snapshots: the current one, and the one that commit() updates next
+    std::array<std::unique_ptr<Snapshot>, 2> _snapshots{};
+
+    //!@}
+
+    //! The snapshot that readers see
+    std::atomic<const Snapshot *> _current{nullptr};
+
+    //! Incremented by each grace period
+    std::atomic<uint64_t> _epoch{IDLE + 1};
+
+    std::mutex _readers_mutex{};       //!< Protects `_readers`
+    std::vector<Reader *> _readers{};  //!< The registered readers
+
+    //! Index of an action in `_actions`, adding it if it is new
+    uint32_t action_index(const Action &action);
+
+    //! The longest route that is shorter than a prefix and covers it
+    std::optional<std::pair<uint32_t, uint8_t>> covering_route(const uint32_t prefix,
+                                                               const uint8_t prefix_length) const;
+
+    //! Apply `_pending` to a snapshot that no reader can see
+    void apply_pending(Snapshot &snapshot) const;
+
+    //! Wait until no reader is still in a read section that began before the call
+    void wait_for_readers();
+
+  public:
+    //! Construct an empty table
+    RouteTable();
+
+    //! \brief Stage a new route
+    //! \returns `false` (and stages nothing) if the table already has a route with this prefix
+    bool add(const uint32_t prefix,
+             const uint8_t prefix_length,
+             const std::optional<uint32_t> next_hop,
+             const size_t interface_num);
+
+    //! \brief Stage a new next hop and interface for a route
+    //! \returns `false` (and stages nothing) if the table has no route with this prefix
+    bool replace(const uint32_t prefix,
+                 const uint8_t prefix_length,
+                 const std::optional<uint32_t> next_hop,
+                 const size_t interface_num);
+
+    //! \brief Stage the removal of a route
+    //! \returns `false` (and stages nothing) if the table has no route with this prefix
+    bool remove(const uint32_t prefix, const uint8_t prefix_length);
+
+    //! \brief Make the staged updates visible to readers, all at once
+    //! \details Waits for the read sections that began before the call, but never blocks a reader.
+    void commit();
+
+    //! Number of routes, counting the staged updates
+    size_t size() const { return _routes.size(); }
+};
+
+//! \class RouteTable
+//! Updates follow read-copy-update (RCU): readers never wait, and a writer never changes anything that a
+//! reader can see. A control thread stages updates with add(), replace() and remove(), and publishes them
+//! with commit(). A forwarding thread registers a Reader once, then brackets each burst of lookups with
+//! Reader::lock() and Reader::unlock(), which only store the table's epoch in the reader's own cache line and
+//! load the current snapshot pointer.
+//!
+//! A full table is tens of MiB, too much to copy for every update, so instead of a fresh copy per commit the
+//! table keeps two snapshots. commit() applies the staged updates to the spare snapshot, publishes it with an
+//! atomic pointer swap, then waits for a grace period: once every reader that might still hold the old
+//! snapshot has left its read section, no reader can reach it any more, and commit() applies the same updates
+//! to it, making it the next spare. Batching many updates into one commit() (as a BGP session's UPDATE
+//! messages arrive) pays for one grace period per batch.
+//!
+//! The grace period is epoch-based: commit() increments the table's epoch after the swap, and waits for each
+//! registered reader to be idle or in a read section that began at the new epoch or later. Only commit(), and
+//! registering and unregistering a Reader, take the mutex.
+
+#endif  // SPONGE_LIBSPONGE_ROUTE_TABLE_HH
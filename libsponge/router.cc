@@ -1,7 +1,9 @@
 #include "router.hh"
 
+#include "latency_histogram.hh"
+#include "logger.hh"
+
 #include <cassert>
-#include <iostream>
 
 using namespace std;
 
@@ -24,45 +26,116 @@ void Router::add_route(const uint32_t route_prefix,
                        const uint8_t prefix_length,
                        const optional<Address> next_hop,
                        const size_t interface_num) {
-    cerr << "DEBUG: adding route " << Address::from_ipv4_numeric(route_prefix).ip() << "/" << int(prefix_length)
-         << " => " << (next_hop.has_value() ? next_hop->ip() : "(direct)") << " on interface " << interface_num << "\n";
+    LOG_DEBUG("adding route " << Address::from_ipv4_numeric(route_prefix).ip() << "/" << int(prefix_length) << " => "
+                              << (next_hop.has_value() ? next_hop->ip() : "(direct)") << " on interface "
+                              << interface_num);
 
-    RouteDef route = make_pair(route_prefix, prefix_length);
-    auto it = _route_table.find(route);
-    if (it != _route_table.end()) {
-        cerr << "DEBUG: route already existed\n";
+    optional<uint32_t> next_hop_ip{};
+    if (next_hop.has_value()) {
+        next_hop_ip = next_hop->ipv4_numeric();
+    }
+    if (not _route_table.add(route_prefix, prefix_length, next_hop_ip, interface_num)) {
+        LOG_DEBUG("route already existed");
         return;
     }
-    _route_table[route] = make_pair(next_hop, interface_num);
+    _routes_staged = true;
 }
 
-//! \param[in] dgram The datagram to be routed
-void Router::route_one_datagram(InternetDatagram &dgram) {
-    if (dgram.header().ttl <= 1)
-        return;
-    uint32_t addr = dgram.header().dst;
-    uint32_t prefix_mask = UINT32_MAX;
-    for (int prefix_length = 32; prefix_length >= 0; prefix_length--) {
-        uint32_t addr_prefix = addr & prefix_mask;
-        prefix_mask <<= 1;
-        auto route = _route_table.find(make_pair(addr_prefix, prefix_length));
-        if (route == _route_table.end())
+//! \details The burst is routed in three passes, like a VPP or DPDK packet vector: first all the
+//! destinations are gathered, then they are looked up together (see LPMTable::lookup_batch), and then
+//! the datagrams are sent interface by interface, each interface's in their original order. Only the lookups
+//! hold the route table's snapshot (see RouteTable::Reader), so sending never delays a route update.
+void Router::route_burst() {
+    SPONGE_LATENCY_SCOPE(RouteBurst);
+    const size_t count = _burst.size();
+    _burst_destinations.resize(count);
+    _burst_routes.resize(count);
+    _burst_next_hops.resize(count);
+    for (size_t i = 0; i < count; i++) {
+        _burst_destinations[i] = _burst[i].header().dst;
+    }
+
+    _egress.resize(_interfaces.size());
+    const RouteTable::Snapshot &routes = _route_reader.lock();
+    routes.lookup_batch(_burst_destinations.data(), _burst_routes.data(), count);
+    for (size_t i = 0; i < count; i++) {
+        if (_burst[i].header().ttl <= 1) {
+            _stats.ttl_drops.add();
             continue;
-        auto [next_hop_opt, interface_num] = route->second;
-        dgram.header().ttl--;
-        auto next_hop = next_hop_opt.value_or(Address::from_ipv4_numeric(dgram.header().dst));
-        _interfaces[interface_num].send_datagram(dgram, next_hop);
-        return;
+        }
+        if (_burst_routes[i] == RouteTable::Snapshot::NO_ROUTE) {
+            _stats.no_route_drops.add();
+            continue;
+        }
+        const RouteTable::Action &action = routes.action(_burst_routes[i]);
+        if (action.interface_num >= _interfaces.size()) {
+            _stats.no_route_drops.add();  // a route to an interface that was never added
+            continue;
+        }
+        _burst_next_hops[i] = action.next_hop.value_or(_burst_destinations[i]);
+        _egress[action.interface_num].push_back(i);
+        _stats.datagrams_routed.add();
     }
+    _route_reader.unlock();
+
+    for (size_t interface_num = 0; interface_num < _egress.size(); interface_num++) {
+        for (const size_t i : _egress[interface_num]) {
+            _burst[i].decrement_ttl();
+            _interfaces[interface_num].send_datagram(_burst[i], Address::from_ipv4_numeric(_burst_next_hops[i]));
+        }
+        _egress[interface_num].clear();
+    }
+    _burst.clear();
 }
 
 void Router::route() {
-    // Go through all the interfaces, and route every incoming datagram to its proper outgoing interface.
+    // Publish the routes that add_route() staged, paying for one grace period however many there were.
+    if (_routes_staged) {
+        _route_table.commit();
+        _routes_staged = false;
+    }
+
+    // Go through all the interfaces, and route every incoming datagram to its proper outgoing interface,
+    // a burst at a time.
     for (auto &interface : _interfaces) {
         auto &queue = interface.datagrams_out();
         while (not queue.empty()) {
-            route_one_datagram(queue.front());
-            queue.pop();
+            while (not queue.empty() and _burst.size() < BURST_SIZE) {
+                _burst.push_back(std::move(queue.front()));
+                queue.pop();
+            }
+            route_burst();
         }
     }
 }
+
+//! \param[in] snapshot is the snapshot to add to
+//! \param[in] labels are the labels to add the counters under
+void RouterStats::collect(StatsSnapshot &snapshot, const string &labels) const {
+    using Type = StatsSnapshot::Type;
+    snapshot.add("sponge_router_datagrams_routed_total",
+                 "Datagrams routed to an interface",
+                 Type::Counter,
+                 datagrams_routed.value(),
+                 labels);
+    snapshot.add("sponge_router_ttl_drops_total",
+                 "Datagrams dropped because their TTL ran out",
+                 Type::Counter,
+                 ttl_drops.value(),
+                 labels);
+    snapshot.add("sponge_router_no_route_drops_total",
+                 "Datagrams dropped because no route matched",
+                 Type::Counter,
+                 no_route_drops.value(),
+                 labels);
+}
+
+//! \param[in] snapshot is the snapshot to add to
+//! \param[in] labels are the labels to add the counters under
+void Router::collect_stats(StatsSnapshot &snapshot, const string &labels) const {
+    _stats.collect(snapshot, labels);
+    for (size_t i = 0; i < _interfaces.size(); i++) {
+        const string interface_label = StatsSnapshot::label("interface", to_string(i));
+        _interfaces[i].stats().collect(snapshot, labels.empty() ? interface_label : labels + "," + interface_label);
+    }
+}
@@ -2,10 +2,12 @@
 #define SPONGE_LIBSPONGE_ROUTER_HH
 
 #include "network_interface.hh"
+#include "route_table.hh"
 
 #include <optional>
 #include <queue>
-#include <map>
+#include <string>
+#include <vector>
 
 //! \brief A wrapper for NetworkInterface that makes the host-side
 //! interface asynchronous: instead of returning received datagrams
@@ -39,22 +41,46 @@ class AsyncNetworkInterface : public NetworkInterface {
     std::queue<InternetDatagram> &datagrams_out() { return _datagrams_out; }
 };
 
+//! \brief Counters of a router's forwarding
+struct alignas(STATS_CACHE_LINE) RouterStats {
+    StatCounter datagrams_routed{};  //!< Datagrams routed to an interface
+    StatCounter ttl_drops{};         //!< Datagrams dropped because their TTL ran out
+    StatCounter no_route_drops{};    //!< Datagrams dropped because no route matched their destination
+
+    //! Add the counters to a snapshot
+    void collect(StatsSnapshot &snapshot, const std::string &labels) const;
+};
+
 //! \brief A router that has multiple network interfaces and
 //! performs longest-prefix-match routing between them.
 class Router {
     //! The router's collection of network interfaces
     std::vector<AsyncNetworkInterface> _interfaces{};
 
+    //! The routes, which a control thread may update through route_table() while route() runs
+    RouteTable _route_table{};
+
+    //! route()'s registration as a reader of `_route_table`
+    RouteTable::Reader _route_reader{_route_table};
+
+    //! Whether add_route() has staged routes that route() has not committed yet
+    bool _routes_staged{false};
 
-    typedef std::pair<uint32_t, uint8_t> RouteDef;
-    typedef std::pair<std::optional<Address>, size_t> ActionDef;
+    //! Datagrams that route() takes from an interface's queue and routes together
+    static constexpr size_t BURST_SIZE = 32;
 
-    std::map<RouteDef, ActionDef> _route_table{};
+    std::vector<InternetDatagram> _burst{};        //!< The datagrams being routed
+    std::vector<uint32_t> _burst_destinations{};   //!< Destination address of each datagram in the burst
+    std::vector<uint32_t> _burst_routes{};         //!< Action index of each datagram's route
+    std::vector<uint32_t> _burst_next_hops{};      //!< Next hop of each datagram
+    std::vector<std::vector<size_t>> _egress{};    //!< Datagrams of the burst to send out each interface
 
-    //! Send a single datagram from the appropriate outbound interface to the next hop,
+    RouterStats _stats{};
+
+    //! Send each datagram in `_burst` from the appropriate outbound interface to the next hop,
     //! as specified by the route with the longest prefix_length that matches the
     //! datagram's destination address.
-    void route_one_datagram(InternetDatagram &dgram);
+    void route_burst();
 
   public:
     //! Add an interface to the router
@@ -68,14 +94,27 @@ class Router {
     //! Access an interface by index
     AsyncNetworkInterface &interface(const size_t N) { return _interfaces.at(N); }
 
-    //! Add a route (a forwarding rule)
+    //! \brief Add a route (a forwarding rule)
+    //! \details The route takes effect at the next route(), which commits all the routes added since the last
+    //! one together.
     void add_route(const uint32_t route_prefix,
                    const uint8_t prefix_length,
                    const std::optional<Address> next_hop,
                    const size_t interface_num);
 
+    //! \brief Access the route table, to add, replace and remove routes in batches
+    //! \details Updates take effect at RouteTable::commit(). They may come from another thread than route()'s,
+    //! as long as all of them come from the same one, and add_route() is not used.
+    RouteTable &route_table() { return _route_table; }
+
     //! Route packets between the interfaces
     void route();
+
+    //! Counters of datagrams routed and dropped (which any thread may read)
+    const RouterStats &stats() const { return _stats; }
+
+    //! \brief Add the router's counters, and each interface's (labelled `interface="<index>"`), to a snapshot
+    void collect_stats(StatsSnapshot &snapshot, const std::string &labels = "") const;
 };
 
 #endif  // SPONGE_LIBSPONGE_ROUTER_HH
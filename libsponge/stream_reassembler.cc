@@ -1,7 +1,10 @@
 #include "stream_reassembler.hh"
 
-#include <cassert>
+#include "latency_histogram.hh"
+
+#include <algorithm>
 #include <iostream>
+#include <iterator>
 
 // Dummy implementation of a stream reassembler.
 
@@ -17,14 +20,20 @@ bool operator<(const Substring &s1, const Substring &s2) {
 }
 
 StreamReassembler::StreamReassembler(const size_t capacity)
-    : _output(capacity), _capacity(capacity), _first_unassembled_index(0), queue(multiset<Substring>()) {}
+    : _output(capacity)
+    , _capacity(capacity)
+    , _first_unassembled_index(0)
+    , queue(multiset<Substring>())
+    , _unassembled_bytes(0)
+    , _eof_index() {}
 
 //! \details This function accepts a substring (aka a segment) of bytes,
 //! possibly out-of-order, from the logical stream, and assembles any newly
 //! contiguous substrings and writes them into the output stream in order.
-void StreamReassembler::push_substring(const string &data, const size_t index, const bool eof) {
+void StreamReassembler::push_substring(const string_view data, const size_t index, const bool eof) {
+    SPONGE_LATENCY_SCOPE(PushSubstring);
     size_t last_index = index + data.size();
-    string _data = data;
+    string_view _data = data;
     bool _eof = eof;
     size_t remaining = _output.remaining_capacity();
     // Silently discard overflow
@@ -35,48 +44,56 @@ void StreamReassembler::push_substring(const string &data, const size_t index, c
     }
     if (index + _data.size() < _first_unassembled_index)
         return;
-    queue.insert(Substring{index, _data, _eof});
-    reassemble();
+    if (_eof)
+        _eof_index = index + _data.size();
+    // In order, with nothing waiting: write the new bytes straight into the stream, without storing them
+    if (index <= _first_unassembled_index and queue.empty()) {
+        const size_t len = index + _data.size() - _first_unassembled_index;
+        _output.write(_data.substr(_first_unassembled_index - index, len));
+        _first_unassembled_index += len;
+    } else {
+        store(_data, index);
+        reassemble();
+    }
+    if (_eof_index.has_value() and _first_unassembled_index >= _eof_index.value())
+        _output.end_input();
 }
 
-void StreamReassembler::reassemble() {
-    while (!queue.empty()) {
-        assert(!_output.input_ended());
-        auto s = *queue.begin();
-        if (s.index <= _first_unassembled_index) {
-            if (s.index + s.data.length() < _first_unassembled_index) {
-                queue.erase(queue.begin());
-            } else {
-                size_t len = s.data.length() - _first_unassembled_index + s.index;
-                auto data = s.data.substr(_first_unassembled_index - s.index, len);
-                _output.write(data);
-                _first_unassembled_index += len;
-                if (s.eof)
-                    _output.end_input();
-                queue.erase(queue.begin());
-            }
-        } else {
-            break;
+//! \details Only the gaps between the substrings already stored are copied, so that the stored substrings never
+//! overlap and `_unassembled_bytes` stays exact without walking the queue.
+void StreamReassembler::store(const string_view data, const size_t index) {
+    size_t begin = max(index, _first_unassembled_index);
+    const size_t end = index + data.size();
+    auto next = queue.upper_bound(Substring{begin, {}});
+    if (next != queue.begin()) {
+        const auto &before = *std::prev(next);
+        begin = max(begin, before.index + before.data.size());
+    }
+    while (begin < end) {
+        const size_t gap_end = next == queue.end() ? end : min(end, next->index);
+        if (begin < gap_end) {
+            queue.emplace_hint(next, Substring{begin, string(data.substr(begin - index, gap_end - begin))});
+            _unassembled_bytes += gap_end - begin;
         }
+        if (next == queue.end())
+            break;
+        begin = max(begin, next->index + next->data.size());
+        ++next;
     }
 }
 
-size_t StreamReassembler::unassembled_bytes() const {
-    size_t last_index = _first_unassembled_index;
-    size_t count = 0;
-    for (const auto &s : queue) {
-        size_t len = s.data.length();
-        if (s.index + len > last_index) {
-            if (s.index > last_index)
-                count += len;
-            else
-                count += s.index + len - last_index;
-            last_index = s.index + len;
-        }
+void StreamReassembler::reassemble() {
+    while (!queue.empty() and queue.begin()->index == _first_unassembled_index) {
+        const string &data = queue.begin()->data;
+        _output.write(data);
+        _first_unassembled_index += data.size();
+        _unassembled_bytes -= data.size();
+        queue.erase(queue.begin());
     }
-    return count;
 }
 
+size_t StreamReassembler::unassembled_bytes() const { return _unassembled_bytes; }
+
 bool StreamReassembler::empty() const { return queue.empty() && _output.buffer_empty(); }
 
 size_t StreamReassembler::first_unassembled_index() const { return _first_unassembled_index; }
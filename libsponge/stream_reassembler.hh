@@ -4,8 +4,10 @@
 #include "byte_stream.hh"
 
 #include <cstdint>
-#include <string>
+#include <optional>
 #include <set>
+#include <string>
+#include <string_view>
 
 //! \brief A class that assembles a series of excerpts from a byte stream (possibly out of order,
 //! possibly overlapping) into an in-order byte stream.
@@ -13,7 +15,6 @@
 struct Substring {
     size_t index;
     std::string data;
-    bool eof;
 };
 
 class StreamReassembler {
@@ -23,7 +24,12 @@ class StreamReassembler {
     ByteStream _output;  //!< The reassembled in-order byte stream
     size_t _capacity;    //!< The maximum number of bytes
     size_t _first_unassembled_index;
-    std::multiset<Substring> queue;
+    std::multiset<Substring> queue;    //!< Stored substrings: disjoint, and all past the assembled bytes
+    size_t _unassembled_bytes;         //!< Bytes in `queue`
+    std::optional<size_t> _eof_index;  //!< Index just past the stream's last byte, once it is known
+
+    //! Store the bytes of `data`, which starts at `index`, that are not stored yet
+    void store(const std::string_view data, const size_t index);
 
     void reassemble();
 
@@ -38,10 +44,10 @@ class StreamReassembler {
     //! The StreamReassembler will stay within the memory limits of the `capacity`.
     //! Bytes that would exceed the capacity are silently discarded.
     //!
-    //! \param data the substring
+    //! \param data the substring (which is copied only if it cannot be assembled at once)
     //! \param index indicates the index (place in sequence) of the first byte in `data`
     //! \param eof the last byte of `data` will be the last byte in the entire stream
-    void push_substring(const std::string &data, const size_t index, const bool eof);
+    void push_substring(const std::string_view data, const size_t index, const bool eof);
 
     //! \name Access the reassembled byte stream
     //!@{
@@ -1,5 +1,8 @@
 #include "tcp_connection.hh"
 
+#include "latency_histogram.hh"
+
+#include <algorithm>
 #include <iostream>
 
 // Dummy implementation of a TCP connection
@@ -18,10 +21,12 @@ size_t TCPConnection::unassembled_bytes() const { return _receiver.unassembled_b
 size_t TCPConnection::time_since_last_segment_received() const { return _time_since_last_segment_received; }
 
 void TCPConnection::segment_received(const TCPSegment &seg) {
+    SPONGE_LATENCY_SCOPE(SegmentReceived);
     auto header = seg.header();
     _time_since_last_segment_received = 0;
     if (header.rst) {
 //        cerr << "received reset connection\n";
+        _stats.resets_received.add();
         _sender.stream_in().set_error();
         _receiver.stream_out().set_error();
         return;
@@ -29,6 +34,9 @@ void TCPConnection::segment_received(const TCPSegment &seg) {
     _receiver.segment_received(seg);
     if (header.ack) {
         _sender.ack_received(header.ackno, header.win);
+        // the ACK may have opened the window
+        if (_sender.next_seqno_absolute())
+            _sender.fill_window();
     }
 //    cerr << "seg received: " << _receiver.stream_out().input_ended() << " " << _sender.is_fin_sent() << "\n";
     if (_receiver.stream_out().input_ended() && !_sender.is_fin_sent()) {
@@ -37,9 +45,11 @@ void TCPConnection::segment_received(const TCPSegment &seg) {
     }
     if (_receiver.ackno().has_value() &&
         (seg.length_in_sequence_space() || header.seqno == _receiver.ackno().value() - 1)) {
-        _sender.send_empty_segment();
-        send_segments();
+        // any segment we are about to send carries the ACK
+        if (_sender.segments_out().empty())
+            _sender.send_empty_segment();
     }
+    send_segments();
 }
 
 bool TCPConnection::active() const {
@@ -80,12 +90,35 @@ void TCPConnection::tick(const size_t ms_since_last_tick) {
     }
 }
 
+optional<size_t> TCPConnection::next_deadline() const {
+    if (!active())
+        return {};
+    auto deadline = _sender.time_until_timeout();
+    // lingering after both streams have finished ends 10 * rt_timeout after the last segment from the peer
+    if (_receiver.stream_out().eof() && !unassembled_bytes() && _sender.stream_in().eof() && !bytes_in_flight() &&
+        _linger_after_streams_finish) {
+        const size_t linger_time = 10 * _cfg.rt_timeout;
+        const size_t linger_left = linger_time - min(linger_time, _time_since_last_segment_received);
+        deadline = min(deadline.value_or(linger_left), linger_left);
+    }
+    return deadline;
+}
+
 void TCPConnection::end_input_stream() {
     _sender.stream_in().end_input();
     _sender.fill_window();
     send_segments();
 }
 
+void TCPConnection::window_update() {
+    const size_t threshold = min(_cfg.max_payload_size, _cfg.recv_capacity / 2);
+    if (!active() || !_receiver.ackno().has_value() || _advertised_window >= threshold ||
+        _receiver.window_size() < threshold)
+        return;
+    _sender.send_empty_segment();
+    send_segments();
+}
+
 void TCPConnection::connect() {
     _sender.fill_window();
     send_segments();
@@ -100,6 +133,7 @@ void TCPConnection::send_segments() {
             if (seg.header().ack)
                 seg.header().ackno = _receiver.ackno().value();
             seg.header().win = _receiver.window_size();
+            _advertised_window = seg.header().win;
         }
         _segments_out.push(seg);
 //        cerr << "sent segment with header:\n"
@@ -112,9 +146,27 @@ void TCPConnection::reset_connection() {
     _sender.stream_in().set_error();
     _receiver.stream_out().set_error();
     _sender.send_empty_segment(true);
+    _stats.resets_sent.add();
     send_segments();
 }
 
+//! \param[in] snapshot is the snapshot to add to
+//! \param[in] labels are the labels to add the counters under
+void TCPConnection::collect_stats(StatsSnapshot &snapshot, const string &labels) const {
+    _sender.stats().collect(snapshot, labels);
+    _receiver.stats().collect(snapshot, labels);
+    snapshot.add("sponge_tcp_resets_sent_total",
+                 "TCP RST segments sent",
+                 StatsSnapshot::Type::Counter,
+                 _stats.resets_sent.value(),
+                 labels);
+    snapshot.add("sponge_tcp_resets_received_total",
+                 "TCP RST segments received",
+                 StatsSnapshot::Type::Counter,
+                 _stats.resets_received.value(),
+                 labels);
+}
+
 TCPConnection::~TCPConnection() {
     try {
 //        cerr << "close connection\n";
@@ -6,6 +6,15 @@
 #include "tcp_sender.hh"
 #include "tcp_state.hh"
 
+#include <optional>
+#include <string>
+
+//! \brief Counters of a TCPConnection, beyond its sender's and receiver's
+struct alignas(STATS_CACHE_LINE) TCPConnectionStats {
+    StatCounter resets_sent{};      //!< RST segments sent
+    StatCounter resets_received{};  //!< RST segments received
+};
+
 //! \brief A complete endpoint of a TCP connection
 class TCPConnection {
   private:
@@ -13,7 +22,7 @@ class TCPConnection {
 
     TCPConfig _cfg;
     TCPReceiver _receiver{_cfg.recv_capacity};
-    TCPSender _sender{_cfg.send_capacity, _cfg.rt_timeout, _cfg.fixed_isn};
+    TCPSender _sender{_cfg.send_capacity, _cfg.rt_timeout, _cfg.fixed_isn, _cfg.max_payload_size};
 
     //! outbound queue of segments that the TCPConnection wants sent
     std::queue<TCPSegment> _segments_out{};
@@ -23,6 +32,11 @@ class TCPConnection {
     //! in case the remote TCPConnection doesn't know we've received its whole stream?
     bool _linger_after_streams_finish{true};
 
+    //! Receive window in the most recent segment sent
+    size_t _advertised_window{0};
+
+    TCPConnectionStats _stats{};
+
     void send_segments();
 
     void reset_connection();
@@ -50,6 +64,11 @@ class TCPConnection {
 
     //! \brief The inbound byte stream received from the peer
     ByteStream &inbound_stream() { return _receiver.stream_out(); }
+
+    //! \brief Tell the peer if reading from inbound_stream() has reopened a window that was too small for a segment
+    //! \details Without this, a peer that filled the window only finds out that it has reopened
+    //! by probing it (see RFC 1122, section 4.2.3.3).
+    void window_update();
     //!@}
 
     //! \name Accessors used for testing
@@ -74,12 +93,21 @@ class TCPConnection {
     //! Called periodically when time elapses
     void tick(const size_t ms_since_last_tick);
 
+    //! \brief Milliseconds until the next call to tick() could make a difference (empty if no timer is running)
+    //! \details Counts the retransmission timer and the linger timer. The owner may wait this long for new
+    //! segments or bytes before calling tick(), instead of calling it at a fixed interval.
+    std::optional<size_t> next_deadline() const;
+
     //! \brief TCPSegments that the TCPConnection has enqueued for transmission.
     //! \note The owner or operating system will dequeue these and
     //! put each one into the payload of a lower-layer datagram (usually Internet datagrams (IP),
     //! but could also be user datagrams (UDP) or any other kind).
     std::queue<TCPSegment> &segments_out() { return _segments_out; }
 
+    //! \brief Add the connection's counters (and its sender's and receiver's) to a snapshot
+    //! \note Safe to call from any thread while the connection lives
+    void collect_stats(StatsSnapshot &snapshot, const std::string &labels = "") const;
+
     //! \brief Is the connection still alive in any way?
     //! \returns `true` if either stream is still running or if the TCPConnection is lingering
     //! after both streams have finished (e.g. to ACK retransmissions from the peer)
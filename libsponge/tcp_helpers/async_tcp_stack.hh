@@ -0,0 +1,445 @@
+#ifndef SPONGE_LIBSPONGE_ASYNC_TCP_STACK_HH
+#define SPONGE_LIBSPONGE_ASYNC_TCP_STACK_HH
+
+#include "tcp_stack.hh"
+
+#if !defined(__cpp_impl_coroutine)
+#error "async_tcp_stack.hh needs C++20 coroutines: build the target with add_sponge_coroutine_exec"
+#endif
+
+#include <algorithm>
+#include <coroutine>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <limits>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+//! \brief A TCPStack whose connections are served by coroutines, scheduled on the thread that calls run()
+template <typename AdaptT>
+class AsyncTCPStack {
+  public:
+    class Task;
+    class Stream;
+    class ReadOp;
+    class WriteOp;
+    class AcceptOp;
+    class ConnectOp;
+
+  private:
+    //! \brief An operation that a coroutine is suspended on
+    class PendingOp {
+      public:
+        std::coroutine_handle<> handle{};  //!< The suspended coroutine
+
+        //! Make what progress is possible; returns `true` once the coroutine can be resumed
+        virtual bool poll() = 0;
+
+        PendingOp() = default;
+        PendingOp(const PendingOp &other) = delete;
+        PendingOp &operator=(const PendingOp &other) = delete;
+        virtual ~PendingOp() = default;
+    };
+
+    TCPStack<AdaptT> _stack;  //!< The connections
+
+    //! Operations waiting for an event on a connection
+    std::unordered_map<FourTuple, std::vector<PendingOp *>, FourTupleHash> _waiting_streams{};
+
+    //! accept() operations waiting for a connection to a port, oldest first
+    std::unordered_map<uint16_t, std::deque<PendingOp *>> _waiting_accepts{};
+
+    std::deque<std::coroutine_handle<>> _runnable{};  //!< Coroutines to resume before waiting again
+    size_t _live_tasks{0};                            //!< Spawned coroutines that have not finished
+    std::exception_ptr _error{};                      //!< First exception that escaped a coroutine
+
+    //! Suspend `op` until the connection `tuple` has an event that lets it complete
+    void wait_on(const FourTuple &tuple, PendingOp &op) { _waiting_streams[tuple].push_back(&op); }
+
+    //! Queue the coroutines whose operations on `tuple` can now complete
+    void wake_stream(const FourTuple &tuple);
+
+    //! Queue the coroutines whose accept() operations can now complete
+    void wake_accepts();
+
+    //! Resume the queued coroutines; rethrows the first exception that escaped one
+    void resume_runnable();
+
+  public:
+    //! \brief Construct from the adapter that all connections will share (see TCPStack::TCPStack)
+    AsyncTCPStack(AdaptT &&adapter, const TCPConfig &tcp_config, const FdAdapterConfig &adapter_config)
+        : _stack(std::move(adapter), tcp_config, adapter_config) {}
+
+    //! Accept connections to `port` (see TCPStack::listen)
+    void listen(const uint16_t port, const size_t backlog = TCPStack<AdaptT>::DEFAULT_BACKLOG) {
+        _stack.listen(port, backlog);
+    }
+
+    //! `co_await` yields the oldest established connection to `port`, suspending until there is one
+    AcceptOp accept(const uint16_t port) { return AcceptOp(*this, port); }
+
+    //! `co_await` yields a connection to `destination`, suspending until the handshake has finished or failed
+    ConnectOp connect(const Address &destination) { return ConnectOp(*this, destination); }
+
+    //! Start a coroutine the next time run() resumes coroutines
+    void spawn(Task &&task);
+
+    //! \brief Resume coroutines as the events they wait for arrive, until every spawned coroutine has finished
+    //! \details If an exception escapes a coroutine, run() rethrows it (and may be called again). Connections
+    //! that are still closing when run() returns need further calls to TCPStack::wait_next_event.
+    void run();
+
+    //! Access the underlying TCPStack (e.g., for its counters)
+    TCPStack<AdaptT> &stack() { return _stack; }
+
+    //! Destroys the coroutines that have not finished (closing their Streams)
+    ~AsyncTCPStack();
+
+    //! \name
+    //! Coroutines hold pointers to the stack, so it can be neither copied nor moved
+    //!@{
+    AsyncTCPStack(const AsyncTCPStack &other) = delete;
+    AsyncTCPStack &operator=(const AsyncTCPStack &other) = delete;
+    //!@}
+};
+
+//! \brief The return type of a coroutine that AsyncTCPStack::spawn can run
+//! \details The coroutine does not start until it is spawned, and its frame is freed when it finishes.
+template <typename AdaptT>
+class AsyncTCPStack<AdaptT>::Task {
+  public:
+    //! \brief The coroutine's promise: reports to the AsyncTCPStack that spawned it
+    class promise_type {
+      public:
+        AsyncTCPStack *owner{nullptr};  //!< Set by AsyncTCPStack::spawn
+
+        Task get_return_object() { return Task(std::coroutine_handle<promise_type>::from_promise(*this)); }
+        std::suspend_always initial_suspend() noexcept { return {}; }
+        std::suspend_never final_suspend() noexcept { return {}; }
+        void return_void() {}
+
+        void unhandled_exception() {
+            if (not owner->_error) {
+                owner->_error = std::current_exception();
+            }
+        }
+
+        promise_type() = default;
+        promise_type(const promise_type &other) = delete;
+        promise_type &operator=(const promise_type &other) = delete;
+
+        ~promise_type() {
+            if (owner) {
+                owner->_live_tasks--;
+            }
+        }
+    };
+
+  private:
+    std::coroutine_handle<promise_type> _handle;  //!< The coroutine, until it is spawned
+
+    friend class AsyncTCPStack;
+
+    explicit Task(const std::coroutine_handle<promise_type> handle) : _handle(handle) {}
+
+  public:
+    //! \name
+    //! A Task can be moved, but not copied
+    //!@{
+    Task(Task &&other) noexcept : _handle(std::exchange(other._handle, nullptr)) {}
+    Task &operator=(Task &&other) = delete;
+    Task(const Task &other) = delete;
+    Task &operator=(const Task &other) = delete;
+    //!@}
+
+    //! Destroys the coroutine if it was never spawned
+    ~Task() {
+        if (_handle) {
+            _handle.destroy();
+        }
+    }
+};
+
+//! \brief A coroutine's handle on one connection of an AsyncTCPStack
+//! \details Like TCPStack::Stream, but reads and writes are awaited. One read and one write may be pending
+//! at a time (e.g., from two coroutines), and a Stream must not be moved while either is.
+template <typename AdaptT>
+class AsyncTCPStack<AdaptT>::Stream {
+  private:
+    AsyncTCPStack *_owner;                    //!< The stack that runs the connection
+    typename TCPStack<AdaptT>::Stream _stream;  //!< The connection
+
+    friend class AsyncTCPStack;
+    friend class ReadOp;
+    friend class WriteOp;
+    friend class ConnectOp;
+
+    Stream(AsyncTCPStack &owner, typename TCPStack<AdaptT>::Stream &&stream)
+        : _owner(&owner), _stream(std::move(stream)) {}
+
+  public:
+    //! `co_await` yields up to `limit` bytes, suspending until there are some; yields an empty string at EOF
+    //! or once the connection has died
+    ReadOp read(const size_t limit = std::numeric_limits<size_t>::max()) { return ReadOp(*this, limit); }
+
+    //! `co_await` writes all of `data`, suspending while the outbound stream is full; yields the number of
+    //! bytes written (less than all only if the connection has died)
+    WriteOp write(std::string data) { return WriteOp(*this, std::move(data)); }
+
+    //! End the outbound stream (see TCPStack::Stream::end_input)
+    void end_input() { _stream.end_input(); }
+
+    //! Has the peer ended its stream, and has all of it been read?
+    bool eof() { return _stream.eof(); }
+
+    //! Is the connection still alive in any way? (see TCPConnection::active)
+    bool active() { return _stream.active(); }
+
+    //! Summary of the connection's state
+    TCPState state() { return _stream.state(); }
+
+    //! The connection's addresses
+    const FourTuple &tuple() const { return _stream.tuple(); }
+
+    //! Close the Stream now, rather than on destruction (see TCPStack::Stream::close)
+    void close() { _stream.close(); }
+
+    //! \name
+    //! A Stream can be moved, but not copied
+    //!@{
+    Stream(Stream &&other) noexcept = default;
+    Stream &operator=(Stream &&other) noexcept = default;
+    Stream(const Stream &other) = delete;
+    Stream &operator=(const Stream &other) = delete;
+    ~Stream() = default;
+    //!@}
+};
+
+//! \brief Awaitable for Stream::read
+template <typename AdaptT>
+class AsyncTCPStack<AdaptT>::ReadOp : public PendingOp {
+  private:
+    Stream &_stream;  //!< The stream to read
+    size_t _limit;    //!< Most bytes to read
+
+    friend class Stream;
+
+    ReadOp(Stream &stream, const size_t limit) : _stream(stream), _limit(limit) {}
+
+  public:
+    bool poll() override { return _stream.active() ? _stream._stream.bytes_available() > 0 or _stream.eof() : true; }
+
+    bool await_ready() { return poll(); }
+    void await_suspend(const std::coroutine_handle<> suspended) {
+        this->handle = suspended;
+        _stream._owner->wait_on(_stream.tuple(), *this);
+    }
+    std::string await_resume() { return _stream._stream.read(_limit); }
+};
+
+//! \brief Awaitable for Stream::write
+template <typename AdaptT>
+class AsyncTCPStack<AdaptT>::WriteOp : public PendingOp {
+  private:
+    Stream &_stream;     //!< The stream to write
+    std::string _data;   //!< The data to write
+    size_t _written{0};  //!< Bytes of `_data` written so far
+
+    friend class Stream;
+
+    WriteOp(Stream &stream, std::string &&data) : _stream(stream), _data(std::move(data)) {}
+
+  public:
+    bool poll() override {
+        if (not _stream.active()) {
+            return true;
+        }
+        const size_t len = std::min(_data.size() - _written, _stream._stream.remaining_outbound_capacity());
+        if (len > 0) {
+            _written += _stream._stream.write(_data.substr(_written, len));
+        }
+        return _written == _data.size();
+    }
+
+    bool await_ready() { return poll(); }
+    void await_suspend(const std::coroutine_handle<> suspended) {
+        this->handle = suspended;
+        _stream._owner->wait_on(_stream.tuple(), *this);
+    }
+    size_t await_resume() const { return _written; }
+};
+
+//! \brief Awaitable for AsyncTCPStack::accept
+template <typename AdaptT>
+class AsyncTCPStack<AdaptT>::AcceptOp : public PendingOp {
+  private:
+    AsyncTCPStack &_owner;                                       //!< The stack
+    uint16_t _port;                                              //!< The listening port
+    std::optional<typename TCPStack<AdaptT>::Stream> _accepted{};  //!< The connection, once there is one
+
+    friend class AsyncTCPStack;
+
+    AcceptOp(AsyncTCPStack &owner, const uint16_t port) : _owner(owner), _port(port) {}
+
+  public:
+    bool poll() override {
+        _accepted = _owner._stack.accept(_port);
+        return _accepted.has_value();
+    }
+
+    bool await_ready() { return poll(); }
+    void await_suspend(const std::coroutine_handle<> suspended) {
+        this->handle = suspended;
+        _owner._waiting_accepts[_port].push_back(this);
+    }
+    Stream await_resume() { return Stream(_owner, std::move(_accepted.value())); }
+};
+
+//! \brief Awaitable for AsyncTCPStack::connect
+//! \details The connection may have failed (e.g., been reset) by the time the coroutine resumes; check
+//! Stream::active or Stream::state.
+template <typename AdaptT>
+class AsyncTCPStack<AdaptT>::ConnectOp : public PendingOp {
+  private:
+    Stream _stream;  //!< The connection, in the handshake
+
+    friend class AsyncTCPStack;
+
+    ConnectOp(AsyncTCPStack &owner, const Address &destination)
+        : _stream(owner, owner._stack.connect(destination)) {}
+
+  public:
+    bool poll() override { return _stream.state() != TCPState::State::SYN_SENT; }
+
+    bool await_ready() { return poll(); }
+    void await_suspend(const std::coroutine_handle<> suspended) {
+        this->handle = suspended;
+        _stream._owner->wait_on(_stream.tuple(), *this);
+    }
+    Stream await_resume() { return std::move(_stream); }
+};
+
+template <typename AdaptT>
+void AsyncTCPStack<AdaptT>::spawn(Task &&task) {
+    task._handle.promise().owner = this;
+    _live_tasks++;
+    _runnable.push_back(std::exchange(task._handle, nullptr));
+}
+
+//! \param[in] tuple is a connection that had an event
+template <typename AdaptT>
+void AsyncTCPStack<AdaptT>::wake_stream(const FourTuple &tuple) {
+    const auto it = _waiting_streams.find(tuple);
+    if (it == _waiting_streams.end()) {
+        return;
+    }
+
+    std::vector<PendingOp *> ops = std::move(it->second);
+    _waiting_streams.erase(it);
+    for (PendingOp *op : ops) {
+        if (op->poll()) {
+            _runnable.push_back(op->handle);
+        } else {
+            _waiting_streams[tuple].push_back(op);
+        }
+    }
+}
+
+template <typename AdaptT>
+void AsyncTCPStack<AdaptT>::wake_accepts() {
+    for (auto it = _waiting_accepts.begin(); it != _waiting_accepts.end();) {
+        std::deque<PendingOp *> &ops = it->second;
+        while (not ops.empty() and ops.front()->poll()) {
+            _runnable.push_back(ops.front()->handle);
+            ops.pop_front();
+        }
+        it = ops.empty() ? _waiting_accepts.erase(it) : std::next(it);
+    }
+}
+
+template <typename AdaptT>
+void AsyncTCPStack<AdaptT>::resume_runnable() {
+    while (not _runnable.empty()) {
+        const std::coroutine_handle<> handle = _runnable.front();
+        _runnable.pop_front();
+        handle.resume();
+        if (_error) {
+            std::rethrow_exception(std::exchange(_error, nullptr));
+        }
+    }
+}
+
+//! \details Each round resumes the coroutines that can make progress, then waits in
+//! TCPStack::wait_next_event and looks up the operations waiting on the connections that it reports
+//! ready(), so the cost of a round does not grow with the number of idle connections.
+template <typename AdaptT>
+void AsyncTCPStack<AdaptT>::run() {
+    while (true) {
+        resume_runnable();
+        if (_live_tasks == 0) {
+            _stack.wait_next_event(0);  // send what the last coroutines queued (e.g., a FIN)
+            return;
+        }
+
+        _stack.wait_next_event(_runnable.empty() ? -1 : 0);
+        for (const FourTuple &tuple : _stack.ready()) {
+            wake_stream(tuple);
+        }
+        if (not _waiting_accepts.empty() and not _stack.ready().empty()) {
+            wake_accepts();
+        }
+    }
+}
+
+template <typename AdaptT>
+AsyncTCPStack<AdaptT>::~AsyncTCPStack() {
+    std::vector<std::coroutine_handle<>> suspended(_runnable.begin(), _runnable.end());
+    for (const auto &[tuple, ops] : _waiting_streams) {
+        for (PendingOp *op : ops) {
+            suspended.push_back(op->handle);
+        }
+    }
+    for (const auto &[port, ops] : _waiting_accepts) {
+        for (PendingOp *op : ops) {
+            suspended.push_back(op->handle);
+        }
+    }
+    _runnable.clear();
+    _waiting_streams.clear();
+    _waiting_accepts.clear();
+
+    for (const auto &handle : suspended) {
+        handle.destroy();
+    }
+}
+
+using AsyncTCPOverUDPStack = AsyncTCPStack<TCPOverUDPSocketAdapter>;
+using AsyncTCPOverIPv4Stack = AsyncTCPStack<TCPOverIPv4OverTunFdAdapter>;
+
+//! \class AsyncTCPStack
+//! Instead of a thread per connection (TCPSpongeSocket) or a hand-written loop around
+//! TCPStack::wait_next_event, each connection can be served by a coroutine that reads and writes as if
+//! it were blocking:
+//!
+//! ~~~{.cpp}
+//! AsyncTCPOverUDPStack::Task echo(AsyncTCPOverUDPStack::Stream stream) {
+//!     for (auto data = co_await stream.read(); not data.empty(); data = co_await stream.read()) {
+//!         co_await stream.write(std::move(data));
+//!     }
+//!     stream.end_input();
+//! }
+//! ~~~
+//!
+//! A coroutine that awaits an operation which cannot complete yet is suspended and filed under its
+//! connection's 4-tuple (or, for accept(), its port). run() wakes it when the connection next shows up
+//! in TCPStack::ready(), so thousands of mostly idle connections cost one thread and no polling.
+//!
+//! The rest of the tree is C++17, so this class is header-only and only built into targets that opt in
+//! to C++20 (see add_sponge_coroutine_exec in etc/build_defs.cmake).
+
+#endif  // SPONGE_LIBSPONGE_ASYNC_TCP_STACK_HH
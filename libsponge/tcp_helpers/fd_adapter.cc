@@ -1,11 +1,32 @@
 #include "fd_adapter.hh"
 
-#include <iostream>
+#include "logger.hh"
+#include "util.hh"
+
+#include <algorithm>
 #include <stdexcept>
+#include <string>
+#include <string_view>
 #include <utility>
 
 using namespace std;
 
+//! \param[in] sock is the UDP socket that will carry the TCP segments
+//! \param[in] offload is `true` to have the kernel split outbound bursts of equal-size segments
+//!                    ([UDP_SEGMENT](\ref man7::udp)) and coalesce inbound ones ([UDP_GRO](\ref man7::udp))
+//! \note If the kernel does not support UDP_GRO, offload is turned off (with a warning).
+TCPOverUDPSocketAdapter::TCPOverUDPSocketAdapter(UDPSocket &&sock, const bool offload)
+    : _sock(move(sock)), _offload(offload) {
+    if (_offload) {
+        try {
+            _sock.set_gro(true);
+        } catch (const unix_error &e) {
+            LOG_WARNING("UDP offload unavailable (" << e.what() << ")");
+            _offload = false;
+        }
+    }
+}
+
 //! \details This function first attempts to parse a TCP segment from the next UDP
 //! payload recv()d from the socket.
 //!
@@ -20,22 +41,69 @@ using namespace std;
 //! \returns a std::optional<TCPSegment> that is empty if the segment was invalid or unrelated
 optional<TCPSegment> TCPOverUDPSocketAdapter::read() {
     auto datagram = _sock.recv();
+    return _unwrap_tcp_in_udp(datagram.source_address, move(datagram.payload));
+}
+
+//! \param[out] segments has each valid and related TCP segment appended to it
+//! \details Like read(), but drains up to UDPSocket::RecvBatch::capacity() datagrams with a
+//! single [recvmmsg(2)](\ref man2::recvmmsg), so one EventLoop wakeup can deliver a burst of segments.
+//! With offload on, a payload that the kernel coalesced is split back into the original datagrams.
+void TCPOverUDPSocketAdapter::read_batch(vector<TCPSegment> &segments) {
+    _recv_payloads([&](const Address &source, string &&payload) {
+        auto seg = _unwrap_tcp_in_udp(source, move(payload));
+        if (seg) {
+            segments.push_back(move(seg.value()));
+        }
+    });
+}
+
+//! \param[out] segments has each valid TCP segment appended to it, with the connection it belongs to
+//! \details Unlike read_batch(), this function ignores the listening flag and the destination in the
+//! configuration: it is for a TCPStack, which sorts segments into connections itself. A connection is
+//! identified by the local address (the configured source) and the UDP address of the peer.
+void TCPOverUDPSocketAdapter::demux_read_batch(vector<DemuxedSegment> &segments) {
+    const Address &local = config().source;
+    _recv_payloads([&](const Address &source, string &&payload) {
+        TCPSegment seg;
+        if (ParseResult::NoError == seg.parse(move(payload), 0)) {
+            segments.emplace_back(FourTuple::from_addresses(local, source), move(seg));
+        }
+    });
+}
+
+//! \param[in] handle is called with the source and payload of each datagram
+void TCPOverUDPSocketAdapter::_recv_payloads(const function<void(const Address &, string &&)> &handle) {
+    _sock.recv_batch(_recv_batch);
+    for (size_t i = 0; i < _recv_batch.size(); i++) {
+        const Address source = _recv_batch.source_address(i);
+        string_view payload = _recv_batch.payload(i);
+        const size_t segment_size = max(_recv_batch.segment_size(i), size_t(1));
+        do {
+            handle(source, string(payload.substr(0, segment_size)));
+            payload.remove_prefix(min(segment_size, payload.size()));
+        } while (not payload.empty());
+    }
+}
 
+//! \param[in] source is the Address that sent the UDP datagram
+//! \param[in] payload is the UDP payload
+//! \returns a std::optional<TCPSegment> that is empty if the segment was invalid or unrelated
+optional<TCPSegment> TCPOverUDPSocketAdapter::_unwrap_tcp_in_udp(const Address &source, string &&payload) {
     // is it for us?
-    if (not listening() and (datagram.source_address != config().destination)) {
+    if (not listening() and (source != config().destination)) {
         return {};
     }
 
     // is the payload a valid TCP segment?
     TCPSegment seg;
-    if (ParseResult::NoError != seg.parse(move(datagram.payload), 0)) {
+    if (ParseResult::NoError != seg.parse(move(payload), 0)) {
         return {};
     }
 
     // should we target this source in all future replies?
     if (listening()) {
         if (seg.header().syn and not seg.header().rst) {
-            config_mutable().destination = datagram.source_address;
+            config_mutable().destination = source;
             set_listening(false);
         } else {
             return {};
@@ -53,5 +121,59 @@ void TCPOverUDPSocketAdapter::write(TCPSegment &seg) {
     _sock.sendto(config().destination, seg.serialize(0));
 }
 
+//! \param[in,out] segments are the TCP segments to write; the queue is empty on return
+//! \details Without offload, the segments are sent with [sendmmsg(2)](\ref man2::sendmmsg), i.e., one
+//! syscall per burst. With offload, each run of equal-size segments (e.g., a window's worth of full-size
+//! segments) is handed to the kernel as one UDP_SEGMENT send.
+void TCPOverUDPSocketAdapter::write_batch(queue<TCPSegment> &segments) {
+    vector<BufferList> serialized;
+    serialized.reserve(segments.size());
+    while (not segments.empty()) {
+        TCPSegment &seg = segments.front();
+        seg.header().sport = config().source.port();
+        seg.header().dport = config().destination.port();
+        serialized.push_back(seg.serialize(0));
+        segments.pop();
+    }
+
+    if (not _offload) {
+        _sock.sendto_batch(config().destination, {serialized.begin(), serialized.end()});
+        return;
+    }
+
+    // find runs of same-size payloads; a run may end with one shorter payload
+    size_t first = 0;
+    while (first < serialized.size()) {
+        const size_t segment_size = serialized[first].size();
+        size_t last = first + 1, run_bytes = segment_size;
+        while (last < serialized.size() and last - first < UDPSocket::MAX_GSO_SEGMENTS and
+               run_bytes + serialized[last].size() <= UDPSocket::MAX_GSO_PAYLOAD and
+               serialized[last].size() <= segment_size) {
+            run_bytes += serialized[last].size();
+            if (serialized[last++].size() < segment_size) {
+                break;
+            }
+        }
+        _send_run(serialized, first, last, segment_size);
+        first = last;
+    }
+}
+
+void TCPOverUDPSocketAdapter::_send_run(const vector<BufferList> &payloads,
+                                        const size_t first,
+                                        const size_t last,
+                                        const size_t segment_size) {
+    if (last - first == 1) {
+        _sock.sendto(config().destination, payloads[first]);
+        return;
+    }
+
+    BufferList run;
+    for (size_t i = first; i < last; i++) {
+        run.append(payloads[i]);
+    }
+    _sock.sendto_gso(config().destination, run, static_cast<uint16_t>(segment_size));
+}
+
 //! Specialize LossyFdAdapter to TCPOverUDPSocketAdapter
 template class LossyFdAdapter<TCPOverUDPSocketAdapter>;
@@ -2,14 +2,18 @@
 #define SPONGE_LIBSPONGE_FD_ADAPTER_HH
 
 #include "file_descriptor.hh"
+#include "four_tuple.hh"
 #include "lossy_fd_adapter.hh"
 #include "socket.hh"
 #include "tcp_config.hh"
 #include "tcp_header.hh"
 #include "tcp_segment.hh"
 
+#include <functional>
 #include <optional>
+#include <queue>
 #include <utility>
+#include <vector>
 
 //! \brief Basic functionality for file descriptor adaptors
 //! \details See TCPOverUDPSocketAdapter and TCPOverIPv4OverTunFdAdapter for more information.
@@ -47,16 +51,43 @@ class TCPOverUDPSocketAdapter : public FdAdapterBase {
   private:
     UDPSocket _sock;
 
+    //! Preallocated receive slots used by read_batch()
+    UDPSocket::RecvBatch _recv_batch{};
+
+    //! Use UDP segmentation offload (GSO) when sending and receive offload (GRO) when receiving?
+    bool _offload;
+
+    //! Parses and filters one UDP payload received from `source`
+    std::optional<TCPSegment> _unwrap_tcp_in_udp(const Address &source, std::string &&payload);
+
+    //! Receives a batch of datagrams and calls `handle` on each payload, splitting coalesced ones
+    void _recv_payloads(const std::function<void(const Address &, std::string &&)> &handle);
+
+    //! Sends `payloads[first, last)`, all but the last of which are `segment_size` bytes long
+    void _send_run(const std::vector<BufferList> &payloads, size_t first, size_t last, size_t segment_size);
+
   public:
-    //! Construct from a UDPSocket sliced into a FileDescriptor
-    explicit TCPOverUDPSocketAdapter(UDPSocket &&sock) : _sock(std::move(sock)) {}
+    //! Construct from a UDPSocket sliced into a FileDescriptor, optionally using UDP GSO/GRO
+    explicit TCPOverUDPSocketAdapter(UDPSocket &&sock, const bool offload = false);
 
     //! Attempts to read and return a TCP segment related to the current connection from a UDP payload
     std::optional<TCPSegment> read();
 
+    //! Reads every ready UDP datagram (one syscall) and appends the related TCP segments to `segments`
+    void read_batch(std::vector<TCPSegment> &segments);
+
+    //! Reads every ready UDP datagram and appends each TCP segment, with its connection, to `segments`
+    void demux_read_batch(std::vector<DemuxedSegment> &segments);
+
     //! Writes a TCP segment into a UDP payload
     void write(TCPSegment &seg);
 
+    //! Writes every queued TCP segment, each in its own UDP payload, and empties the queue
+    void write_batch(std::queue<TCPSegment> &segments);
+
+    //! Is the adapter using UDP GSO/GRO?
+    bool offload() const { return _offload; }
+
     //! Access the underlying UDP socket
     operator UDPSocket &() { return _sock; }
 
@@ -0,0 +1,52 @@
+#include "four_tuple.hh"
+
+#include <cstring>
+#include <endian.h>
+#include <netinet/in.h>
+#include <stdexcept>
+
+using namespace std;
+
+//! Reads the IPv4 address and port straight out of `address`, without a round trip through a string
+static pair<uint32_t, uint16_t> ipv4_endpoint(const Address &address) {
+    const sockaddr *raw = address;
+    if (raw->sa_family != AF_INET or address.size() != sizeof(sockaddr_in)) {
+        throw runtime_error("FourTuple: not an IPv4 address: " + address.to_string());
+    }
+
+    sockaddr_in ipv4_addr{};
+    memcpy(&ipv4_addr, raw, sizeof(ipv4_addr));
+    return {be32toh(ipv4_addr.sin_addr.s_addr), be16toh(ipv4_addr.sin_port)};
+}
+
+//! The inverse of ipv4_endpoint
+static Address ipv4_address(const uint32_t ip, const uint16_t port) {
+    sockaddr_in ipv4_addr{};
+    ipv4_addr.sin_family = AF_INET;
+    ipv4_addr.sin_addr.s_addr = htobe32(ip);
+    ipv4_addr.sin_port = htobe16(port);
+    return {reinterpret_cast<sockaddr *>(&ipv4_addr), sizeof(ipv4_addr)};
+}
+
+//! \param[in] local is the local IPv4 address and port
+//! \param[in] remote is the remote IPv4 address and port
+FourTuple FourTuple::from_addresses(const Address &local, const Address &remote) {
+    const auto [local_ip, local_port] = ipv4_endpoint(local);
+    const auto [remote_ip, remote_port] = ipv4_endpoint(remote);
+    return {local_ip, remote_ip, local_port, remote_port};
+}
+
+Address FourTuple::local_address() const { return ipv4_address(local_ip, local_port); }
+
+Address FourTuple::remote_address() const { return ipv4_address(remote_ip, remote_port); }
+
+string FourTuple::to_string() const { return local_address().to_string() + " <-> " + remote_address().to_string(); }
+
+//! \details Mixes the addresses and ports into one 64-bit word and scrambles it with a multiplicative hash,
+//! so that connections that differ only in the remote port (the common case on a server) spread evenly.
+size_t FourTupleHash::operator()(const FourTuple &tuple) const {
+    uint64_t key = (uint64_t(tuple.local_ip) << 32) ^ tuple.remote_ip;
+    key ^= (uint64_t(tuple.local_port) << 48) ^ (uint64_t(tuple.remote_port) << 16);
+    key *= 0x9e3779b97f4a7c15ULL;
+    return key ^ (key >> 29);
+}
@@ -0,0 +1,50 @@
+#ifndef SPONGE_LIBSPONGE_FOUR_TUPLE_HH
+#define SPONGE_LIBSPONGE_FOUR_TUPLE_HH
+
+#include "address.hh"
+#include "tcp_config.hh"
+#include "tcp_segment.hh"
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <utility>
+
+//! \brief The addresses and ports that identify a TCP connection, from the local endpoint's point of view
+struct FourTuple {
+    uint32_t local_ip{0};     //!< Local IPv4 address, in host byte order
+    uint32_t remote_ip{0};    //!< Remote IPv4 address, in host byte order
+    uint16_t local_port{0};   //!< Local port
+    uint16_t remote_port{0};  //!< Remote port
+
+    //! Build from a local and a remote IPv4 Address
+    static FourTuple from_addresses(const Address &local, const Address &remote);
+
+    //! The local Address (as FdAdapterConfig::source)
+    Address local_address() const;
+
+    //! The remote Address (as FdAdapterConfig::destination)
+    Address remote_address() const;
+
+    //! \name Comparison
+    //!@{
+    bool operator==(const FourTuple &other) const {
+        return local_ip == other.local_ip and remote_ip == other.remote_ip and local_port == other.local_port and
+               remote_port == other.remote_port;
+    }
+    bool operator!=(const FourTuple &other) const { return not operator==(other); }
+    //!@}
+
+    //! Human-readable string, e.g., "10.0.0.1:1234 <-> 10.0.0.2:80"
+    std::string to_string() const;
+};
+
+//! Hash of a FourTuple, for use as the key of a connection table
+struct FourTupleHash {
+    size_t operator()(const FourTuple &tuple) const;
+};
+
+//! A TCP segment, with the connection it was addressed to
+using DemuxedSegment = std::pair<FourTuple, TCPSegment>;
+
+#endif  // SPONGE_LIBSPONGE_FOUR_TUPLE_HH
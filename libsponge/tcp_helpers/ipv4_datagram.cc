@@ -1,18 +1,89 @@
 #include "ipv4_datagram.hh"
 
 #include "parser.hh"
+#include "stats.hh"
 #include "util.hh"
 
+#include <algorithm>
+#include <mutex>
 #include <stdexcept>
 #include <string>
+#include <vector>
 
 using namespace std;
 
+//! \brief One thread's serialize() hits and misses, on a cache line of their own
+struct alignas(STATS_CACHE_LINE) SerializeCounts {
+    StatCounter hits{};
+    StatCounter misses{};
+};
+
+//! \brief The counts of every live thread, and the totals of the threads that have exited
+class SerializeCountsRegistry {
+  private:
+    mutable mutex _mutex{};
+    vector<const SerializeCounts *> _live{};
+    IPv4Datagram::SerializeStats _retired{0, 0};
+
+  public:
+    static SerializeCountsRegistry &get() {
+        static SerializeCountsRegistry registry;
+        return registry;
+    }
+
+    void add(const SerializeCounts &counts) {
+        lock_guard<mutex> lock(_mutex);
+        _live.push_back(&counts);
+    }
+
+    void retire(const SerializeCounts &counts) {
+        lock_guard<mutex> lock(_mutex);
+        _retired.hits += counts.hits.value();
+        _retired.misses += counts.misses.value();
+        _live.erase(remove(_live.begin(), _live.end(), &counts), _live.end());
+    }
+
+    IPv4Datagram::SerializeStats sum() const {
+        lock_guard<mutex> lock(_mutex);
+        IPv4Datagram::SerializeStats ret = _retired;
+        for (const auto *counts : _live) {
+            ret.hits += counts->hits.value();
+            ret.misses += counts->misses.value();
+        }
+        return ret;
+    }
+};
+
+//! \brief The calling thread's counts, which are retired when the thread exits
+class ThreadSerializeCounts {
+  private:
+    SerializeCounts _counts{};
+
+  public:
+    ThreadSerializeCounts() { SerializeCountsRegistry::get().add(_counts); }
+    ThreadSerializeCounts(const ThreadSerializeCounts &other) = delete;
+    ThreadSerializeCounts &operator=(const ThreadSerializeCounts &other) = delete;
+    ~ThreadSerializeCounts() { SerializeCountsRegistry::get().retire(_counts); }
+
+    SerializeCounts &counts() { return _counts; }
+};
+
+//! The calling thread's counts: each thread only writes its own, so routing threads share no cache line
+static SerializeCounts &thread_serialize_counts() {
+    thread_local ThreadSerializeCounts counts;
+    return counts.counts();
+}
+
 ParseResult IPv4Datagram::parse(const Buffer buffer) {
     NetParser p{buffer};
-    _header.parse(p);
+    const ParseResult header_result = _header.parse(p);
     _payload = p.buffer();
 
+    // a header that parsed has a correct checksum, unless it had options (which serialize() does not keep)
+    _cached = header_result == ParseResult::NoError and _header.hlen == IPv4Header::LENGTH / 4;
+    _cached_header = _header;
+    _cached_bytes = {};
+
     if (_payload.size() != _header.payload_length()) {
         return ParseResult::PacketTooShort;
     }
@@ -20,22 +91,69 @@ ParseResult IPv4Datagram::parse(const Buffer buffer) {
     return p.get_error();
 }
 
+bool IPv4Datagram::cache_matches() const {
+    const IPv4Header &a = _header;
+    const IPv4Header &b = _cached_header;
+    return _cached and a.ver == b.ver and a.hlen == b.hlen and a.tos == b.tos and a.len == b.len and a.id == b.id and
+           a.df == b.df and a.mf == b.mf and a.offset == b.offset and a.ttl == b.ttl and a.proto == b.proto and
+           a.src == b.src and a.dst == b.dst;
+}
+
 BufferList IPv4Datagram::serialize() const {
     if (_payload.size() != _header.payload_length()) {
         throw runtime_error("IPv4Datagram::serialize: payload is wrong size");
     }
 
-    IPv4Header header_out = _header;
-    header_out.cksum = 0;
-    const string header_zero_checksum = header_out.serialize();
+    if (cache_matches()) {
+        thread_serialize_counts().hits.add();
+        if (_cached_bytes.size() == 0) {
+            _cached_bytes = _cached_header.serialize();
+        }
+    } else {
+        thread_serialize_counts().misses.add();
+        _cached_header = _header;
+        _cached_header.cksum = 0;
+        string header_out = _cached_header.serialize();
+
+        // calculate checksum -- taken over header only -- and write it into the serialized header
+        InternetChecksum check;
+        check.add(header_out);
+        _cached_header.cksum = check.value();
+        header_out[10] = static_cast<char>(_cached_header.cksum >> 8);
+        header_out[11] = static_cast<char>(_cached_header.cksum & 0xff);
 
-    // calculate checksum -- taken over header only
-    InternetChecksum check;
-    check.add(header_zero_checksum);
-    header_out.cksum = check.value();
+        _cached = true;
+        _cached_bytes = move(header_out);
+    }
 
-    BufferList ret;
-    ret.append(header_out.serialize());
+    BufferList ret{_cached_bytes};
     ret.append(_payload);
     return ret;
 }
+
+//! \details When the checksum is known (the header has not changed since the last parse() or serialize()),
+//! the new one follows from the change to the 16-bit word that holds the TTL: HC' = ~(~HC + ~m + m'), as in
+//! eqn. 3 of RFC 1624. The result equals the one that serialize() would compute, so the next serialize() is a hit.
+void IPv4Datagram::decrement_ttl() {
+    const bool known = cache_matches();
+    _header.ttl--;
+    if (not known) {
+        return;
+    }
+
+    const uint16_t old_word = (_cached_header.ttl << 8) | _cached_header.proto;
+    const uint16_t new_word = (_header.ttl << 8) | _header.proto;
+    uint32_t sum = static_cast<uint16_t>(~_cached_header.cksum);
+    sum += static_cast<uint16_t>(~old_word);
+    sum += new_word;
+    sum = (sum & 0xffff) + (sum >> 16);
+    sum = (sum & 0xffff) + (sum >> 16);
+
+    _cached_header.ttl = _header.ttl;
+    _cached_header.cksum = static_cast<uint16_t>(~sum);
+    _header.cksum = _cached_header.cksum;
+    _cached_bytes = {};
+}
+
+//! \details Sums the counts of every thread that has serialized a datagram, including those that have exited.
+IPv4Datagram::SerializeStats IPv4Datagram::serialize_stats() { return SerializeCountsRegistry::get().sum(); }
@@ -4,19 +4,43 @@
 #include "buffer.hh"
 #include "ipv4_header.hh"
 
+#include <cstdint>
+
 //! \brief [IPv4](\ref rfc::rfc791) Internet datagram
 class IPv4Datagram {
   private:
     IPv4Header _header{};
     BufferList _payload{};
 
+    //! \name Cached serialized form
+    //!@{
+    mutable bool _cached{false};          //!< Whether `_cached_header` holds a header and its correct checksum
+    mutable IPv4Header _cached_header{};  //!< The header as last parsed or serialized, with its checksum
+    mutable Buffer _cached_bytes{};       //!< `_cached_header`, serialized (empty until it is needed)
+    //!@}
+
+    //! Whether the header still has the fields of `_cached_header` (whatever its `cksum` field says)
+    bool cache_matches() const;
+
   public:
+    //! \brief Hits and misses on the cached serialized form, summed over all datagrams
+    struct SerializeStats {
+        uint64_t hits;    //!< Headers serialized without computing the checksum
+        uint64_t misses;  //!< Headers whose checksum had to be computed
+    };
+
     //! \brief Parse the segment from a string
     ParseResult parse(const Buffer buffer);
 
     //! \brief Serialize the segment to a string
     BufferList serialize() const;
 
+    //! \brief Decrement the TTL, updating a known checksum incrementally
+    void decrement_ttl();
+
+    //! \brief The serialize() hits and misses so far
+    static SerializeStats serialize_stats();
+
     //! \name Accessors
     //!@{
     const IPv4Header &header() const { return _header; }
@@ -27,6 +51,15 @@ class IPv4Datagram {
     //!@}
 };
 
+//! \class IPv4Datagram
+//! A datagram remembers its header's checksum, and its serialized header, from the last parse() or serialize().
+//! Serializing it again, or forwarding it after decrement_ttl(), reuses them for as long as the header's fields
+//! are unchanged; any other change to the header (through header()) makes the next serialize() start afresh.
+//! The payload is never copied either way.
+//!
+//! \note The cache makes serialize() modify the datagram, so one datagram must not be serialized by two
+//! threads at once (different datagrams can be).
+
 using InternetDatagram = IPv4Datagram;
 
 #endif  // SPONGE_LIBSPONGE_IPV4_DATAGRAM_HH
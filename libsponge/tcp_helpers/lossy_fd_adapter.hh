@@ -2,13 +2,17 @@
 #define SPONGE_LIBSPONGE_LOSSY_FD_ADAPTER_HH
 
 #include "file_descriptor.hh"
+#include "four_tuple.hh"
 #include "tcp_config.hh"
 #include "tcp_segment.hh"
 #include "util.hh"
 
+#include <algorithm>
 #include <optional>
+#include <queue>
 #include <random>
 #include <utility>
+#include <vector>
 
 //! An adapter class that adds random dropping behavior to an FD adapter
 template <typename AdapterT>
@@ -56,6 +60,41 @@ class LossyFdAdapter {
         return _adapter.write(seg);
     }
 
+    //! \brief Read a batch from the underlying AdapterT instance, potentially dropping each segment
+    //! \param[out] segments has each segment that was not dropped appended to it
+    void read_batch(std::vector<TCPSegment> &segments) {
+        const size_t first_new = segments.size();
+        _adapter.read_batch(segments);
+        segments.erase(std::remove_if(segments.begin() + first_new,
+                                      segments.end(),
+                                      [&](const TCPSegment &) { return _should_drop(false); }),
+                       segments.end());
+    }
+
+    //! \brief Read a demultiplexed batch from the underlying AdapterT instance, potentially dropping each segment
+    //! \param[out] segments has each segment that was not dropped appended to it, with its connection
+    void demux_read_batch(std::vector<DemuxedSegment> &segments) {
+        const size_t first_new = segments.size();
+        _adapter.demux_read_batch(segments);
+        segments.erase(std::remove_if(segments.begin() + first_new,
+                                      segments.end(),
+                                      [&](const DemuxedSegment &) { return _should_drop(false); }),
+                       segments.end());
+    }
+
+    //! \brief Write a batch to the underlying AdapterT instance, potentially dropping each segment
+    //! \param[in,out] segments are the segments to either write or drop; the queue is empty on return
+    void write_batch(std::queue<TCPSegment> &segments) {
+        std::queue<TCPSegment> kept;
+        while (not segments.empty()) {
+            if (not _should_drop(true)) {
+                kept.push(std::move(segments.front()));
+            }
+            segments.pop();
+        }
+        _adapter.write_batch(kept);
+    }
+
     //! \name
     //! Passthrough functions to the underlying AdapterT instance
 
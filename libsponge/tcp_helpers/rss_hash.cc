@@ -0,0 +1,58 @@
+#include "rss_hash.hh"
+
+#include <stdexcept>
+
+using namespace std;
+
+const RSSHash::Key RSSHash::DEFAULT_KEY = {
+    0x6d, 0x5a, 0x56, 0xda, 0x25, 0x5b, 0x0e, 0xc2, 0x41, 0x67, 0x25, 0x3d, 0x43, 0xa3,
+    0x8f, 0xb0, 0xd0, 0xca, 0x2b, 0xcb, 0xae, 0x7b, 0x30, 0xb4, 0x77, 0xcb, 0x2d, 0xa3,
+    0x80, 0x30, 0xf2, 0x0c, 0x6a, 0x42, 0xb7, 0x3b, 0xbe, 0xac, 0x01, 0xfa};
+
+//! \param[in] shards is the number of shards; the indirection table deals them out round-robin
+//! \param[in] key is the secret key of the Toeplitz hash
+RSSHash::RSSHash(const size_t shards, const Key &key) {
+    if (shards == 0 or shards > INDIRECTION_SIZE) {
+        throw runtime_error("RSSHash: need between 1 and " + to_string(INDIRECTION_SIZE) + " shards");
+    }
+
+    // bit i of the input (counting from the most significant bit of byte 0) selects
+    // the 32 bits of the key that start at bit i
+    auto key_window = [&](const size_t bit) {
+        uint32_t window = 0;
+        for (size_t i = 0; i < 32; i++) {
+            const size_t key_bit = bit + i;
+            window = (window << 1) | ((key.at(key_bit / 8) >> (7 - key_bit % 8)) & 1);
+        }
+        return window;
+    };
+
+    for (size_t byte = 0; byte < INPUT_LENGTH; byte++) {
+        for (unsigned value = 0; value < 256; value++) {
+            uint32_t result = 0;
+            for (size_t bit = 0; bit < 8; bit++) {
+                if (value & (0x80 >> bit)) {
+                    result ^= key_window(byte * 8 + bit);
+                }
+            }
+            _table[byte][value] = result;
+        }
+    }
+
+    for (size_t i = 0; i < INDIRECTION_SIZE; i++) {
+        _indirection[i] = i % shards;
+    }
+}
+
+//! \param[in] tuple is the connection, from the point of view of the receiver
+uint32_t RSSHash::operator()(const FourTuple &tuple) const {
+    const uint32_t words[3] = {tuple.remote_ip, tuple.local_ip, (uint32_t(tuple.remote_port) << 16) | tuple.local_port};
+
+    uint32_t hash = 0;
+    for (size_t word = 0; word < 3; word++) {
+        for (size_t byte = 0; byte < 4; byte++) {
+            hash ^= _table[word * 4 + byte][(words[word] >> (24 - 8 * byte)) & 0xff];
+        }
+    }
+    return hash;
+}
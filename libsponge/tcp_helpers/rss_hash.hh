@@ -0,0 +1,50 @@
+#ifndef SPONGE_LIBSPONGE_RSS_HASH_HH
+#define SPONGE_LIBSPONGE_RSS_HASH_HH
+
+#include "four_tuple.hh"
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+//! \brief The Toeplitz hash that NICs use for receive-side scaling (RSS), and an indirection table
+//! that maps the hash of a connection to one of several shards
+class RSSHash {
+  public:
+    static constexpr size_t KEY_LENGTH = 40;         //!< Length of an RSS key, in bytes
+    static constexpr size_t INDIRECTION_SIZE = 128;  //!< Number of entries in the indirection table
+
+    using Key = std::array<uint8_t, KEY_LENGTH>;
+
+    //! The key from Microsoft's RSS specification, which many NICs use by default
+    static const Key DEFAULT_KEY;
+
+  private:
+    static constexpr size_t INPUT_LENGTH = 12;  //!< Source and destination IPv4 addresses, then ports
+
+    //! For each input byte position and value, the XOR of the key windows that its set bits select
+    std::array<std::array<uint32_t, 256>, INPUT_LENGTH> _table{};
+
+    //! Shard for each value of the low bits of the hash
+    std::array<uint16_t, INDIRECTION_SIZE> _indirection{};
+
+  public:
+    //! Hash for `key`, spreading connections over `shards` shards
+    explicit RSSHash(const size_t shards = 1, const Key &key = DEFAULT_KEY);
+
+    //! The Toeplitz hash of an inbound segment's source and destination
+    uint32_t operator()(const FourTuple &tuple) const;
+
+    //! The shard that a connection belongs to
+    size_t shard_of(const FourTuple &tuple) const { return _indirection[operator()(tuple) % INDIRECTION_SIZE]; }
+};
+
+//! \class RSSHash
+//! The hash input is laid out as a NIC lays out an inbound IPv4/TCP packet: the remote (source)
+//! address, the local (destination) address, the remote port, then the local port, all in network
+//! byte order, so the results match the test vectors in the RSS specification.
+//!
+//! Hashing bit by bit costs one 32-bit shift and XOR per input bit. Instead, the constructor works out
+//! the contribution of every possible value of each input byte, so a hash is twelve table lookups.
+
+#endif  // SPONGE_LIBSPONGE_RSS_HASH_HH
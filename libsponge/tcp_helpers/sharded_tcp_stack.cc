@@ -0,0 +1,141 @@
+#include "sharded_tcp_stack.hh"
+
+#include "util.hh"
+
+#include <algorithm>
+#include <exception>
+#include <pthread.h>
+#include <sched.h>
+#include <stdexcept>
+#include <thread>
+#include <utility>
+
+using namespace std;
+
+//! \param[in] adapters are the adapters, one per shard
+//! \param[in] tcp_config is the configuration of each new connection
+//! \param[in] adapter_config is the configuration of every adapter
+template <typename AdaptT>
+ShardedTCPStack<AdaptT>::ShardedTCPStack(vector<AdaptT> &&adapters,
+                                         const TCPConfig &tcp_config,
+                                         const FdAdapterConfig &adapter_config)
+    : _shards() {
+    for (auto &adapter : adapters) {
+        _shards.push_back(make_unique<Shard>(move(adapter), tcp_config, adapter_config));
+    }
+
+    for (size_t i = 0; i < _shards.size(); i++) {
+        Shard &shard = *_shards[i];
+        shard.stack.set_affinity([this, i](const FourTuple &tuple) { return claim(tuple, i); },
+                                 [this](const FourTuple &tuple) { release(tuple); },
+                                 [this, i](DemuxedSegment &segment) { return forward(segment, i); });
+        shard.stack.eventloop().add_rule(shard.wakeup, Direction::In, [&shard] {
+            shard.wakeup.clear();
+            {
+                const lock_guard<mutex> lock(shard.inbox_mutex);
+                swap(shard.inbox, shard.delivering);
+            }
+            shard.stack.deliver(shard.delivering);
+        });
+    }
+}
+
+//! \param[in] tuple is the connection
+//! \param[in] shard is the shard that creates it
+//! \returns `false` if the connection belongs to another shard
+template <typename AdaptT>
+bool ShardedTCPStack<AdaptT>::claim(const FourTuple &tuple, const size_t shard) {
+    const lock_guard<mutex> lock(_owners_mutex);
+    const auto [it, inserted] = _owners.emplace(tuple, shard);
+    return inserted or it->second == shard;
+}
+
+//! \param[in] tuple is the connection
+template <typename AdaptT>
+void ShardedTCPStack<AdaptT>::release(const FourTuple &tuple) {
+    const lock_guard<mutex> lock(_owners_mutex);
+    _owners.erase(tuple);
+}
+
+//! \param[in] tuple is the connection
+template <typename AdaptT>
+optional<size_t> ShardedTCPStack<AdaptT>::shard_of(const FourTuple &tuple) const {
+    const lock_guard<mutex> lock(_owners_mutex);
+    const auto it = _owners.find(tuple);
+    if (it == _owners.end()) {
+        return {};
+    }
+    return it->second;
+}
+
+//! \param[in,out] segment is the segment, with its connection; it is moved from if it is forwarded
+//! \param[in] from is the shard whose adapter received the segment
+//! \returns `false` (leaving the segment alone) if no shard other than `from` owns the connection
+//! \details The owner is only woken when its inbox goes from empty to non-empty; it collects everything
+//! in the inbox at once.
+template <typename AdaptT>
+bool ShardedTCPStack<AdaptT>::forward(DemuxedSegment &segment, const size_t from) {
+    const optional<size_t> shard = shard_of(segment.first);
+    if (not shard.has_value() or shard.value() == from) {
+        return false;
+    }
+
+    Shard &owner = *_shards.at(shard.value());
+    bool was_empty = false;
+    {
+        const lock_guard<mutex> lock(owner.inbox_mutex);
+        was_empty = owner.inbox.empty();
+        owner.inbox.push_back(move(segment));
+    }
+    if (was_empty) {
+        owner.wakeup.notify();
+    }
+    return true;
+}
+
+//! \param[in] port is the local port
+//! \param[in] backlog is the backlog of each shard
+template <typename AdaptT>
+void ShardedTCPStack<AdaptT>::listen(const uint16_t port, const size_t backlog) {
+    for (auto &shard : _shards) {
+        shard->stack.listen(port, backlog);
+    }
+}
+
+//! \param[in] main is the body of each shard's thread
+template <typename AdaptT>
+void ShardedTCPStack<AdaptT>::run(const ShardMain &main) {
+    vector<exception_ptr> errors(_shards.size());
+    vector<thread> threads;
+    const unsigned cpus = max(thread::hardware_concurrency(), 1U);
+
+    for (size_t i = 0; i < _shards.size(); i++) {
+        threads.emplace_back([&, i] {
+            try {
+                main(_shards[i]->stack, i);
+            } catch (...) {
+                errors[i] = current_exception();
+            }
+        });
+
+        cpu_set_t cpu_set;
+        CPU_ZERO(&cpu_set);
+        CPU_SET(i % cpus, &cpu_set);
+        pthread_setaffinity_np(threads.back().native_handle(), sizeof(cpu_set), &cpu_set);  // best effort
+    }
+
+    for (auto &thread : threads) {
+        thread.join();
+    }
+    for (const auto &error : errors) {
+        if (error) {
+            rethrow_exception(error);
+        }
+    }
+}
+
+//! Specialization of ShardedTCPStack for TCPOverUDPSocketAdapter
+template class ShardedTCPStack<TCPOverUDPSocketAdapter>;
+
+//! Specialization of ShardedTCPStack for TCPOverIPv4OverTunFdAdapter
+template class ShardedTCPStack<TCPOverIPv4OverTunFdAdapter>;
@@ -0,0 +1,92 @@
+#ifndef SPONGE_LIBSPONGE_SHARDED_TCP_STACK_HH
+#define SPONGE_LIBSPONGE_SHARDED_TCP_STACK_HH
+
+#include "eventfd.hh"
+#include "four_tuple.hh"
+#include "tcp_config.hh"
+#include "tcp_stack.hh"
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <unordered_map>
+#include <vector>
+
+//! \brief N TCPStacks, each driven by its own thread and owning a disjoint shard of the connections
+template <typename AdaptT>
+class ShardedTCPStack {
+  public:
+    using Stack = TCPStack<AdaptT>;
+
+    //! The body of each shard's thread, given the shard's stack and number
+    using ShardMain = std::function<void(Stack &stack, const size_t shard)>;
+
+  private:
+    //! \brief One shard: a stack, and an inbox for segments that arrived at another shard's adapter
+    struct Shard {
+        Stack stack;                                //!< Touched only by the shard's thread
+        EventFD wakeup{};                           //!< Readable when the inbox is not empty
+        std::mutex inbox_mutex{};                   //!< Protects `inbox`
+        std::vector<DemuxedSegment> inbox{};        //!< Forwarded segments, waiting for the shard's thread
+        std::vector<DemuxedSegment> delivering{};   //!< The inbox, swapped out for delivery
+
+        Shard(AdaptT &&adapter, const TCPConfig &tcp_config, const FdAdapterConfig &adapter_config)
+            : stack(std::move(adapter), tcp_config, adapter_config) {}
+    };
+
+    std::vector<std::unique_ptr<Shard>> _shards;  //!< The shards
+
+    mutable std::mutex _owners_mutex{};                              //!< Protects `_owners`
+    std::unordered_map<FourTuple, size_t, FourTupleHash> _owners{};  //!< The shard of each connection
+
+    //! Records that a connection belongs to `shard`, unless it belongs to another shard
+    bool claim(const FourTuple &tuple, const size_t shard);
+
+    //! Records that a connection has been deleted from its shard
+    void release(const FourTuple &tuple);
+
+    //! Hands a segment to the shard that owns its connection, if that is not `from`
+    bool forward(DemuxedSegment &segment, const size_t from);
+
+  public:
+    //! \brief Construct from one adapter per shard
+    //! \details The adapters should share one address: e.g., UDP sockets bound to the same address with
+    //! Socket::set_reuseport, or the queues of a multi-queue TUN device (see TunFD).
+    ShardedTCPStack(std::vector<AdaptT> &&adapters, const TCPConfig &tcp_config, const FdAdapterConfig &adapter_config);
+
+    //! Listen on `port` in every shard (see TCPStack::listen); call before run()
+    void listen(const uint16_t port, const size_t backlog = Stack::DEFAULT_BACKLOG);
+
+    //! Number of shards
+    size_t shard_count() const { return _shards.size(); }
+
+    //! The shard that owns a connection, if any does
+    std::optional<size_t> shard_of(const FourTuple &tuple) const;
+
+    //! Event counts of one shard (safe to read while the shards are running)
+    const TCPStackCounters &counters(const size_t shard) const { return _shards.at(shard)->stack.counters(); }
+
+    //! \brief Run `main` on one thread per shard, each pinned to its own CPU, and wait for all of them to return
+    //! \details If any thread throws, the first exception is rethrown once all threads have returned.
+    void run(const ShardMain &main);
+};
+
+using TCPOverUDPShardedStack = ShardedTCPStack<TCPOverUDPSocketAdapter>;
+using TCPOverIPv4ShardedStack = ShardedTCPStack<TCPOverIPv4OverTunFdAdapter>;
+
+//! \class ShardedTCPStack
+//! The shards share nothing: each stack, its connections and its timers are only touched by the
+//! shard's thread, which runs the caller's ShardMain (typically a loop around TCPStack::wait_next_event).
+//!
+//! The kernel picks the adapter that receives each packet by its own per-flow hash (SO_REUSEPORT's, or the
+//! TUN queue selection), so a connection belongs to the shard whose adapter received its SYN, and the rest
+//! of its segments normally arrive there too. A connection that a shard opens with TCPStack::connect belongs
+//! to that shard. The shards record which connections they own in a table shared by all of them, which they
+//! only consult for segments that miss their own connection table, and a segment that arrives at another
+//! shard's adapter (e.g., the peer's reply to a connect(), or after the kernel changes its mind) is forwarded
+//! to the owner's inbox, waking the owner through an EventFD.
+
+#endif  // SPONGE_LIBSPONGE_SHARDED_TCP_STACK_HH
@@ -16,9 +16,10 @@ class TCPConfig {
     static constexpr uint16_t TIMEOUT_DFLT = 1000;     //!< Default re-transmit timeout is 1 second
     static constexpr unsigned MAX_RETX_ATTEMPTS = 8;   //!< Maximum re-transmit attempts before giving up
 
-    uint16_t rt_timeout = TIMEOUT_DFLT;       //!< Initial value of the retransmission timeout, in milliseconds
-    size_t recv_capacity = DEFAULT_CAPACITY;  //!< Receive capacity, in bytes
-    size_t send_capacity = DEFAULT_CAPACITY;  //!< Sender capacity, in bytes
+    uint16_t rt_timeout = TIMEOUT_DFLT;          //!< Initial value of the retransmission timeout, in milliseconds
+    size_t recv_capacity = DEFAULT_CAPACITY;     //!< Receive capacity, in bytes
+    size_t send_capacity = DEFAULT_CAPACITY;     //!< Sender capacity, in bytes
+    size_t max_payload_size = MAX_PAYLOAD_SIZE;  //!< Largest payload of a segment that the sender makes, in bytes
     std::optional<WrappingInt32> fixed_isn{};
 };
 
@@ -70,6 +70,32 @@ optional<TCPSegment> TCPOverIPv4Adapter::unwrap_tcp_in_ip(const InternetDatagram
     return tcp_seg;
 }
 
+//! \details Unlike unwrap_tcp_in_ip(), this function ignores the listening flag and the destination in
+//! the configuration: it is for a TCPStack, which sorts segments into connections itself. It only checks
+//! that the datagram carries a valid TCP segment and is addressed to the configured source address
+//! (if that is not INADDR_ANY).
+//! \returns the segment and the connection (as seen from this end) that it belongs to, or empty if the
+//!          segment was invalid or not for us
+optional<DemuxedSegment> TCPOverIPv4Adapter::demux_tcp_in_ip(const InternetDatagram &ip_dgram) const {
+    const uint32_t local_ip = config().source.ipv4_numeric();
+    if (local_ip != 0 and ip_dgram.header().dst != local_ip) {
+        return {};
+    }
+
+    if (ip_dgram.header().proto != IPv4Header::PROTO_TCP) {
+        return {};
+    }
+
+    TCPSegment tcp_seg;
+    if (ParseResult::NoError != tcp_seg.parse(ip_dgram.payload(), ip_dgram.header().pseudo_cksum())) {
+        return {};
+    }
+
+    const FourTuple tuple{
+        ip_dgram.header().dst, ip_dgram.header().src, tcp_seg.header().dport, tcp_seg.header().sport};
+    return DemuxedSegment{tuple, move(tcp_seg)};
+}
+
 //! Takes a TCP segment, sets port numbers as necessary, and wraps it in an IPv4 datagram
 //! \param[in] seg is the TCP segment to convert
 InternetDatagram TCPOverIPv4Adapter::wrap_tcp_in_ip(TCPSegment &seg) {
@@ -3,6 +3,7 @@
 
 #include "buffer.hh"
 #include "fd_adapter.hh"
+#include "four_tuple.hh"
 #include "ipv4_datagram.hh"
 #include "tcp_segment.hh"
 
@@ -13,6 +14,9 @@ class TCPOverIPv4Adapter : public FdAdapterBase {
   public:
     std::optional<TCPSegment> unwrap_tcp_in_ip(const InternetDatagram &ip_dgram);
 
+    //! Parses the TCP segment in any datagram addressed to the local address, whatever connection it belongs to
+    std::optional<DemuxedSegment> demux_tcp_in_ip(const InternetDatagram &ip_dgram) const;
+
     InternetDatagram wrap_tcp_in_ip(TCPSegment &seg);
 };
 
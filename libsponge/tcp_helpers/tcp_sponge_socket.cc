@@ -1,15 +1,18 @@
 #include "tcp_sponge_socket.hh"
 
+#include "logger.hh"
 #include "network_interface.hh"
 #include "parser.hh"
 #include "tun.hh"
 #include "util.hh"
 
+#include <algorithm>
 #include <cstddef>
+#include <cstdint>
 #include <exception>
-#include <iostream>
 #include <stdexcept>
 #include <string>
+#include <string_view>
 #include <sys/socket.h>
 #include <sys/syscall.h>
 #include <sys/types.h>
@@ -18,23 +21,39 @@
 
 using namespace std;
 
-static constexpr size_t TCP_TICK_MS = 10;
+//! Longest wait when no timer is running; bounds how long it takes the TCP thread to notice TCPSpongeSocket::_abort
+static constexpr uint64_t TCP_IDLE_WAIT_MS = 1000;
 
 //! \param[in] condition is a function returning true if loop should continue
+//! \details Rather than waking up at a fixed interval, the loop sleeps until a datagram or bytes from the owner
+//! arrive, or until the TCPConnection's next deadline (see TCPConnection::next_deadline). Time is measured in
+//! microseconds; ticks are whole milliseconds, and the remainder is carried over to the next tick.
 template <typename AdaptT>
 void TCPSpongeSocket<AdaptT>::_tcp_loop(const function<bool()> &condition) {
-    auto base_time = timestamp_ms();
+    auto base_time = timestamp_us();
     while (condition()) {
-        auto ret = _eventloop.wait_next_event(TCP_TICK_MS);
+        if (_rings) {
+            _pump_rings();
+        }
+
+        uint64_t timeout_ms = TCP_IDLE_WAIT_MS;
+        if (const auto deadline = _tcp.value().next_deadline(); deadline.has_value()) {
+            // round up, so that at least `deadline` milliseconds will have passed at the next tick
+            const uint64_t deadline_us = deadline.value() * 1000;
+            const uint64_t elapsed_us = timestamp_us() - base_time;
+            timeout_ms = min(timeout_ms, (deadline_us - min(deadline_us, elapsed_us) + 999) / 1000);
+        }
+
+        auto ret = _eventloop.wait_next_event(timeout_ms);
         if (ret == EventLoop::Result::Exit or _abort) {
             break;
         }
 
-        if (_tcp.value().active()) {
-            const auto next_time = timestamp_ms();
-            _tcp.value().tick(next_time - base_time);
-            _datagram_adapter.tick(next_time - base_time);
-            base_time = next_time;
+        const uint64_t elapsed_ms = (timestamp_us() - base_time) / 1000;
+        if (_tcp.value().active() and elapsed_ms > 0) {
+            _tcp.value().tick(elapsed_ms);
+            _datagram_adapter.tick(elapsed_ms);
+            base_time += elapsed_ms * 1000;
         }
     }
 }
@@ -43,13 +62,86 @@ void TCPSpongeSocket<AdaptT>::_tcp_loop(const function<bool()> &condition) {
 //! \param[in] datagram_interface is the interface for reading and writing datagrams
 template <typename AdaptT>
 TCPSpongeSocket<AdaptT>::TCPSpongeSocket(pair<FileDescriptor, FileDescriptor> data_socket_pair,
-                                         AdaptT &&datagram_interface)
+                                         AdaptT &&datagram_interface,
+                                         const DataPath data_path)
     : LocalStreamSocket(move(data_socket_pair.first))
     , _thread_data(move(data_socket_pair.second))
-    , _datagram_adapter(move(datagram_interface)) {
+    , _datagram_adapter(move(datagram_interface))
+    , _rings(data_path == DataPath::SharedRing ? make_unique<SharedRings>() : nullptr) {
     _thread_data.set_blocking(false);
 }
 
+template <typename AdaptT>
+void TCPSpongeSocket<AdaptT>::_outbound_finished() {
+    _tcp->end_input_stream();
+    _outbound_shutdown = true;
+
+    // debugging output:
+    LOG_DEBUG("Outbound stream to " << _datagram_adapter.config().destination.to_string() << " finished ("
+                                    << _tcp.value().bytes_in_flight() << " byte"
+                                    << (_tcp.value().bytes_in_flight() == 1 ? "" : "s") << " still in flight).");
+}
+
+template <typename AdaptT>
+void TCPSpongeSocket<AdaptT>::_inbound_finished() {
+    _inbound_shutdown = true;
+
+    // debugging output:
+    LOG_DEBUG("Inbound stream from " << _datagram_adapter.config().destination.to_string() << " finished "
+                                     << (_tcp->inbound_stream().error() ? "with an error/reset." : "cleanly."));
+    if (_tcp.value().state() == TCPState::State::TIME_WAIT) {
+        LOG_DEBUG("Waiting for lingering segments (e.g. retransmissions of FIN) from peer...");
+    }
+}
+
+//! \details Moves bytes from the owner's ring into the TCPConnection and from the TCPConnection into the
+//! owner's ring until neither can make progress, then arms the rings' wakeups for whichever side is
+//! waiting on the owner. Runs on each pass through the TCP thread's loop, since a wakeup for any reason
+//! (e.g., an ACK that frees outbound capacity) may let bytes move.
+template <typename AdaptT>
+void TCPSpongeSocket<AdaptT>::_pump_rings() {
+    SPSCRing &outbound = _rings->outbound;
+    SPSCRing &inbound = _rings->inbound;
+    ByteStream &received = _tcp->inbound_stream();
+
+    bool progress = true;
+    while (progress) {
+        progress = false;
+
+        // owner -> TCPConnection
+        if (_tcp->active() and not _outbound_shutdown and _tcp->remaining_outbound_capacity() > 0) {
+            const string data = outbound.read(_tcp->remaining_outbound_capacity());
+            if (not data.empty()) {
+                _tcp->write(data);
+                progress = true;
+            } else if (outbound.eof()) {
+                _outbound_finished();
+            } else if (not outbound.arm_data_wait()) {
+                progress = true;
+            }
+        }
+
+        // TCPConnection -> owner (discarding the bytes if the owner has stopped reading)
+        if (not _inbound_shutdown) {
+            const size_t len = inbound.reader_closed() ? received.buffer_size()
+                                                       : min(received.buffer_size(), inbound.remaining_capacity());
+            if (len > 0) {
+                inbound.write(received.peek_output(len));
+                received.pop_output(len);
+                _tcp->window_update();
+                progress = true;
+            }
+
+            if (received.buffer_empty() and (received.eof() or received.error())) {
+                inbound.end_input();
+                _inbound_finished();
+            } else if (not received.buffer_empty() and not inbound.arm_space_wait()) {
+                progress = true;
+            }
+        }
+    }
+}
+
 template <typename AdaptT>
 void TCPSpongeSocket<AdaptT>::_initialize_TCP(const TCPConfig &config) {
     _tcp.emplace(config);
@@ -72,93 +164,87 @@ void TCPSpongeSocket<AdaptT>::_initialize_TCP(const TCPConfig &config) {
     // 4) Outbound segment generated by TCP (needs to be
     //    given to underlying datagram socket)
 
-    // rule 1: read from filtered packet stream and dump into TCPConnection
+    // rule 1: read a burst from filtered packet stream and dump into TCPConnection
     _eventloop.add_rule(_datagram_adapter,
                         Direction::In,
                         [&] {
-                            auto seg = _datagram_adapter.read();
-                            if (seg) {
-                                _tcp->segment_received(move(seg.value()));
+                            _datagram_adapter.read_batch(_inbound_segments);
+                            for (const auto &seg : _inbound_segments) {
+                                _tcp->segment_received(seg);
                             }
+                            _inbound_segments.clear();
 
                             // debugging output:
-                            if (_thread_data.eof() and _tcp.value().bytes_in_flight() == 0 and not _fully_acked) {
-                                cerr << "DEBUG: Outbound stream to "
-                                     << _datagram_adapter.config().destination.to_string()
-                                     << " has been fully acknowledged.\n";
+                            if (_outbound_shutdown and _tcp.value().bytes_in_flight() == 0 and not _fully_acked) {
+                                LOG_DEBUG("Outbound stream to " << _datagram_adapter.config().destination.to_string()
+                                                                << " has been fully acknowledged.");
                                 _fully_acked = true;
                             }
                         },
                         [&] { return _tcp->active(); });
 
-    // rule 2: read from pipe into outbound buffer
-    _eventloop.add_rule(
-        _thread_data,
-        Direction::In,
-        [&] {
-            const auto data = _thread_data.read(_tcp->remaining_outbound_capacity());
-            const auto len = data.size();
-            const auto amount_written = _tcp->write(move(data));
-            if (amount_written != len) {
-                throw runtime_error("TCPConnection::write() accepted less than advertised length");
-            }
-
-            if (_thread_data.eof()) {
-                _tcp->end_input_stream();
-                _outbound_shutdown = true;
-
-                // debugging output:
-                cerr << "DEBUG: Outbound stream to " << _datagram_adapter.config().destination.to_string()
-                     << " finished (" << _tcp.value().bytes_in_flight() << " byte"
-                     << (_tcp.value().bytes_in_flight() == 1 ? "" : "s") << " still in flight).\n";
-            }
-        },
-        [&] { return (_tcp->active()) and (not _outbound_shutdown) and (_tcp->remaining_outbound_capacity() > 0); },
-        [&] {
-            _tcp->end_input_stream();
-            _outbound_shutdown = true;
-        });
-
-    // rule 3: read from inbound buffer into pipe
-    _eventloop.add_rule(
-        _thread_data,
-        Direction::Out,
-        [&] {
-            ByteStream &inbound = _tcp->inbound_stream();
-            // Write from the inbound_stream into
-            // the pipe, handling the possibility of a partial
-            // write (i.e., only pop what was actually written).
-            const size_t amount_to_write = min(size_t(65536), inbound.buffer_size());
-            const std::string buffer = inbound.peek_output(amount_to_write);
-            const auto bytes_written = _thread_data.write(move(buffer), false);
-            inbound.pop_output(bytes_written);
-
-            if (inbound.eof() or inbound.error()) {
-                _thread_data.shutdown(SHUT_WR);
-                _inbound_shutdown = true;
-
-                // debugging output:
-                cerr << "DEBUG: Inbound stream from " << _datagram_adapter.config().destination.to_string()
-                     << " finished " << (inbound.error() ? "with an error/reset.\n" : "cleanly.\n");
-                if (_tcp.value().state() == TCPState::State::TIME_WAIT) {
-                    cerr << "DEBUG: Waiting for lingering segments (e.g. retransmissions of FIN) from peer...\n";
+    if (_rings) {
+        // rules 2 and 3, with DataPath::SharedRing: _pump_rings() moves the bytes on every pass through the
+        // loop, and these rules only wake the loop when the owner has written, ended its stream, or read
+        _eventloop.add_rule(
+            _rings->outbound.data_ready(),
+            Direction::In,
+            [&] { _rings->outbound.data_ready().clear(); },
+            [&] { return _tcp->active() and not _outbound_shutdown; });
+        _eventloop.add_rule(
+            _rings->inbound.space_ready(), Direction::In, [&] { _rings->inbound.space_ready().clear(); }, [&] {
+                return not _inbound_shutdown;
+            });
+    } else {
+        // rule 2: read from pipe into outbound buffer
+        _eventloop.add_receive_rule(
+            _thread_data,
+            [&](const string_view data) {
+                if (not _tcp->active()) {
+                    return;  // read by a request that was in flight when the connection ended
                 }
-            }
-        },
-        [&] {
-            return (not _tcp->inbound_stream().buffer_empty()) or
-                   ((_tcp->inbound_stream().eof() or _tcp->inbound_stream().error()) and not _inbound_shutdown);
-        });
+                const auto amount_written = _tcp->write(string(data));
+                if (amount_written != data.size()) {
+                    throw runtime_error("TCPConnection::write() accepted less than advertised length");
+                }
+            },
+            [&] { return (_tcp->active()) and (not _outbound_shutdown) ? _tcp->remaining_outbound_capacity() : 0; },
+            [&] {
+                // EOF (or closure) of the pipe
+                if (not _outbound_shutdown) {
+                    _outbound_finished();
+                }
+            });
+
+        // rule 3: read from inbound buffer into pipe
+        _eventloop.add_rule(
+            _thread_data,
+            Direction::Out,
+            [&] {
+                ByteStream &inbound = _tcp->inbound_stream();
+                // Write from the inbound_stream into
+                // the pipe, handling the possibility of a partial
+                // write (i.e., only pop what was actually written).
+                const size_t amount_to_write = min(size_t(65536), inbound.buffer_size());
+                const std::string buffer = inbound.peek_output(amount_to_write);
+                const auto bytes_written = _thread_data.write(move(buffer), false);
+                inbound.pop_output(bytes_written);
+
+                if (inbound.eof() or inbound.error()) {
+                    _thread_data.shutdown(SHUT_WR);
+                    _inbound_finished();
+                }
+            },
+            [&] {
+                return (not _tcp->inbound_stream().buffer_empty()) or
+                       ((_tcp->inbound_stream().eof() or _tcp->inbound_stream().error()) and not _inbound_shutdown);
+            });
+    }
 
     // rule 4: read outbound segments from TCPConnection and send as datagrams
     _eventloop.add_rule(_datagram_adapter,
                         Direction::Out,
-                        [&] {
-                            while (not _tcp->segments_out().empty()) {
-                                _datagram_adapter.write(_tcp->segments_out().front());
-                                _tcp->segments_out().pop();
-                            }
-                        },
+                        [&] { _datagram_adapter.write_batch(_tcp->segments_out()); },
                         [&] { return not _tcp->segments_out().empty(); });
 }
 
@@ -172,34 +258,81 @@ static inline pair<FileDescriptor, FileDescriptor> socket_pair_helper(const int
 }
 
 //! \param[in] datagram_interface is the underlying interface (e.g. to UDP, IP, or Ethernet)
+//! \param[in] data_path is how the owner and the TCP thread exchange the stream's bytes
 template <typename AdaptT>
-TCPSpongeSocket<AdaptT>::TCPSpongeSocket(AdaptT &&datagram_interface)
-    : TCPSpongeSocket(socket_pair_helper(SOCK_STREAM), move(datagram_interface)) {}
+TCPSpongeSocket<AdaptT>::TCPSpongeSocket(AdaptT &&datagram_interface, const DataPath data_path)
+    : TCPSpongeSocket(socket_pair_helper(SOCK_STREAM), move(datagram_interface), data_path) {}
 
 template <typename AdaptT>
 TCPSpongeSocket<AdaptT>::~TCPSpongeSocket() {
     try {
         if (_tcp_thread.joinable()) {
-            cerr << "Warning: unclean shutdown of TCPSpongeSocket\n";
+            LOG_WARNING("unclean shutdown of TCPSpongeSocket");
             // force the other side to exit
             _abort.store(true);
             _tcp_thread.join();
         }
     } catch (const exception &e) {
-        cerr << "Exception destructing TCPSpongeSocket: " << e.what() << endl;
+        LOG_ERROR("Exception destructing TCPSpongeSocket: " << e.what());
     }
 }
 
 template <typename AdaptT>
 void TCPSpongeSocket<AdaptT>::wait_until_closed() {
     shutdown(SHUT_RDWR);
+    if (_rings) {
+        _rings->outbound.end_input();
+        _rings->inbound.close_reader();
+    }
     if (_tcp_thread.joinable()) {
-        cerr << "DEBUG: Waiting for clean shutdown... ";
+        LOG_DEBUG("Waiting for clean shutdown...");
         _tcp_thread.join();
-        cerr << "done.\n";
+        LOG_DEBUG("Clean shutdown done.");
     }
 }
 
+//! \param[in] method is the name of the calling method, for the error message
+template <typename AdaptT>
+typename TCPSpongeSocket<AdaptT>::SharedRings &TCPSpongeSocket<AdaptT>::_shared_rings(const char *method) {
+    if (not _rings) {
+        throw runtime_error(string(method) + "() requires DataPath::SharedRing");
+    }
+    return *_rings;
+}
+
+//! \param[in] data is the data to write
+template <typename AdaptT>
+size_t TCPSpongeSocket<AdaptT>::send(const string_view data) {
+    SPSCRing &outbound = _shared_rings("send").outbound;
+    size_t total = 0;
+    while (total < data.size()) {
+        outbound.wait_for_space();
+        if (outbound.reader_closed()) {
+            break;
+        }
+        total += outbound.write(data.substr(total));
+    }
+    return total;
+}
+
+//! \param[in] limit is the most bytes to read
+template <typename AdaptT>
+string TCPSpongeSocket<AdaptT>::recv(const size_t limit) {
+    SPSCRing &inbound = _shared_rings("recv").inbound;
+    inbound.wait_for_data();
+    return inbound.read(limit);
+}
+
+template <typename AdaptT>
+void TCPSpongeSocket<AdaptT>::end_send() {
+    _shared_rings("end_send").outbound.end_input();
+}
+
+template <typename AdaptT>
+bool TCPSpongeSocket<AdaptT>::recv_eof() {
+    return _shared_rings("recv_eof").inbound.eof();
+}
+
 //! \param[in] c_tcp is the TCPConfig for the TCPConnection
 //! \param[in] c_ad is the FdAdapterConfig for the FdAdapter
 template <typename AdaptT>
@@ -212,7 +345,7 @@ void TCPSpongeSocket<AdaptT>::connect(const TCPConfig &c_tcp, const FdAdapterCon
 
     _datagram_adapter.config_mut() = c_ad;
 
-    cerr << "DEBUG: Connecting to " << c_ad.destination.to_string() << "...\n";
+    LOG_DEBUG("Connecting to " << c_ad.destination.to_string() << "...");
     _tcp->connect();
 
     const TCPState expected_state = TCPState::State::SYN_SENT;
@@ -223,7 +356,7 @@ void TCPSpongeSocket<AdaptT>::connect(const TCPConfig &c_tcp, const FdAdapterCon
     }
 
     _tcp_loop([&] { return _tcp->state() == TCPState::State::SYN_SENT; });
-    cerr << "Successfully connected to " << c_ad.destination.to_string() << ".\n";
+    LOG_INFO("Successfully connected to " << c_ad.destination.to_string() << ".");
 
     _tcp_thread = thread(&TCPSpongeSocket::_tcp_main, this);
 }
@@ -241,12 +374,12 @@ void TCPSpongeSocket<AdaptT>::listen_and_accept(const TCPConfig &c_tcp, const Fd
     _datagram_adapter.config_mut() = c_ad;
     _datagram_adapter.set_listening(true);
 
-    cerr << "DEBUG: Listening for incoming connection...\n";
+    LOG_DEBUG("Listening for incoming connection...");
     _tcp_loop([&] {
         const auto s = _tcp->state();
         return (s == TCPState::State::LISTEN or s == TCPState::State::SYN_RCVD or s == TCPState::State::SYN_SENT);
     });
-    cerr << "New connection from " << _datagram_adapter.config().destination.to_string() << ".\n";
+    LOG_INFO("New connection from " << _datagram_adapter.config().destination.to_string() << ".");
 
     _tcp_thread = thread(&TCPSpongeSocket::_tcp_main, this);
 }
@@ -259,13 +392,18 @@ void TCPSpongeSocket<AdaptT>::_tcp_main() {
         }
         _tcp_loop([] { return true; });
         shutdown(SHUT_RDWR);
+        if (_rings) {
+            // unblock an owner waiting in send() or recv()
+            _rings->outbound.close_reader();
+            _rings->inbound.end_input();
+        }
         if (not _tcp.value().active()) {
-            cerr << "DEBUG: TCP connection finished "
-                 << (_tcp.value().state() == TCPState::State::RESET ? "uncleanly" : "cleanly.\n");
+            LOG_DEBUG("TCP connection finished "
+                      << (_tcp.value().state() == TCPState::State::RESET ? "uncleanly." : "cleanly."));
         }
         _tcp.reset();
     } catch (const exception &e) {
-        cerr << "Exception in TCPConnection runner thread: " << e.what() << "\n";
+        LOG_ERROR("Exception in TCPConnection runner thread: " << e.what());
         throw e;
     }
 }
@@ -6,20 +6,39 @@
 #include "fd_adapter.hh"
 #include "file_descriptor.hh"
 #include "network_interface.hh"
+#include "spsc_ring.hh"
 #include "tcp_config.hh"
 #include "tcp_connection.hh"
 #include "tuntap_adapter.hh"
 
 #include <atomic>
 #include <cstdint>
+#include <memory>
 #include <optional>
+#include <string>
+#include <string_view>
 #include <thread>
 #include <vector>
 
 //! Multithreaded wrapper around TCPConnection that approximates the Unix sockets API
 template <typename AdaptT>
 class TCPSpongeSocket : public LocalStreamSocket {
+  public:
+    //! How bytes move between the owner and the TCP thread
+    enum class DataPath {
+        SocketPair,  //!< Through the LocalStreamSocket that the owner reads and writes (the default)
+        SharedRing   //!< Through in-process rings, with send() and recv() (no system call per read or write)
+    };
+
   private:
+    //! The rings of DataPath::SharedRing
+    struct SharedRings {
+        static constexpr size_t CAPACITY = 65536;  //!< Bytes in each ring
+
+        SPSCRing outbound{CAPACITY};  //!< Owner writes, TCP thread reads
+        SPSCRing inbound{CAPACITY};   //!< TCP thread writes, owner reads
+    };
+
     //! Stream socket for reads and writes between owner and TCP thread
     LocalStreamSocket _thread_data;
 
@@ -37,6 +56,9 @@ class TCPSpongeSocket : public LocalStreamSocket {
     //! eventloop that handles all the events (new inbound datagram, new outbound bytes, new inbound bytes)
     EventLoop _eventloop{};
 
+    //! Segments read from the datagram adapter in one wakeup, waiting to be given to the TCPConnection
+    std::vector<TCPSegment> _inbound_segments{};
+
     //! Process events while specified condition is true
     void _tcp_loop(const std::function<bool()> &condition);
 
@@ -47,7 +69,24 @@ class TCPSpongeSocket : public LocalStreamSocket {
     std::thread _tcp_thread{};
 
     //! Construct LocalStreamSocket fds from socket pair, initialize eventloop
-    TCPSpongeSocket(std::pair<FileDescriptor, FileDescriptor> data_socket_pair, AdaptT &&datagram_interface);
+    TCPSpongeSocket(std::pair<FileDescriptor, FileDescriptor> data_socket_pair,
+                    AdaptT &&datagram_interface,
+                    const DataPath data_path);
+
+    //! Rings between owner and TCP thread, with DataPath::SharedRing (otherwise null)
+    std::unique_ptr<SharedRings> _rings;
+
+    //! Move bytes between the rings and the TCPConnection, with DataPath::SharedRing
+    void _pump_rings();
+
+    //! The owner has ended the outbound stream: end the TCPConnection's
+    void _outbound_finished();
+
+    //! The TCPConnection's inbound stream has been handed to the owner in full
+    void _inbound_finished();
+
+    //! Throws unless the socket uses DataPath::SharedRing
+    SharedRings &_shared_rings(const char *method);
 
     std::atomic_bool _abort{false};  //!< Flag used by the owner to force the TCPConnection thread to shut down
 
@@ -59,7 +98,7 @@ class TCPSpongeSocket : public LocalStreamSocket {
 
   public:
     //! Construct from the interface that the TCPConnection thread will use to read and write datagrams
-    explicit TCPSpongeSocket(AdaptT &&datagram_interface);
+    explicit TCPSpongeSocket(AdaptT &&datagram_interface, const DataPath data_path = DataPath::SocketPair);
 
     //! Close socket, and wait for TCPConnection to finish
     //! \note Calling this function is only advisable if the socket has reached EOF,
@@ -72,6 +111,25 @@ class TCPSpongeSocket : public LocalStreamSocket {
     //! Listen and accept using the specified configurations; blocks until accept succeeds or fails
     void listen_and_accept(const TCPConfig &c_tcp, const FdAdapterConfig &c_ad);
 
+    //! \name
+    //! With DataPath::SharedRing, the owner moves data with these instead of read() and write()
+
+    //!@{
+
+    //! Write all of `data`, blocking while the outbound ring is full; returns the number of bytes written
+    //! (less than all only if the connection has closed)
+    size_t send(const std::string_view data);
+
+    //! Read up to `limit` bytes, blocking until there are some; returns an empty string at EOF
+    std::string recv(const size_t limit = 65536);
+
+    //! Shut down the outbound stream (like [shutdown(2)](\ref man2::shutdown) with SHUT_WR)
+    void end_send();
+
+    //! Has the inbound stream ended, and has all of it been read?
+    bool recv_eof();
+    //!@}
+
     //! When a connected socket is destructed, it will send a RST
     ~TCPSpongeSocket();
 
@@ -122,6 +180,12 @@ using LossyTCPOverIPv4SpongeSocket = TCPSpongeSocket<LossyTCPOverIPv4OverTunFdAd
 //!   and [accept(2)](\ref man2::accept)
 //! - if TCPSpongeSocket is destructed while a TCP connection is open, the connection is
 //!   immediately terminated with a RST (call `wait_until_closed` to avoid this)
+//!
+//! By default, the two threads exchange the stream's bytes through a pair of connected
+//! sockets, so the owner can use the TCPSpongeSocket wherever a FileDescriptor is expected
+//! (e.g., in its own EventLoop). With DataPath::SharedRing, they use a pair of SPSCRing
+//! objects instead: the owner calls send() and recv(), which copy bytes into or out of
+//! shared memory and only make a system call (to an eventfd) when the other thread is asleep.
 
 //! Helper class that makes a TCPOverIPv4SpongeSocket behave more like a (kernel) TCPSocket
 class CS144TCPSocket : public TCPOverIPv4SpongeSocket {
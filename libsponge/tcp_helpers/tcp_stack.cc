@@ -0,0 +1,448 @@
+#include "tcp_stack.hh"
+
+#include "util.hh"
+
+#include <algorithm>
+#include <stdexcept>
+#include <utility>
+
+using namespace std;
+
+//! \param[in] adapter is the adapter that all connections share
+//! \param[in] tcp_config is the configuration of each new connection
+//! \param[in] adapter_config is the configuration of the adapter; its source is the local address
+template <typename AdaptT>
+TCPStack<AdaptT>::TCPStack(AdaptT &&adapter, const TCPConfig &tcp_config, const FdAdapterConfig &adapter_config)
+    : _adapter(move(adapter))
+    , _tcp_config(tcp_config)
+    , _local_address(adapter_config.source)
+    , _now_ms(timestamp_ms())
+    , _adapter_tick_ms(_now_ms)
+    , _rand(get_random_generator()) {
+    _adapter.config_mut() = adapter_config;
+
+    _eventloop.add_rule(_adapter, Direction::In, [&] {
+        _adapter.demux_read_batch(_inbound);
+        deliver(_inbound);
+    });
+}
+
+template <typename AdaptT>
+void TCPStack<AdaptT>::deliver(vector<DemuxedSegment> &segments) {
+    _now_ms = timestamp_ms();
+    for (auto &inbound : segments) {
+        receive(inbound);
+    }
+    segments.clear();
+}
+
+template <typename AdaptT>
+void TCPStack<AdaptT>::set_affinity(function<bool(const FourTuple &)> claim,
+                                    function<void(const FourTuple &)> release,
+                                    function<bool(DemuxedSegment &)> forward) {
+    _claim = move(claim);
+    _release = move(release);
+    _forward = move(forward);
+}
+
+template <typename AdaptT>
+typename TCPStack<AdaptT>::Connection &TCPStack<AdaptT>::connection(const FourTuple &tuple) {
+    const auto it = _connections.find(tuple);
+    if (it == _connections.end()) {
+        throw runtime_error("TCPStack: no connection " + tuple.to_string());
+    }
+    return it->second;
+}
+
+template <typename AdaptT>
+void TCPStack<AdaptT>::advance(Connection &conn) {
+    if (_now_ms > conn.last_tick_ms) {
+        conn.tcp.tick(_now_ms - conn.last_tick_ms);
+        conn.last_tick_ms = _now_ms;
+    }
+}
+
+template <typename AdaptT>
+void TCPStack<AdaptT>::touch(const FourTuple &tuple, Connection &conn) {
+    if (not conn.touched) {
+        conn.touched = true;
+        _touched.push_back(tuple);
+    }
+}
+
+//! \param[in,out] inbound is the segment, and the connection that the adapter says it belongs to
+//! \details A segment for a connection that is not in the table, and that belongs to another stack, is
+//! forwarded there. A SYN for a listening port whose backlog is full is dropped, so the peer will retry it
+//! later, as Linux does. A segment for no connection and no listener is answered with a RST.
+template <typename AdaptT>
+void TCPStack<AdaptT>::receive(DemuxedSegment &inbound) {
+    const FourTuple &tuple = inbound.first;
+    const TCPSegment &seg = inbound.second;
+    auto it = _connections.find(tuple);
+    if (it == _connections.end()) {
+        if (_forward and _forward(inbound)) {
+            TCPStackCounters::add(_counters.segments_forwarded);
+            return;
+        }
+
+        const TCPHeader &header = seg.header();
+        const auto listener = _listeners.find(tuple.local_port);
+        if (header.syn and not header.ack and not header.rst and listener != _listeners.end()) {
+            Listener &l = listener->second;
+            if (l.pending + l.accepted.size() >= l.backlog) {
+                return;
+            }
+            if (_claim and not _claim(tuple)) {
+                // another stack took the connection since _forward looked (e.g. for a retransmitted SYN)
+                if (_forward(inbound)) {
+                    TCPStackCounters::add(_counters.segments_forwarded);
+                }
+                return;
+            }
+            l.pending++;
+            it = _connections
+                     .emplace(tuple,
+                              Connection{TCPConnection{_tcp_config},
+                                         tuple.local_address(),
+                                         tuple.remote_address(),
+                                         _now_ms,
+                                         {},
+                                         tuple.local_port,
+                                         false,
+                                         false})
+                     .first;
+        } else {
+            if (not header.rst) {
+                TCPStackCounters::add(_counters.segments_received);
+                send_reset(tuple, seg);
+            }
+            return;
+        }
+    }
+
+    TCPStackCounters::add(_counters.segments_received);
+    Connection &conn = it->second;
+    advance(conn);
+    conn.tcp.segment_received(seg);
+    if (conn.closed) {
+        ByteStream &unread = conn.tcp.inbound_stream();
+        unread.pop_output(unread.buffer_size());
+    }
+    touch(tuple, conn);
+}
+
+//! \param[in] tuple is the connection that the segment was addressed to
+//! \param[in] seg is the segment (which must not itself be a RST)
+//! \details The RST is built as in RFC 793 (section 3.4, "Reset Generation"), so that the peer accepts it.
+template <typename AdaptT>
+void TCPStack<AdaptT>::send_reset(const FourTuple &tuple, const TCPSegment &seg) {
+    TCPSegment rst;
+    rst.header().rst = true;
+    if (seg.header().ack) {
+        rst.header().seqno = seg.header().ackno;
+    } else {
+        rst.header().ack = true;
+        rst.header().ackno = seg.header().seqno + seg.length_in_sequence_space();
+    }
+
+    TCPStackCounters::add(_counters.resets_sent);
+    queue<TCPSegment> segments;
+    segments.push(move(rst));
+    send(tuple.local_address(), tuple.remote_address(), segments);
+}
+
+//! \param[in] local is the source address for the segments
+//! \param[in] remote is the destination address for the segments
+//! \param[in,out] segments are the segments to write; the queue is empty on return
+//! \details The adapters address what they write according to their configuration, so it is pointed at
+//! the connection before each batch. This keeps the adapters' batching (e.g., UDP GSO) per connection.
+template <typename AdaptT>
+void TCPStack<AdaptT>::send(const Address &local, const Address &remote, queue<TCPSegment> &segments) {
+    FdAdapterConfig &config = _adapter.config_mut();
+    config.source = local;
+    config.destination = remote;
+    TCPStackCounters::add(_counters.segments_sent, segments.size());
+    _adapter.write_batch(segments);
+}
+
+template <typename AdaptT>
+void TCPStack<AdaptT>::run_deadlines() {
+    while (not _deadlines.empty() and _deadlines.top().when_ms <= _now_ms) {
+        const Deadline deadline = _deadlines.top();
+        _deadlines.pop();
+
+        const auto it = _connections.find(deadline.tuple);
+        if (it == _connections.end() or it->second.deadline_ms != deadline.when_ms) {
+            continue;  // stale
+        }
+
+        Connection &conn = it->second;
+        conn.deadline_ms.reset();
+        advance(conn);
+        touch(deadline.tuple, conn);
+    }
+}
+
+//! \details A connection that arrived on a listening port stays out of the accept queue until it
+//! leaves SYN_RCVD. A connection is deleted once its Stream is closed and it is no longer active, or if
+//! it dies before it is accepted.
+template <typename AdaptT>
+void TCPStack<AdaptT>::flush() {
+    for (const FourTuple &tuple : _touched) {
+        const auto it = _connections.find(tuple);
+        if (it == _connections.end()) {
+            continue;
+        }
+
+        Connection &conn = it->second;
+        conn.touched = false;
+        if (not conn.tcp.segments_out().empty()) {
+            send(conn.local, conn.remote, conn.tcp.segments_out());
+        }
+
+        if (conn.listen_port.has_value()) {
+            Listener &listener = _listeners.at(conn.listen_port.value());
+            if (not conn.tcp.active()) {
+                listener.pending--;
+                remove(it);
+                continue;
+            }
+            if (conn.tcp.state() != TCPState::State::SYN_RCVD) {
+                listener.pending--;
+                listener.accepted.push_back(tuple);
+                conn.listen_port.reset();
+                TCPStackCounters::add(_counters.connections_accepted);
+            }
+        }
+
+        if (conn.closed and not conn.tcp.active()) {
+            remove(it);
+            continue;
+        }
+
+        const auto next = conn.tcp.next_deadline();
+        const optional<uint64_t> deadline_ms =
+            next.has_value() ? optional<uint64_t>{conn.last_tick_ms + next.value()} : nullopt;
+        if (deadline_ms != conn.deadline_ms) {
+            conn.deadline_ms = deadline_ms;
+            if (deadline_ms.has_value()) {
+                _deadlines.push({deadline_ms.value(), tuple});
+            }
+        }
+
+        _ready.push_back(tuple);
+    }
+    _touched.clear();
+}
+
+//! \param[in] it is the connection
+template <typename AdaptT>
+void TCPStack<AdaptT>::remove(const typename ConnectionTable::iterator it) {
+    if (_release) {
+        _release(it->first);
+    }
+    _connections.erase(it);
+    TCPStackCounters::add(_counters.connections_removed);
+}
+
+//! \param[in] remote is the connection to pick a port for, with any local port
+//! \returns the configured local port if there is one, else a free port from the ephemeral range,
+//!          searched from a random starting point, for which this stack can claim the connection
+template <typename AdaptT>
+uint16_t TCPStack<AdaptT>::pick_local_port(const FourTuple &remote) {
+    FourTuple tuple = remote;
+    if (_local_address.port() != 0) {
+        tuple.local_port = _local_address.port();
+        if (_connections.count(tuple)) {
+            throw runtime_error("TCPStack: already connected: " + tuple.to_string());
+        }
+        if (_claim and not _claim(tuple)) {
+            throw runtime_error("TCPStack: connection belongs to another stack: " + tuple.to_string());
+        }
+        return tuple.local_port;
+    }
+
+    constexpr unsigned PORT_COUNT = 65536 - EPHEMERAL_PORT_FIRST;
+    const unsigned start = _rand() % PORT_COUNT;
+    for (unsigned i = 0; i < PORT_COUNT; i++) {
+        tuple.local_port = EPHEMERAL_PORT_FIRST + (start + i) % PORT_COUNT;
+        const bool free = not _connections.count(tuple) and not _listeners.count(tuple.local_port);
+        if (free and (not _claim or _claim(tuple))) {
+            return tuple.local_port;
+        }
+    }
+    throw runtime_error("TCPStack: no free ephemeral port to " + remote.remote_address().to_string());
+}
+
+template <typename AdaptT>
+void TCPStack<AdaptT>::close(const FourTuple &tuple) {
+    Connection &conn = connection(tuple);
+    advance(conn);
+    conn.closed = true;
+    if (conn.tcp.active()) {
+        conn.tcp.end_input_stream();
+    }
+    ByteStream &inbound = conn.tcp.inbound_stream();
+    inbound.pop_output(inbound.buffer_size());
+    touch(tuple, conn);
+}
+
+//! \param[in] port is the local port
+//! \param[in] backlog is the limit on connections that have arrived but not yet been accepted
+//! \note Over UDP, connections are identified by UDP ports, so only the adapter's own port can be listened on.
+template <typename AdaptT>
+void TCPStack<AdaptT>::listen(const uint16_t port, const size_t backlog) {
+    if (not _listeners.emplace(port, Listener{backlog, 0}).second) {
+        throw runtime_error("TCPStack: already listening on port " + to_string(port));
+    }
+}
+
+//! \param[in] port is a port that is being listened on
+template <typename AdaptT>
+optional<typename TCPStack<AdaptT>::Stream> TCPStack<AdaptT>::accept(const uint16_t port) {
+    const auto listener = _listeners.find(port);
+    if (listener == _listeners.end()) {
+        throw runtime_error("TCPStack: not listening on port " + to_string(port));
+    }
+
+    deque<FourTuple> &accepted = listener->second.accepted;
+    if (accepted.empty()) {
+        return {};
+    }
+    const FourTuple tuple = accepted.front();
+    accepted.pop_front();
+    return Stream(*this, tuple);
+}
+
+//! \param[in] destination is the address and port of the peer
+template <typename AdaptT>
+typename TCPStack<AdaptT>::Stream TCPStack<AdaptT>::connect(const Address &destination) {
+    _now_ms = timestamp_ms();
+
+    FourTuple tuple = FourTuple::from_addresses(_local_address, destination);
+    tuple.local_port = pick_local_port(tuple);
+
+    Connection &conn =
+        _connections
+            .emplace(tuple,
+                     Connection{
+                         TCPConnection{_tcp_config}, tuple.local_address(), destination, _now_ms, {}, {}, false, false})
+            .first->second;
+    conn.tcp.connect();
+    touch(tuple, conn);
+    TCPStackCounters::add(_counters.connections_opened);
+    return {*this, tuple};
+}
+
+//! \param[in] timeout_ms is the longest time to wait (negative: until the next deadline, or forever)
+template <typename AdaptT>
+EventLoop::Result TCPStack<AdaptT>::wait_next_event(const int timeout_ms) {
+    _now_ms = timestamp_ms();
+    flush();
+    _ready.clear();
+
+    // drop stale timer entries, so the wait is not cut short by a deadline that has since moved
+    while (not _deadlines.empty()) {
+        const Deadline &top = _deadlines.top();
+        const auto it = _connections.find(top.tuple);
+        if (it != _connections.end() and it->second.deadline_ms == top.when_ms) {
+            break;
+        }
+        _deadlines.pop();
+    }
+
+    int timeout = timeout_ms;
+    if (not _deadlines.empty()) {
+        const uint64_t when_ms = _deadlines.top().when_ms;
+        const int until_deadline = when_ms > _now_ms ? static_cast<int>(when_ms - _now_ms) : 0;
+        timeout = timeout < 0 ? until_deadline : min(timeout, until_deadline);
+    }
+
+    const auto result = _eventloop.wait_next_event(timeout);
+
+    _now_ms = timestamp_ms();
+    if (_now_ms > _adapter_tick_ms) {
+        _adapter.tick(_now_ms - _adapter_tick_ms);
+        _adapter_tick_ms = _now_ms;
+    }
+    run_deadlines();
+    flush();
+
+    if (result == EventLoop::Result::Exit) {
+        return result;
+    }
+    return _ready.empty() ? EventLoop::Result::Timeout : EventLoop::Result::Success;
+}
+
+template <typename AdaptT>
+TCPConnection &TCPStack<AdaptT>::Stream::tcp() {
+    if (not _stack) {
+        throw runtime_error("TCPStack::Stream: closed");
+    }
+    Connection &conn = _stack->connection(_tuple);
+    _stack->advance(conn);
+    return conn.tcp;
+}
+
+//! \param[in] data is the data to write
+template <typename AdaptT>
+size_t TCPStack<AdaptT>::Stream::write(const string &data) {
+    TCPConnection &conn = tcp();
+    const size_t written = conn.write(data);
+    _stack->touch(_tuple, _stack->connection(_tuple));
+    return written;
+}
+
+//! \param[in] limit is the most bytes to read
+//! \details If the read reopens a receive window that had closed, the connection sends a window update.
+template <typename AdaptT>
+string TCPStack<AdaptT>::Stream::read(const size_t limit) {
+    TCPConnection &conn = tcp();
+    ByteStream &inbound = conn.inbound_stream();
+    string data = inbound.read(min(limit, inbound.buffer_size()));
+    conn.window_update();
+    if (not conn.segments_out().empty()) {
+        _stack->touch(_tuple, _stack->connection(_tuple));
+    }
+    return data;
+}
+
+template <typename AdaptT>
+void TCPStack<AdaptT>::Stream::end_input() {
+    tcp().end_input_stream();
+    _stack->touch(_tuple, _stack->connection(_tuple));
+}
+
+template <typename AdaptT>
+void TCPStack<AdaptT>::Stream::close() {
+    if (_stack) {
+        _stack->close(_tuple);
+        _stack = nullptr;
+    }
+}
+
+template <typename AdaptT>
+typename TCPStack<AdaptT>::Stream &TCPStack<AdaptT>::Stream::operator=(Stream &&other) noexcept {
+    if (this != &other) {
+        close();
+        _stack = other._stack;
+        _tuple = other._tuple;
+        other._stack = nullptr;
+    }
+    return *this;
+}
+
+//! Specialization of TCPStack for TCPOverUDPSocketAdapter
+template class TCPStack<TCPOverUDPSocketAdapter>;
+
+//! Specialization of TCPStack for TCPOverIPv4OverTunFdAdapter
+template class TCPStack<TCPOverIPv4OverTunFdAdapter>;
+
+//! Specialization of TCPStack for TCPOverIPv4OverEthernetAdapter
+template class TCPStack<TCPOverIPv4OverEthernetAdapter>;
+
+//! Specialization of TCPStack for LossyTCPOverUDPSocketAdapter
+template class TCPStack<LossyTCPOverUDPSocketAdapter>;
+
+//! Specialization of TCPStack for LossyTCPOverIPv4OverTunFdAdapter
+template class TCPStack<LossyTCPOverIPv4OverTunFdAdapter>;
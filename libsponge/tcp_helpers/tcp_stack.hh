@@ -0,0 +1,279 @@
+#ifndef SPONGE_LIBSPONGE_TCP_STACK_HH
+#define SPONGE_LIBSPONGE_TCP_STACK_HH
+
+#include "eventloop.hh"
+#include "fd_adapter.hh"
+#include "four_tuple.hh"
+#include "tcp_config.hh"
+#include "tcp_connection.hh"
+#include "tcp_state.hh"
+#include "tuntap_adapter.hh"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <limits>
+#include <optional>
+#include <queue>
+#include <random>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+//! \brief Event counts of a TCPStack
+//! \details Written only by the thread that drives the stack, so any thread may read them.
+struct TCPStackCounters {
+    std::atomic<uint64_t> segments_received{0};     //!< Segments handed to a connection or answered with a RST
+    std::atomic<uint64_t> segments_sent{0};         //!< Segments given to the adapter, including RSTs
+    std::atomic<uint64_t> segments_forwarded{0};    //!< Segments handed to another stack (see TCPStack::set_affinity)
+    std::atomic<uint64_t> resets_sent{0};           //!< RSTs sent for segments that belonged to no connection
+    std::atomic<uint64_t> connections_opened{0};    //!< Connections started by TCPStack::connect
+    std::atomic<uint64_t> connections_accepted{0};  //!< Connections to listening ports that completed the handshake
+    std::atomic<uint64_t> connections_removed{0};   //!< Connections deleted from the table
+
+    //! Add `n` to a counter (a plain load and store, since there is only one writer)
+    static void add(std::atomic<uint64_t> &counter, const uint64_t n = 1) {
+        counter.store(counter.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+};
+
+//! \brief Many TCPConnections over one adapter, driven by one thread
+template <typename AdaptT>
+class TCPStack {
+  public:
+    class Stream;
+
+    static constexpr size_t DEFAULT_BACKLOG = 128;        //!< Default limit on connections waiting to be accepted
+    static constexpr uint16_t EPHEMERAL_PORT_FIRST = 49152;  //!< Lowest port that connect() picks (RFC 6335)
+
+  private:
+    //! \brief A TCPConnection, and what the stack knows about it
+    struct Connection {
+        TCPConnection tcp;                     //!< The connection itself
+        Address local;                         //!< Source address for the adapter when sending
+        Address remote;                        //!< Destination address for the adapter when sending
+        uint64_t last_tick_ms;                 //!< When the connection was last told that time had passed
+        std::optional<uint64_t> deadline_ms;   //!< When the connection next needs a tick (absolute)
+        std::optional<uint16_t> listen_port;   //!< Port of the listener, until the connection is accepted
+        bool touched;                          //!< Is the connection in TCPStack::_touched?
+        bool closed;                           //!< Has the owner closed its Stream?
+    };
+
+    //! \brief A passive-open port
+    struct Listener {
+        size_t backlog;                     //!< Limit on connections that are neither accepted nor dead
+        size_t pending;                     //!< Connections still in the handshake
+        std::deque<FourTuple> accepted{};   //!< Established connections, waiting for accept()
+    };
+
+    //! \brief An entry in the timer queue; stale if it no longer matches Connection::deadline_ms
+    struct Deadline {
+        uint64_t when_ms;  //!< Absolute time
+        FourTuple tuple;   //!< Connection to tick
+
+        bool operator>(const Deadline &other) const { return when_ms > other.when_ms; }
+    };
+
+    using ConnectionTable = std::unordered_map<FourTuple, Connection, FourTupleHash>;
+
+    AdaptT _adapter;         //!< The one adapter that all connections share
+    TCPConfig _tcp_config;   //!< Configuration of new connections
+    Address _local_address;  //!< Local address; a port of 0 means "pick an ephemeral port for each connect()"
+
+    ConnectionTable _connections{};                      //!< All connections, by 4-tuple
+    std::unordered_map<uint16_t, Listener> _listeners{};  //!< Listening ports
+    std::priority_queue<Deadline, std::vector<Deadline>, std::greater<Deadline>> _deadlines{};  //!< Timer queue
+
+    std::vector<FourTuple> _touched{};        //!< Connections that may have segments to send or a new deadline
+    std::vector<FourTuple> _ready{};          //!< Connections with events during the last wait_next_event
+    std::vector<DemuxedSegment> _inbound{};   //!< Segments read from the adapter in one wakeup
+
+    std::function<bool(const FourTuple &)> _claim{};    //!< Takes a new connection for this stack (see set_affinity)
+    std::function<void(const FourTuple &)> _release{};  //!< Gives up a connection that this stack took
+    std::function<bool(DemuxedSegment &)> _forward{};   //!< Takes segments for connections of other stacks
+    TCPStackCounters _counters{};                       //!< Event counts
+
+    EventLoop _eventloop{};        //!< Waits for the adapter to become readable
+    uint64_t _now_ms;              //!< Time as of the current wakeup
+    uint64_t _adapter_tick_ms;     //!< When the adapter was last told that time had passed
+    std::mt19937 _rand;            //!< Chooses where the search for a free ephemeral port starts
+
+    //! The connection with the given 4-tuple; throws if there is none
+    Connection &connection(const FourTuple &tuple);
+
+    //! Brings a connection's clock up to date, so it can be given new segments or data
+    void advance(Connection &conn);
+
+    //! Records that a connection needs to be looked at before the next wait
+    void touch(const FourTuple &tuple, Connection &conn);
+
+    //! Delivers one inbound segment, creating a connection if it is a SYN to a listening port
+    void receive(DemuxedSegment &inbound);
+
+    //! Answers a segment that belongs to no connection with a RST
+    void send_reset(const FourTuple &tuple, const TCPSegment &seg);
+
+    //! Writes a queue of segments with the adapter addressed as given
+    void send(const Address &local, const Address &remote, std::queue<TCPSegment> &segments);
+
+    //! Ticks every connection whose deadline has passed
+    void run_deadlines();
+
+    //! Sends what the touched connections queued, updates their deadlines, and retires dead connections
+    void flush();
+
+    //! Deletes a connection from the table, giving it up (see set_affinity)
+    void remove(const typename ConnectionTable::iterator it);
+
+    //! Picks a local port for a new connection to `remote`
+    uint16_t pick_local_port(const FourTuple &remote);
+
+    //! Closes the Stream for a connection: ends its outbound stream and lets it be deleted once it is done
+    void close(const FourTuple &tuple);
+
+  public:
+    //! \brief Construct from the adapter that all connections will share
+    TCPStack(AdaptT &&adapter, const TCPConfig &tcp_config, const FdAdapterConfig &adapter_config);
+
+    //! Accept connections to `port`, queueing up to `backlog` of them until accept() is called
+    void listen(const uint16_t port, const size_t backlog = DEFAULT_BACKLOG);
+
+    //! Take the oldest established connection to `port`, if there is one
+    std::optional<Stream> accept(const uint16_t port);
+
+    //! Start connecting to `destination` (the handshake completes during later calls to wait_next_event)
+    Stream connect(const Address &destination);
+
+    //! \brief Send pending segments, then wait for inbound segments or the next deadline, and handle them
+    //! \returns Result::Success if any connection had an event (see ready()), Result::Timeout if not,
+    //!          or Result::Exit if the wait was interrupted by a signal
+    EventLoop::Result wait_next_event(const int timeout_ms);
+
+    //! \brief Hand inbound segments to their connections, as if they had been read from the adapter
+    //! \param[in,out] segments are the segments, with their connections; the vector is empty on return
+    void deliver(std::vector<DemuxedSegment> &segments);
+
+    //! \brief Share the space of connections with other stacks (e.g., one per thread)
+    //! \param[in] claim records that a new connection belongs to this stack, or returns `false` if it
+    //!                  already belongs to another stack
+    //! \param[in] release records that a connection that this stack claimed has been deleted
+    //! \param[in] forward moves an inbound segment to the stack that its connection belongs to, or returns
+    //!                    `false` if no other stack has it
+    //! \details A SYN to a listening port, and connect(), claim the new connection for the stack that
+    //! creates it, so a connection stays with the stack whose adapter received its SYN (or that opened it).
+    //! Only a segment for a connection that is not in the table is offered to `forward`.
+    void set_affinity(std::function<bool(const FourTuple &)> claim,
+                      std::function<void(const FourTuple &)> release,
+                      std::function<bool(DemuxedSegment &)> forward);
+
+    //! Connections that had inbound segments or timer events during the last wait_next_event
+    const std::vector<FourTuple> &ready() const { return _ready; }
+
+    //! Number of connections in the table (including ones that are lingering or not yet accepted)
+    size_t connection_count() const { return _connections.size(); }
+
+    //! Access the adapter
+    AdaptT &adapter() { return _adapter; }
+
+    //! The EventLoop that wait_next_event waits in, e.g., to add rules that feed deliver()
+    EventLoop &eventloop() { return _eventloop; }
+
+    //! Event counts
+    const TCPStackCounters &counters() const { return _counters; }
+
+    //! \name
+    //! The event loop holds pointers to the stack, so it can be neither copied nor moved
+    //!@{
+    TCPStack(const TCPStack &other) = delete;
+    TCPStack &operator=(const TCPStack &other) = delete;
+    //!@}
+};
+
+//! \brief The owner's handle on one connection of a TCPStack
+//! \details Like a connected socket: bytes written are sent, bytes received can be read. Destroying (or
+//! close()ing) the Stream ends the outbound stream, discards further inbound bytes, and lets the stack
+//! delete the connection once it has finished. A Stream must not outlive its TCPStack.
+template <typename AdaptT>
+class TCPStack<AdaptT>::Stream {
+  private:
+    TCPStack *_stack;   //!< The stack that owns the connection (or `nullptr` once closed or moved from)
+    FourTuple _tuple;   //!< The connection's key in the stack
+
+    friend class TCPStack;
+
+    Stream(TCPStack &stack, const FourTuple &tuple) : _stack(&stack), _tuple(tuple) {}
+
+    //! The connection, brought up to date
+    TCPConnection &tcp();
+
+  public:
+    //! The connection's addresses
+    const FourTuple &tuple() const { return _tuple; }
+
+    //! Write as much of `data` as the outbound stream has room for; returns the number of bytes written
+    size_t write(const std::string &data);
+
+    //! Read up to `limit` bytes that have arrived in order
+    std::string read(const size_t limit = std::numeric_limits<size_t>::max());
+
+    //! End the outbound stream (like [shutdown(2)](\ref man2::shutdown) with SHUT_WR)
+    void end_input();
+
+    //! Number of bytes that write() would accept now
+    size_t remaining_outbound_capacity() { return tcp().remaining_outbound_capacity(); }
+
+    //! Number of bytes that read() would return now
+    size_t bytes_available() { return tcp().inbound_stream().buffer_size(); }
+
+    //! Has the peer ended its stream, and has all of it been read?
+    bool eof() { return tcp().inbound_stream().eof(); }
+
+    //! Is the connection still alive in any way? (see TCPConnection::active)
+    bool active() { return tcp().active(); }
+
+    //! Summary of the connection's state
+    TCPState state() { return tcp().state(); }
+
+    //! Close the Stream now, rather than on destruction
+    void close();
+
+    //! Closes the Stream
+    ~Stream() { close(); }
+
+    //! \name
+    //! A Stream can be moved, but not copied
+    //!@{
+    Stream(Stream &&other) noexcept : _stack(other._stack), _tuple(other._tuple) { other._stack = nullptr; }
+    Stream &operator=(Stream &&other) noexcept;
+    Stream(const Stream &other) = delete;
+    Stream &operator=(const Stream &other) = delete;
+    //!@}
+};
+
+using TCPOverUDPStack = TCPStack<TCPOverUDPSocketAdapter>;
+using TCPOverIPv4Stack = TCPStack<TCPOverIPv4OverTunFdAdapter>;
+using TCPOverIPv4OverEthernetStack = TCPStack<TCPOverIPv4OverEthernetAdapter>;
+
+using LossyTCPOverUDPStack = TCPStack<LossyTCPOverUDPSocketAdapter>;
+using LossyTCPOverIPv4Stack = TCPStack<LossyTCPOverIPv4OverTunFdAdapter>;
+
+//! \class TCPStack
+//! Where each TCPSpongeSocket runs one TCPConnection on its own thread with its own adapter and
+//! EventLoop, a TCPStack runs any number of connections on the caller's thread, over one adapter.
+//! Inbound segments are read in batches (see e.g. TCPOverUDPSocketAdapter::demux_read_batch) and handed
+//! to the connection with the matching 4-tuple, found in a hash table. A SYN to a port that is being
+//! listen()ed on creates a connection, which accept() hands out once the handshake completes; a segment
+//! for no connection is answered with a RST.
+//!
+//! The owner calls wait_next_event() in a loop and then looks at the ready() connections, reading from
+//! and writing to their Stream handles. Time is tracked per connection: a connection is ticked only when
+//! its own next deadline (see TCPConnection::next_deadline) comes up, or when it is about to be given a
+//! segment or data, so idle connections cost nothing.
+//!
+//! Over UDP, a connection is identified by the peer's UDP address, and every connection uses the local
+//! UDP port. Over IPv4, connect() picks a free ephemeral port for each connection, unless the configured
+//! source address has a port.
+
+#endif  // SPONGE_LIBSPONGE_TCP_STACK_HH
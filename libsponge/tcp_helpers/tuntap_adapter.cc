@@ -1,7 +1,119 @@
 #include "tuntap_adapter.hh"
 
+#include "util.hh"
+
+#include <cstring>
+
 using namespace std;
 
+static constexpr size_t MAX_OFFLOAD_FRAME = 65536 + 64;  //!< Room for a 64 KiB super-segment and its headers
+
+static uint16_t read_u16(const string &frame, const size_t offset) {
+    return (uint8_t(frame.at(offset)) << 8) | uint8_t(frame.at(offset + 1));
+}
+
+static void write_u16(string &frame, const size_t offset, const uint16_t value) {
+    frame.at(offset) = char(value >> 8);
+    frame.at(offset + 1) = char(value & 0xff);
+}
+
+//! \brief Strips the virtio-net header from `frame` and completes a checksum the kernel left partial
+//! \returns the frame after the header (without moving it), or an empty Buffer if the frame is malformed
+static Buffer strip_vnet_hdr(string &&frame) {
+    if (frame.size() < TunTapFD::VNET_HDR_LEN) {
+        return {};
+    }
+    TunTapFD::VnetHeader vnet{};
+    memcpy(&vnet, frame.data(), sizeof(vnet));
+
+    if (vnet.flags & TunTapFD::VnetHeader::F_NEEDS_CSUM) {
+        // The checksum field holds the pseudo-header sum; sum everything from csum_start on top of it
+        const size_t csum_start = TunTapFD::VNET_HDR_LEN + vnet.csum_start;
+        const size_t csum_at = csum_start + vnet.csum_offset;
+        if (csum_start >= frame.size() or csum_at + 2 > frame.size()) {
+            return {};
+        }
+        InternetChecksum check;
+        check.add({frame.data() + csum_start, frame.size() - csum_start});
+        write_u16(frame, csum_at, check.value());
+    }
+
+    Buffer stripped{move(frame)};
+    stripped.remove_prefix(TunTapFD::VNET_HDR_LEN);
+    return stripped;
+}
+
+//! \brief Builds the virtio-net header for an outgoing frame
+//! \details A frame carrying more than TCPConfig::MAX_PAYLOAD_SIZE bytes of TCP payload can only be the
+//! result of coalesce(), so it is marked for segmentation into TCPConfig::MAX_PAYLOAD_SIZE-byte segments,
+//! and its TCP checksum is replaced by the pseudo-header sum that the kernel expects to complete.
+static string make_vnet_hdr(string &frame) {
+    TunTapFD::VnetHeader vnet{};
+    vnet.gso_type = TunTapFD::VnetHeader::GSO_NONE;
+
+    const size_t ip_at = EthernetHeader::LENGTH;
+    if (frame.size() >= ip_at + IPv4Header::LENGTH and read_u16(frame, 12) == EthernetHeader::TYPE_IPv4 and
+        uint8_t(frame[ip_at + 9]) == IPv4Header::PROTO_TCP) {
+        const size_t tcp_at = ip_at + 4 * (frame[ip_at] & 0x0f);
+        const size_t ip_len = read_u16(frame, ip_at + 2);
+        if (tcp_at + TCPHeader::LENGTH <= frame.size() and ip_at + ip_len <= frame.size()) {
+            const size_t tcp_len = ip_at + ip_len - tcp_at;
+            const size_t header_len = 4 * (uint8_t(frame[tcp_at + 12]) >> 4);
+            if (tcp_len > header_len + TCPConfig::MAX_PAYLOAD_SIZE) {
+                InternetChecksum pseudo;
+                pseudo.add({frame.data() + ip_at + 12, 8});  // source and destination addresses
+                pseudo.add(string{0, char(IPv4Header::PROTO_TCP)});
+                pseudo.add(string{char(tcp_len >> 8), char(tcp_len & 0xff)});
+                write_u16(frame, tcp_at + 16, ~pseudo.value());
+
+                vnet.flags = TunTapFD::VnetHeader::F_NEEDS_CSUM;
+                vnet.gso_type = TunTapFD::VnetHeader::GSO_TCPV4;
+                vnet.gso_size = TCPConfig::MAX_PAYLOAD_SIZE;
+                vnet.hdr_len = tcp_at + header_len;
+                vnet.csum_start = tcp_at;
+                vnet.csum_offset = 16;  // offset of the checksum in the TCP header
+            }
+        }
+    }
+
+    string ret(TunTapFD::VNET_HDR_LEN, 0);
+    memcpy(ret.data(), &vnet, sizeof(vnet));
+    return ret;
+}
+
+//! \param[in] tun Raw network device that will be owned by the adapter
+TCPOverIPv4OverTunFdAdapter::TCPOverIPv4OverTunFdAdapter(TunFD &&tun) : _tun(move(tun)) { _tun.set_blocking(false); }
+
+//! \param[out] segments has the TCP segments appended to it, one per related datagram
+void TCPOverIPv4OverTunFdAdapter::read_batch(vector<TCPSegment> &segments) {
+    _tun.read_batch(_frames);
+    for (size_t i = 0; i < _frames.size(); i++) {
+        InternetDatagram ip_dgram;
+        if (ip_dgram.parse(_frames.take(i)) != ParseResult::NoError) {
+            continue;
+        }
+        auto seg = unwrap_tcp_in_ip(ip_dgram);
+        if (seg) {
+            segments.push_back(move(seg.value()));
+        }
+    }
+}
+
+//! \param[out] segments has the TCP segments appended to it, one per datagram addressed to us
+void TCPOverIPv4OverTunFdAdapter::demux_read_batch(vector<DemuxedSegment> &segments) {
+    _tun.read_batch(_frames);
+    for (size_t i = 0; i < _frames.size(); i++) {
+        InternetDatagram ip_dgram;
+        if (ip_dgram.parse(_frames.take(i)) != ParseResult::NoError) {
+            continue;
+        }
+        auto seg = demux_tcp_in_ip(ip_dgram);
+        if (seg) {
+            segments.push_back(move(seg.value()));
+        }
+    }
+}
+
 //! \param[in] tap Raw network device that will be owned by the adapter
 //! \param[in] eth_address Ethernet address (local address) of the adapter
 //! \param[in] ip_address IP address (local address) of the adapter
@@ -11,20 +123,37 @@ TCPOverIPv4OverEthernetAdapter::TCPOverIPv4OverEthernetAdapter(TapFD &&tap,
                                                                const Address &ip_address,
                                                                const Address &next_hop)
     : _tap(move(tap)), _interface(eth_address, ip_address), _next_hop(next_hop) {
+    _tap.set_blocking(false);
+    _tap.set_tso(_tap.vnet_hdr());
+    if (_tap.vnet_hdr()) {
+        _frames = TunTapFD::ReadBatch(16, MAX_OFFLOAD_FRAME);
+    }
+
     // Linux seems to ignore the first frame sent on a TAP device, so send a dummy frame to prime the pump :-(
     EthernetFrame dummy_frame;
-    _tap.write(dummy_frame.serialize());
+    _interface.frames_out().push(dummy_frame);
+    send_pending();
 }
 
-optional<TCPSegment> TCPOverIPv4OverEthernetAdapter::read() {
-    // Read Ethernet frame from the raw device
-    EthernetFrame frame;
-    if (frame.parse(_tap.read()) != ParseResult::NoError) {
+//! \param[in] frame is the frame as read from the device, including the virtio-net header if there is one
+optional<InternetDatagram> TCPOverIPv4OverEthernetAdapter::receive_frame(string &&frame) {
+    EthernetFrame eth_frame;
+    const Buffer buffer = _tap.vnet_hdr() ? strip_vnet_hdr(move(frame)) : Buffer(move(frame));
+    if (eth_frame.parse(buffer) != ParseResult::NoError) {
         return {};
     }
 
     // Give the frame to the NetworkInterface. Get back an Internet datagram if frame was carrying one.
-    optional<InternetDatagram> ip_dgram = _interface.recv_frame(frame);
+    return _interface.recv_frame(eth_frame);
+}
+
+optional<TCPSegment> TCPOverIPv4OverEthernetAdapter::read() {
+    // Read Ethernet frame from the raw device, if one is ready
+    string frame;
+    if (not _tap.read_frame(frame, _frames.mtu())) {
+        return {};
+    }
+    auto ip_dgram = receive_frame(move(frame));
 
     // The incoming frame may have caused the NetworkInterface to send a frame.
     send_pending();
@@ -36,6 +165,36 @@ optional<TCPSegment> TCPOverIPv4OverEthernetAdapter::read() {
     return {};
 }
 
+//! \param[out] segments has the TCP segments appended to it, one per frame that carried one
+void TCPOverIPv4OverEthernetAdapter::read_batch(vector<TCPSegment> &segments) {
+    _tap.read_batch(_frames);
+    for (size_t i = 0; i < _frames.size(); i++) {
+        auto ip_dgram = receive_frame(_frames.take(i));
+        auto seg = ip_dgram ? unwrap_tcp_in_ip(ip_dgram.value()) : nullopt;
+        if (seg) {
+            segments.push_back(move(seg.value()));
+        }
+    }
+
+    // The incoming frames may have caused the NetworkInterface to send frames (e.g. ARP replies).
+    send_pending();
+}
+
+//! \param[out] segments has the TCP segments appended to it, one per frame that carried one addressed to us
+void TCPOverIPv4OverEthernetAdapter::demux_read_batch(vector<DemuxedSegment> &segments) {
+    _tap.read_batch(_frames);
+    for (size_t i = 0; i < _frames.size(); i++) {
+        auto ip_dgram = receive_frame(_frames.take(i));
+        auto seg = ip_dgram ? demux_tcp_in_ip(ip_dgram.value()) : nullopt;
+        if (seg) {
+            segments.push_back(move(seg.value()));
+        }
+    }
+
+    // The incoming frames may have caused the NetworkInterface to send frames (e.g. ARP replies).
+    send_pending();
+}
+
 //! \param[in] ms_since_last_tick the number of milliseconds since the last call to this method
 void TCPOverIPv4OverEthernetAdapter::tick(const size_t ms_since_last_tick) {
     _interface.tick(ms_since_last_tick);
@@ -48,9 +207,70 @@ void TCPOverIPv4OverEthernetAdapter::write(TCPSegment &seg) {
     send_pending();
 }
 
+//! \param[in,out] segments the TCPSegments to send; the queue is empty on return
+//! \details With TCP segmentation offload, each run of contiguous full-size segments goes to the kernel
+//! as one super-segment, which the kernel splits back into the original segments.
+void TCPOverIPv4OverEthernetAdapter::write_batch(queue<TCPSegment> &segments) {
+    while (not segments.empty()) {
+        TCPSegment seg = move(segments.front());
+        segments.pop();
+        if (_tap.vnet_hdr()) {
+            coalesce(seg, segments);
+        }
+        _interface.send_datagram(wrap_tcp_in_ip(seg), _next_hop);
+    }
+    send_pending();
+}
+
+//! \param[in,out] seg is the first segment of the run; on return it carries the payload of the whole run
+//! \param[in,out] segments has the segments that were merged into `seg` removed from its front
+//! \details Segments are merged only if the kernel can split the result back into exactly the same segments:
+//! all but the last carry TCPConfig::MAX_PAYLOAD_SIZE bytes, they are contiguous in sequence space,
+//! and their headers agree except for the sequence number.
+void TCPOverIPv4OverEthernetAdapter::coalesce(TCPSegment &seg, queue<TCPSegment> &segments) {
+    const auto mergeable = [](const TCPHeader &hdr) { return not(hdr.syn or hdr.fin or hdr.rst or hdr.urg); };
+
+    if (seg.payload().size() != TCPConfig::MAX_PAYLOAD_SIZE or not mergeable(seg.header())) {
+        return;
+    }
+
+    string payload;
+    size_t n_segments = 1;
+    size_t last_size = seg.payload().size();
+    while (not segments.empty() and n_segments < MAX_TSO_SEGMENTS and last_size == TCPConfig::MAX_PAYLOAD_SIZE) {
+        const TCPSegment &next = segments.front();
+        const TCPHeader &hdr = next.header();
+        if (not mergeable(hdr) or next.payload().size() == 0 or hdr.ack != seg.header().ack or
+            hdr.psh != seg.header().psh or hdr.ackno != seg.header().ackno or hdr.win != seg.header().win or
+            hdr.seqno != seg.header().seqno + (n_segments * TCPConfig::MAX_PAYLOAD_SIZE)) {
+            break;
+        }
+
+        if (payload.empty()) {
+            payload.reserve(MAX_TSO_SEGMENTS * TCPConfig::MAX_PAYLOAD_SIZE);
+            payload.append(seg.payload().str());
+        }
+        payload.append(next.payload().str());
+        last_size = next.payload().size();
+        n_segments++;
+        segments.pop();
+    }
+
+    if (n_segments > 1) {
+        seg.payload() = Buffer(move(payload));
+    }
+}
+
 void TCPOverIPv4OverEthernetAdapter::send_pending() {
     while (not _interface.frames_out().empty()) {
-        _tap.write(_interface.frames_out().front().serialize());
+        if (_tap.vnet_hdr()) {
+            string frame = _interface.frames_out().front().serialize().concatenate();
+            BufferList out{make_vnet_hdr(frame)};
+            out.append(move(frame));
+            _tap.write(out);
+        } else {
+            _tap.write(_interface.frames_out().front().serialize());
+        }
         _interface.frames_out().pop();
     }
 }
@@ -3,33 +3,54 @@
 
 #include "ethernet_header.hh"
 #include "network_interface.hh"
+#include "tcp_config.hh"
 #include "tun.hh"
 
 #include <optional>
+#include <queue>
+#include <string>
 #include <unordered_map>
 #include <utility>
+#include <vector>
 
 //! \brief A FD adapter for IPv4 datagrams read from and written to a TUN device
 class TCPOverIPv4OverTunFdAdapter : public TCPOverIPv4Adapter {
   private:
     TunFD _tun;
 
+    TunTapFD::ReadBatch _frames{};  //!< Preallocated buffers for read_batch
+
   public:
-    //! Construct from a TunFD
-    explicit TCPOverIPv4OverTunFdAdapter(TunFD &&tun) : _tun(std::move(tun)) {}
+    //! Construct from a TunFD (which is made non-blocking, so that read_batch can drain it)
+    explicit TCPOverIPv4OverTunFdAdapter(TunFD &&tun);
 
-    //! Attempts to read and parse an IPv4 datagram containing a TCP segment related to the current connection
+    //! \brief Attempts to read and parse an IPv4 datagram containing a TCP segment related to the current connection
+    //! \details Returns nothing if no datagram is ready.
     std::optional<TCPSegment> read() {
+        std::string frame;
         InternetDatagram ip_dgram;
-        if (ip_dgram.parse(_tun.read()) != ParseResult::NoError) {
+        if (not _tun.read_frame(frame, _frames.mtu()) or ip_dgram.parse(std::move(frame)) != ParseResult::NoError) {
             return {};
         }
         return unwrap_tcp_in_ip(ip_dgram);
     }
 
+    //! Reads every ready IPv4 datagram and appends the TCP segments they carry (if related) to `segments`
+    void read_batch(std::vector<TCPSegment> &segments);
+
+    //! Reads every ready IPv4 datagram and appends the TCP segments they carry, with their connections, to `segments`
+    void demux_read_batch(std::vector<DemuxedSegment> &segments);
+
     //! Creates an IPv4 datagram from a TCP segment and writes it to the TUN device
     void write(TCPSegment &seg) { _tun.write(wrap_tcp_in_ip(seg).serialize()); }
 
+    //! Writes every queued TCP segment to the TUN device (one datagram per write) and empties the queue
+    void write_batch(std::queue<TCPSegment> &segments) {
+        for (; not segments.empty(); segments.pop()) {
+            write(segments.front());
+        }
+    }
+
     //! Access the underlying TUN device
     operator TunFD &() { return _tun; }
 
@@ -45,24 +66,46 @@ class TCPOverIPv4OverEthernetAdapter : public TCPOverIPv4Adapter {
   private:
     TapFD _tap;  //!< Raw Ethernet connection
 
+    TunTapFD::ReadBatch _frames{};  //!< Preallocated buffers for read_batch
+
     NetworkInterface _interface;  //!< NIC abstraction
 
     Address _next_hop;  //!< IP address of the next hop
 
     void send_pending();  //!< Sends any pending Ethernet frames
 
+    //! Hands one frame read from the device to the NetworkInterface, returning the IPv4 datagram it carries (if any)
+    std::optional<InternetDatagram> receive_frame(std::string &&frame);
+
+    //! Merges the run of full-size segments at the front of `segments` into `seg` (for the kernel to re-split)
+    static void coalesce(TCPSegment &seg, std::queue<TCPSegment> &segments);
+
   public:
-    //! Construct from a TapFD
+    //! Most TCPSegments that coalesce() will merge into one super-segment
+    static constexpr size_t MAX_TSO_SEGMENTS = 64;
+
+    //! \brief Construct from a TapFD (which is made non-blocking, so that read_batch can drain it)
+    //! \details TCP segmentation offload is turned on if the TapFD was opened with a virtio-net header, off otherwise.
     explicit TCPOverIPv4OverEthernetAdapter(TapFD &&tap,
                                             const EthernetAddress &eth_address,
                                             const Address &ip_address,
                                             const Address &next_hop);
-    //! Attempts to read and parse an Ethernet frame containing an IPv4 datagram that contains a TCP segment
+    //! \brief Attempts to read and parse an Ethernet frame containing an IPv4 datagram that contains a TCP segment
+    //! \details Returns nothing if no frame is ready.
     std::optional<TCPSegment> read();
 
+    //! Reads every ready Ethernet frame and appends the TCP segments they carry (if any) to `segments`
+    void read_batch(std::vector<TCPSegment> &segments);
+
+    //! Reads every ready Ethernet frame and appends the TCP segments they carry, with their connections, to `segments`
+    void demux_read_batch(std::vector<DemuxedSegment> &segments);
+
     //! Sends a TCP segment (in an IPv4 datagram, in an Ethernet frame).
     void write(TCPSegment &seg);
 
+    //! Sends every queued TCP segment and empties the queue
+    void write_batch(std::queue<TCPSegment> &segments);
+
     //! Called periodically when time elapses
     void tick(const size_t ms_since_last_tick);
 
@@ -10,8 +10,36 @@
 
 using namespace std;
 
+//! \param[in] snapshot is the snapshot to add to
+//! \param[in] labels are the labels to add the counters under
+void TCPReceiverStats::collect(StatsSnapshot &snapshot, const string &labels) const {
+    using Type = StatsSnapshot::Type;
+    snapshot.add("sponge_tcp_segments_received_total",
+                 "TCP segments received",
+                 Type::Counter,
+                 segments_received.value(),
+                 labels);
+    snapshot.add("sponge_tcp_payload_bytes_received_total",
+                 "TCP payload bytes received",
+                 Type::Counter,
+                 payload_bytes_received.value(),
+                 labels);
+    snapshot.add("sponge_tcp_out_of_order_bytes_total",
+                 "TCP payload bytes received ahead of the first unassembled byte",
+                 Type::Counter,
+                 out_of_order_bytes.value(),
+                 labels);
+    snapshot.add("sponge_tcp_unassembled_bytes",
+                 "Bytes waiting in the TCP reassembler",
+                 Type::Gauge,
+                 unassembled_bytes.value(),
+                 labels);
+}
+
 void TCPReceiver::segment_received(const TCPSegment &seg) {
     bool eof = false;
+    _stats.segments_received.add();
+    _stats.payload_bytes_received.add(seg.payload().size());
 
     if (seg.header().syn) {
         assert(!syn_received);
@@ -29,7 +57,11 @@ void TCPReceiver::segment_received(const TCPSegment &seg) {
     }
     size_t index = unwrap(seg.header().seqno, isn, checkpoint);
     checkpoint = index;
-    _reassembler.push_substring(seg.payload().copy(), index - !seg.header().syn, eof);
+    const size_t stream_index = index - !seg.header().syn;
+    if (stream_index > _reassembler.first_unassembled_index())
+        _stats.out_of_order_bytes.add(seg.payload().size());
+    _reassembler.push_substring(seg.payload().str(), stream_index, eof);
+    _stats.unassembled_bytes.set(_reassembler.unassembled_bytes());
 }
 
 optional<WrappingInt32> TCPReceiver::ackno() const {
@@ -2,6 +2,7 @@
 #define SPONGE_LIBSPONGE_TCP_RECEIVER_HH
 
 #include "byte_stream.hh"
+#include "stats.hh"
 #include "stream_reassembler.hh"
 #include "tcp_segment.hh"
 #include "wrapping_integers.hh"
@@ -10,6 +11,17 @@
 
 //! \brief The "receiver" part of a TCP implementation.
 
+//! \brief Counters of a TCPReceiver
+struct alignas(STATS_CACHE_LINE) TCPReceiverStats {
+    StatCounter segments_received{};       //!< Segments received
+    StatCounter payload_bytes_received{};  //!< Payload bytes in those segments
+    StatCounter out_of_order_bytes{};      //!< Payload bytes that arrived ahead of the first unassembled byte
+    StatCounter unassembled_bytes{};       //!< Bytes waiting in the reassembler (a gauge)
+
+    //! Add the counters to a snapshot
+    void collect(StatsSnapshot &snapshot, const std::string &labels) const;
+};
+
 //! Receives and reassembles segments into a ByteStream, and computes
 //! the acknowledgment number and window size to advertise back to the
 //! remote TCPSender.
@@ -23,13 +35,15 @@ class TCPReceiver {
     WrappingInt32 isn;
     uint64_t checkpoint;
 
+    TCPReceiverStats _stats{};
+
   public:
     //! \brief Construct a TCP receiver
     //!
     //! \param capacity the maximum number of bytes that the receiver will
     //!                 store in its buffers at any give time.
     TCPReceiver(const size_t capacity)
-        : _reassembler(capacity), _capacity(capacity), syn_received(false), isn(0), checkpoint(0) {}
+        : _reassembler(capacity), _capacity(capacity), syn_received(false), isn(0), checkpoint(0), _stats() {}
 
     //! \name Accessors to provide feedback to the remote TCPSender
     //!@{
@@ -57,6 +71,9 @@ class TCPReceiver {
     //! \brief number of bytes stored but not yet reassembled
     size_t unassembled_bytes() const { return _reassembler.unassembled_bytes(); }
 
+    //! \brief Counters of segments received, out-of-order bytes and reassembler occupancy
+    const TCPReceiverStats &stats() const { return _stats; }
+
     //! \brief handle an inbound segment
     void segment_received(const TCPSegment &seg);
 
@@ -1,5 +1,6 @@
 #include "tcp_sender.hh"
 
+#include "latency_histogram.hh"
 #include "tcp_config.hh"
 
 #include <random>
@@ -21,12 +22,43 @@ bool operator<(const TransmittingSegment& a, const TransmittingSegment &b) {
 //! \param[in] capacity the capacity of the outgoing byte stream
 //! \param[in] retx_timeout the initial amount of time to wait before retransmitting the oldest outstanding segment
 //! \param[in] fixed_isn the Initial Sequence Number to use, if set (otherwise uses a random ISN)
-TCPSender::TCPSender(const size_t capacity, const uint16_t retx_timeout, const std::optional<WrappingInt32> fixed_isn)
+//! \param[in] max_payload_size the largest payload to put in a segment
+TCPSender::TCPSender(const size_t capacity,
+                     const uint16_t retx_timeout,
+                     const std::optional<WrappingInt32> fixed_isn,
+                     const size_t max_payload_size)
     : _isn(fixed_isn.value_or(WrappingInt32{random_device()()}))
     , _initial_retransmission_timeout{retx_timeout}
     , _retransmission_timeout{retx_timeout}
     , _timer()
-    , _stream(capacity) {}
+    , _stream(capacity)
+    , _max_payload_size(max_payload_size) {}
+
+//! \param[in] snapshot is the snapshot to add to
+//! \param[in] labels are the labels to add the counters under
+void TCPSenderStats::collect(StatsSnapshot &snapshot, const string &labels) const {
+    using Type = StatsSnapshot::Type;
+    snapshot.add("sponge_tcp_segments_sent_total",
+                 "TCP segments sent, including retransmissions",
+                 Type::Counter,
+                 segments_sent.value(),
+                 labels);
+    snapshot.add("sponge_tcp_payload_bytes_sent_total",
+                 "TCP payload bytes sent, including retransmissions",
+                 Type::Counter,
+                 payload_bytes_sent.value(),
+                 labels);
+    snapshot.add("sponge_tcp_retransmissions_total",
+                 "TCP segments retransmitted after a timeout",
+                 Type::Counter,
+                 retransmissions.value(),
+                 labels);
+    snapshot.add("sponge_tcp_duplicate_acks_total",
+                 "ACKs received that acknowledged nothing new, with data in flight",
+                 Type::Counter,
+                 duplicate_acks.value(),
+                 labels);
+}
 
 size_t TCPSender::bytes_in_flight() const {
     size_t bytes_count = 0;
@@ -43,6 +75,7 @@ bool TCPSender::is_fin_sent() const {
 
 
 void TCPSender::fill_window() {
+    SPONGE_LATENCY_SCOPE(FillWindow);
 //    cerr << "fill_window: " << _stream.eof() << " " << _stream.bytes_written() << " " << _next_seqno << " " << _window_size << "\n";
     size_t last_seqno = _stream.bytes_written() + _stream.input_ended() + 1;
     if (_next_seqno == last_seqno)
@@ -54,14 +87,14 @@ void TCPSender::fill_window() {
     TCPSegment segment;
     TCPHeader header;
     header.syn = !_next_seqno;
-    size_t max_payload_size = min(max_segment_size - header.syn, TCPConfig::MAX_PAYLOAD_SIZE);
+    size_t max_payload_size = min(max_segment_size - header.syn, _max_payload_size);
     Buffer payload = _stream.read(min(max_payload_size, _stream.buffer_size()));
     header.fin = _stream.eof() && header.syn + payload.size() < max_segment_size;
     header.seqno = wrap(_next_seqno, _isn);
     segment.header() = header;
     segment.payload() = payload;
 //    cerr << "sending segment " << segment.header().to_string() << "payload size: " << payload.size() << "\n";
-    _segments_out.push(segment);
+    _send(segment);
     if (_segments_transmitting.empty())
         _timer.reset(_retransmission_timeout);
     _segments_transmitting.insert(TransmittingSegment{_next_seqno, segment});
@@ -74,6 +107,8 @@ void TCPSender::fill_window() {
 //! \param window_size The remote receiver's advertised window size
 void TCPSender::ack_received(const WrappingInt32 ackno, const uint16_t window_size) {
     size_t raw_ackno = unwrap(ackno, _isn, _next_seqno);
+    if (raw_ackno == _ackno && window_size == _window_size && !_segments_transmitting.empty())
+        _stats.duplicate_acks.add();
     _window_size = window_size;
     if (raw_ackno > _next_seqno || raw_ackno <= _ackno) {
         assert(_segments_transmitting.empty() || _segments_transmitting.begin()->seqno < raw_ackno);
@@ -118,13 +153,20 @@ void TCPSender::_retransmit() {
     }
     if (_consecutive_retranmissions > TCPConfig::MAX_RETX_ATTEMPTS)
         return;
-    auto segment = _segments_transmitting.begin()->tcp_segment;
-    _segments_out.push(segment);
+    _stats.retransmissions.add();
+    _send(_segments_transmitting.begin()->tcp_segment);
     _timer.reset(_retransmission_timeout);
 }
 
 unsigned int TCPSender::consecutive_retransmissions() const { return _consecutive_retranmissions; }
 
+//! \details A timer that has already expired (but hasn't been noticed by tick()) reports 0.
+optional<size_t> TCPSender::time_until_timeout() const {
+    if (!_timer.is_running())
+        return {};
+    return max(_timer.time_left(), int64_t(0));
+}
+
 void TCPSender::send_empty_segment(bool rst) {
     TCPHeader header;
     TCPSegment segment;
@@ -135,8 +177,18 @@ void TCPSender::send_empty_segment(bool rst) {
 //    cerr << "send empty segment, rst = " << rst << ", syn = " << header.syn << "\n";
     segment.header() = header;
     segment.payload() = Buffer("");
-    _segments_out.push(segment);
-    if (header.syn)
+    _send(segment);
+    if (header.syn) {
+        // a SYN/ACK must be retransmitted like any other segment, or losing it stalls the handshake
+        if (_segments_transmitting.empty())
+            _timer.reset(_retransmission_timeout);
         _segments_transmitting.insert({_next_seqno, segment});
+    }
     _next_seqno += segment.length_in_sequence_space();
 }
+
+void TCPSender::_send(const TCPSegment &segment) {
+    _stats.segments_sent.add();
+    _stats.payload_bytes_sent.add(segment.payload().size());
+    _segments_out.push(segment);
+}
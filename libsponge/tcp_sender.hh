@@ -2,12 +2,14 @@
 #define SPONGE_LIBSPONGE_TCP_SENDER_HH
 
 #include "byte_stream.hh"
+#include "stats.hh"
 #include "tcp_config.hh"
 #include "tcp_segment.hh"
 #include "wrapping_integers.hh"
 #include "timer.hh"
 
 #include <functional>
+#include <optional>
 #include <queue>
 #include <set>
 
@@ -18,6 +20,17 @@ struct TransmittingSegment {
     TCPSegment tcp_segment;
 };
 
+//! \brief Counters of a TCPSender
+struct alignas(STATS_CACHE_LINE) TCPSenderStats {
+    StatCounter segments_sent{};       //!< Segments sent, including retransmissions
+    StatCounter payload_bytes_sent{};  //!< Payload bytes in those segments
+    StatCounter retransmissions{};     //!< Segments retransmitted after a timeout
+    StatCounter duplicate_acks{};      //!< ACKs that repeated the last ackno and window, with data in flight
+
+    //! Add the counters to a snapshot
+    void collect(StatsSnapshot &snapshot, const std::string &labels) const;
+};
+
 //! Accepts a ByteStream, divides it up into segments and sends the
 //! segments, keeps track of which segments are still in-flight,
 //! maintains the Retransmission Timer, and retransmits in-flight
@@ -42,6 +55,9 @@ class TCPSender {
     //! outgoing stream of bytes that have not yet been sent
     ByteStream _stream;
 
+    //! largest payload of a segment (the MSS)
+    size_t _max_payload_size;
+
     //! the (absolute) sequence number for the next byte to be sent
     uint64_t _next_seqno{0};
 
@@ -51,13 +67,19 @@ class TCPSender {
 
     unsigned int _consecutive_retranmissions{0};
 
+    TCPSenderStats _stats{};
+
     void _retransmit();
 
+    //! Queue a segment to be sent, and count it
+    void _send(const TCPSegment &segment);
+
   public:
     //! Initialize a TCPSender
     TCPSender(const size_t capacity = TCPConfig::DEFAULT_CAPACITY,
               const uint16_t retx_timeout = TCPConfig::TIMEOUT_DFLT,
-              const std::optional<WrappingInt32> fixed_isn = {});
+              const std::optional<WrappingInt32> fixed_isn = {},
+              const size_t max_payload_size = TCPConfig::MAX_PAYLOAD_SIZE);
 
     //! \name "Input" interface for the writer
     //!@{
@@ -94,6 +116,12 @@ class TCPSender {
     //! \brief Number of consecutive retransmissions that have occurred in a row
     unsigned int consecutive_retransmissions() const;
 
+    //! \brief Milliseconds until the retransmission timer expires (empty if it is not running)
+    std::optional<size_t> time_until_timeout() const;
+
+    //! \brief Counters of segments sent, retransmissions and duplicate ACKs
+    const TCPSenderStats &stats() const { return _stats; }
+
     //! \brief TCPSegments that the TCPSender has enqueued for transmission.
     //! \note These must be dequeued and sent by the TCPConnection,
     //! which will need to fill in the fields that are set by the TCPReceiver
@@ -0,0 +1,69 @@
+#include "allocation_counter.hh"
+
+#include <cstdlib>
+#include <new>
+
+using namespace std;
+
+//! \brief The calling thread's counts
+//! \details Constant-initialized and trivially destructible, so that operator new can use it at any point in
+//! a thread's life, including while the thread starts and exits.
+static thread_local AllocationCount thread_counts{};
+
+string AllocationCount::to_string() const {
+    return std::to_string(allocations) + " allocations (" + std::to_string(bytes) + " bytes), " +
+           std::to_string(deallocations) + " deallocations";
+}
+
+AllocationCount AllocationCounter::thread_count() { return thread_counts; }
+
+//! \param[in] size is the number of bytes asked for
+//! \param[in] alignment is the alignment asked for, or 0 for malloc()'s
+//! \returns the allocation, or nullptr if there was no memory
+static void *counted_allocation(const size_t size, const size_t alignment = 0) {
+    thread_counts.allocations++;
+    thread_counts.bytes += size;
+    if (alignment == 0) {
+        return malloc(size == 0 ? 1 : size);
+    }
+    // aligned_alloc() wants a size that is a multiple of the alignment
+    return aligned_alloc(alignment, (size + alignment - 1) / alignment * alignment);
+}
+
+//! \param[in] ptr is the allocation to free (or nullptr)
+static void counted_deallocation(void *ptr) noexcept {
+    if (ptr != nullptr) {
+        thread_counts.deallocations++;
+        free(ptr);
+    }
+}
+
+// The replacements of the global operator new and operator delete. The array forms and the sized deletes of
+// the standard library call these ones, and the aligned forms are replaced too, for the alignas() types.
+
+void *operator new(const size_t size) {
+    if (void *const ptr = counted_allocation(size)) {
+        return ptr;
+    }
+    throw bad_alloc();
+}
+
+void *operator new(const size_t size, const nothrow_t &) noexcept { return counted_allocation(size); }
+
+void *operator new(const size_t size, const align_val_t alignment) {
+    if (void *const ptr = counted_allocation(size, static_cast<size_t>(alignment))) {
+        return ptr;
+    }
+    throw bad_alloc();
+}
+
+void *operator new(const size_t size, const align_val_t alignment, const nothrow_t &) noexcept {
+    return counted_allocation(size, static_cast<size_t>(alignment));
+}
+
+void operator delete(void *ptr) noexcept { counted_deallocation(ptr); }
+void operator delete(void *ptr, size_t) noexcept { counted_deallocation(ptr); }
+void operator delete(void *ptr, const nothrow_t &) noexcept { counted_deallocation(ptr); }
+void operator delete(void *ptr, align_val_t) noexcept { counted_deallocation(ptr); }
+void operator delete(void *ptr, size_t, align_val_t) noexcept { counted_deallocation(ptr); }
+void operator delete(void *ptr, align_val_t, const nothrow_t &) noexcept { counted_deallocation(ptr); }
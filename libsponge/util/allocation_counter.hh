@@ -0,0 +1,48 @@
+#ifndef SPONGE_LIBSPONGE_ALLOCATION_COUNTER_HH
+#define SPONGE_LIBSPONGE_ALLOCATION_COUNTER_HH
+
+#include <cstdint>
+#include <string>
+
+//! \brief Allocations made through operator new, and the bytes they asked for
+struct AllocationCount {
+    uint64_t allocations{0};    //!< Calls to operator new
+    uint64_t deallocations{0};  //!< Calls to operator delete, with a pointer that was not null
+    uint64_t bytes{0};          //!< Bytes that the allocations asked for
+
+    //! The counts since an earlier snapshot
+    AllocationCount operator-(const AllocationCount &earlier) const {
+        return {allocations - earlier.allocations, deallocations - earlier.deallocations, bytes - earlier.bytes};
+    }
+
+    //! Human-readable string, e.g., "3 allocations (1200 bytes), 2 deallocations"
+    std::string to_string() const;
+};
+
+//! \brief Counts of the allocations that each thread makes through operator new
+class AllocationCounter {
+  public:
+    //! The calling thread's counts, since it started
+    static AllocationCount thread_count();
+};
+
+//! \class AllocationCounter
+//! The counts come from replacements of the global operator new and operator delete, which are in the
+//! `sponge_allocations` library rather than `sponge`: only the test and benchmark binaries that link it pay
+//! for counting (a few thread-local additions per allocation). Each thread counts its own allocations, so
+//! that a test can measure the code it runs without what other threads (e.g. the Logger's) allocate meanwhile.
+
+//! \brief The allocations that the calling thread makes during a phase: from construction (or restart()) to count()
+class AllocationPhase {
+  private:
+    AllocationCount _start{AllocationCounter::thread_count()};
+
+  public:
+    //! Start counting again
+    void restart() { _start = AllocationCounter::thread_count(); }
+
+    //! The counts since the phase started
+    AllocationCount count() const { return AllocationCounter::thread_count() - _start; }
+};
+
+#endif  // SPONGE_LIBSPONGE_ALLOCATION_COUNTER_HH
@@ -0,0 +1,42 @@
+#include "eventfd.hh"
+
+#include "util.hh"
+
+#include <cerrno>
+#include <cstdint>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+using namespace std;
+
+EventFD::EventFD() : FileDescriptor(SystemCall("eventfd", ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC))) {}
+
+//! \details Adds one to the counter with [write(2)](\ref man2::write). The counter cannot overflow in
+//! practice, but if it would, the eventfd is already readable, so the failure is ignored.
+void EventFD::notify() {
+    const uint64_t one = 1;
+    if (::write(fd_num(), &one, sizeof(one)) < 0 and errno != EAGAIN) {
+        throw unix_error("write");
+    }
+}
+
+bool EventFD::clear() {
+    register_read();
+    uint64_t count = 0;
+    if (::read(fd_num(), &count, sizeof(count)) < 0) {
+        if (errno == EAGAIN) {
+            return false;
+        }
+        throw unix_error("read");
+    }
+    return count > 0;
+}
+
+//! \param[in] timeout_ms is the longest time to wait, in milliseconds
+//! \details A [signal(7)](\ref man7::signal) that interrupts the wait ends it early, like a spurious wakeup.
+void EventFD::wait(const int timeout_ms) {
+    pollfd pfd{fd_num(), POLLIN, 0};
+    SystemCall("poll", ::poll(&pfd, 1, timeout_ms), EINTR);
+    clear();
+}
@@ -0,0 +1,28 @@
+#ifndef SPONGE_LIBSPONGE_EVENTFD_HH
+#define SPONGE_LIBSPONGE_EVENTFD_HH
+
+#include "file_descriptor.hh"
+
+//! A FileDescriptor to an [eventfd(2)](\ref man2::eventfd), for waking up a thread that waits in an EventLoop
+class EventFD : public FileDescriptor {
+  public:
+    //! Create a non-blocking eventfd whose counter starts at zero
+    EventFD();
+
+    //! Make the eventfd readable (safe to call from any thread)
+    void notify();
+
+    //! Reset the counter to zero; returns `false` if it already was
+    bool clear();
+
+    //! Block until the eventfd is readable or `timeout_ms` passes (negative: forever), then clear() it
+    void wait(const int timeout_ms = -1);
+};
+
+//! \class EventFD
+//! One thread adds a rule for the EventFD (Direction::In) to its EventLoop, and other threads call
+//! notify() after handing it work. The rule's callback calls clear() and then looks for the work, so
+//! a notification that arrives while the work is being collected is not lost. A thread that has
+//! nothing else to wait for can call wait() instead.
+
+#endif  // SPONGE_LIBSPONGE_EVENTFD_HH
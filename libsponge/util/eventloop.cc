@@ -1,34 +1,292 @@
 #include "eventloop.hh"
 
+#include "latency_histogram.hh"
 #include "util.hh"
 
+#include <algorithm>
 #include <cerrno>
+#include <cstdlib>
+#include <iostream>
 #include <stdexcept>
+#include <sys/stat.h>
 #include <system_error>
 #include <utility>
 #include <vector>
 
 using namespace std;
 
+static constexpr unsigned URING_ENTRIES = 256;  //!< Submission queue size for Backend::IoUring
+static constexpr size_t RECEIVE_SIZE = 65536;   //!< Most bytes that a receive rule reads at a time
+static constexpr unsigned RECEIVE_BUFFERS = 8;  //!< Provided buffers per receive rule on the io_uring
+static constexpr uint64_t IGNORE_TAG = 0;       //!< user_data of a request whose completion is ignored
+static constexpr uint64_t EPOLL_TAG = uint64_t(1) << 63;  //!< user_data bit of a poll of the epoll instance
+static constexpr uint8_t OP_READ_MULTISHOT = IORING_OP_SENDMSG_ZC + 1;  //!< Linux 6.7; missing from older headers
+
 unsigned int EventLoop::Rule::service_count() const {
     return direction == Direction::In ? fd.read_count() : fd.write_count();
 }
 
+//! \details Lets a program, or the tests, be run against each backend without being rebuilt.
+EventLoop::Backend EventLoop::default_backend() {
+    static const Backend backend = [] {
+        const char *const name = getenv("SPONGE_EVENTLOOP");
+        if (name and string(name) == "poll") {
+            return Backend::Poll;
+        }
+        if (name and string(name) == "io_uring") {
+            return Backend::IoUring;
+        }
+        return Backend::Epoll;
+    }();
+    return backend;
+}
+
+//! \param[in] backend selects between [poll(2)](\ref man2::poll), [epoll(7)](\ref man7::epoll),
+//!                    and [io_uring(7)](\ref man7::io_uring)
+//! \details If an io_uring can't be set up (an old kernel, or one where it is disabled), the EventLoop uses
+//! Backend::Epoll instead.
+EventLoop::EventLoop(const Backend backend) : _backend(backend) {
+    if (_backend == Backend::IoUring) {
+        try {
+            _uring = make_unique<IoUring>(URING_ENTRIES);
+        } catch (const exception &) {
+            _backend = Backend::Epoll;
+        }
+    }
+
+    if (_backend != Backend::Poll) {
+        _epoll.emplace(SystemCall("epoll_create1", ::epoll_create1(EPOLL_CLOEXEC)));
+    }
+}
+
+//! \details The kernel writes into a receive rule's buffers until its read's last completion, so each read
+//! in flight is canceled and its last completion awaited before the buffers are freed.
+EventLoop::~EventLoop() {
+    const auto in_flight = [&] {
+        return any_of(
+            _receive_rules.begin(), _receive_rules.end(), [](const auto &entry) { return entry.second.armed; });
+    };
+    if (not _uring or not in_flight()) {
+        return;
+    }
+
+    try {
+        io_uring_sqe &sqe = next_sqe();
+        sqe.opcode = IORING_OP_ASYNC_CANCEL;
+        sqe.cancel_flags = IORING_ASYNC_CANCEL_ANY;
+        sqe.user_data = IGNORE_TAG;
+        for (unsigned attempt = 0; attempt < 10 and in_flight(); attempt++) {
+            _uring->submit_and_wait(1, 100);
+            io_uring_cqe cqe{};
+            while (_uring->pop_cqe(cqe)) {
+                const auto rule = _receive_rules.find(cqe.user_data);
+                if (rule != _receive_rules.end() and not(cqe.flags & IORING_CQE_F_MORE)) {
+                    rule->second.armed = false;
+                }
+            }
+        }
+    } catch (const exception &e) {
+        cerr << "Exception canceling reads in flight: " << e.what() << endl;
+    }
+}
+
 //! \param[in] fd is the FileDescriptor to be polled
 //! \param[in] direction indicates whether to poll for reading (Direction::In) or writing (Direction::Out)
 //! \param[in] callback is called when `fd` is ready.
 //! \param[in] interest is called by EventLoop::wait_next_event. If it returns `true`, `fd` will
 //!                     be polled, otherwise `fd` will be ignored only for this execution of `wait_next_event.
+//!                     If empty (the default), `fd` is always polled.
 //! \param[in] cancel is called when the rule is cancelled (e.g. on hangup, EOF, or closure).
 void EventLoop::add_rule(const FileDescriptor &fd,
                          const Direction direction,
                          const CallbackT &callback,
                          const InterestT &interest,
                          const CallbackT &cancel) {
-    _rules.push_back({fd.duplicate(), direction, callback, interest, cancel});
+    _rules.push_back({fd.duplicate(), direction, callback, interest, cancel, false});
+    if (_epoll) {
+        register_rule(prev(_rules.end()));
+    }
 }
 
-//! \param[in] timeout_ms is the timeout value passed to [poll(2)](\ref man2::poll); `wait_next_event`
+//! \param[in] fd is the FileDescriptor to be read
+//! \param[in] callback is called with the bytes of each read from `fd`
+//! \param[in] limit is called by EventLoop::wait_next_event, and returns the most bytes that may be read from `fd`
+//!                  in this execution of `wait_next_event`; if 0, `fd` is not read. If empty (the default), `fd`
+//!                  is always read, as much as is ready.
+//! \param[in] cancel is called when the rule is cancelled (on EOF, or closure).
+//! \details On Backend::IoUring, regular files, and any fd on a kernel without rings of provided buffers
+//! (before Linux 5.19), get an ordinary rule instead.
+void EventLoop::add_receive_rule(const FileDescriptor &fd,
+                                 const ReceiveT &callback,
+                                 const LimitT &limit,
+                                 const CallbackT &cancel) {
+    struct stat st {};
+    SystemCall("fstat", ::fstat(fd.fd_num(), &st));
+    const bool socket = S_ISSOCK(st.st_mode);
+    if (_uring and (socket or S_ISFIFO(st.st_mode) or S_ISCHR(st.st_mode))) {
+        const uint16_t group = _free_groups.empty() ? _next_group : _free_groups.back();
+        unique_ptr<ProvidedBufferRing> buffers{};
+        try {
+            buffers = make_unique<ProvidedBufferRing>(*_uring, group, RECEIVE_BUFFERS, RECEIVE_SIZE);
+        } catch (const unix_error &) {
+            // fall through to an ordinary rule
+        }
+
+        if (buffers) {
+            if (_free_groups.empty()) {
+                _next_group++;
+            } else {
+                _free_groups.pop_back();
+            }
+            _receive_rules.emplace(
+                _next_receive_id++,
+                ReceiveRule{fd.duplicate(), callback, limit, cancel, move(buffers), socket, true, false, false, false});
+            return;
+        }
+    }
+
+    const InterestT interest = limit ? InterestT([limit] { return limit() > 0; }) : InterestT{};
+    _rules.push_back({fd.duplicate(), Direction::In, {}, interest, cancel, false});
+    const RuleIterator rule = prev(_rules.end());
+    rule->callback = [this, rule, callback, limit] {
+        rule->fd.read(_receive_buffer, limit ? min(limit(), RECEIVE_SIZE) : RECEIVE_SIZE);
+        if (not _receive_buffer.empty()) {
+            callback(_receive_buffer);
+        }
+    };
+    if (_epoll) {
+        register_rule(rule);
+    }
+}
+
+//! \param[in] rule is the newly added Rule
+//! \details The fd is added to the epoll set with an empty event mask; wait_next_event_epoll sets the mask
+//! once it knows which of the fd's rules are interested.
+//!
+//! If every rule on the fd number watches a closed fd, the number was closed and reused before the next wait
+//! could cancel those rules. Their registration is then for the closed fd, so the new one is registered
+//! afresh; the closed fd's rules stay in the Registration until the next wait cancels them.
+void EventLoop::register_rule(const RuleIterator rule) {
+    const int fd_num = rule->fd.fd_num();
+    auto [reg, is_new] = _registrations.try_emplace(fd_num, Registration{0, true, {}});
+    const auto &rules = reg->second.rules;
+    const bool reused =
+        not is_new and all_of(rules.begin(), rules.end(), [](const RuleIterator &r) { return r->fd.closed(); });
+    if (reused) {
+        if (not reg->second.pollable) {
+            _unpollable_fds.erase(remove(_unpollable_fds.begin(), _unpollable_fds.end(), fd_num),
+                                  _unpollable_fds.end());
+        }
+        reg->second.events = 0;
+        reg->second.pollable = true;
+        _epoll_stale = true;  // the closed fd may linger in the epoll set as a ghost
+    }
+
+    reg->second.rules.push_back(rule);
+    if (rule->interest) {
+        _conditional_rules.push_back(rule);
+    } else {
+        set_interested(*rule, true);
+    }
+    if (not is_new and not reused) {
+        return;
+    }
+
+    epoll_event event{};
+    event.data.fd = fd_num;
+    if (::epoll_ctl(_epoll->fd_num(), EPOLL_CTL_ADD, fd_num, &event) < 0) {
+        if (errno == EPERM) {
+            // a regular file, or a device without poll support
+            reg->second.pollable = false;
+            _unpollable_fds.push_back(fd_num);
+        } else if (errno == EEXIST) {
+            // a ghost left behind by an fd that was closed while registered
+            SystemCall("epoll_ctl", ::epoll_ctl(_epoll->fd_num(), EPOLL_CTL_MOD, fd_num, &event));
+        } else {
+            throw unix_error("epoll_ctl");
+        }
+    }
+    _dirty_fds.push_back(fd_num);
+}
+
+//! \param[in] rule is the Rule that is being canceled
+void EventLoop::unregister_rule(const RuleIterator rule) {
+    set_interested(*rule, false);
+    if (rule->interest) {
+        _conditional_rules.erase(remove(_conditional_rules.begin(), _conditional_rules.end(), rule),
+                                 _conditional_rules.end());
+    }
+
+    const int fd_num = rule->fd.fd_num();
+    auto reg = _registrations.find(fd_num);
+    if (reg == _registrations.end()) {
+        return;
+    }
+
+    auto &rules = reg->second.rules;
+    rules.erase(remove(rules.begin(), rules.end(), rule), rules.end());
+    if (not rules.empty()) {
+        return;
+    }
+
+    if (not reg->second.pollable) {
+        _unpollable_fds.erase(remove(_unpollable_fds.begin(), _unpollable_fds.end(), fd_num), _unpollable_fds.end());
+    } else if (rule->fd.closed()) {
+        // The kernel drops an fd from an epoll set only when every descriptor sharing its open file
+        // description has been closed, and it can no longer be removed by number. Start afresh.
+        _epoll_stale = true;
+    } else {
+        SystemCall("epoll_ctl", ::epoll_ctl(_epoll->fd_num(), EPOLL_CTL_DEL, fd_num, nullptr));
+    }
+    _registrations.erase(reg);
+}
+
+//! \param[in] rule is a Rule that is registered with the epoll instance
+//! \param[in] interested is the latest result of Rule::is_interested
+void EventLoop::set_interested(Rule &rule, const bool interested) {
+    if (rule.interested == interested) {
+        return;
+    }
+    rule.interested = interested;
+    _interested_count += interested ? 1 : -1;
+    _dirty_fds.push_back(rule.fd.fd_num());
+}
+
+//! \param[in] rule is the Rule to cancel
+//! \returns the iterator following `rule`
+EventLoop::RuleIterator EventLoop::cancel_rule(const RuleIterator rule) {
+    rule->cancel();
+    if (_epoll) {
+        unregister_rule(rule);
+    }
+    return _rules.erase(rule);
+}
+
+//! \details With Backend::IoUring, a poll of the old instance that is in flight is withdrawn, and the new
+//! instance's polls get a new tag, so that a late completion from the old one is not taken for theirs.
+void EventLoop::rebuild_epoll() {
+    if (_epoll_armed) {
+        io_uring_sqe &sqe = next_sqe();
+        sqe.opcode = IORING_OP_POLL_REMOVE;
+        sqe.addr = EPOLL_TAG | _epoll_generation;
+        sqe.user_data = IGNORE_TAG;
+        _epoll_armed = false;
+    }
+    _epoll_generation++;
+
+    _epoll.emplace(SystemCall("epoll_create1", ::epoll_create1(EPOLL_CLOEXEC)));
+    for (const auto &[fd_num, reg] : _registrations) {
+        if (reg.pollable) {
+            epoll_event event{};
+            event.events = reg.events;
+            event.data.fd = fd_num;
+            SystemCall("epoll_ctl", ::epoll_ctl(_epoll->fd_num(), EPOLL_CTL_ADD, fd_num, &event));
+        }
+    }
+}
+
+//! \param[in] timeout_ms is the timeout value passed to [poll(2)](\ref man2::poll) or
+//!                       [epoll_wait(2)](\ref man2::epoll_wait); `wait_next_event`
 //!                       returns Result::Timeout if no fd is ready after the timeout expires.
 //! \returns Eventloop::Result indicating success, timeout, or no more Rule objects to poll.
 //!
@@ -58,28 +316,40 @@ void EventLoop::add_rule(const FileDescriptor &fd,
 //! because [poll(2)](\ref man2::poll) is level triggered, so failing to act on a ready file descriptor
 //! will result in a busy loop (poll returns on a ready file descriptor; file descriptor is not read or
 //! written, so it is still ready; the next call to poll will immediately return).
+//! The same holds for Backend::Epoll and Backend::IoUring, whose registrations are level triggered.
+//! Receive rules (see EventLoop::add_receive_rule) do their own reading, so this can't happen to them.
 EventLoop::Result EventLoop::wait_next_event(const int timeout_ms) {
+    switch (_backend) {
+        case Backend::Poll:
+            return wait_next_event_poll(timeout_ms);
+        case Backend::Epoll:
+            return wait_next_event_epoll(timeout_ms);
+        default:
+            return wait_next_event_uring(timeout_ms);
+    }
+}
+
+//! \details Builds a pollfd for every Rule, calling every Rule::interest, on each call.
+EventLoop::Result EventLoop::wait_next_event_poll(const int timeout_ms) {
     vector<pollfd> pollfds{};
     pollfds.reserve(_rules.size());
     bool something_to_poll = false;
 
     // set up the pollfd for each rule
-    for (auto it = _rules.cbegin(); it != _rules.cend();) {  // NOTE: it gets erased or incremented in loop body
+    for (auto it = _rules.begin(); it != _rules.end();) {  // NOTE: it gets erased or incremented in loop body
         const auto &this_rule = *it;
         if (this_rule.direction == Direction::In && this_rule.fd.eof()) {
             // no more reading on this rule, it's reached is_eof
-            this_rule.cancel();
-            it = _rules.erase(it);
+            it = cancel_rule(it);
             continue;
         }
 
         if (this_rule.fd.closed()) {
-            this_rule.cancel();
-            it = _rules.erase(it);
+            it = cancel_rule(it);
             continue;
         }
 
-        if (this_rule.interest()) {
+        if (this_rule.is_interested()) {
             pollfds.push_back({this_rule.fd.fd_num(), static_cast<short>(this_rule.direction), 0});
             something_to_poll = true;
         } else {
@@ -121,18 +391,20 @@ EventLoop::Result EventLoop::wait_next_event(const int timeout_ms) {
             // if we asked for the status, and the _only_ condition was a hangup, this FD is defunct:
             //   - if it was POLLIN and nothing is readable, no more will ever be readable
             //   - if it was POLLOUT, it will not be writable again
-            this_rule.cancel();
-            it = _rules.erase(it);
+            it = cancel_rule(it);
             continue;
         }
 
         if (poll_ready) {
             // we only want to call callback if revents includes the event we asked for
             const auto count_before = this_rule.service_count();
-            this_rule.callback();
+            {
+                SPONGE_LATENCY_SCOPE(EventDispatch);
+                this_rule.callback();
+            }
 
             // only check for busy wait if we're not canceling or exiting
-            if (count_before == this_rule.service_count() and this_rule.interest()) {
+            if (count_before == this_rule.service_count() and this_rule.is_interested()) {
                 throw runtime_error(
                     "EventLoop: busy wait detected: callback did not read/write fd and is still interested");
             }
@@ -143,3 +415,360 @@ EventLoop::Result EventLoop::wait_next_event(const int timeout_ms) {
 
     return Result::Success;
 }
+
+//! \param[in] reg is the Registration of a watched fd
+//! \returns the union of the directions that the fd's rules are interested in
+uint32_t EventLoop::wanted_events(const Registration &reg) {
+    uint32_t wanted = 0;
+    for (const auto &rule : reg.rules) {
+        wanted |= rule->interested ? static_cast<uint16_t>(rule->direction) : 0;
+    }
+    return wanted;
+}
+
+//! \details Defunct rules are looked for only if some fd has reached EOF or been closed since the last look.
+bool EventLoop::refresh_interest() {
+    if (_status_changes != FileDescriptor::status_changes()) {
+        _status_changes = FileDescriptor::status_changes();
+        for (auto it = _rules.begin(); it != _rules.end();) {  // NOTE: it gets erased or incremented in loop body
+            if ((it->direction == Direction::In and it->fd.eof()) or it->fd.closed()) {
+                it = cancel_rule(it);
+            } else {
+                ++it;
+            }
+        }
+
+        for (auto it = _receive_rules.begin(); it != _receive_rules.end();) {
+            auto &[id, rule] = *it;
+            if (rule.fd.closed() and not rule.canceled) {
+                cancel_receive(id, rule);
+            }
+            if (rule.canceled and not rule.armed) {
+                _free_groups.push_back(rule.buffers->group());
+                it = _receive_rules.erase(it);
+            } else {
+                ++it;
+            }
+        }
+    }
+
+    // collect the interest of the rules that have a say in it
+    for (const auto &rule : _conditional_rules) {
+        set_interested(*rule, rule->is_interested());
+    }
+
+    return _interested_count > 0;
+}
+
+void EventLoop::update_epoll() {
+    if (_epoll_stale) {
+        rebuild_epoll();
+        _epoll_stale = false;
+    }
+
+    for (const int fd_num : _dirty_fds) {
+        const auto reg = _registrations.find(fd_num);
+        if (reg == _registrations.end() or not reg->second.pollable) {
+            continue;
+        }
+
+        const uint32_t wanted = wanted_events(reg->second);
+        if (wanted != reg->second.events) {
+            epoll_event event{};
+            event.events = wanted;
+            event.data.fd = fd_num;
+            SystemCall("epoll_ctl", ::epoll_ctl(_epoll->fd_num(), EPOLL_CTL_MOD, fd_num, &event));
+            reg->second.events = wanted;
+        }
+    }
+    _dirty_fds.clear();
+}
+
+//! \details fds that epoll can't watch are always ready, like poll reports them. _ready is sized for every
+//! watched fd, so the ones epoll returns fit in front of them.
+size_t EventLoop::collect_unpollable() {
+    _ready.resize(_registrations.size() + 1);  // room for every fd, and never empty
+    size_t n_always_ready = 0;
+    for (const int fd_num : _unpollable_fds) {
+        const uint32_t wanted = wanted_events(_registrations.at(fd_num));
+        if (wanted) {
+            n_always_ready++;
+            _ready[_ready.size() - n_always_ready].data.fd = fd_num;
+            _ready[_ready.size() - n_always_ready].events = wanted;
+        }
+    }
+    return n_always_ready;
+}
+
+//! \param[in] n_ready is the number of entries at the front of _ready
+//! \details The cancellation of hung-up rules is left until the end, so each fd's rules stay put.
+void EventLoop::dispatch_ready(const size_t n_ready) {
+    _hung_up.clear();
+    for (size_t idx = 0; idx < n_ready; idx++) {
+        const uint32_t revents = _ready[idx].events;
+        const auto reg = _registrations.find(_ready[idx].data.fd);
+        if (reg == _registrations.end()) {
+            continue;  // all of its rules were canceled earlier in this pass
+        }
+
+        if (revents & EPOLLERR) {
+            throw runtime_error("EventLoop: error on polled file descriptor");
+        }
+
+        // NOTE: a callback may add rules to this fd (which stay for the next wait), but none are removed until the end
+        const Registration &registration = reg->second;
+        const size_t n_rules = registration.rules.size();
+        for (size_t rule_idx = 0; rule_idx < n_rules; rule_idx++) {
+            const RuleIterator rule = registration.rules[rule_idx];
+            const auto poll_ready = rule->interested and (revents & static_cast<uint16_t>(rule->direction));
+            const auto poll_hup = static_cast<bool>(revents & EPOLLHUP);
+            if (poll_hup and rule->interested and not poll_ready) {
+                // same as for poll: if hangup was the only condition, this FD is defunct for this rule
+                _hung_up.push_back(rule);
+                continue;
+            }
+
+            if (poll_ready) {
+                const auto count_before = rule->service_count();
+                {
+                    SPONGE_LATENCY_SCOPE(EventDispatch);
+                    rule->callback();
+                }
+
+                // only check for busy wait if we're not canceling or exiting
+                if (count_before == rule->service_count() and rule->is_interested()) {
+                    throw runtime_error(
+                        "EventLoop: busy wait detected: callback did not read/write fd and is still interested");
+                }
+            }
+        }
+    }
+
+    for (const RuleIterator rule : _hung_up) {
+        cancel_rule(rule);
+    }
+    _hung_up.clear();
+}
+
+//! \details Entries are normally submitted by the [io_uring_enter(2)](\ref man2::io_uring_enter) that waits;
+//! if they run out before then, the queued ones are submitted without waiting.
+io_uring_sqe &EventLoop::next_sqe() {
+    io_uring_sqe *sqe = _uring->get_sqe();
+    if (not sqe) {
+        _uring->submit_and_wait(0, 0);
+        sqe = _uring->get_sqe();
+    }
+    if (not sqe) {
+        throw runtime_error("EventLoop: io_uring submission queue is full");
+    }
+    return *sqe;
+}
+
+//! \details A rule without a limit gets a multishot read, which stays in flight across waits until its
+//! buffers run out or its fd reaches EOF; a rule with a limit gets a one-shot read of at most that many
+//! bytes in each wait that it has room for one.
+bool EventLoop::arm_receive_rules() {
+    bool in_flight = false;
+    for (auto &[id, rule] : _receive_rules) {
+        const size_t limit = rule.armed or rule.canceled or not rule.limit ? 0 : min(rule.limit(), RECEIVE_SIZE);
+        if (not rule.armed and not rule.canceled and (limit > 0 or not rule.limit)) {
+            io_uring_sqe &sqe = next_sqe();
+            rule.multishot = not rule.limit and rule.pollable and (rule.socket ? _recv_multishot : _read_multishot);
+            if (rule.socket) {
+                sqe.opcode = IORING_OP_RECV;
+                sqe.ioprio = rule.multishot ? IORING_RECV_MULTISHOT : 0;
+            } else {
+                sqe.opcode = rule.multishot ? OP_READ_MULTISHOT : static_cast<uint8_t>(IORING_OP_READ);
+                sqe.off = UINT64_MAX;  // the file position, like read(2)
+            }
+            sqe.fd = rule.fd.fd_num();
+            sqe.len = limit;  // 0: a whole buffer
+            sqe.flags = IOSQE_BUFFER_SELECT;
+            sqe.buf_group = rule.buffers->group();
+            sqe.user_data = id;
+            rule.armed = true;
+        }
+        in_flight |= rule.armed;
+    }
+    return in_flight;
+}
+
+//! \param[in] id is the receive rule's ID, the user_data of its reads
+//! \param[in] cqe is the completion
+//! \returns `true` if the rule's callback, or its cancel callback on EOF, was run
+bool EventLoop::complete_receive(const uint64_t id, const io_uring_cqe &cqe) {
+    const auto entry = _receive_rules.find(id);
+    if (entry == _receive_rules.end()) {
+        return false;
+    }
+
+    ReceiveRule &rule = entry->second;
+    if (not(cqe.flags & IORING_CQE_F_MORE)) {
+        rule.armed = false;
+    }
+
+    bool ran = false;
+    if (cqe.flags & IORING_CQE_F_BUFFER) {
+        const auto buffer_id = static_cast<uint16_t>(cqe.flags >> IORING_CQE_BUFFER_SHIFT);
+        if (cqe.res > 0 and not rule.canceled) {
+            {
+                SPONGE_LATENCY_SCOPE(EventDispatch);
+                rule.callback(rule.buffers->buffer(buffer_id, cqe.res));
+            }
+            ran = true;
+        }
+        rule.buffers->recycle(buffer_id);
+    }
+
+    if (cqe.res == 0 and not rule.canceled) {
+        cancel_receive(id, rule);  // EOF
+        ran = true;
+    } else if (cqe.res < 0 and not rule.canceled) {
+        const int error = -cqe.res;
+        if (rule.multishot and error == EINVAL) {
+            // the kernel predates this kind of multishot read; read one buffer at a time
+            (rule.socket ? _recv_multishot : _read_multishot) = false;
+        } else if (rule.multishot and error == EBADFD) {
+            rule.pollable = false;  // a multishot read needs an fd that the kernel can poll
+        } else if (error != ENOBUFS and error != ECANCELED and error != EINTR and error != EAGAIN) {
+            throw unix_error(rule.socket ? "recv" : "read", error);
+        }
+    }
+
+    if (rule.canceled and not rule.armed) {
+        _free_groups.push_back(rule.buffers->group());
+        _receive_rules.erase(entry);
+    }
+    return ran;
+}
+
+//! \param[in] id is the receive rule's ID
+//! \param[in] rule is the receive rule
+//! \details The rule is erased once its read in flight, if any, has completed for the last time.
+void EventLoop::cancel_receive(const uint64_t id, ReceiveRule &rule) {
+    rule.canceled = true;
+    rule.cancel();
+    if (rule.armed) {
+        io_uring_sqe &sqe = next_sqe();
+        sqe.opcode = IORING_OP_ASYNC_CANCEL;
+        sqe.addr = id;
+        sqe.user_data = IGNORE_TAG;
+    }
+}
+
+//! \details Calls Rule::interest only for rules that have one, changes an fd's epoll registration only
+//! when the union of its rules' interest changes, and dispatches only the rules on ready fds.
+EventLoop::Result EventLoop::wait_next_event_epoll(const int timeout_ms) {
+    // quit if there is nothing left to poll
+    if (not refresh_interest()) {
+        return Result::Exit;
+    }
+
+    update_epoll();
+    const size_t n_always_ready = collect_unpollable();
+
+    // call epoll_wait -- wait until one of the fds satisfies one of the rules (writeable/readable)
+    size_t n_ready = 0;
+    try {
+        n_ready = SystemCall("epoll_wait",
+                             ::epoll_wait(_epoll->fd_num(),
+                                          _ready.data(),
+                                          _ready.size() - n_always_ready,
+                                          n_always_ready ? 0 : timeout_ms));
+    } catch (unix_error const &e) {
+        if (e.code().value() == EINTR) {
+            return Result::Exit;
+        }
+        throw;
+    }
+    if (n_ready == 0 and n_always_ready == 0) {
+        return Result::Timeout;
+    }
+
+    // move the always-ready fds (stored at the back of _ready) next to the ones epoll returned
+    move(_ready.end() - n_always_ready, _ready.end(), _ready.begin() + n_ready);
+    dispatch_ready(n_ready + n_always_ready);
+
+    return Result::Success;
+}
+
+//! \details Arms the receive rules' reads and a poll of the epoll instance that holds the other rules, and
+//! waits for their completions, all in one [io_uring_enter(2)](\ref man2::io_uring_enter). Completions that
+//! run nothing (late ones for canceled reads, or a poll of an epoll instance whose ready fds no rule wants)
+//! don't end the wait before its timeout.
+EventLoop::Result EventLoop::wait_next_event_uring(const int timeout_ms) {
+    const bool interested = refresh_interest();
+    if (not arm_receive_rules() and not interested) {
+        return Result::Exit;
+    }
+
+    update_epoll();
+    const uint64_t deadline = timestamp_ms() + max(timeout_ms, 0);
+    while (true) {
+        const size_t n_always_ready = collect_unpollable();
+        if (_interested_count > 0 and not _epoll_armed) {
+            io_uring_sqe &sqe = next_sqe();
+            sqe.opcode = IORING_OP_POLL_ADD;
+            sqe.fd = _epoll->fd_num();
+            sqe.poll32_events = POLLIN;
+            sqe.user_data = EPOLL_TAG | _epoll_generation;
+            _epoll_armed = true;
+        }
+
+        int wait_ms = timeout_ms;
+        if (n_always_ready) {
+            wait_ms = 0;
+        } else if (timeout_ms >= 0) {
+            wait_ms = static_cast<int>(deadline - min(deadline, timestamp_ms()));
+        }
+        try {
+            _uring->submit_and_wait(1, wait_ms);
+        } catch (unix_error const &e) {
+            if (e.code().value() == EINTR) {
+                return Result::Exit;
+            }
+            throw;
+        }
+
+        bool ran = false;
+        bool epoll_ready = n_always_ready > 0;
+        io_uring_cqe cqe{};
+        while (_uring->pop_cqe(cqe)) {
+            if (cqe.user_data == (EPOLL_TAG | _epoll_generation)) {
+                _epoll_armed = false;
+                epoll_ready = true;
+            } else if (cqe.user_data != IGNORE_TAG and not(cqe.user_data & EPOLL_TAG)) {
+                ran |= complete_receive(cqe.user_data, cqe);
+            }
+        }
+
+        if (epoll_ready) {
+            size_t n_ready = 0;
+            try {
+                n_ready = SystemCall(
+                    "epoll_wait", ::epoll_wait(_epoll->fd_num(), _ready.data(), _ready.size() - n_always_ready, 0));
+            } catch (unix_error const &e) {
+                if (e.code().value() == EINTR) {
+                    return Result::Exit;
+                }
+                throw;
+            }
+            move(_ready.end() - n_always_ready, _ready.end(), _ready.begin() + n_ready);
+            if (n_ready + n_always_ready > 0) {
+                dispatch_ready(n_ready + n_always_ready);
+                ran = true;
+            }
+        }
+
+        if (ran) {
+            return Result::Success;
+        }
+        if (timeout_ms >= 0 and timestamp_ms() >= deadline) {
+            return Result::Timeout;
+        }
+        // re-arm reads that ran out of buffers, or whose multishot form the kernel refused
+        if (not arm_receive_rules() and _interested_count == 0) {
+            return Result::Exit;
+        }
+    }
+}
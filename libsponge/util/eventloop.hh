@@ -2,11 +2,20 @@
 #define SPONGE_LIBSPONGE_EVENTLOOP_HH
 
 #include "file_descriptor.hh"
+#include "io_uring.hh"
 
+#include <cstdint>
 #include <cstdlib>
 #include <functional>
 #include <list>
+#include <memory>
+#include <optional>
 #include <poll.h>
+#include <string>
+#include <string_view>
+#include <sys/epoll.h>
+#include <unordered_map>
+#include <vector>
 
 //! Waits for events on file descriptors and executes corresponding callbacks.
 class EventLoop {
@@ -17,9 +26,27 @@ class EventLoop {
         Out = POLLOUT  //!< Callback will be triggered when Rule::fd is writable.
     };
 
+    //! The kernel interface used to wait for ready file descriptors.
+    enum class Backend {
+        Poll,    //!< Build a pollfd array from all rules and call [poll(2)](\ref man2::poll) on every wakeup.
+        Epoll,   //!< Register each fd once with [epoll(7)](\ref man7::epoll); only changes of interest cost a syscall.
+        IoUring  //!< Epoll, with receive rules reading through [io_uring(7)](\ref man7::io_uring); else Epoll.
+    };
+
+    //! Returned by each call to EventLoop::wait_next_event.
+    enum class Result {
+        Success,  //!< At least one Rule was triggered.
+        Timeout,  //!< No rules were triggered before timeout.
+        Exit  //!< All rules have been canceled or were uninterested; make no further calls to EventLoop::wait_next_event.
+    };
+
   private:
     using CallbackT = std::function<void(void)>;  //!< Callback for ready Rule::fd
     using InterestT = std::function<bool(void)>;  //!< `true` return indicates Rule::fd should be polled.
+    using ReceiveT = std::function<void(std::string_view)>;  //!< Callback for the bytes a receive rule has read
+    using LimitT = std::function<size_t(void)>;  //!< Most bytes that a receive rule may read now (0: none)
+
+    static_assert(POLLIN == EPOLLIN and POLLOUT == EPOLLOUT, "Direction doubles as a poll and an epoll event mask");
 
     //! \brief Specifies a condition and callback that an EventLoop should handle.
     //! \details Created by calling EventLoop::add_rule() or EventLoop::add_cancelable_rule().
@@ -28,33 +55,148 @@ class EventLoop {
         FileDescriptor fd;    //!< FileDescriptor to monitor for activity.
         Direction direction;  //!< Direction::In for reading from fd, Direction::Out for writing to fd.
         CallbackT callback;   //!< A callback that reads or writes fd.
-        InterestT interest;   //!< A callback that returns `true` whenever fd should be polled.
+        InterestT interest;   //!< A callback that returns `true` whenever fd should be polled (empty: always).
         CallbackT cancel;     //!< A callback that is called when the rule is cancelled (e.g. on hangup)
+        bool interested;      //!< Result of Rule::interest as of the current wait (Backend::Epoll)
 
         //! Returns the number of times fd has been read or written, depending on the value of Rule::direction.
         //! \details This function is used internally by EventLoop; you will not need to call it
         unsigned int service_count() const;
+
+        //! Calls Rule::interest, if there is one.
+        bool is_interested() const { return not interest or interest(); }
     };
 
+    using RuleIterator = std::list<Rule>::iterator;  //!< Stable handle on a Rule in EventLoop::_rules
+
+    //! \brief The epoll registration shared by all rules on one file descriptor.
+    struct Registration {
+        uint32_t events;                  //!< Events the fd is registered for with the kernel
+        bool pollable;                    //!< `false` if epoll refused the fd (e.g. a regular file)
+        std::vector<RuleIterator> rules;  //!< Rules that watch this fd
+    };
+
+    //! \brief A receive rule whose reads are requests on the io_uring (Backend::IoUring).
+    //! \details Created by calling EventLoop::add_receive_rule().
+    struct ReceiveRule {
+        FileDescriptor fd;                            //!< FileDescriptor to read from
+        ReceiveT callback;                            //!< Takes the bytes of each completed read
+        LimitT limit;                                 //!< Most bytes to read, asked before each read (empty: no limit)
+        CallbackT cancel;                             //!< Called when the rule is canceled (EOF or closure)
+        std::unique_ptr<ProvidedBufferRing> buffers;  //!< The buffers the kernel reads into
+        bool socket;                                  //!< Read with IORING_OP_RECV rather than IORING_OP_READ
+        bool pollable;                                //!< The kernel can poll fd, which multishot reads need
+        bool multishot;                               //!< The request in flight is multishot
+        bool armed;                                   //!< A read request is in flight
+        bool canceled;                                //!< Canceled, but waiting for the request's last completion
+    };
+
+    Backend _backend;          //!< Which of the wait_next_event implementations to use
     std::list<Rule> _rules{};  //!< All rules that have been added and not canceled.
 
+    std::optional<FileDescriptor> _epoll{};                  //!< The epoll instance (Backend::Epoll only)
+    std::unordered_map<int, Registration> _registrations{};  //!< Registration of each watched fd, by fd number
+    std::vector<RuleIterator> _conditional_rules{};          //!< Rules with a Rule::interest callback
+    std::vector<int> _dirty_fds{};                           //!< Fds whose rules' interest may have changed
+    std::vector<int> _unpollable_fds{};                      //!< Fds that epoll refused; always ready
+    std::vector<epoll_event> _ready{};                       //!< Output array for epoll_wait
+    std::vector<RuleIterator> _hung_up{};                    //!< Rules to cancel once the ready fds are dispatched
+    size_t _interested_count{0};                             //!< Number of rules with Rule::interested set
+    unsigned int _status_changes{0};  //!< FileDescriptor::status_changes() as of the last check for EOF/closure
+    bool _epoll_stale{false};  //!< A watched fd was closed while registered, so the epoll set may hold a ghost
+    std::string _receive_buffer{};  //!< What receive rules read into, unless they read through the io_uring
+
+    std::unique_ptr<IoUring> _uring{};                           //!< The io_uring instance (Backend::IoUring only)
+    std::unordered_map<uint64_t, ReceiveRule> _receive_rules{};  //!< Receive rules on the io_uring, by user_data
+    uint64_t _next_receive_id{1};                                //!< user_data of the next receive rule
+    std::vector<uint16_t> _free_groups{};                        //!< Buffer group IDs released by receive rules
+    uint16_t _next_group{0};                                     //!< Lowest buffer group ID never handed out
+    uint64_t _epoll_generation{0};  //!< Number of times the epoll instance was replaced; tags polls of it
+    bool _epoll_armed{false};       //!< A poll of the epoll instance is in flight on the io_uring
+    bool _recv_multishot{true};     //!< The kernel takes multishot IORING_OP_RECV (Linux 6.0)
+    bool _read_multishot{true};     //!< The kernel takes IORING_OP_READ_MULTISHOT (Linux 6.7)
+
+    //! Adds `rule` to its fd's Registration, registering the fd with the epoll instance if it is new
+    void register_rule(const RuleIterator rule);
+
+    //! Removes `rule` from its fd's Registration, and the fd from the epoll instance if it has no rules left
+    void unregister_rule(const RuleIterator rule);
+
+    //! Records the result of Rule::interest, marking the fd's Registration for update if it changed
+    void set_interested(Rule &rule, const bool interested);
+
+    //! Calls Rule::cancel and deletes the rule; returns the iterator to the next rule
+    RuleIterator cancel_rule(const RuleIterator rule);
+
+    //! Replaces the epoll instance with a fresh one holding the current registrations
+    void rebuild_epoll();
+
+    //! The union of the directions that the rules on a Registration are interested in
+    static uint32_t wanted_events(const Registration &reg);
+
+    //! Cancels defunct rules and collects the interest of those with Rule::interest; `true` if any rule is interested
+    bool refresh_interest();
+
+    //! Brings the epoll instance's view of each fd whose rules' interest changed up to date
+    void update_epoll();
+
+    //! Puts the interested fds that epoll can't watch at the back of _ready; returns how many there are
+    size_t collect_unpollable();
+
+    //! Runs the interested rules on the first `n_ready` fds in _ready
+    void dispatch_ready(const size_t n_ready);
+
+    //! Next submission queue entry of the io_uring, submitting the queued ones first if it is full
+    io_uring_sqe &next_sqe();
+
+    //! Arms a read for each receive rule that is interested and has none in flight; `true` if any is in flight
+    bool arm_receive_rules();
+
+    //! Handles a completion of receive rule `id`'s read; `true` if it ran one of the rule's callbacks
+    bool complete_receive(const uint64_t id, const io_uring_cqe &cqe);
+
+    //! Calls ReceiveRule::cancel, and withdraws the rule's read if one is in flight
+    void cancel_receive(const uint64_t id, ReceiveRule &rule);
+
+    Result wait_next_event_poll(const int timeout_ms);   //!< wait_next_event for Backend::Poll
+    Result wait_next_event_epoll(const int timeout_ms);  //!< wait_next_event for Backend::Epoll
+    Result wait_next_event_uring(const int timeout_ms);  //!< wait_next_event for Backend::IoUring
+
   public:
-    //! Returned by each call to EventLoop::wait_next_event.
-    enum class Result {
-        Success,  //!< At least one Rule was triggered.
-        Timeout,  //!< No rules were triggered before timeout.
-        Exit  //!< All rules have been canceled or were uninterested; make no further calls to EventLoop::wait_next_event.
-    };
+    //! The Backend named by the `SPONGE_EVENTLOOP` environment variable (`poll`, `epoll` or `io_uring`), or Epoll
+    static Backend default_backend();
+
+    //! Construct an EventLoop that waits using the specified Backend.
+    explicit EventLoop(const Backend backend = default_backend());
+
+    //! Withdraws the reads in flight on the io_uring
+    ~EventLoop();
+
+    //! The Backend in use, which is Epoll if IoUring was asked for but is unavailable
+    Backend backend() const { return _backend; }
 
     //! Add a rule whose callback will be called when `fd` is ready in the specified Direction.
     void add_rule(const FileDescriptor &fd,
                   const Direction direction,
                   const CallbackT &callback,
-                  const InterestT &interest = [] { return true; },
+                  const InterestT &interest = {},
                   const CallbackT &cancel = [] {});
 
-    //! Calls [poll(2)](\ref man2::poll) and then executes callback for each ready fd.
+    //! Add a rule whose callback will be called with the bytes read from `fd` whenever some arrive.
+    void add_receive_rule(const FileDescriptor &fd,
+                          const ReceiveT &callback,
+                          const LimitT &limit = {},
+                          const CallbackT &cancel = [] {});
+
+    //! Waits for ready fds (see EventLoop::Backend) and then executes callback for each ready fd.
     Result wait_next_event(const int timeout_ms);
+
+    //! \name
+    //! An EventLoop cannot be copied or moved: its rules' callbacks may refer to it
+    //!@{
+    EventLoop(const EventLoop &other) = delete;
+    EventLoop &operator=(const EventLoop &other) = delete;
+    //!@}
 };
 
 using Direction = EventLoop::Direction;
@@ -62,13 +204,33 @@ using Direction = EventLoop::Direction;
 //! \class EventLoop
 //!
 //! An EventLoop holds a std::list of Rule objects. Each time EventLoop::wait_next_event is
-//! executed, the EventLoop uses the Rule objects to construct a call to [poll(2)](\ref man2::poll).
+//! executed, the EventLoop uses the Rule objects to construct a call to [poll(2)](\ref man2::poll),
+//! or, with Backend::Epoll, to update a persistent [epoll(7)](\ref man7::epoll) set.
 //!
 //! When a Rule is installed using EventLoop::add_rule, it will be polled for the specified Rule::direction
-//! whenver the Rule::interest callback returns `true`, until Rule::fd is no longer readable
-//! (for Rule::direction == Direction::In) or writable (for Rule::direction == Direction::Out).
+//! whenver the Rule::interest callback returns `true` (or always, if there is no Rule::interest),
+//! until Rule::fd is no longer readable (for Rule::direction == Direction::In) or writable
+//! (for Rule::direction == Direction::Out).
 //! Once this occurs, the Rule is canceled, i.e., the EventLoop deletes it.
 //!
+//! With Backend::Epoll, each fd is registered with the kernel once, for the union of the directions
+//! that its rules are interested in; the registration is modified only when that union changes, and
+//! only the rules on fds that the kernel reports ready are dispatched. Rules without an interest
+//! callback cost nothing per wakeup: they are rechecked for EOF or closure only after some fd in the
+//! process has reached EOF or been closed (see FileDescriptor::status_changes). File descriptors that epoll
+//! cannot watch (regular files and some character devices) are treated as always ready, which is
+//! what [poll(2)](\ref man2::poll) reports for them.
+//!
+//! A receive rule, installed using EventLoop::add_receive_rule, does its own reading: its callback is
+//! handed the bytes that were read, at most as many as its limit callback allowed. On Backend::Poll and
+//! Backend::Epoll it is an ordinary Direction::In rule that reads into a buffer owned by the EventLoop.
+//! On Backend::IoUring the kernel does the reading: each receive rule has a ProvidedBufferRing, and a
+//! rule without a limit keeps one multishot receive (or, for pipes and devices, multishot read) in flight,
+//! so data that arrives on any number of fds is gathered by the one
+//! [io_uring_enter(2)](\ref man2::io_uring_enter) that waits, with no system call per read. A rule with
+//! a limit gets a one-shot read of at most that many bytes in each wait. The other rules stay on an epoll
+//! set, which is itself polled through the io_uring.
+//!
 //! A Rule installed using EventLoop::add_cancelable_rule will be polled and canceled under the
 //! same conditions, with the additional condition that if Rule::callback returns `true`, the
 //! Rule will be canceled.
@@ -3,6 +3,7 @@
 #include "util.hh"
 
 #include <algorithm>
+#include <atomic>
 #include <fcntl.h>
 #include <iostream>
 #include <stdexcept>
@@ -11,6 +12,11 @@
 
 using namespace std;
 
+//! Counts EOF and close transitions, so that EventLoop can tell when it needs to recheck its fds
+static atomic<unsigned int> status_change_count{0};
+
+unsigned int FileDescriptor::status_changes() { return status_change_count.load(memory_order_relaxed); }
+
 //! \param[in] fd is the file descriptor number returned by [open(2)](\ref man2::open) or similar
 FileDescriptor::FDWrapper::FDWrapper(const int fd) : _fd(fd) {
     if (fd < 0) {
@@ -21,6 +27,7 @@ FileDescriptor::FDWrapper::FDWrapper(const int fd) : _fd(fd) {
 void FileDescriptor::FDWrapper::close() {
     SystemCall("close", ::close(_fd));
     _eof = _closed = true;
+    status_change_count.fetch_add(1, memory_order_relaxed);
 }
 
 FileDescriptor::FDWrapper::~FDWrapper() {
@@ -54,6 +61,7 @@ void FileDescriptor::read(std::string &str, const size_t limit) {
     ssize_t bytes_read = SystemCall("read", ::read(fd_num(), str.data(), size_to_read));
     if (limit > 0 && bytes_read == 0) {
         _internal_fd->_eof = true;
+        status_change_count.fetch_add(1, memory_order_relaxed);
     }
     if (bytes_read > static_cast<ssize_t>(size_to_read)) {
         throw runtime_error("read() read more than requested");
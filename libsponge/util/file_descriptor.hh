@@ -96,6 +96,9 @@ class FileDescriptor {
 
     //! number of writes
     unsigned int write_count() const { return _internal_fd->_write_count; }
+
+    //! number of times any FileDescriptor in the process has reached EOF or been closed
+    static unsigned int status_changes();
     //!@}
 
     //! \name Copy/move constructor/assignment operators
@@ -0,0 +1,186 @@
+#include "io_uring.hh"
+
+#include "util.hh"
+
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+using namespace std;
+
+//! [io_uring_setup(2)](\ref man2::io_uring_setup); glibc has no wrapper
+static int io_uring_setup(const unsigned entries, io_uring_params &params) {
+    return SystemCall("io_uring_setup", static_cast<int>(::syscall(__NR_io_uring_setup, entries, &params)));
+}
+
+//! \param[in] ring is the io_uring instance
+//! \param[in] len is the length of the region
+//! \param[in] offset selects the region (IORING_OFF_SQ_RING, IORING_OFF_CQ_RING, or IORING_OFF_SQES)
+IoUring::Mapping::Mapping(const FileDescriptor &ring, const size_t len, const uint64_t offset)
+    : _addr(::mmap(nullptr, len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring.fd_num(), offset))
+    , _len(len) {
+    if (_addr == MAP_FAILED) {
+        throw unix_error("mmap");
+    }
+}
+
+IoUring::Mapping::~Mapping() { ::munmap(_addr, _len); }
+
+//! \param[in] entries is the size of the submission queue, rounded up by the kernel to a power of two
+//! \details The SQ and CQ rings are mapped separately even if the kernel offers IORING_FEAT_SINGLE_MMAP;
+//! it accepts both offsets either way. The submission queue's index array is filled with the identity
+//! permutation once, so each entry is submitted from the slot it was prepared in.
+IoUring::IoUring(const unsigned entries)
+    : _params()
+    , _ring(io_uring_setup(entries, _params))
+    , _sq_ring(_ring, _params.sq_off.array + _params.sq_entries * sizeof(unsigned), IORING_OFF_SQ_RING)
+    , _cq_ring(_ring, _params.cq_off.cqes + _params.cq_entries * sizeof(io_uring_cqe), IORING_OFF_CQ_RING)
+    , _sqes(_ring, _params.sq_entries * sizeof(io_uring_sqe), IORING_OFF_SQES)
+    , _sq_head(_sq_ring.at<unsigned>(_params.sq_off.head))
+    , _sq_tail(_sq_ring.at<unsigned>(_params.sq_off.tail))
+    , _sq_mask(*_sq_ring.at<unsigned>(_params.sq_off.ring_mask))
+    , _sqe_array(_sqes.at<io_uring_sqe>(0))
+    , _cq_head(_cq_ring.at<unsigned>(_params.cq_off.head))
+    , _cq_tail(_cq_ring.at<unsigned>(_params.cq_off.tail))
+    , _cq_mask(*_cq_ring.at<unsigned>(_params.cq_off.ring_mask))
+    , _cqe_array(_cq_ring.at<io_uring_cqe>(_params.cq_off.cqes))
+    , _sqe_tail(*_sq_tail) {
+    if (not(_params.features & IORING_FEAT_EXT_ARG)) {
+        throw runtime_error("io_uring: kernel lacks IORING_FEAT_EXT_ARG");
+    }
+
+    unsigned *const sq_array = _sq_ring.at<unsigned>(_params.sq_off.array);
+    for (unsigned i = 0; i < _params.sq_entries; i++) {
+        sq_array[i] = i;
+    }
+}
+
+//! \returns a zeroed entry for the caller to fill in; it is submitted by the next submit_and_wait()
+io_uring_sqe *IoUring::get_sqe() {
+    const unsigned head = __atomic_load_n(_sq_head, __ATOMIC_ACQUIRE);
+    if (_sqe_tail - head >= _params.sq_entries) {
+        return nullptr;
+    }
+
+    io_uring_sqe *const sqe = &_sqe_array[_sqe_tail & _sq_mask];
+    _sqe_tail++;
+    memset(sqe, 0, sizeof(*sqe));
+    return sqe;
+}
+
+//! \param[in] wait_nr is the number of completions to wait for (0: submit only)
+//! \param[in] timeout_ms is the longest time to wait, in milliseconds; negative waits indefinitely
+//! \returns `true` if the completion queue is non-empty afterwards
+//! \details A [signal(7)](\ref man7::signal) that interrupts the wait is thrown as a unix_error with EINTR.
+bool IoUring::submit_and_wait(const unsigned wait_nr, const int timeout_ms) {
+    __atomic_store_n(_sq_tail, _sqe_tail, __ATOMIC_RELEASE);
+    const unsigned to_submit = _sqe_tail - __atomic_load_n(_sq_head, __ATOMIC_ACQUIRE);
+
+    __kernel_timespec timeout{};
+    timeout.tv_sec = timeout_ms / 1000;
+    timeout.tv_nsec = (timeout_ms % 1000) * 1000000LL;
+
+    io_uring_getevents_arg arg{};
+    arg.ts = timeout_ms < 0 ? 0 : reinterpret_cast<uint64_t>(&timeout);
+
+    const unsigned flags = wait_nr ? IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG : IORING_ENTER_EXT_ARG;
+    const long ret = ::syscall(__NR_io_uring_enter, _ring.fd_num(), to_submit, wait_nr, flags, &arg, sizeof(arg));
+    // ETIME: the wait timed out; EBUSY: the completion queue overflowed and must be drained first
+    if (ret < 0 and errno != ETIME and errno != EBUSY) {
+        throw unix_error("io_uring_enter");
+    }
+
+    return __atomic_load_n(_cq_tail, __ATOMIC_ACQUIRE) != *_cq_head;
+}
+
+//! \param[out] cqe is filled with the completion, if there is one
+bool IoUring::pop_cqe(io_uring_cqe &cqe) {
+    const unsigned head = *_cq_head;
+    if (head == __atomic_load_n(_cq_tail, __ATOMIC_ACQUIRE)) {
+        return false;
+    }
+
+    cqe = _cqe_array[head & _cq_mask];
+    __atomic_store_n(_cq_head, head + 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+//! \param[in] reg describes the ring: its address, number of entries and buffer group ID
+bool IoUring::register_buffer_ring(const io_uring_buf_reg &reg) {
+    return ::syscall(__NR_io_uring_register, _ring.fd_num(), IORING_REGISTER_PBUF_RING, &reg, 1) == 0;
+}
+
+//! \param[in] group is the buffer group ID that was registered
+void IoUring::unregister_buffer_ring(const uint16_t group) {
+    io_uring_buf_reg reg{};
+    reg.bgid = group;
+    const long ret = ::syscall(__NR_io_uring_register, _ring.fd_num(), IORING_UNREGISTER_PBUF_RING, &reg, 1);
+    SystemCall("io_uring_register", static_cast<int>(ret));
+}
+
+//! \param[in] ring is the IoUring whose reads will use the buffers
+//! \param[in] group is the buffer group ID, unique among the ring's buffer groups
+//! \param[in] count is the number of buffers, a power of two no larger than 32768
+//! \param[in] buffer_size is the size of each buffer
+//! \details The kernel requires the ring of entries to be page-aligned, so it gets a mapping of its own.
+ProvidedBufferRing::ProvidedBufferRing(IoUring &ring,
+                                       const uint16_t group,
+                                       const unsigned count,
+                                       const size_t buffer_size)
+    : _ring(ring)
+    , _group(group)
+    , _count(count)
+    , _buffer_size(buffer_size)
+    , _entries_size(count * sizeof(io_uring_buf))
+    , _entries(static_cast<io_uring_buf *>(
+          ::mmap(nullptr, _entries_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0)))
+    , _storage(count * buffer_size, 0) {
+    if (_entries == MAP_FAILED) {
+        throw unix_error("mmap");
+    }
+
+    io_uring_buf_reg reg{};
+    reg.ring_addr = reinterpret_cast<uint64_t>(_entries);
+    reg.ring_entries = _count;
+    reg.bgid = _group;
+    if (not _ring.register_buffer_ring(reg)) {
+        const int error = errno;
+        ::munmap(_entries, _entries_size);
+        throw unix_error("io_uring_register(IORING_REGISTER_PBUF_RING)", error);
+    }
+
+    for (unsigned id = 0; id < _count; id++) {
+        recycle(id);
+    }
+}
+
+ProvidedBufferRing::~ProvidedBufferRing() {
+    try {
+        _ring.unregister_buffer_ring(_group);
+    } catch (const exception &e) {
+        cerr << "Exception unregistering buffer group: " << e.what() << endl;
+    }
+    ::munmap(_entries, _entries_size);
+}
+
+//! \param[in] id is the buffer ID, from the upper bits of io_uring_cqe::flags
+//! \param[in] length is the number of bytes read into it, from io_uring_cqe::res
+string_view ProvidedBufferRing::buffer(const uint16_t id, const size_t length) const {
+    return {_storage.data() + id * _buffer_size, length};
+}
+
+//! \param[in] id is the buffer ID
+//! \details The entry is filled in before the new tail is published, which is what hands it to the kernel.
+void ProvidedBufferRing::recycle(const uint16_t id) {
+    io_uring_buf &entry = _entries[_tail & (_count - 1)];
+    entry.addr = reinterpret_cast<uint64_t>(_storage.data() + id * _buffer_size);
+    entry.len = _buffer_size;
+    entry.bid = id;
+    _tail++;
+    // the tail shares the first entry's reserved field
+    __atomic_store_n(&_entries[0].resv, _tail, __ATOMIC_RELEASE);
+}
@@ -0,0 +1,142 @@
+#ifndef SPONGE_LIBSPONGE_IO_URING_HH
+#define SPONGE_LIBSPONGE_IO_URING_HH
+
+#include "file_descriptor.hh"
+
+#include <cstddef>
+#include <cstdint>
+#include <linux/io_uring.h>
+#include <string>
+#include <string_view>
+
+//! \brief A minimal [io_uring(7)](\ref man7::io_uring) instance, driven through the raw system calls
+class IoUring {
+  private:
+    //! A memory-mapped region of the ring, unmapped on destruction
+    class Mapping {
+      private:
+        void *_addr;  //!< Start of the mapping
+        size_t _len;  //!< Length of the mapping
+
+      public:
+        //! Map `len` bytes of `ring` at `offset` (one of the IORING_OFF_* constants)
+        Mapping(const FileDescriptor &ring, const size_t len, const uint64_t offset);
+
+        //! Unmap the region
+        ~Mapping();
+
+        //! Address `offset` bytes into the mapping
+        template <typename T>
+        T *at(const uint32_t offset) const {
+            return reinterpret_cast<T *>(static_cast<char *>(_addr) + offset);
+        }
+
+        //! \name
+        //! A Mapping cannot be copied or moved
+        //!@{
+        Mapping(const Mapping &other) = delete;
+        Mapping &operator=(const Mapping &other) = delete;
+        //!@}
+    };
+
+    io_uring_params _params;  //!< Ring geometry and features, as returned by io_uring_setup
+    FileDescriptor _ring;     //!< The io_uring instance
+    Mapping _sq_ring;         //!< Submission queue indices and index array
+    Mapping _cq_ring;         //!< Completion queue indices and entries
+    Mapping _sqes;            //!< Submission queue entries
+
+    unsigned *_sq_head;        //!< Consumer index of the submission queue (written by the kernel)
+    unsigned *_sq_tail;        //!< Producer index of the submission queue (written by us)
+    unsigned _sq_mask;         //!< Mask from index to slot in the submission queue
+    io_uring_sqe *_sqe_array;  //!< Submission queue entries
+    unsigned *_cq_head;        //!< Consumer index of the completion queue (written by us)
+    unsigned *_cq_tail;        //!< Producer index of the completion queue (written by the kernel)
+    unsigned _cq_mask;         //!< Mask from index to slot in the completion queue
+    io_uring_cqe *_cqe_array;  //!< Completion queue entries
+
+    unsigned _sqe_tail;  //!< Slots handed out by get_sqe(), including those not yet published
+
+  public:
+    //! Create a ring with room for `entries` submissions (and twice as many completions)
+    explicit IoUring(const unsigned entries);
+
+    //! Next free submission queue entry, cleared, or `nullptr` if all are waiting to be submitted
+    io_uring_sqe *get_sqe();
+
+    //! Submit the prepared entries and wait for `wait_nr` completions or `timeout_ms` (negative: forever)
+    bool submit_and_wait(const unsigned wait_nr, const int timeout_ms);
+
+    //! Remove the oldest completion from the queue; `false` if there is none
+    bool pop_cqe(io_uring_cqe &cqe);
+
+    //! Register a ring of provided buffers (see ProvidedBufferRing); `false` if the kernel declines
+    bool register_buffer_ring(const io_uring_buf_reg &reg);
+
+    //! Unregister the ring of provided buffers for buffer group `group`
+    void unregister_buffer_ring(const uint16_t group);
+
+    //! \name
+    //! An IoUring cannot be copied or moved
+    //!@{
+    IoUring(const IoUring &other) = delete;
+    IoUring &operator=(const IoUring &other) = delete;
+    //!@}
+};
+
+//! \class IoUring
+//! The ring's three shared regions are mapped once at construction. Entries are prepared in place
+//! with get_sqe(), published and handed to the kernel by submit_and_wait() in a single
+//! [io_uring_enter(2)](\ref man2::io_uring_enter), and harvested with pop_cqe().
+//!
+//! The constructor throws if the kernel does not support io_uring, forbids it (e.g. via seccomp or
+//! `kernel.io_uring_disabled`), or lacks IORING_FEAT_EXT_ARG (Linux 5.11), which is needed to wait
+//! with a timeout.
+
+//! \brief A group of equal-sized buffers that the kernel picks from to complete reads on an IoUring
+class ProvidedBufferRing {
+  private:
+    IoUring &_ring;          //!< The ring the buffers are registered with
+    uint16_t _group;         //!< Buffer group ID, which read requests name in io_uring_sqe::buf_group
+    unsigned _count;         //!< Number of buffers (a power of two)
+    size_t _buffer_size;     //!< Size of each buffer
+    size_t _entries_size;    //!< Length of the mapping that holds the ring of io_uring_buf entries
+    io_uring_buf *_entries;  //!< The ring of buffers that the kernel may pick from
+    uint16_t _tail = 0;      //!< Producer index of the ring (published through _entries[0].resv)
+    std::string _storage;    //!< The buffers themselves
+
+  public:
+    //! Register `count` buffers of `buffer_size` bytes as buffer group `group` of `ring`
+    ProvidedBufferRing(IoUring &ring, const uint16_t group, const unsigned count, const size_t buffer_size);
+
+    //! Unregister the buffer group
+    ~ProvidedBufferRing();
+
+    //! Buffer group ID
+    uint16_t group() const { return _group; }
+
+    //! Size of each buffer
+    size_t buffer_size() const { return _buffer_size; }
+
+    //! The first `length` bytes of buffer `id`, which a completion has reported filled
+    std::string_view buffer(const uint16_t id, const size_t length) const;
+
+    //! Give buffer `id` back to the kernel
+    void recycle(const uint16_t id);
+
+    //! \name
+    //! A ProvidedBufferRing cannot be copied or moved
+    //!@{
+    ProvidedBufferRing(const ProvidedBufferRing &other) = delete;
+    ProvidedBufferRing &operator=(const ProvidedBufferRing &other) = delete;
+    //!@}
+};
+
+//! \class ProvidedBufferRing
+//! A read request that sets IOSQE_BUFFER_SELECT and names the group does not say where its data goes;
+//! the kernel takes the next buffer from the ring when data arrives, and reports its ID in the completion
+//! (IORING_CQE_F_BUFFER). A multishot request keeps reading into fresh buffers until the ring runs dry,
+//! so each buffer must be recycled once its contents have been consumed.
+//!
+//! The constructor throws if the kernel lacks IORING_REGISTER_PBUF_RING (Linux 5.19).
+
+#endif  // SPONGE_LIBSPONGE_IO_URING_HH
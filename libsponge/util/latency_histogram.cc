@@ -0,0 +1,250 @@
+#include "latency_histogram.hh"
+
+#include <algorithm>
+#include <cstdlib>
+#include <iomanip>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+//! \param[in] index is the bucket's index
+uint64_t LatencyHistogram::bucket_lower(const size_t index) {
+    if (index < SUB_BUCKETS) {
+        return index;
+    }
+    const size_t shift = index / SUB_BUCKETS - 1;
+    return (SUB_BUCKETS + index % SUB_BUCKETS) << shift;
+}
+
+//! \param[in] index is the bucket's index
+uint64_t LatencyHistogram::bucket_upper(const size_t index) {
+    if (index < SUB_BUCKETS) {
+        return index;
+    }
+    const size_t shift = index / SUB_BUCKETS - 1;
+    return bucket_lower(index) + ((uint64_t(1) << shift) - 1);
+}
+
+//! \param[in] other is the histogram to add
+void LatencyHistogram::merge(const LatencyHistogram &other) {
+    for (size_t i = 0; i < BUCKETS; i++) {
+        const uint64_t n = other._buckets[i].value();
+        if (n != 0) {
+            _buckets[i].add(n);
+        }
+    }
+    _count.add(other.count());
+    _sum.add(other.sum());
+    _max.set(std::max(max(), other.max()));
+}
+
+void LatencyHistogram::reset() {
+    for (auto &bucket : _buckets) {
+        bucket.set(0);
+    }
+    _count.set(0);
+    _sum.set(0);
+    _max.set(0);
+}
+
+//! \param[in] quantile is the fraction of the values, from 0 to 1
+uint64_t LatencyHistogram::percentile(const double quantile) const {
+    const uint64_t total = count();
+    if (total == 0) {
+        return 0;
+    }
+    const uint64_t rank = std::max(uint64_t(1), static_cast<uint64_t>(quantile * static_cast<double>(total) + 0.5));
+    uint64_t seen = 0;
+    for (size_t i = 0; i < BUCKETS; i++) {
+        seen += _buckets[i].value();
+        if (seen >= rank) {
+            return std::min(bucket_upper(i), max());
+        }
+    }
+    return max();
+}
+
+//! \returns whether the `SPONGE_LATENCY` environment variable asks for recording
+static bool initially_enabled() {
+    const char *const value = getenv("SPONGE_LATENCY");
+    return value != nullptr and string(value) != "" and string(value) != "0";
+}
+
+atomic<bool> LatencyHistograms::_enabled{initially_enabled()};
+
+//! One histogram per probe
+using ProbeHistograms = array<LatencyHistogram, LatencyHistograms::PROBES>;
+
+//! \brief The histograms of every thread that has recorded, and of those that have exited
+//! \details It is never destroyed, since threads may exit after the statics are destroyed.
+class HistogramRegistry {
+  private:
+    mutex _mutex{};
+    vector<shared_ptr<ProbeHistograms>> _live{};  //!< One per thread that has recorded and not exited
+    ProbeHistograms _retired{};                    //!< The sum of the exited threads'
+
+  public:
+    //! The registry
+    static HistogramRegistry &get() {
+        static HistogramRegistry *const registry = new HistogramRegistry;
+        return *registry;
+    }
+
+    //! Make histograms for the calling thread
+    shared_ptr<ProbeHistograms> add() {
+        auto histograms = make_shared<ProbeHistograms>();
+        lock_guard<mutex> lock(_mutex);
+        _live.push_back(histograms);
+        return histograms;
+    }
+
+    //! Fold an exiting thread's histograms into the retired ones
+    void retire(const shared_ptr<ProbeHistograms> &histograms) {
+        lock_guard<mutex> lock(_mutex);
+        for (size_t i = 0; i < LatencyHistograms::PROBES; i++) {
+            _retired[i].merge((*histograms)[i]);
+        }
+        _live.erase(find(_live.begin(), _live.end(), histograms));
+    }
+
+    //! Sum one probe's histograms over all the threads
+    LatencyHistogram merged(const size_t probe) {
+        lock_guard<mutex> lock(_mutex);
+        LatencyHistogram ret = _retired[probe];
+        for (const auto &histograms : _live) {
+            ret.merge((*histograms)[probe]);
+        }
+        return ret;
+    }
+
+    //! Forget everything
+    void reset() {
+        lock_guard<mutex> lock(_mutex);
+        for (size_t i = 0; i < LatencyHistograms::PROBES; i++) {
+            _retired[i].reset();
+            for (const auto &histograms : _live) {
+                (*histograms)[i].reset();
+            }
+        }
+    }
+};
+
+//! \brief The calling thread's histograms, which are retired when the thread exits
+class ThreadHistograms {
+  private:
+    shared_ptr<ProbeHistograms> _histograms{HistogramRegistry::get().add()};
+
+  public:
+    ThreadHistograms() = default;
+    ThreadHistograms(const ThreadHistograms &other) = delete;
+    ThreadHistograms &operator=(const ThreadHistograms &other) = delete;
+    ~ThreadHistograms() { HistogramRegistry::get().retire(_histograms); }
+
+    LatencyHistogram &operator[](const LatencyProbe probe) { return (*_histograms)[static_cast<size_t>(probe)]; }
+};
+
+//! \param[in] probe is the probe that timed the duration
+//! \param[in] cycles is the duration
+void LatencyHistograms::record(const LatencyProbe probe, const uint64_t cycles) {
+    thread_local ThreadHistograms histograms;
+    histograms[probe].record(cycles);
+}
+
+//! \param[in] probe is the probe whose histograms to merge
+LatencyHistogram LatencyHistograms::merged(const LatencyProbe probe) {
+    return HistogramRegistry::get().merged(static_cast<size_t>(probe));
+}
+
+void LatencyHistograms::reset() { HistogramRegistry::get().reset(); }
+
+//! \param[in] probe is the probe to name
+string LatencyHistograms::name(const LatencyProbe probe) {
+    switch (probe) {
+        case LatencyProbe::SegmentReceived:
+            return "segment_received";
+        case LatencyProbe::FillWindow:
+            return "fill_window";
+        case LatencyProbe::PushSubstring:
+            return "push_substring";
+        case LatencyProbe::RouteBurst:
+            return "route_burst";
+        case LatencyProbe::EventDispatch:
+            return "event_dispatch";
+        default:
+            return "unknown";
+    }
+}
+
+//! \details The time stamp counter is compared with the steady clock over 20 ms, the first time it is needed.
+double LatencyHistograms::cycles_per_ns() {
+#if defined(__x86_64__) || defined(__i386__)
+    static const double ratio = [] {
+        const auto start_time = chrono::steady_clock::now();
+        const uint64_t start_cycles = read_cycles();
+        this_thread::sleep_for(chrono::milliseconds(20));
+        const uint64_t cycles = read_cycles() - start_cycles;
+        const auto ns = chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start_time).count();
+        return static_cast<double>(cycles) / static_cast<double>(ns);
+    }();
+    return ratio;
+#else
+    return 1;
+#endif
+}
+
+//! The quantiles that collect() and report() give
+static constexpr array<double, 5> QUANTILES{0.5, 0.9, 0.99, 0.999, 1};
+
+//! \param[in] cycles is a duration in cycles
+//! \returns the duration in nanoseconds
+static uint64_t to_ns(const uint64_t cycles) {
+    return static_cast<uint64_t>(static_cast<double>(cycles) / LatencyHistograms::cycles_per_ns() + 0.5);
+}
+
+//! \param[in] snapshot is the snapshot to add to
+//! \param[in] labels are the labels to add the metrics under
+void LatencyHistograms::collect(StatsSnapshot &snapshot, const string &labels) {
+    for (size_t i = 0; i < PROBES; i++) {
+        const auto probe = static_cast<LatencyProbe>(i);
+        const LatencyHistogram histogram = merged(probe);
+        const string probe_label = StatsSnapshot::label("probe", name(probe));
+        const string probe_labels = labels.empty() ? probe_label : labels + "," + probe_label;
+        snapshot.add("sponge_latency_samples_total",
+                     "Durations recorded by a latency probe",
+                     StatsSnapshot::Type::Counter,
+                     histogram.count(),
+                     probe_labels);
+        for (const double quantile : QUANTILES) {
+            ostringstream quantile_name;
+            quantile_name << quantile;
+            snapshot.add("sponge_latency_ns",
+                         "Quantiles of the durations recorded by a latency probe",
+                         StatsSnapshot::Type::Gauge,
+                         to_ns(histogram.percentile(quantile)),
+                         probe_labels + "," + StatsSnapshot::label("quantile", quantile_name.str()));
+        }
+    }
+}
+
+string LatencyHistograms::report() {
+    ostringstream ret;
+    ret << left << setw(18) << "probe" << right << setw(12) << "count";
+    for (const auto *const heading : {"p50 ns", "p90 ns", "p99 ns", "p99.9 ns", "max ns"}) {
+        ret << setw(12) << heading;
+    }
+    ret << "\n";
+    for (size_t i = 0; i < PROBES; i++) {
+        const auto probe = static_cast<LatencyProbe>(i);
+        const LatencyHistogram histogram = merged(probe);
+        ret << left << setw(18) << name(probe) << right << setw(12) << histogram.count();
+        for (const double quantile : QUANTILES) {
+            ret << setw(12) << to_ns(histogram.percentile(quantile));
+        }
+        ret << "\n";
+    }
+    return ret.str();
+}
@@ -0,0 +1,180 @@
+#ifndef SPONGE_LIBSPONGE_LATENCY_HISTOGRAM_HH
+#define SPONGE_LIBSPONGE_LATENCY_HISTOGRAM_HH
+
+#include "stats.hh"
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+//! \brief Set to 0 (e.g. `-DSPONGE_LATENCY_HISTOGRAMS=0` in CMAKE_CXX_FLAGS) to compile the latency probes out
+#ifndef SPONGE_LATENCY_HISTOGRAMS
+#define SPONGE_LATENCY_HISTOGRAMS 1
+#endif
+
+//! \brief A timestamp in CPU cycles: the time stamp counter on x86, or else nanoseconds of the steady clock
+inline uint64_t read_cycles() {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+#endif
+}
+
+//! \brief A histogram of durations, with log-linear buckets like an HdrHistogram's
+class LatencyHistogram {
+  public:
+    //! Each power of two is split into 2^SUB_BUCKET_BITS linear buckets, so a bucket is within 1/16 of its values
+    static constexpr unsigned SUB_BUCKET_BITS = 4;
+    static constexpr size_t SUB_BUCKETS = size_t(1) << SUB_BUCKET_BITS;  //!< Buckets per power of two
+    static constexpr size_t BUCKETS = (64 - SUB_BUCKET_BITS + 1) * SUB_BUCKETS;  //!< Buckets to cover any uint64_t
+
+  private:
+    std::array<StatCounter, BUCKETS> _buckets{};
+    StatCounter _count{};
+    StatCounter _sum{};
+    StatCounter _max{};
+
+  public:
+    //! The bucket that holds `value`
+    static size_t bucket_index(const uint64_t value) {
+        if (value < SUB_BUCKETS) {
+            return value;
+        }
+        const unsigned shift = 63 - __builtin_clzll(value) - SUB_BUCKET_BITS;
+        return (shift + 1) * SUB_BUCKETS + ((value >> shift) - SUB_BUCKETS);
+    }
+
+    //! The smallest value in a bucket
+    static uint64_t bucket_lower(const size_t index);
+
+    //! The largest value in a bucket
+    static uint64_t bucket_upper(const size_t index);
+
+    //! Count a value (only the owning thread may call this)
+    void record(const uint64_t value) {
+        _buckets[bucket_index(value)].add();
+        _count.add();
+        _sum.add(value);
+        if (value > _max.value()) {
+            _max.set(value);
+        }
+    }
+
+    //! Add another histogram's values to this one's (only the owning thread may call this)
+    void merge(const LatencyHistogram &other);
+
+    //! Forget every value (only the owning thread may call this)
+    void reset();
+
+    uint64_t count() const { return _count.value(); }  //!< Number of values
+    uint64_t sum() const { return _sum.value(); }      //!< Sum of the values
+    uint64_t max() const { return _max.value(); }      //!< Largest value
+
+    //! Number of values in a bucket
+    uint64_t bucket_count(const size_t index) const { return _buckets.at(index).value(); }
+
+    //! \brief The value below which a fraction `quantile` (from 0 to 1) of the values lie
+    //! \returns the largest value of the bucket where that fraction is reached (but no more than max()), or 0
+    //! if the histogram is empty
+    uint64_t percentile(const double quantile) const;
+};
+
+//! \class LatencyHistogram
+//! The buckets of one power of two, [2^k, 2^(k+1)), each cover 2^(k-4) values, so recording is a count of
+//! leading zeros and a shift, and any percentile is off by at most 6.25% however long the tail. The histogram
+//! is about 8 KiB, whatever the number of values, and merging two of them adds their buckets. Like StatCounter,
+//! one thread writes a histogram and any thread can read it.
+
+//! The code that the latency probes time
+enum class LatencyProbe : uint8_t {
+    SegmentReceived,  //!< TCPConnection::segment_received
+    FillWindow,       //!< TCPSender::fill_window
+    PushSubstring,    //!< StreamReassembler::push_substring
+    RouteBurst,       //!< Router and ParallelRouter routing one burst of datagrams
+    EventDispatch,    //!< EventLoop calling one rule's callback
+    Count             //!< The number of probes
+};
+
+//! \brief The latency probes' histograms: one set per thread, merged when read
+class LatencyHistograms {
+  private:
+    static std::atomic<bool> _enabled;  //!< Do the probes record?
+
+  public:
+    //! Number of probes
+    static constexpr size_t PROBES = static_cast<size_t>(LatencyProbe::Count);
+
+    //! \brief Do the probes record? (initially, if the `SPONGE_LATENCY` environment variable is set and not "0")
+    static bool enabled() { return SPONGE_LATENCY_HISTOGRAMS and _enabled.load(std::memory_order_relaxed); }
+
+    //! Start or stop recording
+    static void set_enabled(const bool enabled) { _enabled.store(enabled, std::memory_order_relaxed); }
+
+    //! Record a duration, in cycles, in the calling thread's histogram for `probe`
+    static void record(const LatencyProbe probe, const uint64_t cycles);
+
+    //! The histogram of `probe`, merged from all the threads (including those that have exited)
+    static LatencyHistogram merged(const LatencyProbe probe);
+
+    //! \brief Forget every recorded duration
+    //! \note Durations that other threads record meanwhile may be lost or kept
+    static void reset();
+
+    //! A probe's name, e.g. "segment_received"
+    static std::string name(const LatencyProbe probe);
+
+    //! Cycles per nanosecond of read_cycles(), measured once (1 where there is no time stamp counter)
+    static double cycles_per_ns();
+
+    //! \brief Add each probe's count and percentiles (in nanoseconds) to a snapshot
+    //! \details The metrics are `sponge_latency_samples_total{probe="..."}` and
+    //! `sponge_latency_ns{probe="...",quantile="..."}` (quantile 1 being the maximum).
+    static void collect(StatsSnapshot &snapshot, const std::string &labels = "");
+
+    //! A table of each probe's count and percentiles, in nanoseconds
+    static std::string report();
+};
+
+//! \class LatencyHistograms
+//! Each thread records into its own histograms, so a probe costs two reads of the time stamp counter and a
+//! few uncontended stores; nothing is shared until merged() is called. When a thread exits, its histograms are
+//! folded into a set that merged() also reads. While recording is disabled, a probe costs one relaxed load and a
+//! branch, and with SPONGE_LATENCY_HISTOGRAMS set to 0 it compiles to nothing.
+
+//! \brief Times the scope it lives in, for a probe
+class LatencyScope {
+  private:
+    LatencyProbe _probe;
+    uint64_t _start;  //!< When the scope began, or 0 if recording is disabled
+
+  public:
+    explicit LatencyScope(const LatencyProbe probe)
+        : _probe(probe), _start(LatencyHistograms::enabled() ? read_cycles() : 0) {}
+
+    ~LatencyScope() {
+        if (_start != 0) {
+            LatencyHistograms::record(_probe, read_cycles() - _start);
+        }
+    }
+
+    LatencyScope(const LatencyScope &other) = delete;
+    LatencyScope &operator=(const LatencyScope &other) = delete;
+};
+
+//! Time the rest of the enclosing scope for a probe, e.g. `SPONGE_LATENCY_SCOPE(FillWindow);`
+#if SPONGE_LATENCY_HISTOGRAMS
+#define SPONGE_LATENCY_SCOPE(probe) const LatencyScope sponge_latency_scope_(LatencyProbe::probe)
+#else
+#define SPONGE_LATENCY_SCOPE(probe) static_cast<void>(0)
+#endif
+
+#endif  // SPONGE_LIBSPONGE_LATENCY_HISTOGRAM_HH
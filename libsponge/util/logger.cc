@@ -0,0 +1,177 @@
+#include "logger.hh"
+
+#include "spsc_ring.hh"
+
+#include <cerrno>
+#include <chrono>
+#include <cstdlib>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+using namespace std;
+
+//! How often the background thread drains the rings
+static constexpr auto FLUSH_INTERVAL = chrono::milliseconds(10);
+
+//! \returns the level named by the `SPONGE_LOG_LEVEL` environment variable, or Info
+static LogLevel initial_level() {
+    const char *const name = getenv("SPONGE_LOG_LEVEL");
+    try {
+        return name ? Logger::parse_level(name) : LogLevel::Info;
+    } catch (const exception &) {
+        return LogLevel::Info;
+    }
+}
+
+atomic<LogLevel> Logger::_level{initial_level()};
+atomic<uint64_t> Logger::_dropped{0};
+
+//! \returns the text that starts each line of a message at `level` (the prefixes the messages had before)
+static string_view prefix(const LogLevel level) {
+    switch (level) {
+        case LogLevel::Debug:
+            return "DEBUG: ";
+        case LogLevel::Warning:
+            return "Warning: ";
+        case LogLevel::Error:
+            return "Error: ";
+        default:
+            return "";
+    }
+}
+
+//! Write all of `data` to stderr, giving up on an error (there is nowhere left to report it)
+static void write_to_stderr(string_view data) {
+    while (not data.empty()) {
+        const ssize_t written = ::write(STDERR_FILENO, data.data(), data.size());
+        if (written < 0 and errno == EINTR) {
+            continue;
+        }
+        if (written <= 0) {
+            return;
+        }
+        data.remove_prefix(written);
+    }
+}
+
+//! \brief The rings of all the threads that have logged, and the thread that drains them
+//! \details It is never destroyed (objects that outlive any static can still log); at exit it is drained one last
+//! time, and from then on messages are written directly.
+class LogFlusher {
+  private:
+    mutex _mutex{};                         //!< Guards `_rings`, and makes drain() their only reader
+    vector<shared_ptr<SPSCRing>> _rings{};  //!< One per thread that has logged (until its input ends and is read)
+    uint64_t _reported_drops{0};            //!< Drops already reported
+    bool _started{false};                   //!< Is the background thread running?
+    atomic<bool> _exiting{false};           //!< Has the program begun to exit?
+
+  public:
+    //! The flusher
+    static LogFlusher &get() {
+        static LogFlusher *const flusher = new LogFlusher;
+        return *flusher;
+    }
+
+    //! Make a ring for the calling thread, starting the background thread if it is the first
+    shared_ptr<SPSCRing> add_ring() {
+        auto ring = make_shared<SPSCRing>(Logger::RING_CAPACITY);
+        lock_guard<mutex> lock(_mutex);
+        _rings.push_back(ring);
+        if (not _started) {
+            _started = true;
+            atexit([] {
+                LogFlusher &flusher = get();
+                flusher._exiting.store(true);
+                flusher.drain();
+            });
+            thread([this] {
+                while (true) {
+                    this_thread::sleep_for(FLUSH_INTERVAL);
+                    drain();
+                }
+            }).detach();
+        }
+        return ring;
+    }
+
+    //! Write what every ring holds to stderr, with one write(2)
+    void drain() {
+        lock_guard<mutex> lock(_mutex);
+        string data;
+        for (auto it = _rings.begin(); it != _rings.end();) {
+            data += (*it)->read(Logger::RING_CAPACITY);
+            it = (*it)->eof() ? _rings.erase(it) : it + 1;
+        }
+        const uint64_t dropped = Logger::dropped();
+        if (dropped != _reported_drops) {
+            data += string(prefix(LogLevel::Warning)) + to_string(dropped - _reported_drops);
+            data += " log messages dropped\n";
+            _reported_drops = dropped;
+        }
+        write_to_stderr(data);
+    }
+
+    //! Has the program begun to exit (so that messages should no longer wait)?
+    bool exiting() const { return _exiting.load(memory_order_relaxed); }
+};
+
+//! \brief The calling thread's ring, which is read to the end (and freed) once the thread exits
+class ThreadLogRing {
+  private:
+    shared_ptr<SPSCRing> _ring{LogFlusher::get().add_ring()};
+
+  public:
+    ThreadLogRing() = default;
+    ThreadLogRing(const ThreadLogRing &other) = delete;
+    ThreadLogRing &operator=(const ThreadLogRing &other) = delete;
+    ~ThreadLogRing() { _ring->end_input(); }
+
+    SPSCRing &ring() { return *_ring; }
+};
+
+//! \param[in] name is the name of a level, in lower case
+LogLevel Logger::parse_level(const string_view name) {
+    if (name == "debug") {
+        return LogLevel::Debug;
+    }
+    if (name == "info") {
+        return LogLevel::Info;
+    }
+    if (name == "warning") {
+        return LogLevel::Warning;
+    }
+    if (name == "error") {
+        return LogLevel::Error;
+    }
+    if (name == "off") {
+        return LogLevel::Off;
+    }
+    throw runtime_error("Logger: unknown level \"" + string(name) + "\"");
+}
+
+//! \param[in] level is the message's level
+//! \param[in] message is the message
+void Logger::write(const LogLevel level, const string_view message) {
+    string line{prefix(level)};
+    line += message;
+    line += '\n';
+
+    if (LogFlusher::get().exiting()) {
+        write_to_stderr(line);
+        return;
+    }
+
+    thread_local ThreadLogRing thread_ring;
+    SPSCRing &ring = thread_ring.ring();
+    if (ring.remaining_capacity() < line.size()) {
+        _dropped.fetch_add(1, memory_order_relaxed);
+        return;
+    }
+    ring.write(line);
+}
+
+void Logger::flush() { LogFlusher::get().drain(); }
@@ -0,0 +1,89 @@
+#ifndef SPONGE_LIBSPONGE_LOGGER_HH
+#define SPONGE_LIBSPONGE_LOGGER_HH
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <sstream>
+#include <string>
+#include <string_view>
+
+//! Severity of a log message
+enum class LogLevel : uint8_t { Debug, Info, Warning, Error, Off };
+
+//! \brief Log messages below this level (0 = Debug ... 4 = Off) are compiled out entirely
+//! \details Set it with, e.g., `-DSPONGE_LOG_MIN_LEVEL=2` in CMAKE_CXX_FLAGS to keep only warnings and errors.
+#ifndef SPONGE_LOG_MIN_LEVEL
+#define SPONGE_LOG_MIN_LEVEL 0
+#endif
+
+//! \brief A leveled logger that writes through per-thread lock-free rings, flushed to stderr by a background thread
+class Logger {
+  public:
+    //! Messages below this level are compiled out
+    static constexpr LogLevel COMPILED_LEVEL = static_cast<LogLevel>(SPONGE_LOG_MIN_LEVEL);
+
+    static constexpr size_t RING_CAPACITY = 64 * 1024;  //!< Bytes of messages that each thread can have waiting
+
+  private:
+    static std::atomic<LogLevel> _level;    //!< Messages below this level are discarded at run time
+    static std::atomic<uint64_t> _dropped;  //!< Messages dropped because their thread's ring was full
+
+  public:
+    //! Is a message at `level` logged?
+    static bool enabled(const LogLevel level) {
+        return level >= COMPILED_LEVEL and level >= _level.load(std::memory_order_relaxed);
+    }
+
+    //! \brief The run-time level (initially from the `SPONGE_LOG_LEVEL` environment variable, or Info)
+    static LogLevel level() { return _level.load(std::memory_order_relaxed); }
+
+    //! Change the run-time level
+    static void set_level(const LogLevel level) { _level.store(level, std::memory_order_relaxed); }
+
+    //! Parse a level name ("debug", "info", "warning", "error" or "off")
+    static LogLevel parse_level(const std::string_view name);
+
+    //! Queue a message (without its trailing newline) on the calling thread's ring
+    static void write(const LogLevel level, const std::string_view message);
+
+    //! Write every message queued so far (by any thread) to stderr before returning
+    static void flush();
+
+    //! Number of messages dropped because a ring was full
+    static uint64_t dropped() { return _dropped.load(std::memory_order_relaxed); }
+};
+
+//! \class Logger
+//! Each thread formats its messages itself and copies them into its own SPSCRing, so logging never takes a
+//! lock or makes a system call on the thread that logs; a background thread (started by the first message)
+//! drains the rings every few milliseconds, with one write(2) for all of them. A message that does not fit in its
+//! thread's ring is dropped and counted, rather than stalling the thread. Messages from one thread stay in
+//! order; messages from different threads may interleave differently than they were logged.
+//!
+//! Use the LOG_DEBUG, LOG_INFO, LOG_WARNING and LOG_ERROR macros, which take a stream expression:
+//! ~~~{.cpp}
+//! LOG_DEBUG("adding route " << prefix << "/" << int(prefix_length));
+//! ~~~
+//! A statement below SPONGE_LOG_MIN_LEVEL compiles to nothing; one below the run-time level costs one relaxed
+//! load and a branch, and its stream expression is not evaluated.
+
+//! \cond
+#define SPONGE_LOG(level, message)                                                                                     \
+    do {                                                                                                               \
+        if constexpr (level >= Logger::COMPILED_LEVEL) {                                                               \
+            if (Logger::enabled(level)) {                                                                              \
+                std::ostringstream sponge_log_stream_;                                                                 \
+                sponge_log_stream_ << message;                                                                         \
+                Logger::write(level, sponge_log_stream_.str());                                                        \
+            }                                                                                                          \
+        }                                                                                                              \
+    } while (false)
+//! \endcond
+
+#define LOG_DEBUG(message) SPONGE_LOG(LogLevel::Debug, message)      //!< Log a message at Debug level
+#define LOG_INFO(message) SPONGE_LOG(LogLevel::Info, message)        //!< Log a message at Info level
+#define LOG_WARNING(message) SPONGE_LOG(LogLevel::Warning, message)  //!< Log a message at Warning level
+#define LOG_ERROR(message) SPONGE_LOG(LogLevel::Error, message)      //!< Log a message at Error level
+
+#endif  // SPONGE_LIBSPONGE_LOGGER_HH
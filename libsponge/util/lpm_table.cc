@@ -0,0 +1,180 @@
+#include "lpm_table.hh"
+
+#include <stdexcept>
+#include <string>
+
+using namespace std;
+
+//! \details Every slot of the first level starts out as a leaf with no prefix.
+LPMTable::LPMTable() { _levels[0].assign(size_t(1) << STRIDE[0], NO_MATCH); }
+
+//! \param[in] level is the level
+//! \param[in] slot is the index of the slot in the level
+//! \param[in] new_leaf is the leaf to store
+//! \param[in] old_rank is the rank of the leaves to replace, or SHORTER for all the leaves of shorter prefixes
+//! \returns whether any slot changed
+bool LPMTable::push(const unsigned level, const size_t slot, const Entry new_leaf, const unsigned old_rank) {
+    const Entry entry = _levels.at(level)[slot];
+    if (entry & CHILD) {
+        const size_t first = (entry & ~CHILD) * GROUP_SIZE;
+        bool changed = false;
+        for (size_t i = first; i < first + GROUP_SIZE; i++) {
+            changed |= push(level + 1, i, new_leaf, old_rank);
+        }
+        return changed;
+    }
+
+    if (old_rank == SHORTER ? rank(entry) < rank(new_leaf) : rank(entry) == old_rank) {
+        _levels[level][slot] = new_leaf;
+        return entry != new_leaf;
+    }
+    return false;
+}
+
+//! \param[in] level is the level
+//! \param[in] group is the index of the group in the level (0 for the first level, which has one "group")
+//! \param[in] prefix is the prefix, with the bits after `prefix_length` cleared
+//! \param[in] prefix_length is the number of significant bits in `prefix`
+//! \param[in] new_leaf is the leaf to store
+//! \param[in] old_rank is the rank of the leaves to replace, or SHORTER for all the leaves of shorter prefixes
+//! \returns whether any slot changed
+bool LPMTable::update(const unsigned level,
+                      const size_t group,
+                      const uint32_t prefix,
+                      const uint8_t prefix_length,
+                      const Entry new_leaf,
+                      const unsigned old_rank) {
+    const unsigned last_bit = FIRST_BITS[level] + STRIDE[level];
+    const size_t base = group * GROUP_SIZE;
+    const size_t index = ((uint64_t(prefix) << FIRST_BITS[level]) & 0xffffffff) >> (32 - STRIDE[level]);
+
+    // the prefix ends in this level: it covers a run of slots
+    if (prefix_length <= last_bit) {
+        const size_t count = size_t(1) << (last_bit - prefix_length);
+        bool changed = false;
+        for (size_t slot = base + index; slot < base + index + count; slot++) {
+            changed |= push(level, slot, new_leaf, old_rank);
+        }
+        return changed;
+    }
+
+    // the prefix goes deeper: make sure the slot points to a group, which starts out with the slot's leaf
+    // (a prefix in the table that goes deeper always has a group, so only adding one needs to make it)
+    Entry &entry = _levels.at(level)[base + index];
+    if (not(entry & CHILD)) {
+        if (old_rank != SHORTER) {
+            return false;
+        }
+        const Entry parent = entry;
+        std::vector<Entry> &next = _levels.at(level + 1);
+        const size_t child = next.size() / GROUP_SIZE;
+        if (child >= CHILD) {
+            throw runtime_error("LPMTable: too many groups");
+        }
+        next.resize(next.size() + GROUP_SIZE, parent);
+        entry = CHILD | Entry(child);  // still valid: only the next level grew
+    }
+    return update(level + 1, entry & ~CHILD, prefix, prefix_length, new_leaf, old_rank);
+}
+
+//! \param[in] prefix_length is the prefix length to check
+//! \param[in] value is the value to check (or NO_MATCH, if `allow_no_match`)
+//! \param[in] allow_no_match is whether NO_MATCH is an acceptable `value`
+void LPMTable::check(const uint8_t prefix_length, const uint32_t value, const bool allow_no_match) {
+    if (prefix_length > 32) {
+        throw runtime_error("LPMTable: prefix length " + to_string(prefix_length) + " is more than 32");
+    }
+    if (value > MAX_VALUE and not(allow_no_match and value == NO_MATCH)) {
+        throw runtime_error("LPMTable: value " + to_string(value) + " is too large");
+    }
+}
+
+//! \param[in] prefix is the prefix
+//! \param[in] prefix_length is the number of significant bits in `prefix`
+//! \returns `prefix` with the bits after `prefix_length` cleared
+static uint32_t masked(const uint32_t prefix, const uint8_t prefix_length) {
+    return prefix_length == 0 ? 0 : prefix & (0xffffffff << (32 - prefix_length));
+}
+
+//! \param[in] prefix is the prefix; bits after `prefix_length` are ignored
+//! \param[in] prefix_length is the number of significant bits in `prefix` (0 to 32)
+//! \param[in] value is what lookup() returns for the addresses that this prefix is the longest match for
+bool LPMTable::add(const uint32_t prefix, const uint8_t prefix_length, const uint32_t value) {
+    check(prefix_length, value, false);
+    const Entry new_leaf = leaf(value, prefix_length);
+    const bool changed = update(0, 0, masked(prefix, prefix_length), prefix_length, new_leaf, SHORTER);
+    _prefixes += changed;
+    return changed;
+}
+
+//! \param[in] prefix is the prefix; bits after `prefix_length` are ignored
+//! \param[in] prefix_length is the number of significant bits in `prefix` (0 to 32)
+//! \param[in] value is the new value of the prefix
+bool LPMTable::replace(const uint32_t prefix, const uint8_t prefix_length, const uint32_t value) {
+    check(prefix_length, value, false);
+    const Entry new_leaf = leaf(value, prefix_length);
+    return update(0, 0, masked(prefix, prefix_length), prefix_length, new_leaf, rank(new_leaf));
+}
+
+//! \param[in] prefix is the prefix; bits after `prefix_length` are ignored
+//! \param[in] prefix_length is the number of significant bits in `prefix` (0 to 32)
+//! \param[in] covering_value is the value of the longest prefix in the table that is shorter than this one and
+//! covers it, or NO_MATCH if there is none
+//! \param[in] covering_length is the length of that prefix (ignored if `covering_value` is NO_MATCH)
+//! \details The table keeps the length of the prefix behind each leaf but not the prefixes themselves, so it
+//! cannot find the covering prefix on its own: the caller, which knows the whole set of prefixes, provides it.
+bool LPMTable::remove(const uint32_t prefix,
+                      const uint8_t prefix_length,
+                      const uint32_t covering_value,
+                      const uint8_t covering_length) {
+    check(prefix_length, covering_value, true);
+    if (covering_value != NO_MATCH and covering_length >= prefix_length) {
+        throw runtime_error("LPMTable: the covering prefix of a /" + to_string(prefix_length) + " cannot be a /" +
+                            to_string(covering_length));
+    }
+
+    const Entry covering = covering_value == NO_MATCH ? NO_MATCH : leaf(covering_value, covering_length);
+    const bool changed =
+        update(0, 0, masked(prefix, prefix_length), prefix_length, covering, rank(leaf(0, prefix_length)));
+    _prefixes -= changed;
+    return changed;
+}
+
+//! \param[in] addresses are the addresses to look up
+//! \param[out] results are the values of the longest matching prefixes (or NO_MATCH), one per address
+//! \param[in] count is the number of addresses
+void LPMTable::lookup_batch(const uint32_t *addresses, uint32_t *results, const size_t count) const {
+    const Entry *first = _levels[0].data();
+    const Entry *second = _levels[1].data();
+    const Entry *third = _levels[2].data();
+
+    // each pass reads the slots prefetched by the pass before, and prefetches the slots for the next one
+    for (size_t i = 0; i < count; i++) {
+        results[i] = first[addresses[i] >> 16];
+        if (results[i] & CHILD) {
+            __builtin_prefetch(&second[(results[i] & ~CHILD) * GROUP_SIZE + ((addresses[i] >> 8) & 0xff)]);
+        }
+    }
+    for (size_t i = 0; i < count; i++) {
+        if (results[i] & CHILD) {
+            results[i] = second[(results[i] & ~CHILD) * GROUP_SIZE + ((addresses[i] >> 8) & 0xff)];
+            if (results[i] & CHILD) {
+                __builtin_prefetch(&third[(results[i] & ~CHILD) * GROUP_SIZE + (addresses[i] & 0xff)]);
+            }
+        }
+    }
+    for (size_t i = 0; i < count; i++) {
+        if (results[i] & CHILD) {
+            results[i] = third[(results[i] & ~CHILD) * GROUP_SIZE + (addresses[i] & 0xff)];
+        }
+        results[i] &= VALUE_MASK;
+    }
+}
+
+size_t LPMTable::memory_usage() const {
+    size_t bytes = 0;
+    for (const auto &level : _levels) {
+        bytes += level.size() * sizeof(Entry);
+    }
+    return bytes;
+}
@@ -0,0 +1,124 @@
+#ifndef SPONGE_LIBSPONGE_LPM_TABLE_HH
+#define SPONGE_LIBSPONGE_LPM_TABLE_HH
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+//! \brief A longest-prefix-match table from IPv4 prefixes to small integers, with lookups in at most three
+//! memory accesses
+class LPMTable {
+  public:
+    static constexpr uint32_t NO_MATCH = 0xffffff;  //!< lookup() result for an address that no prefix matches
+    static constexpr uint32_t MAX_VALUE = NO_MATCH - 1;  //!< Largest value that a prefix can map to
+
+  private:
+    //! \brief One slot of a level: either a leaf (the value of the longest prefix covering the slot's
+    //! addresses, and that prefix's rank) or the index of a group of 256 slots at the next level
+    using Entry = uint32_t;
+
+    static constexpr Entry CHILD = 1U << 31;  //!< Set in an Entry that points to a group at the next level
+    static constexpr unsigned RANK_SHIFT = 24;  //!< Leaves keep the rank in bits 24-29
+    static constexpr Entry VALUE_MASK = (1U << RANK_SHIFT) - 1;  //!< Leaves keep the value in bits 0-23
+
+    static constexpr unsigned LEVELS = 3;                        //!< Number of levels
+    static constexpr unsigned FIRST_BITS[LEVELS] = {0, 16, 24};  //!< Address bits consumed before each level
+    static constexpr unsigned STRIDE[LEVELS] = {16, 8, 8};       //!< Address bits that index each level
+    static constexpr size_t GROUP_SIZE = 256;                    //!< Slots in a group of the second or third level
+
+    //! Slots of each level: 65536 at the first level, groups of 256 at the others
+    std::array<std::vector<Entry>, LEVELS> _levels{};
+
+    size_t _prefixes{0};  //!< Number of prefixes that add() accepted, less those that remove() took out
+
+    //! Make a leaf for a prefix; its rank is the prefix length plus one (zero means "no prefix")
+    static Entry leaf(const uint32_t value, const uint8_t prefix_length) {
+        return (Entry(prefix_length + 1) << RANK_SHIFT) | value;
+    }
+
+    //! The rank of a leaf
+    static unsigned rank(const Entry entry) { return entry >> RANK_SHIFT; }
+
+    //! push() and update() argument for replacing the leaves of every prefix shorter than the new leaf's
+    static constexpr unsigned SHORTER = 64;
+
+    //! Store a leaf in the slots of a prefix, starting at a group (0 for the first level) of `level`
+    bool update(const unsigned level,
+                const size_t group,
+                const uint32_t prefix,
+                const uint8_t prefix_length,
+                const Entry new_leaf,
+                const unsigned old_rank);
+
+    //! Store a leaf in a slot of `level` (or, if the slot points to a group, in every slot below it),
+    //! wherever the leaf there has rank `old_rank` (or, for SHORTER, comes from a shorter prefix)
+    bool push(const unsigned level, const size_t slot, const Entry new_leaf, const unsigned old_rank);
+
+    //! Throw if a prefix length or value is out of range
+    static void check(const uint8_t prefix_length, const uint32_t value, const bool allow_no_match);
+
+  public:
+    //! Construct an empty table
+    LPMTable();
+
+    //! \brief Map the addresses whose first `prefix_length` bits equal those of `prefix` to `value`
+    //! \returns `false` if this changes no lookup: the table already has the same prefix (which keeps its
+    //! value), or longer prefixes cover all of its addresses
+    bool add(const uint32_t prefix, const uint8_t prefix_length, const uint32_t value);
+
+    //! \brief Change the value of a prefix that is in the table
+    //! \returns `false` if this changes no lookup: the prefix is not in the table, already has `value`, or
+    //! longer prefixes cover all of its addresses
+    bool replace(const uint32_t prefix, const uint8_t prefix_length, const uint32_t value);
+
+    //! \brief Remove a prefix, handing its addresses to the longest prefix that covers it
+    //! \returns `false` if this changes no lookup (as for replace())
+    bool remove(const uint32_t prefix,
+                const uint8_t prefix_length,
+                const uint32_t covering_value,
+                const uint8_t covering_length);
+
+    //! The value of the longest prefix that matches `address`, or NO_MATCH
+    uint32_t lookup(const uint32_t address) const {
+        Entry entry = _levels[0][address >> 16];
+        if (entry & CHILD) {
+            entry = _levels[1][(entry & ~CHILD) * GROUP_SIZE + ((address >> 8) & 0xff)];
+            if (entry & CHILD) {
+                entry = _levels[2][(entry & ~CHILD) * GROUP_SIZE + (address & 0xff)];
+            }
+        }
+        return entry & VALUE_MASK;
+    }
+
+    //! \brief Look up `count` addresses at once, storing the values in `results` (as lookup() would)
+    //! \details Faster than one lookup() at a time when the table does not fit in the cache: see the class
+    //! description.
+    void lookup_batch(const uint32_t *addresses, uint32_t *results, const size_t count) const;
+
+    //! Number of prefixes in the table
+    size_t size() const { return _prefixes; }
+
+    //! Bytes used by the slots of all levels
+    size_t memory_usage() const;
+};
+
+//! \class LPMTable
+//! The table is a multibit trie with fixed strides of 16, 8 and 8 bits (a "DIR-16-8-8" variant of
+//! Gupta, Lin and McKeown's DIR-24-8, with a 256 KiB first level instead of a 64 MiB one). Prefixes are
+//! pushed to the leaves: each slot holds the answer for all the addresses it covers, so a lookup follows
+//! at most two child pointers and never backtracks. A /24 or shorter prefix is found in at most two
+//! accesses, which covers nearly all of an Internet routing table.
+//!
+//! To support adding prefixes in any order, each leaf also records the length of the prefix it came
+//! from; a new prefix only replaces leaves from shorter prefixes (or from no prefix). The same ranks make
+//! replacing and removing a prefix exact: within the prefix's slots, the leaves of its rank can only be its
+//! own, so replace() rewrites just those, and remove() turns them into leaves of the covering prefix. Groups
+//! are never freed, so a table that churns keeps the memory of its largest shape.
+//!
+//! A full table is far larger than the cache, so nearly every lookup misses once or twice, and each
+//! miss depends on the one before it. lookup_batch() walks a whole batch of addresses through the
+//! levels together, as in VPP's and DPDK's vector paths: it prefetches the slots that every address needs
+//! at one level before reading any of them, so the misses of the batch overlap instead of queueing.
+
+#endif  // SPONGE_LIBSPONGE_LPM_TABLE_HH
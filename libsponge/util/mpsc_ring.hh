@@ -0,0 +1,94 @@
+#ifndef SPONGE_LIBSPONGE_MPSC_RING_HH
+#define SPONGE_LIBSPONGE_MPSC_RING_HH
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <utility>
+
+//! \brief A bounded lock-free queue from any number of producer threads to one consumer thread
+//! \tparam T is the type of the elements, which must be default-constructible and move-assignable
+template <typename T>
+class MPSCRing {
+  private:
+    static constexpr size_t CACHE_LINE = 64;  //!< Keeps the producers' and consumer's positions on separate lines
+
+    //! \brief An element, with the position it holds (plus one) once a producer has filled it in
+    struct Slot {
+        std::atomic<size_t> sequence{0};
+        T value{};
+    };
+
+    std::unique_ptr<Slot[]> _slots;  //!< Storage; positions are taken modulo its (power-of-two) size
+    size_t _mask;                    //!< Size of `_slots`, minus one
+
+    alignas(CACHE_LINE) std::atomic<size_t> _push_pos{0};  //!< Position that the next producer claims
+    alignas(CACHE_LINE) size_t _pop_pos{0};                //!< Position of the next element (only the consumer)
+
+    //! The smallest power of two that is at least `capacity`
+    static size_t round_up(const size_t capacity) {
+        size_t size = 1;
+        while (size < capacity) {
+            size <<= 1;
+        }
+        return size;
+    }
+
+  public:
+    //! Construct a ring that holds at least `capacity` elements (rounded up to a power of two)
+    explicit MPSCRing(const size_t capacity)
+        : _slots(std::make_unique<Slot[]>(round_up(capacity))), _mask(round_up(capacity) - 1) {
+        for (size_t i = 0; i <= _mask; i++) {
+            _slots[i].sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    //! \brief Append an element (any thread)
+    //! \returns `false` (leaving `value` alone) if the ring is full
+    bool push(T &&value) {
+        size_t pos = _push_pos.load(std::memory_order_relaxed);
+        while (true) {
+            Slot &slot = _slots[pos & _mask];
+            const size_t sequence = slot.sequence.load(std::memory_order_acquire);
+            if (sequence == pos) {
+                // the slot is free for position `pos`: claim the position, then fill the slot in
+                if (_push_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    slot.value = std::move(value);
+                    slot.sequence.store(pos + 1, std::memory_order_release);
+                    return true;
+                }
+            } else if (sequence < pos) {
+                return false;  // the slot still holds the element from one lap before
+            } else {
+                pos = _push_pos.load(std::memory_order_relaxed);  // another producer claimed `pos`
+            }
+        }
+    }
+
+    //! \brief Remove the oldest element (only the consumer thread)
+    //! \returns `false` if the ring is empty, or its oldest element is still being filled in
+    bool pop(T &value) {
+        Slot &slot = _slots[_pop_pos & _mask];
+        if (slot.sequence.load(std::memory_order_acquire) != _pop_pos + 1) {
+            return false;
+        }
+        value = std::move(slot.value);
+        slot.sequence.store(_pop_pos + _mask + 1, std::memory_order_release);  // free for the next lap
+        _pop_pos++;
+        return true;
+    }
+
+    //! Number of elements that the ring holds
+    size_t capacity() const { return _mask + 1; }
+};
+
+//! \class MPSCRing
+//! This is Dmitry Vyukov's bounded queue, with a single consumer. Each slot carries a sequence number that
+//! says whose turn it is: a slot at position `pos` is free for the producer of `pos` when its sequence is
+//! `pos`, and full for the consumer when its sequence is `pos + 1`. Producers claim positions with one
+//! compare-and-swap, and producers and the consumer never touch the same slot at the same time, so there is no
+//! lock anywhere; a producer that stalls between claiming a slot and filling it in only delays the consumer at
+//! that slot.
+
+#endif  // SPONGE_LIBSPONGE_MPSC_RING_HH
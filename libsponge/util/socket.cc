@@ -2,7 +2,10 @@
 
 #include "util.hh"
 
+#include <array>
 #include <cstddef>
+#include <cstring>
+#include <netinet/udp.h>
 #include <stdexcept>
 #include <unistd.h>
 
@@ -112,6 +115,72 @@ UDPSocket::received_datagram UDPSocket::recv(const size_t mtu) {
     return ret;
 }
 
+//! \param[in] capacity is the maximum number of datagrams returned by one call to UDPSocket::recv_batch
+//! \param[in] mtu is the size of each slot; a larger datagram makes UDPSocket::recv_batch throw
+UDPSocket::RecvBatch::RecvBatch(const size_t capacity, const size_t mtu)
+    : _mtu(mtu)
+    , _storage(capacity * mtu, 0)
+    , _addresses(capacity)
+    , _iovecs(capacity)
+    , _headers(capacity)
+    , _control(capacity * CMSG_SPACE(sizeof(int)), 0)
+    , _payloads()
+    , _segment_sizes() {
+    _payloads.reserve(capacity);
+    _segment_sizes.reserve(capacity);
+}
+
+//! \param[in] n is the index of the datagram in the batch
+Address UDPSocket::RecvBatch::source_address(const size_t n) const {
+    return {_addresses.at(n), _headers.at(n).msg_hdr.msg_namelen};
+}
+
+//! \returns the number of datagrams received, which is also `batch.size()`
+//! \details Blocks until at least one datagram is ready (like recv()), then takes
+//! whatever else is already queued, up to `batch.capacity()`, without blocking again.
+//! \note If a datagram is bigger than the batch's `mtu`, this method throws a std::runtime_error
+size_t UDPSocket::recv_batch(RecvBatch &batch) {
+    // (re)point each header at its slot; cheap, and keeps RecvBatch safely movable
+    for (size_t i = 0; i < batch.capacity(); i++) {
+        batch._iovecs[i] = {&batch._storage[i * batch._mtu], batch._mtu};
+        msghdr &hdr = batch._headers[i].msg_hdr;
+        hdr = {};
+        hdr.msg_name = static_cast<sockaddr *>(batch._addresses[i]);
+        hdr.msg_namelen = sizeof(batch._addresses[i].storage);
+        hdr.msg_iov = &batch._iovecs[i];
+        hdr.msg_iovlen = 1;
+        hdr.msg_control = &batch._control[i * CMSG_SPACE(sizeof(int))];
+        hdr.msg_controllen = CMSG_SPACE(sizeof(int));
+        batch._headers[i].msg_len = 0;
+    }
+
+    const int count = SystemCall(
+        "recvmmsg", ::recvmmsg(fd_num(), batch._headers.data(), batch._headers.size(), MSG_WAITFORONE, nullptr));
+
+    register_read();
+    batch._payloads.clear();
+    batch._segment_sizes.clear();
+    for (int i = 0; i < count; i++) {
+        auto &hdr = batch._headers[i];
+        if (hdr.msg_hdr.msg_flags & MSG_TRUNC) {
+            throw runtime_error("recvmmsg (oversized datagram)");
+        }
+        batch._payloads.emplace_back(&batch._storage[i * batch._mtu], hdr.msg_len);
+
+        size_t segment_size = hdr.msg_len;
+        for (cmsghdr *cmsg = CMSG_FIRSTHDR(&hdr.msg_hdr); cmsg != nullptr; cmsg = CMSG_NXTHDR(&hdr.msg_hdr, cmsg)) {
+            if (cmsg->cmsg_level == SOL_UDP and cmsg->cmsg_type == UDP_GRO) {
+                int gso_size;
+                memcpy(&gso_size, CMSG_DATA(cmsg), sizeof(gso_size));
+                segment_size = gso_size;
+            }
+        }
+        batch._segment_sizes.push_back(segment_size);
+    }
+
+    return count;
+}
+
 void sendmsg_helper(const int fd_num,
                     const sockaddr *destination_address,
                     const socklen_t destination_address_len,
@@ -141,6 +210,78 @@ void UDPSocket::send(const BufferViewList &payload) {
     register_write();
 }
 
+//! \param[in] destination is the Address to which every datagram is sent
+//! \param[in] payloads are the datagram payloads, in order
+//! \details Calls [sendmmsg(2)](\ref man2::sendmmsg) until every datagram has been sent.
+void UDPSocket::sendto_batch(const Address &destination, const vector<BufferViewList> &payloads) {
+    if (payloads.empty()) {
+        return;
+    }
+
+    vector<vector<iovec>> iovecs;
+    vector<mmsghdr> headers(payloads.size());
+    iovecs.reserve(payloads.size());
+    for (size_t i = 0; i < payloads.size(); i++) {
+        iovecs.push_back(payloads[i].as_iovecs());
+        msghdr &hdr = headers[i].msg_hdr;
+        hdr.msg_name = const_cast<sockaddr *>(static_cast<const sockaddr *>(destination));
+        hdr.msg_namelen = destination.size();
+        hdr.msg_iov = iovecs.back().data();
+        hdr.msg_iovlen = iovecs.back().size();
+    }
+
+    size_t sent = 0;
+    while (sent < headers.size()) {
+        const int count = SystemCall("sendmmsg", ::sendmmsg(fd_num(), &headers[sent], headers.size() - sent, 0));
+        for (int i = 0; i < count; i++, sent++) {
+            if (headers[sent].msg_len != payloads[sent].size()) {
+                throw runtime_error("datagram payload too big for sendmmsg()");
+            }
+        }
+        register_write();
+    }
+}
+
+//! \param[in] destination is the Address to which every datagram is sent
+//! \param[in] payload is the concatenation of the datagram payloads
+//! \param[in] segment_size is the size of every datagram but the last, which may be shorter
+//! \note `payload` must split into at most UDPSocket::MAX_GSO_SEGMENTS datagrams,
+//! and must be no bigger than UDPSocket::MAX_GSO_PAYLOAD.
+void UDPSocket::sendto_gso(const Address &destination, const BufferViewList &payload, const uint16_t segment_size) {
+    if (payload.size() <= segment_size) {
+        sendto(destination, payload);
+        return;
+    }
+
+    auto iovecs = payload.as_iovecs();
+    array<char, CMSG_SPACE(sizeof(uint16_t))> control{};
+
+    msghdr message{};
+    message.msg_name = const_cast<sockaddr *>(static_cast<const sockaddr *>(destination));
+    message.msg_namelen = destination.size();
+    message.msg_iov = iovecs.data();
+    message.msg_iovlen = iovecs.size();
+    message.msg_control = control.data();
+    message.msg_controllen = control.size();
+
+    cmsghdr *cmsg = CMSG_FIRSTHDR(&message);
+    cmsg->cmsg_level = SOL_UDP;
+    cmsg->cmsg_type = UDP_SEGMENT;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(segment_size));
+    memcpy(CMSG_DATA(cmsg), &segment_size, sizeof(segment_size));
+
+    const ssize_t bytes_sent = SystemCall("sendmsg", ::sendmsg(fd_num(), &message, 0));
+    if (size_t(bytes_sent) != payload.size()) {
+        throw runtime_error("payload too big for UDP_SEGMENT sendmsg()");
+    }
+
+    register_write();
+}
+
+//! \param[in] enabled is `true` to let the kernel coalesce received datagrams
+//! \note Throws a unix_error on kernels without [UDP_GRO](\ref man7::udp) support
+void UDPSocket::set_gro(const bool enabled) { setsockopt(SOL_UDP, UDP_GRO, int(enabled)); }
+
 // mark the socket as listening for incoming connections
 //! \param[in] backlog is the number of waiting connections to queue (see [listen(2)](\ref man2::listen))
 void TCPSocket::listen(const int backlog) { SystemCall("listen", ::listen(fd_num(), backlog)); }
@@ -166,3 +307,7 @@ void Socket::setsockopt(const int level, const int option, const option_type &op
 // allow local address to be reused sooner, at the cost of some robustness
 //! \note Using `SO_REUSEADDR` may reduce the robustness of your application
 void Socket::set_reuseaddr() { setsockopt(SOL_SOCKET, SO_REUSEADDR, int(true)); }
+
+//! \details Each socket must set this before bind(). The kernel then spreads inbound datagrams (or
+//! connections) over the sockets by a hash of the source and destination, so each flow sticks to one socket.
+void Socket::set_reuseport() { setsockopt(SOL_SOCKET, SO_REUSEPORT, int(true)); }
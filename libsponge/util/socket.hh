@@ -7,7 +7,9 @@
 #include <cstdint>
 #include <functional>
 #include <string>
+#include <string_view>
 #include <sys/socket.h>
+#include <vector>
 
 //! \brief Base class for network sockets (TCP, UDP, etc.)
 //! \details Socket is generally used via a subclass. See TCPSocket and UDPSocket for usage examples.
@@ -45,6 +47,9 @@ class Socket : public FileDescriptor {
 
     //! Allow local address to be reused sooner via [SO_REUSEADDR](\ref man7::socket)
     void set_reuseaddr();
+
+    //! Allow several sockets to bind the same address via [SO_REUSEPORT](\ref man7::socket)
+    void set_reuseport();
 };
 
 //! A wrapper around [UDP sockets](\ref man7::udp)
@@ -70,16 +75,75 @@ class UDPSocket : public Socket {
     //! Receive a datagram and the Address of its sender (caller can allocate storage)
     void recv(received_datagram &datagram, const size_t mtu = 65536);
 
+    //! \brief A ring of preallocated receive slots, filled by UDPSocket::recv_batch
+    class RecvBatch {
+      private:
+        friend class UDPSocket;
+
+        size_t _mtu;                              //!< Size of each slot
+        std::string _storage;                     //!< `capacity * mtu` bytes of payload storage
+        std::vector<Address::Raw> _addresses;     //!< Source address of each slot
+        std::vector<iovec> _iovecs;               //!< One iovec per slot, pointing into _storage
+        std::vector<mmsghdr> _headers;            //!< One mmsghdr per slot, as used by recvmmsg
+        std::string _control;                     //!< Ancillary-data space for each slot (carries UDP_GRO)
+        std::vector<std::string_view> _payloads;  //!< Received payloads (views into _storage)
+        std::vector<size_t> _segment_sizes;       //!< GRO segment size of each received payload
+
+      public:
+        //! Allocate `capacity` slots of `mtu` bytes each
+        explicit RecvBatch(const size_t capacity = 16, const size_t mtu = 65536);
+
+        //! Number of slots
+        size_t capacity() const { return _headers.size(); }
+
+        //! Number of datagrams received by the last call to UDPSocket::recv_batch
+        size_t size() const { return _payloads.size(); }
+
+        //! Payload of the `n`th received datagram (valid until the next UDPSocket::recv_batch)
+        std::string_view payload(const size_t n) const { return _payloads.at(n); }
+
+        //! Address from which the `n`th received datagram was sent
+        Address source_address(const size_t n) const;
+
+        //! \brief Size of the datagrams that the kernel coalesced into the `n`th payload
+        //! \details Equal to the payload size unless [UDP_GRO](\ref man7::udp) is enabled and the kernel
+        //! merged several equal-size datagrams; the last of them may be shorter.
+        size_t segment_size(const size_t n) const { return _segment_sizes.at(n); }
+    };
+
+    //! Largest number of datagrams the kernel will split one sendto_gso() payload into
+    static constexpr size_t MAX_GSO_SEGMENTS = 64;
+
+    //! Largest payload that sendto_gso() can pass to the kernel in one call
+    static constexpr size_t MAX_GSO_PAYLOAD = 65507;
+
+    //! Ask the kernel to coalesce received datagrams ([UDP_GRO](\ref man7::udp)); see RecvBatch::segment_size
+    void set_gro(const bool enabled);
+
+    //! Receive as many datagrams as are ready (at least one) with a single syscall
+    size_t recv_batch(RecvBatch &batch);
+
     //! Send a datagram to specified Address
     void sendto(const Address &destination, const BufferViewList &payload);
 
     //! Send datagram to the socket's connected address (must call connect() first)
     void send(const BufferViewList &payload);
+
+    //! Send several datagrams to specified Address with as few syscalls as possible
+    void sendto_batch(const Address &destination, const std::vector<BufferViewList> &payloads);
+
+    //! Send `payload` as a run of `segment_size`-byte datagrams, split by the kernel ([UDP_SEGMENT](\ref man7::udp))
+    void sendto_gso(const Address &destination, const BufferViewList &payload, const uint16_t segment_size);
 };
 
 //! \class UDPSocket
 //! Functions in this class are essentially wrappers over their POSIX eponyms.
 //!
+//! UDPSocket::recv_batch and UDPSocket::sendto_batch wrap [recvmmsg(2)](\ref man2::recvmmsg)
+//! and [sendmmsg(2)](\ref man2::sendmmsg), which move a burst of datagrams per syscall.
+//! On Linux, UDPSocket::sendto_gso and UDPSocket::set_gro go further by letting the kernel
+//! split one large send, and merge several receives, into or from equal-size datagrams.
+//!
 //! Example:
 //!
 //! \include socket_example_1.cc
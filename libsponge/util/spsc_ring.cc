@@ -0,0 +1,128 @@
+#include "spsc_ring.hh"
+
+#include <algorithm>
+#include <cstring>
+
+using namespace std;
+
+//! Smallest power of two that is at least `n` (and at least 1)
+static size_t round_up_to_power_of_two(const size_t n) {
+    size_t size = 1;
+    while (size < n) {
+        size <<= 1;
+    }
+    return size;
+}
+
+//! \param[in] capacity is the least number of bytes the ring must hold
+SPSCRing::SPSCRing(const size_t capacity)
+    : _buffer(make_unique<char[]>(round_up_to_power_of_two(capacity))), _mask(round_up_to_power_of_two(capacity) - 1) {}
+
+void SPSCRing::wake_reader() {
+    if (_reader_waiting.load() and _reader_waiting.exchange(false)) {
+        _data_ready.notify();
+    }
+}
+
+void SPSCRing::wake_writer() {
+    if (_writer_waiting.load() and _writer_waiting.exchange(false)) {
+        _space_ready.notify();
+    }
+}
+
+//! \param[in] data is the data to write
+//! \details The data is copied in at most two pieces (before and after the end of the buffer).
+size_t SPSCRing::write(const string_view data) {
+    if (reader_closed()) {
+        return 0;
+    }
+
+    const size_t write_pos = _write_pos.load(memory_order_relaxed);
+    const size_t len = min(data.size(), _mask + 1 - (write_pos - _read_pos.load(memory_order_acquire)));
+    if (len == 0) {
+        return 0;
+    }
+
+    const size_t offset = write_pos & _mask;
+    const size_t first = min(len, _mask + 1 - offset);
+    memcpy(&_buffer[offset], data.data(), first);
+    memcpy(&_buffer[0], data.data() + first, len - first);
+
+    _write_pos.store(write_pos + len);
+    wake_reader();
+    return len;
+}
+
+void SPSCRing::end_input() {
+    _input_ended.store(true);
+    wake_reader();
+}
+
+size_t SPSCRing::remaining_capacity() const {
+    return _mask + 1 - (_write_pos.load(memory_order_relaxed) - _read_pos.load(memory_order_acquire));
+}
+
+//! \details The loads after the flag is set are sequentially consistent, so they cannot be ordered before it.
+bool SPSCRing::arm_space_wait() {
+    _writer_waiting.store(true);
+    if (_write_pos.load(memory_order_relaxed) - _read_pos.load() <= _mask or _reader_closed.load()) {
+        _writer_waiting.store(false);
+        return false;
+    }
+    return true;
+}
+
+void SPSCRing::wait_for_space() {
+    while (arm_space_wait()) {
+        _space_ready.wait();
+    }
+}
+
+//! \param[in] limit is the most bytes to read
+string SPSCRing::read(const size_t limit) {
+    const size_t read_pos = _read_pos.load(memory_order_relaxed);
+    const size_t len = min(limit, _write_pos.load(memory_order_acquire) - read_pos);
+    if (len == 0) {
+        return {};
+    }
+
+    string data(len, 0);
+    const size_t offset = read_pos & _mask;
+    const size_t first = min(len, _mask + 1 - offset);
+    memcpy(data.data(), &_buffer[offset], first);
+    memcpy(data.data() + first, &_buffer[0], len - first);
+
+    _read_pos.store(read_pos + len);
+    wake_writer();
+    return data;
+}
+
+size_t SPSCRing::buffer_size() const {
+    return _write_pos.load(memory_order_acquire) - _read_pos.load(memory_order_relaxed);
+}
+
+bool SPSCRing::eof() const {
+    // check the flag first: once it is set, no more data can arrive
+    return _input_ended.load(memory_order_acquire) and buffer_size() == 0;
+}
+
+void SPSCRing::close_reader() {
+    _reader_closed.store(true);
+    wake_writer();
+}
+
+//! \details The loads after the flag is set are sequentially consistent, so they cannot be ordered before it.
+bool SPSCRing::arm_data_wait() {
+    _reader_waiting.store(true);
+    if (_write_pos.load() != _read_pos.load(memory_order_relaxed) or _input_ended.load()) {
+        _reader_waiting.store(false);
+        return false;
+    }
+    return true;
+}
+
+void SPSCRing::wait_for_data() {
+    while (arm_data_wait()) {
+        _data_ready.wait();
+    }
+}
@@ -0,0 +1,109 @@
+#ifndef SPONGE_LIBSPONGE_SPSC_RING_HH
+#define SPONGE_LIBSPONGE_SPSC_RING_HH
+
+#include "eventfd.hh"
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <string_view>
+
+//! \brief A lock-free byte queue between one writer thread and one reader thread, with EventFD wakeups
+class SPSCRing {
+  private:
+    static constexpr size_t CACHE_LINE = 64;  //!< Keeps the writer's and reader's indices on separate lines
+
+    std::unique_ptr<char[]> _buffer;  //!< Storage; positions are taken modulo its (power-of-two) size
+    size_t _mask;                     //!< Size of `_buffer`, minus one
+
+    alignas(CACHE_LINE) std::atomic<size_t> _write_pos{0};  //!< Bytes written so far (only the writer stores it)
+    std::atomic<bool> _input_ended{false};                  //!< Has the writer called end_input()?
+    std::atomic<bool> _writer_waiting{false};               //!< Does the writer want a space_ready() wakeup?
+
+    alignas(CACHE_LINE) std::atomic<size_t> _read_pos{0};  //!< Bytes read so far (only the reader stores it)
+    std::atomic<bool> _reader_closed{false};               //!< Has the reader called close_reader()?
+    std::atomic<bool> _reader_waiting{false};              //!< Does the reader want a data_ready() wakeup?
+
+    EventFD _data_ready{};   //!< Wakes the reader
+    EventFD _space_ready{};  //!< Wakes the writer
+
+    //! Wake the reader if it is waiting
+    void wake_reader();
+
+    //! Wake the writer if it is waiting
+    void wake_writer();
+
+  public:
+    //! Construct a ring that holds at least `capacity` bytes (rounded up to a power of two)
+    explicit SPSCRing(const size_t capacity);
+
+    //! \name Writer side
+    //!@{
+
+    //! Copy as much of `data` into the ring as fits; returns the number of bytes written
+    size_t write(const std::string_view data);
+
+    //! Signal that nothing more will be written
+    void end_input();
+
+    //! Number of bytes that write() would accept now
+    size_t remaining_capacity() const;
+
+    //! Has the reader gone away? (If so, write() accepts nothing.)
+    bool reader_closed() const { return _reader_closed.load(std::memory_order_acquire); }
+
+    //! \brief Ask for a space_ready() wakeup when the reader frees space
+    //! \returns `false` (and asks for nothing) if there is already space, or the reader has gone away
+    bool arm_space_wait();
+
+    //! Block until there is space in the ring or the reader has gone away
+    void wait_for_space();
+
+    //! Readable when the reader has freed space after arm_space_wait()
+    EventFD &space_ready() { return _space_ready; }
+    //!@}
+
+    //! \name Reader side
+    //!@{
+
+    //! Remove and return up to `limit` bytes
+    std::string read(const size_t limit);
+
+    //! Number of bytes that read() would return now
+    size_t buffer_size() const;
+
+    //! Has the writer ended the input, and has all of it been read?
+    bool eof() const;
+
+    //! Signal that nothing more will be read; the writer's writes will be discarded
+    void close_reader();
+
+    //! \brief Ask for a data_ready() wakeup when the writer adds data or ends the input
+    //! \returns `false` (and asks for nothing) if there already is data, or the input has ended
+    bool arm_data_wait();
+
+    //! Block until there is data in the ring or the input has ended
+    void wait_for_data();
+
+    //! Readable when the writer has added data or ended the input after arm_data_wait()
+    EventFD &data_ready() { return _data_ready; }
+    //!@}
+};
+
+//! \class SPSCRing
+//! Each side only stores its own position, so neither needs a lock: the writer fills the bytes after
+//! `_write_pos` and then publishes them by advancing it; the reader copies out the bytes after `_read_pos`
+//! and then frees them by advancing it.
+//!
+//! A side that finds nothing to do and wants to sleep first "arms" a wait by setting its flag and then
+//! checks the ring once more. The other side, after advancing its position, checks the flag and
+//! notifies the EventFD if it is set. Both the position stores and the flag accesses are sequentially
+//! consistent, so either the sleeper sees the new position or the other side sees the flag; a wakeup is
+//! never lost, and no system call is made while both threads are busy.
+//!
+//! A thread that waits in an EventLoop adds a rule for data_ready() or space_ready() and calls
+//! arm_data_wait() or arm_space_wait() before going back to wait; a thread with nothing else to do
+//! calls wait_for_data() or wait_for_space().
+
+#endif  // SPONGE_LIBSPONGE_SPSC_RING_HH
@@ -0,0 +1,208 @@
+#include "stats.hh"
+
+#include "util.hh"
+
+#include <cerrno>
+#include <cstdio>
+#include <fstream>
+#include <stdexcept>
+#include <string_view>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <utility>
+
+using namespace std;
+
+//! \param[in] name is the metric's name, e.g. `sponge_tcp_segments_sent_total`
+//! \param[in] help is a one-line description of the metric
+//! \param[in] type is whether the metric is a counter or a gauge
+//! \param[in] value is the value to add
+//! \param[in] labels are the labels, formatted and separated by commas (see label()), or empty
+void StatsSnapshot::add(
+    const string &name, const string &help, const Type type, const uint64_t value, const string &labels) {
+    auto it = _metrics.find(name);
+    if (it == _metrics.end()) {
+        it = _metrics.emplace(name, Metric{help, type, {}}).first;
+    } else if (it->second.type != type) {
+        throw runtime_error("StatsSnapshot: " + name + " added as both a counter and a gauge");
+    }
+    it->second.values[labels] += value;
+}
+
+//! \param[in] name is the metric's name
+//! \param[in] labels are the labels, formatted as for add()
+uint64_t StatsSnapshot::value(const string &name, const string &labels) const {
+    const auto metric = _metrics.find(name);
+    if (metric == _metrics.end()) {
+        return 0;
+    }
+    const auto it = metric->second.values.find(labels);
+    return it == metric->second.values.end() ? 0 : it->second;
+}
+
+//! \param[in] name is the metric's name
+uint64_t StatsSnapshot::total(const string &name) const {
+    const auto metric = _metrics.find(name);
+    uint64_t sum = 0;
+    if (metric != _metrics.end()) {
+        for (const auto &[labels, value] : metric->second.values) {
+            sum += value;
+        }
+    }
+    return sum;
+}
+
+string StatsSnapshot::to_prometheus() const {
+    string ret;
+    for (const auto &[name, metric] : _metrics) {
+        ret += "# HELP " + name + " " + metric.help + "\n";
+        ret += "# TYPE " + name + (metric.type == Type::Counter ? " counter\n" : " gauge\n");
+        for (const auto &[labels, value] : metric.values) {
+            ret += name + (labels.empty() ? "" : "{" + labels + "}") + " " + to_string(value) + "\n";
+        }
+    }
+    return ret;
+}
+
+//! \param[in] path is the file to write
+void StatsSnapshot::write_prometheus_file(const string &path) const {
+    const string temporary = path + ".tmp";
+    {
+        ofstream file{temporary, ios::trunc};
+        file << to_prometheus();
+        if (not file.flush()) {
+            throw runtime_error("StatsSnapshot: could not write " + temporary);
+        }
+    }
+    SystemCall("rename", ::rename(temporary.c_str(), path.c_str()));
+}
+
+//! \param[in] name is the label's name
+//! \param[in] value is the label's value, which is escaped as the exposition format requires
+string StatsSnapshot::label(const string &name, const string &value) {
+    string ret = name + "=\"";
+    for (const char ch : value) {
+        if (ch == '\\' or ch == '"') {
+            ret += '\\';
+            ret += ch;
+        } else if (ch == '\n') {
+            ret += "\\n";
+        } else {
+            ret += ch;
+        }
+    }
+    return ret + "\"";
+}
+
+StatsRegistry::Registration::~Registration() {
+    if (_registry) {
+        lock_guard<mutex> lock(_registry->_mutex);
+        _registry->_sources.erase(_id);
+    }
+}
+
+StatsRegistry::Registration::Registration(Registration &&other) noexcept
+    : _registry(exchange(other._registry, nullptr)), _id(other._id) {}
+
+StatsRegistry::Registration &StatsRegistry::Registration::operator=(Registration &&other) noexcept {
+    if (this != &other) {
+        Registration old{move(*this)};
+        _registry = exchange(other._registry, nullptr);
+        _id = other._id;
+    }
+    return *this;
+}
+
+//! \param[in] source adds a component's counters to a snapshot
+StatsRegistry::Registration StatsRegistry::add(Source source) {
+    lock_guard<mutex> lock(_mutex);
+    const uint64_t id = _next_id++;
+    _sources.emplace(id, move(source));
+    return {this, id};
+}
+
+StatsSnapshot StatsRegistry::snapshot() const {
+    StatsSnapshot snapshot;
+    lock_guard<mutex> lock(_mutex);
+    for (const auto &[id, source] : _sources) {
+        source(snapshot);
+    }
+    return snapshot;
+}
+
+//! \param[in] path is the path of the socket
+static FileDescriptor listen_unix(const string &path) {
+    sockaddr_un address{};
+    address.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(address.sun_path)) {
+        throw runtime_error("PrometheusExporter: socket path too long: " + path);
+    }
+    path.copy(static_cast<char *>(address.sun_path), path.size());
+
+    FileDescriptor listener{SystemCall("socket", ::socket(AF_UNIX, SOCK_STREAM, 0))};
+    SystemCall("bind",
+               ::bind(listener.fd_num(), reinterpret_cast<const sockaddr *>(&address), sizeof(address)));
+    SystemCall("listen", ::listen(listener.fd_num(), 16));
+    return listener;
+}
+
+//! \param[in] fd is a connected stream socket
+//! \param[in] data is what to send
+//! \details Sends with MSG_NOSIGNAL, so a client that has gone away is an EPIPE (thrown as a unix_error) rather
+//! than a SIGPIPE that would kill the process.
+static void send_all(const int fd, string_view data) {
+    while (not data.empty()) {
+        const int sent = SystemCall("send", static_cast<int>(::send(fd, data.data(), data.size(), MSG_NOSIGNAL)));
+        data.remove_prefix(sent);
+    }
+}
+
+//! \param[in] registry is the registry to snapshot for each connection
+//! \param[in] socket_path is the path at which to listen
+PrometheusExporter::PrometheusExporter(const StatsRegistry &registry, const string &socket_path)
+    : _registry(registry), _path(socket_path), _listener(listen_unix(socket_path)) {
+    _thread = thread([this] { serve(); });
+}
+
+void PrometheusExporter::serve() {
+    while (true) {
+        const int fd = ::accept(_listener.fd_num(), nullptr, nullptr);
+        if (fd < 0) {
+            if (errno == EINTR or errno == ECONNABORTED) {
+                continue;
+            }
+            return;  // the listener was shut down
+        }
+        FileDescriptor connection{fd};
+        try {
+            // read (and ignore) the request, if the client sends one promptly, so that closing the connection
+            // does not reset it
+            const timeval timeout{0, 100000};
+            SystemCall("setsockopt", ::setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)));
+            char request[4096];
+            SystemCall("recv", ::recv(fd, static_cast<char *>(request), sizeof(request), 0), EAGAIN);
+
+            // a client that stops reading gets a second to take the reply, rather than wedging this thread
+            const timeval send_timeout{1, 0};
+            SystemCall("setsockopt",
+                       ::setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &send_timeout, sizeof(send_timeout)));
+
+            const string body = _registry.snapshot().to_prometheus();
+            send_all(fd,
+                     "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: " +
+                         to_string(body.size()) + "\r\n\r\n" + body);
+        } catch (const exception &) {
+            // a client that went away does not stop the exporter
+        }
+    }
+}
+
+PrometheusExporter::~PrometheusExporter() {
+    ::shutdown(_listener.fd_num(), SHUT_RDWR);
+    if (_thread.joinable()) {
+        _thread.join();
+    }
+    ::unlink(_path.c_str());
+}
@@ -0,0 +1,164 @@
+#ifndef SPONGE_LIBSPONGE_STATS_HH
+#define SPONGE_LIBSPONGE_STATS_HH
+
+#include "file_descriptor.hh"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+
+//! Size of a cache line: each component's block of counters is aligned to one, so blocks never share a line
+static constexpr size_t STATS_CACHE_LINE = 64;
+
+//! \brief A count that one thread updates and any thread can read
+class StatCounter {
+  private:
+    std::atomic<uint64_t> _value{0};
+
+  public:
+    StatCounter() = default;
+
+    //! \name Copying (so that the components that hold counters can still be copied and moved)
+    //!@{
+    StatCounter(const StatCounter &other) : _value(other.value()) {}
+    StatCounter &operator=(const StatCounter &other) {
+        _value.store(other.value(), std::memory_order_relaxed);
+        return *this;
+    }
+    //!@}
+
+    //! Add to the count (only the owning thread may call this)
+    void add(const uint64_t n = 1) {
+        _value.store(_value.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+
+    //! Set the value, for a gauge or for a count kept elsewhere (only the owning thread may call this)
+    void set(const uint64_t value) { _value.store(value, std::memory_order_relaxed); }
+
+    //! The current value
+    uint64_t value() const { return _value.load(std::memory_order_relaxed); }
+};
+
+//! \class StatCounter
+//! Since only the owning thread writes the counter, add() is a relaxed load and store rather than a locked
+//! read-modify-write: on x86 it compiles to the same code as incrementing a plain integer. The atomic only
+//! keeps readers on other threads (taking a snapshot) from seeing a torn value.
+
+//! \brief The values of a set of metrics at one moment, summed over all the sources that share a name and labels
+class StatsSnapshot {
+  public:
+    //! How a metric's value behaves
+    enum class Type {
+        Counter,  //!< Only increases
+        Gauge     //!< Goes up and down
+    };
+
+  private:
+    //! \brief A metric and its value for each set of labels
+    struct Metric {
+        std::string help;
+        Type type;
+        std::map<std::string, uint64_t> values;  //!< From labels (e.g. `interface="1"`) to value
+    };
+
+    std::map<std::string, Metric> _metrics{};
+
+  public:
+    //! Add `value` to a metric (summing it with what other sources added under the same labels)
+    void add(const std::string &name,
+             const std::string &help,
+             const Type type,
+             const uint64_t value,
+             const std::string &labels = "");
+
+    //! The value of a metric under a set of labels (0 if no source added it)
+    uint64_t value(const std::string &name, const std::string &labels = "") const;
+
+    //! The value of a metric, summed over all the labels
+    uint64_t total(const std::string &name) const;
+
+    //! \brief The snapshot in the Prometheus text exposition format
+    //! \details See https://prometheus.io/docs/instrumenting/exposition_formats/
+    std::string to_prometheus() const;
+
+    //! Write to_prometheus() to a file, replacing it atomically (as the node exporter's textfile collector wants)
+    void write_prometheus_file(const std::string &path) const;
+
+    //! Format a label, escaping its value: e.g. `label("interface", "eth0")` is `interface="eth0"`
+    static std::string label(const std::string &name, const std::string &value);
+};
+
+//! \brief The sources of metrics in a program, which it can snapshot at any time and from any thread
+class StatsRegistry {
+  public:
+    //! Adds a component's counters to a snapshot (called from the thread taking the snapshot)
+    using Source = std::function<void(StatsSnapshot &snapshot)>;
+
+    //! \brief Keeps a source in the registry until it is destroyed
+    class Registration {
+      private:
+        StatsRegistry *_registry;
+        uint64_t _id;
+
+      public:
+        //! Register nothing
+        Registration() : _registry(nullptr), _id(0) {}
+        Registration(StatsRegistry *registry, const uint64_t id) : _registry(registry), _id(id) {}
+        ~Registration();
+
+        //! \name Moving (a registration cannot be copied)
+        //!@{
+        Registration(Registration &&other) noexcept;
+        Registration &operator=(Registration &&other) noexcept;
+        Registration(const Registration &other) = delete;
+        Registration &operator=(const Registration &other) = delete;
+        //!@}
+    };
+
+  private:
+    mutable std::mutex _mutex{};
+    std::map<uint64_t, Source> _sources{};
+    uint64_t _next_id{0};
+
+  public:
+    //! \brief Add a source; it stays in the registry for as long as the returned Registration lives
+    //! \note The Registration must be destroyed before anything the source reads
+    [[nodiscard]] Registration add(Source source);
+
+    //! Collect every source's counters
+    StatsSnapshot snapshot() const;
+};
+
+//! \brief Serves a registry's metrics on a Unix-domain socket
+class PrometheusExporter {
+  private:
+    const StatsRegistry &_registry;
+    std::string _path;
+    FileDescriptor _listener;
+    std::thread _thread{};
+
+    //! Answer connections until the listener is shut down
+    void serve();
+
+  public:
+    //! Listen on `socket_path` (which must not exist), serving from a background thread
+    PrometheusExporter(const StatsRegistry &registry, const std::string &socket_path);
+
+    //! Stop serving, and remove the socket
+    ~PrometheusExporter();
+
+    PrometheusExporter(const PrometheusExporter &other) = delete;
+    PrometheusExporter &operator=(const PrometheusExporter &other) = delete;
+};
+
+//! \class PrometheusExporter
+//! Each connection gets one snapshot, as a minimal HTTP/1.0 response, and is closed; so
+//! `curl --unix-socket <path> http://localhost/metrics` reads the metrics, and a Prometheus server can scrape
+//! them through any Unix-socket-to-TCP proxy.
+
+#endif  // SPONGE_LIBSPONGE_STATS_HH
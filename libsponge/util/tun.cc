@@ -6,14 +6,21 @@
 #include <fcntl.h>
 #include <linux/if.h>
 #include <linux/if_tun.h>
+#include <stdexcept>
 #include <sys/ioctl.h>
+#include <unistd.h>
+#include <utility>
 
 static constexpr const char *CLONEDEV = "/dev/net/tun";
 
 using namespace std;
 
+static_assert(TunTapFD::VNET_HDR_LEN == 10, "TunTapFD::VnetHeader must match struct virtio_net_hdr");
+
 //! \param[in] devname is the name of the TUN or TAP device, specified at its creation.
 //! \param[in] is_tun is `true` for a TUN device (expects IP datagrams), or `false` for a TAP device (expects Ethernet frames)
+//! \param[in] multi_queue is `true` to attach a new queue of a multi-queue device (see [IFF_MULTI_QUEUE](https://www.kernel.org/doc/Documentation/networking/tuntap.txt))
+//! \param[in] vnet_hdr is `true` to prefix every frame with a `struct virtio_net_hdr` (IFF_VNET_HDR)
 //!
 //! To create a TUN device, you should already have run
 //!
@@ -21,11 +28,17 @@ using namespace std;
 //!
 //! as root before calling this function.
 
-TunTapFD::TunTapFD(const string &devname, const bool is_tun)
-    : FileDescriptor(SystemCall("open", open(CLONEDEV, O_RDWR))) {
+TunTapFD::TunTapFD(const string &devname, const bool is_tun, const bool multi_queue, const bool vnet_hdr)
+    : FileDescriptor(SystemCall("open", open(CLONEDEV, O_RDWR))), _vnet_hdr(vnet_hdr) {
     struct ifreq tun_req {};
 
     tun_req.ifr_flags = (is_tun ? IFF_TUN : IFF_TAP) | IFF_NO_PI;  // tun device with no packetinfo
+    if (multi_queue) {
+        tun_req.ifr_flags |= IFF_MULTI_QUEUE;
+    }
+    if (vnet_hdr) {
+        tun_req.ifr_flags |= IFF_VNET_HDR;
+    }
 
     // copy devname to ifr_name, making sure to null terminate
 
@@ -34,3 +47,69 @@ TunTapFD::TunTapFD(const string &devname, const bool is_tun)
 
     SystemCall("ioctl", ioctl(fd_num(), TUNSETIFF, static_cast<void *>(&tun_req)));
 }
+
+//! \param[in] enabled is `true` to turn on checksum and TCPv4 segmentation offload, `false` to turn it off
+//! \note The setting belongs to the device and outlives this TunTapFD, so a reader without a virtio-net
+//! header should turn it off in case an earlier reader left it on.
+void TunTapFD::set_tso(const bool enabled) {
+    if (enabled and not _vnet_hdr) {
+        throw runtime_error("TunTapFD::set_tso: device was not opened with a virtio-net header");
+    }
+    const unsigned int offload = enabled ? TUN_F_CSUM | TUN_F_TSO4 : 0;
+    SystemCall("ioctl", ioctl(fd_num(), TUNSETOFFLOAD, offload));
+}
+
+//! \param[in] capacity is the maximum number of frames returned by one call to TunTapFD::read_batch
+//! \param[in] mtu is the size of each slot; the kernel truncates any longer frame
+TunTapFD::ReadBatch::ReadBatch(const size_t capacity, const size_t mtu)
+    : _mtu(mtu), _slots(capacity, string(mtu, 0)), _lengths() {
+    _lengths.reserve(capacity);
+}
+
+//! \param[in] n is the index of the frame
+//! \returns the frame; one that fills at least half of its slot is the slot itself, moved rather than copied,
+//! while a smaller one is copied, so that it does not hold on to a whole slot
+string TunTapFD::ReadBatch::take(const size_t n) {
+    string &slot = _slots.at(n);
+    const size_t length = exchange(_lengths.at(n), 0);
+    if (2 * length < _mtu) {
+        return slot.substr(0, length);
+    }
+    slot.resize(length);
+    return exchange(slot, string());
+}
+
+//! \returns the number of frames read, which is also `batch.size()`
+//! \details A TUN/TAP device returns one frame per [read(2)](\ref man2::read), so this function keeps
+//! reading into the next preallocated slot until the read would block (`EAGAIN`). Nothing is allocated,
+//! except to replace the slots that ReadBatch::take moved out of the batch.
+size_t TunTapFD::read_batch(ReadBatch &batch) {
+    batch._lengths.clear();
+    while (batch._lengths.size() < batch.capacity()) {
+        string &slot = batch._slots[batch._lengths.size()];
+        slot.resize(batch._mtu);
+        const ssize_t bytes_read = SystemCall("read", ::read(fd_num(), slot.data(), batch._mtu), EAGAIN);
+        if (bytes_read < 0) {
+            break;
+        }
+        batch._lengths.push_back(bytes_read);
+    }
+
+    register_read();
+    return batch._lengths.size();
+}
+
+//! \param[out] frame is the frame read
+//! \param[in] mtu is the longest frame to read; the kernel truncates any longer frame
+bool TunTapFD::read_frame(string &frame, const size_t mtu) {
+    frame.resize(mtu);
+    const ssize_t bytes_read = SystemCall("read", ::read(fd_num(), frame.data(), mtu), EAGAIN);
+    if (bytes_read < 0) {
+        frame.clear();
+        return false;
+    }
+    frame.resize(bytes_read);
+
+    register_read();
+    return true;
+}
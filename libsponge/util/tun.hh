@@ -3,27 +3,110 @@
 
 #include "file_descriptor.hh"
 
+#include <cstdint>
 #include <string>
+#include <string_view>
+#include <vector>
 
 //! A FileDescriptor to a [Linux TUN/TAP](https://www.kernel.org/doc/Documentation/networking/tuntap.txt) device
 class TunTapFD : public FileDescriptor {
+  private:
+    bool _vnet_hdr;  //!< Every frame is preceded by a `struct virtio_net_hdr`
+
   public:
     //! Open an existing persistent [TUN or TAP device](https://www.kernel.org/doc/Documentation/networking/tuntap.txt).
-    explicit TunTapFD(const std::string &devname, const bool is_tun);
+    explicit TunTapFD(const std::string &devname,
+                      const bool is_tun,
+                      const bool multi_queue = false,
+                      const bool vnet_hdr = false);
+
+    //! \brief The `struct virtio_net_hdr` that precedes each frame when vnet_hdr() is `true`
+    //! \note Mirrors <linux/virtio_net.h>, which cannot be included from C++. Fields are in host byte order.
+    struct VnetHeader {
+        static constexpr uint8_t F_NEEDS_CSUM = 1;  //!< Checksum from csum_start on must be completed
+        static constexpr uint8_t GSO_NONE = 0;      //!< Not a super-segment
+        static constexpr uint8_t GSO_TCPV4 = 1;     //!< TCPv4 super-segment, to be split into gso_size payloads
+
+        uint8_t flags = 0;         //!< F_NEEDS_CSUM or 0
+        uint8_t gso_type = 0;      //!< GSO_NONE or GSO_TCPV4
+        uint16_t hdr_len = 0;      //!< Length of the Ethernet, IPv4 and TCP headers
+        uint16_t gso_size = 0;     //!< Payload size of each segment the super-segment is split into
+        uint16_t csum_start = 0;   //!< Offset at which checksumming starts
+        uint16_t csum_offset = 0;  //!< Offset of the checksum field, relative to csum_start
+    };
+
+    //! Size of the VnetHeader that precedes each frame when vnet_hdr() is `true`
+    static constexpr size_t VNET_HDR_LEN = sizeof(VnetHeader);
+
+    //! Whether frames read from and written to this device carry a virtio-net header (IFF_VNET_HDR)
+    bool vnet_hdr() const { return _vnet_hdr; }
+
+    //! Let the kernel exchange TCPv4 super-segments and partially-checksummed frames with us (needs vnet_hdr())
+    void set_tso(const bool enabled);
+
+    //! \brief Preallocated frame buffers, filled by TunTapFD::read_batch
+    class ReadBatch {
+      private:
+        friend class TunTapFD;
+
+        size_t _mtu;                      //!< Size of each slot
+        std::vector<std::string> _slots;  //!< One slot per frame (empty once taken, until the next read_batch)
+        std::vector<size_t> _lengths;     //!< Length of each frame read by the last read_batch
+
+      public:
+        //! Allocate `capacity` slots of `mtu` bytes each
+        explicit ReadBatch(const size_t capacity = 32, const size_t mtu = 2048);
+
+        //! Number of slots
+        size_t capacity() const { return _slots.size(); }
+
+        //! Size of each slot, which is the longest frame that can be read into it
+        size_t mtu() const { return _mtu; }
+
+        //! Number of frames read by the last call to TunTapFD::read_batch
+        size_t size() const { return _lengths.size(); }
+
+        //! The `n`th frame (valid until the next TunTapFD::read_batch, and empty once taken)
+        std::string_view frame(const size_t n) const { return {_slots.at(n).data(), _lengths.at(n)}; }
+
+        //! Take the `n`th frame out of the batch (see TunTapFD::read_batch)
+        std::string take(const size_t n);
+    };
+
+    //! Read frames until the device has no more ready or `batch` is full (fd must be non-blocking)
+    size_t read_batch(ReadBatch &batch);
+
+    //! \brief Read one frame, if the device has one ready (fd must be non-blocking)
+    //! \returns `false`, leaving `frame` empty, if no frame was ready
+    bool read_frame(std::string &frame, const size_t mtu);
 };
 
 //! A FileDescriptor to a [Linux TUN](https://www.kernel.org/doc/Documentation/networking/tuntap.txt) device
 class TunFD : public TunTapFD {
   public:
     //! Open an existing persistent [TUN device](https://www.kernel.org/doc/Documentation/networking/tuntap.txt).
-    explicit TunFD(const std::string &devname) : TunTapFD(devname, true) {}
+    explicit TunFD(const std::string &devname, const bool multi_queue = false)
+        : TunTapFD(devname, true, multi_queue) {}
 };
 
 //! A FileDescriptor to a [Linux TAP](https://www.kernel.org/doc/Documentation/networking/tuntap.txt) device
 class TapFD : public TunTapFD {
   public:
     //! Open an existing persistent [TAP device](https://www.kernel.org/doc/Documentation/networking/tuntap.txt).
-    explicit TapFD(const std::string &devname) : TunTapFD(devname, false) {}
+    explicit TapFD(const std::string &devname, const bool multi_queue = false, const bool vnet_hdr = false)
+        : TunTapFD(devname, false, multi_queue, vnet_hdr) {}
 };
 
+//! \class TunTapFD
+//! Opening the same device several times with `multi_queue` set attaches one queue per TunTapFD,
+//! and the kernel spreads flows across the queues, so each queue can be served by its own thread.
+//! This needs a device that was itself created as multi-queue, e.g.
+//!
+//!     ip tuntap add mode tun multi_queue user `username` name `devname`
+//!
+//! With `vnet_hdr` set, each frame is prefixed by a [virtio-net header](https://docs.oasis-open.org/virtio/virtio/v1.1/virtio-v1.1.html)
+//! describing its checksum and segmentation state. After TunTapFD::set_tso, the kernel may hand us
+//! TCP super-segments of up to 64 KiB whose checksum still has to be completed, and accepts the same
+//! from us, splitting them into MTU-size frames itself.
+
 #endif  // SPONGE_LIBSPONGE_TUN_HH
@@ -10,12 +10,22 @@
 
 using namespace std;
 
+//! \returns the time at which the program started (strictly, at which it first asked for a timestamp)
+static std::chrono::steady_clock::time_point program_start() {
+    static const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    return start;
+}
+
 //! \returns the number of milliseconds since the program started
 uint64_t timestamp_ms() {
-    using time_point = std::chrono::steady_clock::time_point;
-    static const time_point program_start = std::chrono::steady_clock::now();
-    const time_point now = std::chrono::steady_clock::now();
-    return std::chrono::duration_cast<std::chrono::milliseconds>(now - program_start).count();
+    const auto start = program_start();
+    return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+}
+
+//! \returns the number of microseconds since the program started
+uint64_t timestamp_us() {
+    const auto start = program_start();
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
 }
 
 //! \param[in] attempt is the name of the syscall to try (for error reporting)
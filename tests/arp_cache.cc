@@ -0,0 +1,179 @@
+#include "arp_cache.hh"
+#include "test_err_if.hh"
+#include "test_should_be.hh"
+#include "util.hh"
+
+#include <cstdint>
+#include <cstdlib>
+#include <exception>
+#include <iostream>
+#include <map>
+#include <random>
+#include <string>
+#include <utility>
+
+using namespace std;
+
+static EthernetAddress ethernet_address(const uint32_t n) {
+    return {0x02, 0, uint8_t(n >> 24), uint8_t(n >> 16), uint8_t(n >> 8), uint8_t(n)};
+}
+
+//! A 10-byte serialized "datagram" that carries its number
+static BufferList datagram(const uint32_t id) {
+    string number = to_string(id);
+    return string(10 - number.size(), '0') + number;
+}
+
+static uint32_t id(const BufferList &dgram) { return stoul(dgram.concatenate()); }
+
+int main() {
+    try {
+        auto rd = get_random_generator();
+
+        // deadlines are exact, whatever the wheel's granularity
+        {
+            ARPCache cache;
+            cache.learn(1, ethernet_address(1));
+            cache.tick(30000);
+            test_should_be(cache.lookup(1).has_value(), true);
+            cache.tick(1);
+            test_should_be(cache.lookup(1).has_value(), false);
+            test_should_be(cache.size(), size_t(0));
+
+            test_should_be(cache.enqueue(2, datagram(1)), true);
+            cache.tick(5000);
+            test_should_be(cache.enqueue(2, datagram(2)), false);
+            cache.tick(1);
+            test_should_be(cache.enqueue(2, datagram(3)), true);  // the request expired, with its datagrams
+            test_should_be(cache.dropped(), size_t(2));
+            const auto queued = cache.learn(2, ethernet_address(2));
+            test_should_be(queued.size(), size_t(1));
+            test_should_be(id(queued.front()), uint32_t(3));
+            test_err_if(cache.lookup(2) != ethernet_address(2), "wrong Ethernet address");
+        }
+
+        // the least recently used neighbor makes room, and each neighbor's queue is bounded in bytes
+        {
+            ARPCacheConfig config;
+            config.capacity = 4;
+            config.max_pending_bytes = 30;
+            ARPCache cache{config};
+            for (uint32_t ip = 1; ip <= 4; ip++) {
+                cache.learn(ip, ethernet_address(ip));
+            }
+            test_should_be(cache.lookup(1).has_value(), true);  // 2 is now the least recently used
+            cache.learn(5, ethernet_address(5));
+            test_should_be(cache.size(), size_t(4));
+            test_should_be(cache.lookup(2).has_value(), false);
+            test_should_be(cache.lookup(1).has_value(), true);
+            test_should_be(cache.lookup(5).has_value(), true);
+
+            for (uint32_t i = 0; i < 5; i++) {
+                cache.enqueue(6, datagram(i));
+            }
+            test_should_be(cache.dropped(), size_t(2));
+            test_should_be(cache.dropped_bytes(), size_t(20));
+            test_should_be(cache.pending_bytes(), size_t(30));
+            const auto queued = cache.learn(6, ethernet_address(6));
+            test_should_be(queued.size(), size_t(3));
+            test_should_be(id(queued.front()), uint32_t(2));
+            test_should_be(id(queued.back()), uint32_t(4));
+            test_should_be(cache.pending_bytes(), size_t(0));
+
+            // a datagram larger than the limit never waits, and takes nothing else with it
+            cache.enqueue(7, datagram(0));
+            cache.enqueue(7, string(31, 'x'));
+            test_should_be(cache.dropped(), size_t(3));
+            test_should_be(cache.learn(7, ethernet_address(7)).size(), size_t(1));
+        }
+
+        // under DropNewest, the datagrams that arrived first are the ones that wait
+        {
+            ARPCacheConfig config;
+            config.max_pending_bytes = 30;
+            config.drop_policy = ARPCacheConfig::DropPolicy::DropNewest;
+            ARPCache cache{config};
+            for (uint32_t i = 0; i < 5; i++) {
+                cache.enqueue(1, datagram(i));
+            }
+            test_should_be(cache.dropped(), size_t(2));
+            const auto queued = cache.learn(1, ethernet_address(1));
+            test_should_be(queued.size(), size_t(3));
+            test_should_be(id(queued.front()), uint32_t(0));
+            test_should_be(id(queued.back()), uint32_t(2));
+        }
+
+        // the global limit holds across neighbors: a neighbor can only push out its own datagrams
+        {
+            ARPCacheConfig config;
+            config.max_pending_bytes = 30;
+            config.max_total_pending_bytes = 50;
+            ARPCache cache{config};
+            for (uint32_t i = 0; i < 3; i++) {
+                cache.enqueue(1, datagram(i));
+            }
+            cache.enqueue(2, datagram(10));
+            cache.enqueue(2, datagram(11));
+            test_should_be(cache.pending_bytes(), size_t(50));
+            test_should_be(cache.dropped(), size_t(0));
+
+            cache.enqueue(3, datagram(20));  // nothing of 3's to drop, so it is dropped itself
+            test_should_be(cache.dropped(), size_t(1));
+            cache.enqueue(2, datagram(12));  // 2's oldest makes room
+            test_should_be(cache.dropped(), size_t(2));
+            test_should_be(cache.pending_bytes(), size_t(50));
+
+            const auto queued = cache.learn(2, ethernet_address(2));
+            test_should_be(queued.size(), size_t(2));
+            test_should_be(id(queued.front()), uint32_t(11));
+            test_should_be(id(queued.back()), uint32_t(12));
+            test_should_be(cache.pending_bytes(), size_t(30));
+
+            cache.tick(ARPCache::REQUEST_TIMEOUT + 1000);  // the wheel reclaims 1, with its datagrams
+            test_should_be(cache.pending_bytes(), size_t(0));
+            test_should_be(cache.dropped(), size_t(5));
+            test_should_be(cache.dropped_bytes(), size_t(50));
+        }
+
+        // random traffic from many neighbors, checked against a map with the same expiry rules; addresses are
+        // clustered so that they collide in the hash table, and the wheel must reclaim every neighbor
+        {
+            ARPCacheConfig config;
+            config.capacity = 4096;
+            ARPCache cache{config};
+            map<uint32_t, pair<EthernetAddress, size_t>> reference{};  // ip -> (address, deadline)
+            size_t now = 0;
+            for (unsigned i = 0; i < 200000; i++) {
+                const uint32_t ip = (10U << 24) | (rd() % 2000) * 4096;
+                switch (rd() % 4) {
+                    case 0:
+                        cache.learn(ip, ethernet_address(i));
+                        reference[ip] = {ethernet_address(i), now + ARPCache::ENTRY_TIMEOUT};
+                        break;
+                    case 1: {
+                        const size_t ms = rd() % 700;
+                        cache.tick(ms);
+                        now += ms;
+                        break;
+                    }
+                    default: {
+                        const auto it = reference.find(ip);
+                        const bool expected = it != reference.end() and now <= it->second.second;
+                        const auto found = cache.lookup(ip);
+                        test_err_if(found.has_value() != expected, "lookup of " + to_string(ip) + " disagrees");
+                        test_err_if(expected and found.value() != it->second.first, "wrong Ethernet address");
+                    }
+                }
+                test_err_if(cache.size() > reference.size(), "the cache has neighbors it never learned");
+            }
+            test_err_if(cache.size() == 0, "the cache is empty");
+            cache.tick(ARPCache::ENTRY_TIMEOUT + 1000);  // past the end of the wheel slot of the last deadline
+            test_should_be(cache.size(), size_t(0));
+        }
+    } catch (const exception &e) {
+        cerr << e.what() << endl;
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
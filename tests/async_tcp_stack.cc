@@ -0,0 +1,150 @@
+#include "async_tcp_stack.hh"
+#include "test_err_if.hh"
+#include "util.hh"
+
+#include <cstdint>
+#include <cstdlib>
+#include <exception>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+using Stack = AsyncTCPOverUDPStack;
+
+static constexpr size_t N_CLIENTS = 3;
+static constexpr size_t PAYLOAD_SIZE = 100000;
+static constexpr size_t CHUNK_SIZE = 6000;
+
+static TCPConfig tcp_config() {
+    // small windows, so that the bursts from all clients fit in the server's socket buffer, and a short
+    // retransmission timeout, so that TIME_WAIT is short
+    TCPConfig config;
+    config.rt_timeout = 100;
+    config.send_capacity = config.recv_capacity = 16000;
+    return config;
+}
+
+static unique_ptr<Stack> make_stack() {
+    UDPSocket sock;
+    sock.bind(Address("127.0.0.1", 0));
+    FdAdapterConfig config;
+    config.source = sock.local_address();
+    return make_unique<Stack>(TCPOverUDPSocketAdapter(move(sock)), tcp_config(), config);
+}
+
+static Stack::Task echo(Stack::Stream stream) {
+    for (auto data = co_await stream.read(); not data.empty(); data = co_await stream.read()) {
+        co_await stream.write(move(data));
+    }
+    test_err_if(not stream.eof(), "echo: connection died");
+    stream.end_input();
+}
+
+static Stack::Task serve(Stack &stack, const uint16_t port, const size_t connections) {
+    for (size_t i = 0; i < connections; i++) {
+        stack.spawn(echo(co_await stack.accept(port)));
+    }
+}
+
+// sends the payload a chunk at a time, reading each chunk's echo before sending the next
+static Stack::Task client(Stack &stack, const Address server, const string &payload, string &echoed) {
+    auto stream = co_await stack.connect(server);
+    test_err_if(not stream.active(), "client: connect failed");
+    for (size_t sent = 0; sent < payload.size(); sent += CHUNK_SIZE) {
+        const string chunk = payload.substr(sent, CHUNK_SIZE);
+        test_err_if(co_await stream.write(chunk) != chunk.size(), "client: short write");
+        const size_t goal = echoed.size() + chunk.size();
+        while (echoed.size() < goal) {
+            const string data = co_await stream.read();
+            test_err_if(data.empty(), "client: echo ended early");
+            echoed += data;
+        }
+    }
+    stream.end_input();
+    test_err_if(not(co_await stream.read()).empty() or not stream.eof(), "client: expected EOF");
+}
+
+// A server coroutine accepts connections and spawns an echo coroutine for each; clients, each with its
+// own stack and thread, check the echo. Also checks that an exception thrown by a coroutine comes out of run().
+int main() {
+    try {
+        auto rd = get_random_generator();
+
+        auto server = make_stack();
+        const Address server_address = server->stack().adapter().config().source;
+        server->listen(server_address.port());
+        server->spawn(serve(*server, server_address.port(), N_CLIENTS));
+
+        exception_ptr server_error{};
+        thread server_thread([&] {
+            try {
+                server->run();
+                while (server->stack().connection_count() > 0) {
+                    server->stack().wait_next_event(10);
+                }
+            } catch (...) {
+                server_error = current_exception();
+            }
+        });
+
+        vector<string> payloads(N_CLIENTS), echoes(N_CLIENTS);
+        vector<exception_ptr> client_errors(N_CLIENTS);
+        vector<thread> client_threads;
+        for (size_t i = 0; i < N_CLIENTS; i++) {
+            payloads[i].resize(PAYLOAD_SIZE);
+            for (auto &ch : payloads[i]) {
+                ch = static_cast<char>(rd());
+            }
+            client_threads.emplace_back([&, i] {
+                try {
+                    auto stack = make_stack();
+                    stack->spawn(client(*stack, server_address, payloads[i], echoes[i]));
+                    stack->run();
+                    while (stack->stack().connection_count() > 0) {
+                        stack->stack().wait_next_event(10);  // linger until the connection is done
+                    }
+                } catch (...) {
+                    client_errors[i] = current_exception();
+                }
+            });
+        }
+
+        for (auto &t : client_threads) {
+            t.join();
+        }
+        server_thread.join();
+        for (const auto &error : client_errors) {
+            if (error) {
+                rethrow_exception(error);
+            }
+        }
+        if (server_error) {
+            rethrow_exception(server_error);
+        }
+        for (size_t i = 0; i < N_CLIENTS; i++) {
+            test_err_if(echoes[i] != payloads[i], "client " + to_string(i) + " got a bad echo");
+        }
+
+        auto stack = make_stack();
+        stack->spawn([]() -> Stack::Task {
+            throw runtime_error("from a coroutine");
+            co_return;
+        }());
+        bool threw = false;
+        try {
+            stack->run();
+        } catch (const runtime_error &e) {
+            threw = string(e.what()) == "from a coroutine";
+        }
+        test_err_if(not threw, "run() should rethrow an exception from a coroutine");
+    } catch (const exception &e) {
+        cerr << e.what() << endl;
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
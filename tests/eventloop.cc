@@ -0,0 +1,232 @@
+#include "eventloop.hh"
+#include "socket.hh"
+#include "test_err_if.hh"
+#include "test_should_be.hh"
+#include "util.hh"
+
+#include <cstdlib>
+#include <exception>
+#include <fcntl.h>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <unistd.h>
+#include <utility>
+
+using namespace std;
+
+//! A connected pair of AF_UNIX stream sockets
+static pair<LocalStreamSocket, LocalStreamSocket> socket_pair() {
+    int fds[2];
+    SystemCall("socketpair", ::socketpair(AF_UNIX, SOCK_STREAM, 0, static_cast<int *>(fds)));
+    return {LocalStreamSocket{FileDescriptor{fds[0]}}, LocalStreamSocket{FileDescriptor{fds[1]}}};
+}
+
+//! The name of a backend, for messages
+static string name(const EventLoop::Backend backend) {
+    switch (backend) {
+        case EventLoop::Backend::Poll:
+            return "poll";
+        case EventLoop::Backend::Epoll:
+            return "epoll";
+        default:
+            return "io_uring";
+    }
+}
+
+// A callback that neither reads its ready fd nor loses interest is a busy wait, and is reported;
+// one that loses interest instead is not.
+static void busy_wait(const EventLoop::Backend backend) {
+    auto [writer, reader] = socket_pair();
+    writer.write("x");
+
+    {
+        EventLoop loop{backend};
+        loop.add_rule(reader, Direction::In, [] {});
+        bool threw = false;
+        try {
+            loop.wait_next_event(0);
+        } catch (const runtime_error &e) {
+            threw = string(e.what()).find("busy wait") != string::npos;
+        }
+        test_err_if(not threw, name(backend) + ": busy wait was not detected");
+    }
+
+    {
+        EventLoop loop{backend};
+        bool interested = true;
+        size_t calls = 0;
+        loop.add_rule(
+            reader,
+            Direction::In,
+            [&] {
+                calls++;
+                interested = false;
+            },
+            [&] { return interested; });
+        test_err_if(loop.wait_next_event(0) != EventLoop::Result::Success, name(backend) + ": rule was not run");
+        test_should_be(calls, size_t(1));
+        test_err_if(loop.wait_next_event(0) != EventLoop::Result::Exit, name(backend) + ": uninterested rule ran");
+    }
+}
+
+// A rule is canceled, and its cancel callback run once, when its fd reaches EOF or is closed.
+static void eof_and_close(const EventLoop::Backend backend) {
+    EventLoop loop{backend};
+    auto [writer, reader] = socket_pair();
+    auto [other_writer, other_reader] = socket_pair();
+    string received;
+    size_t canceled = 0, other_canceled = 0;
+    loop.add_rule(
+        reader, Direction::In, [&] { received += reader.read(); }, {}, [&] { canceled++; });
+    loop.add_rule(
+        other_reader, Direction::In, [&] { other_reader.read(); }, {}, [&] { other_canceled++; });
+
+    writer.write("hello");
+    writer.close();
+    for (size_t i = 0; i < 3 and canceled == 0; i++) {
+        test_err_if(loop.wait_next_event(0) == EventLoop::Result::Exit, name(backend) + ": exited with a live rule");
+    }
+    test_err_if(received != "hello", name(backend) + ": received " + received);
+    test_should_be(canceled, size_t(1));
+    test_should_be(other_canceled, size_t(0));
+
+    other_reader.close();
+    test_err_if(loop.wait_next_event(0) != EventLoop::Result::Exit, name(backend) + ": closed fd's rule remained");
+    test_should_be(other_canceled, size_t(1));
+    test_should_be(canceled, size_t(1));
+}
+
+// When a hangup is the only event on an fd, all of its interested rules are canceled in the same wakeup.
+static void hangup(const EventLoop::Backend backend) {
+    int fds[2];
+    SystemCall("pipe2", ::pipe2(static_cast<int *>(fds), O_CLOEXEC));
+    FileDescriptor reader{fds[0]}, writer{fds[1]};
+
+    EventLoop loop{backend};
+    size_t calls = 0, canceled = 0;
+    loop.add_rule(
+        reader, Direction::In, [&] { calls++; }, {}, [&] { canceled++; });
+    loop.add_rule(
+        reader, Direction::In, [&] { calls++; }, [] { return true; }, [&] { canceled++; });
+
+    writer.close();  // an empty pipe with no writer reports only POLLHUP
+    test_err_if(loop.wait_next_event(0) != EventLoop::Result::Success, name(backend) + ": hangup was not seen");
+    test_should_be(calls, size_t(0));
+    test_should_be(canceled, size_t(2));
+    test_err_if(loop.wait_next_event(0) != EventLoop::Result::Exit, name(backend) + ": hung-up rules remained");
+}
+
+// An fd that is closed and whose number is reused before the next wait must not hide the new fd from the loop.
+static void reused_fd_number(const EventLoop::Backend backend) {
+    EventLoop loop{backend};
+    auto [writer, reader] = socket_pair();
+    auto [new_writer, new_reader] = socket_pair();
+    size_t canceled = 0;
+    loop.add_rule(
+        reader, Direction::In, [&] { reader.read(); }, {}, [&] { canceled++; });
+
+    const int fd_num = reader.fd_num();
+    reader.close();
+    FileDescriptor reused{SystemCall("dup", ::dup(new_reader.fd_num()))};
+    test_should_be(reused.fd_num(), fd_num);
+    string received;
+    loop.add_rule(reused, Direction::In, [&] { received += reused.read(); });
+
+    new_writer.write("hello");
+    for (size_t i = 0; i < 3 and received.empty(); i++) {
+        test_err_if(loop.wait_next_event(0) == EventLoop::Result::Exit, name(backend) + ": exited with a live rule");
+    }
+    test_err_if(received != "hello", name(backend) + ": received " + received + " on the reused fd number");
+    test_should_be(canceled, size_t(1));
+}
+
+// A receive rule is handed what arrives on a socket or a pipe, and is canceled on EOF or closure.
+static void receive(const EventLoop::Backend backend) {
+    auto [writer, reader] = socket_pair();
+    int fds[2];
+    SystemCall("pipe2", ::pipe2(static_cast<int *>(fds), O_CLOEXEC));
+    FileDescriptor pipe_reader{fds[0]}, pipe_writer{fds[1]};
+
+    EventLoop loop{backend};
+    string received, pipe_received;
+    size_t canceled = 0, pipe_canceled = 0;
+    loop.add_receive_rule(
+        reader, [&](const string_view data) { received += data; }, {}, [&] { canceled++; });
+    loop.add_receive_rule(
+        pipe_reader, [&](const string_view data) { pipe_received += data; }, {}, [&] { pipe_canceled++; });
+
+    for (size_t round = 0; round < 3; round++) {
+        writer.write("hello");
+        pipe_writer.write("world");
+        const size_t expected = 5 * (round + 1);
+        for (size_t i = 0; i < 10 and (received.size() < expected or pipe_received.size() < expected); i++) {
+            test_err_if(loop.wait_next_event(100) == EventLoop::Result::Exit, name(backend) + ": exited early");
+        }
+    }
+    test_err_if(received != "hellohellohello", name(backend) + ": received " + received);
+    test_err_if(pipe_received != "worldworldworld", name(backend) + ": received " + pipe_received + " from a pipe");
+
+    writer.close();
+    for (size_t i = 0; i < 10 and canceled == 0; i++) {
+        test_err_if(loop.wait_next_event(100) == EventLoop::Result::Exit, name(backend) + ": exited with a live rule");
+    }
+    test_should_be(canceled, size_t(1));
+    test_should_be(pipe_canceled, size_t(0));
+
+    pipe_reader.close();
+    for (size_t i = 0; i < 10 and pipe_canceled == 0; i++) {
+        loop.wait_next_event(100);
+    }
+    test_should_be(pipe_canceled, size_t(1));
+    test_err_if(loop.wait_next_event(0) != EventLoop::Result::Exit, name(backend) + ": canceled rules remained");
+    test_should_be(canceled, size_t(1));
+}
+
+// A receive rule reads no more than its limit allows, and not at all while the limit is 0.
+static void receive_limit(const EventLoop::Backend backend) {
+    auto [writer, reader] = socket_pair();
+    EventLoop loop{backend};
+    string received;
+    size_t limit = 3;
+    loop.add_receive_rule(
+        reader,
+        [&](const string_view data) {
+            test_err_if(data.size() > limit, name(backend) + ": read " + to_string(data.size()) + " bytes");
+            received += data;
+            limit -= data.size();
+        },
+        [&] { return limit; });
+
+    writer.write("hello world");
+    for (size_t i = 0; i < 10 and limit > 0; i++) {
+        test_err_if(loop.wait_next_event(100) == EventLoop::Result::Exit, name(backend) + ": exited with room to read");
+    }
+    test_err_if(received != "hel", name(backend) + ": received " + received + " with a limit of 3");
+    test_err_if(loop.wait_next_event(0) != EventLoop::Result::Exit, name(backend) + ": read with a limit of 0");
+
+    limit = 100;
+    for (size_t i = 0; i < 10 and received.size() < 11; i++) {
+        loop.wait_next_event(100);
+    }
+    test_err_if(received != "hello world", name(backend) + ": received " + received);
+}
+
+int main() {
+    try {
+        for (const auto backend : {EventLoop::Backend::Poll, EventLoop::Backend::Epoll, EventLoop::Backend::IoUring}) {
+            busy_wait(backend);
+            eof_and_close(backend);
+            hangup(backend);
+            reused_fd_number(backend);
+            receive(backend);
+            receive_limit(backend);
+        }
+    } catch (const exception &e) {
+        cerr << e.what() << endl;
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
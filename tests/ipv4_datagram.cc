@@ -0,0 +1,132 @@
+#include "ipv4_datagram.hh"
+#include "test_err_if.hh"
+#include "test_should_be.hh"
+#include "util.hh"
+
+#include <cstdint>
+#include <cstdlib>
+#include <exception>
+#include <iostream>
+#include <random>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+using namespace std;
+
+//! The serialization of a datagram, computed from scratch
+static string reference(const IPv4Datagram &dgram) {
+    IPv4Header header = dgram.header();
+    header.cksum = 0;
+    InternetChecksum check;
+    check.add(header.serialize());
+    header.cksum = check.value();
+    return header.serialize() + dgram.payload().concatenate();
+}
+
+static IPv4Datagram random_datagram(mt19937 &rd) {
+    IPv4Datagram dgram;
+    IPv4Header &header = dgram.header();
+    header.tos = rd();
+    header.id = rd();
+    header.df = rd() % 2;
+    header.offset = rd() % 0x2000;
+    header.ttl = 2 + rd() % 254;
+    header.proto = rd();
+    header.src = rd();
+    header.dst = rd();
+    dgram.payload() = string(rd() % 100, 'x');
+    header.len = header.hlen * 4 + dgram.payload().size();
+    return dgram;
+}
+
+//! Check a serialization, and whether it hit the cache
+static void check_serialize(const IPv4Datagram &dgram, const bool hit) {
+    const auto before = IPv4Datagram::serialize_stats();
+    test_err_if(dgram.serialize().concatenate() != reference(dgram), "wrong serialization");
+    const auto after = IPv4Datagram::serialize_stats();
+    test_should_be(after.hits - before.hits, uint64_t(hit));
+    test_should_be(after.misses - before.misses, uint64_t(not hit));
+}
+
+int main() {
+    try {
+        auto rd = get_random_generator();
+
+        for (unsigned i = 0; i < 10000; i++) {
+            // a new header is a miss, and serializing it again is a hit
+            IPv4Datagram dgram = random_datagram(rd);
+            check_serialize(dgram, false);
+            check_serialize(dgram, true);
+
+            // changing a field invalidates the cache; the checksum field itself is ignored
+            dgram.header().id++;
+            check_serialize(dgram, false);
+            dgram.header().cksum++;
+            check_serialize(dgram, true);
+
+            // a parsed datagram already has its checksum, and a forwarded one updates it incrementally
+            IPv4Datagram parsed;
+            test_err_if(parsed.parse(dgram.serialize().concatenate()) != ParseResult::NoError, "parse failed");
+            check_serialize(parsed, true);
+            parsed.decrement_ttl();
+            test_should_be(parsed.header().ttl, uint8_t(dgram.header().ttl - 1));
+            check_serialize(parsed, true);
+            while (parsed.header().ttl > 0) {
+                parsed.decrement_ttl();
+            }
+            check_serialize(parsed, true);
+
+            // with the header changed, the checksum is unknown, so it is computed afresh
+            parsed.header().dst++;
+            parsed.decrement_ttl();
+            check_serialize(parsed, false);
+        }
+
+        // options are not serialized, so their checksum is not reused
+        {
+            IPv4Datagram dgram = random_datagram(rd);
+            string serialized = dgram.serialize().concatenate();
+            serialized.insert(20, string(4, '\x01'));
+            serialized[0] = 0x46;
+            serialized[3] += 4;
+            serialized[10] = serialized[11] = 0;
+            InternetChecksum check;
+            check.add(serialized.substr(0, 24));
+            serialized[10] = check.value() >> 8;
+            serialized[11] = check.value() & 0xff;
+
+            IPv4Datagram parsed;
+            test_err_if(parsed.parse(move(serialized)) != ParseResult::NoError, "parse failed");
+            check_serialize(parsed, false);
+        }
+
+        // each thread counts its own serializations, and they still count after it exits
+        {
+            const auto before = IPv4Datagram::serialize_stats();
+            vector<thread> threads;
+            for (unsigned t = 0; t < 4; t++) {
+                threads.emplace_back([] {
+                    auto thread_rd = get_random_generator();
+                    for (unsigned i = 0; i < 1000; i++) {
+                        const IPv4Datagram dgram = random_datagram(thread_rd);
+                        dgram.serialize();
+                        dgram.serialize();
+                    }
+                });
+            }
+            for (auto &t : threads) {
+                t.join();
+            }
+            const auto after = IPv4Datagram::serialize_stats();
+            test_should_be(after.hits - before.hits, uint64_t(4000));
+            test_should_be(after.misses - before.misses, uint64_t(4000));
+        }
+    } catch (const exception &e) {
+        cerr << e.what() << endl;
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
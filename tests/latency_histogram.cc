@@ -0,0 +1,124 @@
+#include "latency_histogram.hh"
+#include "stream_reassembler.hh"
+#include "test_err_if.hh"
+#include "test_should_be.hh"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <exception>
+#include <iostream>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+// Every value lands in a bucket that holds it, and the buckets cover the values without gaps.
+static void buckets() {
+    for (size_t i = 0; i < LatencyHistogram::BUCKETS; i++) {
+        const uint64_t lower = LatencyHistogram::bucket_lower(i), upper = LatencyHistogram::bucket_upper(i);
+        test_should_be(LatencyHistogram::bucket_index(lower), i);
+        test_should_be(LatencyHistogram::bucket_index(upper), i);
+        if (i + 1 < LatencyHistogram::BUCKETS) {
+            test_should_be(LatencyHistogram::bucket_lower(i + 1), upper + 1);
+        }
+        // a bucket is never wider than 1/16 of its values
+        test_err_if(upper - lower > lower / LatencyHistogram::SUB_BUCKETS, "bucket " + to_string(i) + " too wide");
+    }
+    test_should_be(LatencyHistogram::bucket_upper(LatencyHistogram::BUCKETS - 1), UINT64_MAX);
+}
+
+// Percentiles are within a bucket of the exact ones, and merging two histograms gives what one would have held.
+static void percentiles() {
+    mt19937 rd{42};
+    exponential_distribution<double> distribution{1.0 / 2000};
+    vector<uint64_t> values;
+    LatencyHistogram whole, first_half, second_half;
+    for (size_t i = 0; i < 100000; i++) {
+        const auto value = static_cast<uint64_t>(distribution(rd)) + 1;
+        values.push_back(value);
+        whole.record(value);
+        (i % 2 ? first_half : second_half).record(value);
+    }
+    sort(values.begin(), values.end());
+
+    for (const double quantile : {0.5, 0.9, 0.99, 0.999}) {
+        const uint64_t exact = values.at(static_cast<size_t>(quantile * values.size() + 0.5) - 1);
+        const uint64_t estimate = whole.percentile(quantile);
+        test_err_if(estimate < exact or estimate > exact + exact / LatencyHistogram::SUB_BUCKETS,
+                    "percentile " + to_string(quantile) + " is " + to_string(estimate) + ", not about " +
+                        to_string(exact));
+    }
+    test_should_be(whole.percentile(1), values.back());
+    test_should_be(whole.max(), values.back());
+    test_should_be(whole.count(), uint64_t(values.size()));
+
+    first_half.merge(second_half);
+    test_should_be(first_half.count(), whole.count());
+    test_should_be(first_half.sum(), whole.sum());
+    test_should_be(first_half.max(), whole.max());
+    for (size_t i = 0; i < LatencyHistogram::BUCKETS; i++) {
+        test_should_be(first_half.bucket_count(i), whole.bucket_count(i));
+    }
+
+    whole.reset();
+    test_should_be(whole.count(), uint64_t(0));
+    test_should_be(whole.percentile(0.5), uint64_t(0));
+}
+
+// The probes record only while enabled, and the histograms of every thread (exited or not) are merged.
+static void probes() {
+    LatencyHistograms::set_enabled(false);
+    LatencyHistograms::reset();
+    StreamReassembler reassembler{1000};
+    reassembler.push_substring("a", 0, false);
+    test_should_be(LatencyHistograms::merged(LatencyProbe::PushSubstring).count(), uint64_t(0));
+
+    if (not SPONGE_LATENCY_HISTOGRAMS) {
+        return;
+    }
+    LatencyHistograms::set_enabled(true);
+    reassembler.push_substring("b", 1, false);
+    thread([] {
+        StreamReassembler other{1000};
+        for (size_t i = 0; i < 10; i++) {
+            other.push_substring("x", i, false);
+        }
+    }).join();
+    uint64_t others = 0;
+    thread recorder([&others] {
+        LatencyHistograms::record(LatencyProbe::EventDispatch, 100);
+        others = LatencyHistograms::merged(LatencyProbe::EventDispatch).count();
+    });
+    recorder.join();
+    LatencyHistograms::set_enabled(false);
+
+    const LatencyHistogram push = LatencyHistograms::merged(LatencyProbe::PushSubstring);
+    test_should_be(push.count(), uint64_t(11));
+    test_err_if(push.max() == 0, "no time recorded");
+    test_should_be(others, uint64_t(1));
+    test_err_if(LatencyHistograms::cycles_per_ns() <= 0, "no cycles per nanosecond");
+
+    StatsSnapshot snapshot;
+    LatencyHistograms::collect(snapshot);
+    const string push_label = StatsSnapshot::label("probe", "push_substring");
+    test_should_be(snapshot.value("sponge_latency_samples_total", push_label), uint64_t(11));
+    test_err_if(snapshot.value("sponge_latency_ns", push_label + "," + StatsSnapshot::label("quantile", "1")) == 0,
+                "no maximum in the snapshot");
+    test_err_if(LatencyHistograms::report().find("push_substring") == string::npos, "probe missing from report");
+}
+
+int main() {
+    try {
+        buckets();
+        percentiles();
+        probes();
+    } catch (const exception &e) {
+        cerr << e.what() << endl;
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,145 @@
+#include "logger.hh"
+#include "test_err_if.hh"
+#include "test_should_be.hh"
+#include "util.hh"
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <exception>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+using namespace std;
+
+//! \brief Sends stderr (fd 2) to a temporary file while it lives
+class CapturedStderr {
+  private:
+    char _path[32] = "/tmp/sponge_logger_XXXXXX";
+    int _saved_stderr;
+
+  public:
+    CapturedStderr() : _saved_stderr(SystemCall("dup", dup(STDERR_FILENO))) {
+        const int fd = SystemCall("mkstemp", mkstemp(_path));
+        SystemCall("dup2", dup2(fd, STDERR_FILENO));
+        SystemCall("close", close(fd));
+    }
+    CapturedStderr(const CapturedStderr &other) = delete;
+    CapturedStderr &operator=(const CapturedStderr &other) = delete;
+    ~CapturedStderr() {
+        dup2(_saved_stderr, STDERR_FILENO);
+        close(_saved_stderr);
+        unlink(_path);
+    }
+
+    //! The lines written to stderr so far
+    vector<string> lines() const {
+        ifstream file{_path};
+        vector<string> ret;
+        for (string line; getline(file, line);) {
+            ret.push_back(line);
+        }
+        return ret;
+    }
+};
+
+int main() {
+    try {
+        Logger::set_level(LogLevel::Info);
+        test_err_if(Logger::parse_level("warning") != LogLevel::Warning, "wrong level");
+        bool threw = false;
+        try {
+            Logger::parse_level("verbose");
+        } catch (const exception &) {
+            threw = true;
+        }
+        test_err_if(not threw, "an unknown level was accepted");
+
+        // a message below the level is not even formatted
+        {
+            CapturedStderr captured;
+            size_t evaluated = 0;
+            LOG_DEBUG("hidden " << ++evaluated);
+            LOG_INFO("shown " << ++evaluated);
+            LOG_WARNING("careful");
+            Logger::flush();
+            test_should_be(evaluated, size_t(1));
+            const auto lines = captured.lines();
+            test_should_be(lines.size(), size_t(2));
+            test_err_if(lines.at(0) != "shown 1", "wrong line: " + lines.at(0));
+            test_err_if(lines.at(1) != "Warning: careful", "wrong line: " + lines.at(1));
+
+            Logger::set_level(LogLevel::Debug);
+            LOG_DEBUG("now shown");
+            Logger::set_level(LogLevel::Info);
+            Logger::flush();
+            test_err_if(captured.lines().back() != "DEBUG: now shown", "wrong line: " + captured.lines().back());
+        }
+
+        // messages from many threads all arrive, whole, and each thread's in order
+        {
+            constexpr size_t n_threads = 4;
+            constexpr size_t per_thread = 20000;
+            CapturedStderr captured;
+            vector<thread> threads;
+            for (size_t t = 0; t < n_threads; t++) {
+                threads.emplace_back([t] {
+                    for (size_t i = 0; i < per_thread; i++) {
+                        LOG_INFO(t << " " << i);
+                        if (i % 100 == 0) {
+                            // keep the rings from filling up faster than the background thread drains them
+                            this_thread::sleep_for(chrono::microseconds(200));
+                        }
+                    }
+                });
+            }
+            for (auto &thread : threads) {
+                thread.join();
+            }
+            Logger::flush();
+
+            vector<size_t> next(n_threads);
+            size_t drops_reported = 0;
+            for (const auto &line : captured.lines()) {
+                if (line.find("log messages dropped") != string::npos) {
+                    drops_reported++;
+                    continue;
+                }
+                istringstream fields{line};
+                size_t t = 0, i = 0;
+                fields >> t >> i;
+                test_err_if(not fields or t >= n_threads or i < next.at(t), "mangled or reordered line: " + line);
+                next.at(t) = i + 1;
+            }
+            test_err_if(Logger::dropped() == 0 and drops_reported != 0, "drops reported but none counted");
+            for (size_t t = 0; t < n_threads; t++) {
+                test_err_if(Logger::dropped() == 0 and next[t] != per_thread, "a message went missing");
+            }
+        }
+
+        // a thread that logs faster than the ring drains loses messages, and the loss is reported
+        {
+            CapturedStderr captured;
+            const uint64_t dropped_before = Logger::dropped();
+            thread([] {
+                const string message(1000, 'x');
+                for (size_t i = 0; i < 2 * Logger::RING_CAPACITY / message.size(); i++) {
+                    LOG_INFO(message);
+                }
+            }).join();
+            Logger::flush();
+            test_err_if(Logger::dropped() == dropped_before, "nothing was dropped");
+            test_err_if(captured.lines().back().find("log messages dropped") == string::npos, "drops not reported");
+        }
+    } catch (const exception &e) {
+        cerr << e.what() << endl;
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
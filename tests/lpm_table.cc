@@ -0,0 +1,163 @@
+#include "lpm_table.hh"
+#include "test_err_if.hh"
+#include "test_should_be.hh"
+#include "util.hh"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <exception>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+struct Prefix {
+    uint32_t prefix;
+    uint8_t length;
+    uint32_t value;
+};
+
+static uint32_t mask(const uint8_t length) { return length == 0 ? 0 : 0xffffffff << (32 - length); }
+
+//! the longest matching prefix, by brute force (the first one added wins a tie)
+static uint32_t reference_lookup(const vector<Prefix> &prefixes, const uint32_t address) {
+    int best_length = -1;
+    uint32_t best = LPMTable::NO_MATCH;
+    for (const auto &p : prefixes) {
+        if ((address & mask(p.length)) == (p.prefix & mask(p.length)) and p.length > best_length) {
+            best_length = p.length;
+            best = p.value;
+        }
+    }
+    return best;
+}
+
+int main() {
+    try {
+        auto rd = get_random_generator();
+
+        // simple cases, added from most to least specific so that pushed leaves must not overwrite longer ones
+        {
+            LPMTable table;
+            test_should_be(table.lookup(0x0a000001), LPMTable::NO_MATCH);
+            test_should_be(table.add(0x0a000001, 32, 1), true);
+            test_should_be(table.add(0x0a000000, 24, 2), true);
+            test_should_be(table.add(0x0a0000ff, 24, 99), false);  // same prefix; host bits are ignored
+            test_should_be(table.add(0x0a000000, 8, 3), true);
+            test_should_be(table.add(0, 0, 4), true);
+            test_should_be(table.lookup(0x0a000001), 1U);
+            test_should_be(table.lookup(0x0a000002), 2U);
+            test_should_be(table.lookup(0x0a010000), 3U);
+            test_should_be(table.lookup(0xc0a80001), 4U);
+            test_should_be(table.size(), size_t(4));
+
+            LPMTable covered;
+            test_should_be(covered.add(0x0a000000, 31, 1), true);
+            test_should_be(covered.add(0x0a000000, 32, 2), true);
+            test_should_be(covered.add(0x0a000001, 32, 3), true);
+            test_should_be(covered.add(0x0a000000, 31, 4), false);  // both addresses already have longer matches
+        }
+
+        // random prefixes, clustered so that they overlap, checked against brute force
+        for (unsigned round = 0; round < 4; round++) {
+            vector<Prefix> prefixes;
+            LPMTable table;
+            const uint32_t base = rd() & 0xff000000;
+            for (uint32_t value = 0; value < 300; value++) {
+                const uint8_t length = uniform_int_distribution<unsigned>{0, 32}(rd);
+                const uint32_t prefix = base | (rd() & (value % 2 ? 0x0000ffff : 0x00ffffff));
+                const bool added = table.add(prefix, length, value);
+                const bool duplicate =
+                    any_of(prefixes.begin(), prefixes.end(), [&](const Prefix &p) {
+                        return p.length == length and (p.prefix & mask(length)) == (prefix & mask(length));
+                    });
+                test_err_if(added and duplicate, "a duplicate prefix was added");
+                if (not duplicate) {
+                    prefixes.push_back({prefix, length, value});
+                }
+            }
+
+            vector<uint32_t> addresses;
+            for (unsigned i = 0; i < 20000; i++) {
+                // half of the addresses from inside the prefixes, half at random
+                uint32_t address = rd();
+                if (i % 2) {
+                    const Prefix &p = prefixes[rd() % prefixes.size()];
+                    address = (p.prefix & mask(p.length)) | (address & ~mask(p.length));
+                }
+                const uint32_t expected = reference_lookup(prefixes, address);
+                test_err_if(table.lookup(address) != expected,
+                            "lookup of " + to_string(address) + " gave " + to_string(table.lookup(address)) +
+                                ", expected " + to_string(expected));
+                addresses.push_back(address);
+            }
+
+            // batches of various sizes must agree with one lookup at a time
+            vector<uint32_t> results(addresses.size());
+            for (size_t first = 0; first < addresses.size();) {
+                const size_t count = min(addresses.size() - first, size_t(rd() % 70));
+                table.lookup_batch(&addresses[first], &results[first], count);
+                first += count;
+            }
+            for (size_t i = 0; i < addresses.size(); i++) {
+                test_err_if(results[i] != table.lookup(addresses[i]), "lookup_batch disagrees with lookup");
+            }
+
+            // replace and remove half of the prefixes, each removed one handing over to its covering prefix
+            for (unsigned change = 0; change < 150 and not prefixes.empty(); change++) {
+                const size_t victim = rd() % prefixes.size();
+                const Prefix p = prefixes[victim];
+                if (change % 2) {
+                    prefixes[victim].value = 1000 + change;
+                    table.replace(p.prefix, p.length, prefixes[victim].value);
+                    continue;
+                }
+                prefixes.erase(prefixes.begin() + victim);
+                const Prefix *covering = nullptr;
+                for (const auto &q : prefixes) {
+                    if (q.length < p.length and (p.prefix & mask(q.length)) == (q.prefix & mask(q.length)) and
+                        (covering == nullptr or q.length > covering->length)) {
+                        covering = &q;
+                    }
+                }
+                table.remove(p.prefix,
+                             p.length,
+                             covering ? covering->value : LPMTable::NO_MATCH,
+                             covering ? covering->length : 0);
+            }
+            for (const uint32_t address : addresses) {
+                const uint32_t expected = reference_lookup(prefixes, address);
+                test_err_if(table.lookup(address) != expected,
+                            "after changes, lookup of " + to_string(address) + " gave " +
+                                to_string(table.lookup(address)) + ", expected " + to_string(expected));
+            }
+        }
+
+        // replace and remove on a simple table
+        {
+            LPMTable table;
+            table.add(0x0a000000, 8, 1);
+            table.add(0x0a010000, 16, 2);
+            table.add(0x0a010100, 24, 3);
+            test_should_be(table.replace(0x0a010000, 16, 4), true);
+            test_should_be(table.replace(0x0a020000, 16, 5), false);  // not in the table
+            test_should_be(table.lookup(0x0a010200), 4U);
+            test_should_be(table.lookup(0x0a010101), 3U);
+            test_should_be(table.remove(0x0a010100, 24, 4, 16), true);
+            test_should_be(table.lookup(0x0a010101), 4U);
+            test_should_be(table.remove(0x0a010000, 16, 1, 8), true);
+            test_should_be(table.lookup(0x0a010101), 1U);
+            test_should_be(table.remove(0x0a000000, 8, LPMTable::NO_MATCH, 0), true);
+            test_should_be(table.lookup(0x0a010101), LPMTable::NO_MATCH);
+            test_should_be(table.size(), size_t(0));
+        }
+    } catch (const exception &e) {
+        cerr << e.what() << endl;
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,180 @@
+#include "network_emulator.hh"
+#include "test_err_if.hh"
+#include "test_should_be.hh"
+
+#include <cstdint>
+#include <cstdlib>
+#include <exception>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+// Events run in time order, and in the order they were scheduled at the same time.
+static void event_queue() {
+    EventQueue events;
+    string order;
+    events.at(2000, [&] { order += "c"; });
+    events.at(1000, [&] { order += "a"; });
+    events.at(1000, [&] {
+        order += "b";
+        events.after(500, [&] { order += "d"; });  // at 1500, before "c"
+    });
+    events.run_until(1200);
+    test_err_if(order != "ab", "ran " + order + " by 1200 ns, not ab");
+    test_should_be(events.now_ns(), uint64_t(1200));
+    events.run_until(5000);
+    test_err_if(order != "abdc", "ran " + order + ", not abdc");
+    test_should_be(events.empty(), true);
+
+    bool threw = false;
+    try {
+        events.at(1000, [] {});
+    } catch (const exception &) {
+        threw = true;
+    }
+    test_err_if(not threw, "scheduled an event in the past");
+}
+
+//! A frame of `size` bytes on the wire
+static EthernetFrame frame_of(const size_t size) {
+    EthernetFrame frame;
+    frame.header().type = EthernetHeader::TYPE_IPv4;
+    frame.payload() = string(size - EthernetHeader::LENGTH, 'x');
+    return frame;
+}
+
+// A link sends a frame at a time at its rate, delivers it after its delay, and drops what its queue cannot hold.
+static void link() {
+    EventQueue events;
+    mt19937 rd{0};
+    LinkConfig config;
+    config.bandwidth = 8;  // a byte per microsecond
+    config.delay_us = 1000;
+    config.queue_bytes = 2000;
+    vector<uint64_t> arrivals;
+    EmulatedLink wire{events, config, rd, [&](EthernetFrame &&) { arrivals.push_back(events.now_ns() / 1000); }};
+
+    for (size_t i = 0; i < 4; i++) {
+        wire.send(frame_of(1000));  // the first is sent at once, two wait, and the last does not fit
+    }
+    test_should_be(wire.queued_bytes(), size_t(2000));
+    events.run_until(UINT64_MAX / 2);
+    test_err_if(arrivals != vector<uint64_t>({2000, 3000, 4000}), "frames did not arrive at 2, 3 and 4 ms");
+
+    const EmulatedLinkStats &stats = wire.stats();
+    test_should_be(stats.frames_offered, uint64_t(4));
+    test_should_be(stats.frames_sent, uint64_t(3));
+    test_should_be(stats.queue_drops, uint64_t(1));
+    test_should_be(stats.busy_ns, uint64_t(3000 * 1000));
+    test_should_be(stats.queueing_delay_ns.max(), uint64_t(2000 * 1000));
+    test_should_be(stats.queueing_delay_ns.sum(), uint64_t(3000 * 1000));
+}
+
+// With RED tracking the instantaneous queue, frames are dropped early once it reaches the max threshold.
+static void red() {
+    EventQueue events;
+    mt19937 rd{0};
+    LinkConfig config;
+    config.bandwidth = 8;
+    config.queue_bytes = 10000;
+    config.discipline = LinkConfig::QueueDiscipline::RED;
+    config.red_weight = 1;
+    config.red_min_threshold = 0.1;
+    config.red_max_threshold = 0.2;
+    size_t arrived = 0;
+    EmulatedLink wire{events, config, rd, [&](EthernetFrame &&) { arrived++; }};
+
+    for (size_t i = 0; i < 10; i++) {
+        wire.send(frame_of(1000));  // the queue holds 0, 1000 and then 2000 bytes as frames 2, 3 and 4 arrive
+    }
+    events.run_until(UINT64_MAX / 2);
+    test_should_be(arrived, size_t(3));
+    test_should_be(wire.stats().early_drops, uint64_t(7));
+    test_should_be(wire.stats().queue_drops, uint64_t(0));
+}
+
+// A flow between two hosts on one link delivers its bytes, at no more than the link's rate.
+static void one_flow() {
+    NetworkEmulator net;
+    const size_t a = net.add_host(Address{"10.0.0.1"}), b = net.add_host(Address{"10.0.0.2"});
+    LinkConfig config;
+    config.bandwidth = 10;
+    config.delay_us = 5000;
+    config.queue_bytes = 128 * 1024;  // holds a whole window
+    net.connect_hosts(a, b, config);
+    net.add_flow(a, b, 200000, 3000000);
+
+    test_should_be(net.run(), true);
+    const auto flows = net.flow_reports();
+    test_should_be(flows.size(), size_t(1));
+    test_should_be(flows[0].bytes_delivered, uint64_t(200000));
+    test_should_be(flows[0].start_ns, uint64_t(3000000));
+    test_should_be(flows[0].retransmissions, uint64_t(0));
+    test_err_if(flows[0].throughput > 10 or flows[0].throughput < 2,
+                "throughput of " + to_string(flows[0].throughput) + " Mbit/s over a 10 Mbit/s link");
+    test_err_if(flows[0].frames_queued == 0 or flows[0].max_queueing_delay_us == 0, "no queueing delay measured");
+    test_err_if(net.report().find("200000") == string::npos, "flow missing from report");
+}
+
+//! \brief Run flows between two pairs of hosts, through two routers joined by a lossy bottleneck
+//! \returns each flow's finish time and retransmissions, and the bottleneck's losses
+static vector<uint64_t> lossy_dumbbell(const unsigned seed) {
+    NetworkEmulator net{seed};
+    const size_t left = net.add_router(), right = net.add_router();
+    const size_t left_uplink = net.add_router_interface(left, Address{"10.0.0.1"});
+    const size_t right_uplink = net.add_router_interface(right, Address{"10.0.0.2"});
+    net.add_route(left, 0x0a020000, 16, Address{"10.0.0.2"}, left_uplink);
+    net.add_route(right, 0x0a010000, 16, Address{"10.0.0.1"}, right_uplink);
+    LinkConfig bottleneck;
+    bottleneck.bandwidth = 20;
+    bottleneck.delay_us = 2000;
+    bottleneck.loss = 0.02;
+    net.connect_routers(left, left_uplink, right, right_uplink, bottleneck);
+
+    for (uint32_t i = 0; i < 2; i++) {
+        const size_t sender = net.add_host(Address::from_ipv4_numeric(0x0a010002 + i));
+        const size_t receiver = net.add_host(Address::from_ipv4_numeric(0x0a020002 + i));
+        const size_t left_port = net.add_router_interface(left, Address{"10.1.0.1"});
+        const size_t right_port = net.add_router_interface(right, Address{"10.2.0.1"});
+        net.add_route(left, 0x0a010002 + i, 32, {}, left_port);
+        net.add_route(right, 0x0a020002 + i, 32, {}, right_port);
+        net.connect_host(sender, left, left_port, {});
+        net.connect_host(receiver, right, right_port, {});
+        net.add_flow(sender, receiver, 100000, i * 1000000);
+    }
+
+    test_should_be(net.run(), true);
+    vector<uint64_t> ret;
+    for (const auto &flow : net.flow_reports()) {
+        test_should_be(flow.bytes_delivered, uint64_t(100000));
+        ret.push_back(flow.finish_ns.value());
+        ret.push_back(flow.retransmissions);
+    }
+    ret.push_back(net.link(0).stats().losses + net.link(1).stats().losses);
+    return ret;
+}
+
+// Flows are routed and recover from losses, and the same seed gives the same emulation.
+static void determinism() {
+    const vector<uint64_t> first = lossy_dumbbell(7);
+    test_err_if(first.back() == 0, "no losses at the bottleneck");
+    test_err_if(lossy_dumbbell(7) != first, "the same seed gave a different emulation");
+}
+
+int main() {
+    try {
+        event_queue();
+        link();
+        red();
+        one_flow();
+        determinism();
+    } catch (const exception &e) {
+        cerr << e.what() << endl;
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,196 @@
+#include "arp_message.hh"
+#include "parallel_router.hh"
+#include "test_err_if.hh"
+#include "test_should_be.hh"
+#include "util.hh"
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <exception>
+#include <iostream>
+#include <random>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+using namespace std;
+
+// Producers push numbered elements through a small ring, retrying when it is full: the consumer must get every
+// element once, and each producer's in order.
+static void mpsc_ring() {
+    constexpr size_t n_producers = 4;
+    constexpr size_t per_producer = 100000;
+
+    MPSCRing<pair<size_t, size_t>> ring{100};
+    test_should_be(ring.capacity(), size_t(128));
+
+    vector<thread> producers;
+    for (size_t producer = 0; producer < n_producers; producer++) {
+        producers.emplace_back([&ring, producer] {
+            for (size_t i = 0; i < per_producer; i++) {
+                while (not ring.push({producer, i})) {
+                    this_thread::yield();
+                }
+            }
+        });
+    }
+
+    vector<size_t> next(n_producers);
+    pair<size_t, size_t> element;
+    for (size_t received = 0; received < n_producers * per_producer;) {
+        if (not ring.pop(element)) {
+            this_thread::yield();
+            continue;
+        }
+        test_err_if(element.second != next.at(element.first)++, "MPSCRing reordered a producer's elements");
+        received++;
+    }
+    for (auto &producer : producers) {
+        producer.join();
+    }
+    test_should_be(ring.pop(element), false);
+}
+
+constexpr size_t n_interfaces = 4;
+constexpr size_t datagrams_per_interface = 20000;
+
+static EthernetAddress ethernet_address(const uint8_t host) { return {0x02, 0, 0, 0, 0, host}; }
+
+static uint32_t interface_ip(const size_t interface) { return (10U << 24) | (uint32_t(interface) << 8) | 1; }
+
+static uint32_t next_hop_ip(const size_t interface) { return interface_ip(interface) + 1; }
+
+//! The network behind an interface: 10.(interface + 1).0.0/16
+static uint32_t network(const size_t interface) { return (10U << 24) | (uint32_t(interface + 1) << 16); }
+
+//! \brief What each interface's driver has done; only the interface's worker touches it while the router runs
+struct DriverState {
+    size_t generated = 0;
+    size_t delivered = 0;    //!< IPv4 frames sent to the right next hop, with the TTL decremented
+    size_t misrouted = 0;    //!< Anything else that came out
+    std::atomic<size_t> delivered_total{0};
+};
+
+// Every interface receives datagrams for all the networks (its own included) and answers its own ARP requests
+// as the next hop would, so each datagram needs the lookup, a trip through an egress ring, and ARP resolution
+// on the egress interface's worker.
+static void forwarding() {
+    ParallelRouter router;
+    for (size_t i = 0; i < n_interfaces; i++) {
+        router.add_interface({ethernet_address(i), Address::from_ipv4_numeric(interface_ip(i))});
+        router.add_route(network(i), 16, Address::from_ipv4_numeric(next_hop_ip(i)), i);
+    }
+
+    array<DriverState, n_interfaces> states{};
+    router.start([&](const size_t interface_num, AsyncNetworkInterface &interface) {
+        DriverState &state = states[interface_num];
+        thread_local mt19937 rd{get_random_generator()};
+
+        auto &frames = interface.frames_out();
+        while (not frames.empty()) {
+            const EthernetFrame frame = move(frames.front());
+            frames.pop();
+
+            if (frame.header().type == EthernetHeader::TYPE_ARP) {
+                ARPMessage request;
+                if (request.parse(frame.payload().concatenate()) != ParseResult::NoError or
+                    request.target_ip_address != next_hop_ip(interface_num)) {
+                    state.misrouted++;
+                    continue;
+                }
+                ARPMessage reply;
+                reply.opcode = ARPMessage::OPCODE_REPLY;
+                reply.sender_ethernet_address = ethernet_address(0x80 + interface_num);
+                reply.sender_ip_address = next_hop_ip(interface_num);
+                reply.target_ethernet_address = request.sender_ethernet_address;
+                reply.target_ip_address = request.sender_ip_address;
+                EthernetFrame reply_frame;
+                reply_frame.header() = {
+                    reply.target_ethernet_address, reply.sender_ethernet_address, EthernetHeader::TYPE_ARP};
+                reply_frame.payload() = reply.serialize();
+                interface.recv_frame(reply_frame);
+                continue;
+            }
+
+            InternetDatagram dgram;
+            const bool ok = dgram.parse(frame.payload().concatenate()) == ParseResult::NoError and
+                            frame.header().dst == ethernet_address(0x80 + interface_num) and
+                            (dgram.header().dst & 0xffff0000) == network(interface_num) and
+                            dgram.header().ttl == 63;
+            (ok ? state.delivered : state.misrouted)++;
+        }
+        state.delivered_total.store(state.delivered, memory_order_relaxed);
+
+        for (size_t i = 0; i < 64 and state.generated < datagrams_per_interface; i++, state.generated++) {
+            InternetDatagram dgram;
+            dgram.header().ttl = 64;
+            dgram.header().src = next_hop_ip(interface_num);
+            dgram.header().dst = network(rd() % n_interfaces) | (rd() & 0xffff);
+            dgram.payload() = string(16, 'x');
+            dgram.header().len = dgram.header().hlen * 4 + dgram.payload().size();
+            interface.datagrams_out().push(move(dgram));
+        }
+    });
+
+    // wait until every datagram is delivered or dropped
+    const auto deadline = chrono::steady_clock::now() + chrono::seconds(20);
+    while (chrono::steady_clock::now() < deadline) {
+        size_t done = 0;
+        for (size_t i = 0; i < n_interfaces; i++) {
+            done += states[i].delivered_total.load(memory_order_relaxed) + router.dropped(i);
+        }
+        if (done == n_interfaces * datagrams_per_interface) {
+            break;
+        }
+        this_thread::sleep_for(chrono::milliseconds(1));
+    }
+    router.stop();
+
+    size_t delivered = 0;
+    for (size_t i = 0; i < n_interfaces; i++) {
+        test_should_be(states[i].generated, datagrams_per_interface);
+        test_should_be(states[i].misrouted, size_t(0));
+        test_should_be(uint64_t(states[i].delivered), router.forwarded(i));
+        test_err_if(states[i].delivered == 0, "an interface delivered nothing");
+        delivered += states[i].delivered + router.dropped(i);
+    }
+    test_should_be(delivered, n_interfaces * datagrams_per_interface);
+}
+
+// The single-threaded Router drops a datagram whose route names an interface it does not have, as a datagram
+// with no route.
+static void missing_interface() {
+    Router router;
+    router.add_interface({ethernet_address(0), Address::from_ipv4_numeric(interface_ip(0))});
+    router.add_route(network(0), 16, {}, 0);
+    router.add_route(network(1), 16, {}, 7);
+
+    for (const size_t interface : {0, 1}) {
+        InternetDatagram dgram;
+        dgram.header().ttl = 64;
+        dgram.header().src = next_hop_ip(0);
+        dgram.header().dst = network(interface) | 1;
+        dgram.header().len = dgram.header().hlen * 4;
+        router.interface(0).datagrams_out().push(move(dgram));
+    }
+    router.route();
+    test_should_be(router.stats().datagrams_routed.value(), uint64_t(1));
+    test_should_be(router.stats().no_route_drops.value(), uint64_t(1));
+}
+
+int main() {
+    try {
+        mpsc_ring();
+        forwarding();
+        missing_interface();
+    } catch (const exception &e) {
+        cerr << e.what() << endl;
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
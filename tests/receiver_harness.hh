@@ -1,6 +1,7 @@
 #ifndef SPONGE_RECEIVER_HARNESS_HH
 #define SPONGE_RECEIVER_HARNESS_HH
 
+#include "allocation_counter.hh"
 #include "byte_stream.hh"
 #include "tcp_receiver.hh"
 #include "tcp_state.hh"
@@ -13,6 +14,7 @@
 #include <optional>
 #include <sstream>
 #include <string>
+#include <vector>
 
 struct ReceiverTestStep {
     virtual std::string to_string() const { return "ReceiverTestStep"; }
@@ -293,6 +295,42 @@ struct SegmentArrives : public ReceiverAction {
     }
 };
 
+//! \brief Segments arrive, and the TCPReceiver must allocate at most `budget` times per segment in receiving them
+//! \details The segments are built before the allocations are counted, so that only the receiver's count.
+struct SegmentsArriveWithinBudget : public ReceiverAction {
+    std::vector<SegmentArrives> segments;
+    double budget;
+
+    SegmentsArriveWithinBudget(std::vector<SegmentArrives> segments_, const double budget_)
+        : segments(std::move(segments_)), budget(budget_) {}
+
+    std::string description() const override {
+        std::ostringstream o;
+        o << segments.size() << " segments arrive, with at most " << budget << " allocations per segment";
+        return o.str();
+    }
+
+    void execute(TCPReceiver &receiver) const override {
+        std::vector<TCPSegment> built;
+        for (const auto &segment : segments) {
+            built.push_back(segment.build_segment());
+        }
+
+        const AllocationPhase phase;
+        for (const auto &seg : built) {
+            receiver.segment_received(seg);
+        }
+        const AllocationCount count = phase.count();
+
+        if (count.allocations > budget * built.size()) {
+            std::ostringstream o;
+            o << "The TCPReceiver made " << count.to_string() << " receiving " << built.size()
+              << " segments, but it was expected to allocate at most " << budget << " allocations per segment";
+            throw ReceiverExpectationViolation(o.str());
+        }
+    }
+};
+
 class TCPReceiverTestHarness {
     TCPReceiver receiver;
     std::vector<std::string> steps_executed;
@@ -0,0 +1,60 @@
+#include "receiver_harness.hh"
+#include "wrapping_integers.hh"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <exception>
+#include <iostream>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+//! `count` segments of `size` bytes each, in order, starting at stream index `first`
+static vector<SegmentArrives> segments_of(const uint32_t isn,
+                                          const size_t first,
+                                          const size_t count,
+                                          const size_t size) {
+    vector<SegmentArrives> ret;
+    for (size_t i = 0; i < count; i++) {
+        const size_t index = first + i * size;
+        ret.push_back(SegmentArrives{}.with_seqno(isn + 1 + index).with_data(string(size, 'a' + index % 26)));
+    }
+    return ret;
+}
+
+int main() {
+    try {
+        {
+            // Steady-state in-order receive allocates at most once per segment, and a duplicate not at all
+            const size_t cap = 1000000, size = 1000;
+            const uint32_t isn = 17;
+            TCPReceiverTestHarness test{cap};
+            test.execute(SegmentArrives{}.with_syn().with_seqno(isn).with_result(SegmentArrives::Result::OK));
+            test.execute(SegmentsArriveWithinBudget{segments_of(isn, 0, 500, size), 1});
+            test.execute(ExpectTotalAssembledBytes{500 * size});
+            test.execute(ExpectUnassembledBytes{0});
+            test.execute(SegmentsArriveWithinBudget{segments_of(isn, 0, 100, size), 0});
+            test.execute(ExpectTotalAssembledBytes{500 * size});
+        }
+
+        {
+            // Out of order, each segment is stored once, and assembling them allocates nothing more
+            const size_t cap = 100000, size = 1000;
+            const uint32_t isn = 9000;
+            TCPReceiverTestHarness test{cap};
+            test.execute(SegmentArrives{}.with_syn().with_seqno(isn).with_result(SegmentArrives::Result::OK));
+            vector<SegmentArrives> reversed = segments_of(isn, 0, 50, size);
+            reverse(reversed.begin(), reversed.end());
+            test.execute(SegmentsArriveWithinBudget{reversed, 2});
+            test.execute(ExpectTotalAssembledBytes{50 * size});
+            test.execute(ExpectUnassembledBytes{0});
+        }
+    } catch (const exception &e) {
+        cerr << e.what() << endl;
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
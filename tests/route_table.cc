@@ -0,0 +1,134 @@
+#include "route_table.hh"
+#include "test_err_if.hh"
+#include "test_should_be.hh"
+#include "util.hh"
+
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <exception>
+#include <iostream>
+#include <optional>
+#include <random>
+#include <string>
+#include <thread>
+
+using namespace std;
+
+//! The interface of the route for an address, or -1 if none matches
+static int route_of(const RouteTable::Snapshot &snapshot, const uint32_t address) {
+    const uint32_t index = snapshot.lookup(address);
+    return index == RouteTable::Snapshot::NO_ROUTE ? -1 : int(snapshot.action(index).interface_num);
+}
+
+// Staged updates only show up at commit(); removing a route hands its addresses to the covering one.
+static void updates() {
+    RouteTable table;
+    RouteTable::Reader reader{table};
+
+    test_should_be(table.add(0x0a000000, 8, nullopt, 1), true);
+    test_should_be(table.add(0x0a010000, 16, 0x0b000001, 2), true);
+    test_should_be(table.add(0x0a01ffff, 16, nullopt, 9), false);  // same prefix; host bits are ignored
+    test_should_be(route_of(reader.lock(), 0x0a010101), -1);
+    reader.unlock();
+
+    table.commit();
+    {
+        const auto &snapshot = reader.lock();
+        test_should_be(route_of(snapshot, 0x0a010101), 2);
+        test_should_be(route_of(snapshot, 0x0a020101), 1);
+        test_should_be(snapshot.action(snapshot.lookup(0x0a010101)).next_hop.value(), 0x0b000001U);
+        reader.unlock();
+    }
+
+    test_should_be(table.replace(0x0a000000, 8, nullopt, 3), true);
+    test_should_be(table.replace(0x0a020000, 16, nullopt, 3), false);
+    test_should_be(table.remove(0x0a010000, 16), true);
+    test_should_be(table.remove(0x0a010000, 16), false);
+    test_should_be(table.size(), size_t(1));
+    table.commit();
+    test_should_be(route_of(reader.lock(), 0x0a010101), 3);
+    reader.unlock();
+
+    // both snapshots got the updates: the next commit must not bring back the old routes
+    test_should_be(table.add(0, 0, nullopt, 4), true);
+    table.commit();
+    {
+        const auto &snapshot = reader.lock();
+        test_should_be(route_of(snapshot, 0x0a010101), 3);
+        test_should_be(route_of(snapshot, 0xc0a80001), 4);
+        reader.unlock();
+    }
+    test_should_be(table.remove(0x0a000000, 8), true);
+    table.commit();
+    test_should_be(route_of(reader.lock(), 0x0a010101), 4);
+    reader.unlock();
+}
+
+// A control thread keeps moving every route to a new interface, one batch per commit, while this thread looks
+// routes up: every read section must see all the routes of one batch, and never an older batch than before.
+static void concurrent_updates() {
+    constexpr unsigned n_routes = 2000;
+    constexpr unsigned n_batches = 300;
+
+    RouteTable table;
+    for (uint32_t i = 0; i < n_routes; i++) {
+        table.add((10U << 24) | (i << 8), 24, nullopt, 0);
+    }
+    table.add(10U << 24, 8, nullopt, 0);
+    table.commit();
+
+    RouteTable::Reader reader{table};
+    atomic<bool> done{false};
+    thread control([&] {
+        RouteTable::Reader unused{table};  // an idle reader must not hold up grace periods
+        for (size_t batch = 1; batch <= n_batches; batch++) {
+            for (uint32_t i = 0; i < n_routes; i++) {
+                // every other batch removes the odd routes, whose addresses then go to the /8
+                const uint32_t prefix = (10U << 24) | (i << 8);
+                if (i % 2 and batch % 2) {
+                    table.remove(prefix, 24);
+                } else if (not table.replace(prefix, 24, nullopt, batch)) {
+                    table.add(prefix, 24, nullopt, batch);
+                }
+            }
+            table.replace(10U << 24, 8, nullopt, batch);
+            table.commit();
+        }
+        done = true;
+    });
+
+    auto rd = get_random_generator();
+    int last_batch = 0;
+    unsigned sections = 0;
+    while (not done) {
+        const auto &snapshot = reader.lock();
+        const int batch = route_of(snapshot, 10U << 24);
+        for (unsigned i = 0; i < 64; i++) {
+            const uint32_t address = (10U << 24) | ((rd() % n_routes) << 8) | (rd() & 0xff);
+            test_err_if(route_of(snapshot, address) != batch, "a read section saw two batches");
+        }
+        reader.unlock();
+        test_err_if(batch < last_batch, "a read section saw an older batch than the one before");
+        last_batch = batch;
+        sections++;
+        this_thread::yield();
+    }
+    control.join();
+
+    test_should_be(route_of(reader.lock(), (10U << 24) | 0x101), int(n_batches));
+    reader.unlock();
+    test_err_if(sections == 0, "the reader never ran");
+}
+
+int main() {
+    try {
+        updates();
+        concurrent_updates();
+    } catch (const exception &e) {
+        cerr << e.what() << endl;
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,56 @@
+#include "rss_hash.hh"
+#include "test_err_if.hh"
+#include "test_should_be.hh"
+
+#include <cstdint>
+#include <cstdlib>
+#include <exception>
+#include <iostream>
+#include <vector>
+
+using namespace std;
+
+// Checks RSSHash against the IPv4/TCP test vectors in Microsoft's RSS specification
+// ("Verifying the RSS Hash Calculation"), and that the indirection table spreads connections evenly.
+int main() {
+    try {
+        struct Vector {
+            Address destination;
+            Address source;
+            uint32_t hash;
+        };
+        const vector<Vector> vectors = {
+            {{"161.142.100.80", 1766}, {"66.9.149.187", 2794}, 0x51ccc178},
+            {{"65.69.140.83", 4739}, {"199.92.111.2", 14230}, 0xc626b0ea},
+            {{"12.22.207.184", 38024}, {"24.19.198.95", 12898}, 0x5c2b394a},
+            {{"209.142.163.6", 2217}, {"38.27.205.30", 48228}, 0xafc7327f},
+            {{"202.188.127.2", 1303}, {"153.39.163.191", 44251}, 0x10e828a2},
+        };
+
+        const RSSHash rss;
+        for (const auto &v : vectors) {
+            test_should_be(rss(FourTuple::from_addresses(v.destination, v.source)), v.hash);
+        }
+
+        constexpr size_t SHARDS = 4;
+        constexpr size_t CONNECTIONS = 40000;
+        const RSSHash sharded{SHARDS};
+        vector<size_t> per_shard(SHARDS);
+        const FourTuple server = FourTuple::from_addresses({"10.0.0.1", 80}, {"10.0.0.2", 0});
+        for (size_t i = 0; i < CONNECTIONS; i++) {
+            FourTuple tuple = server;
+            tuple.remote_ip += i / 10000;
+            tuple.remote_port = 20000 + i % 10000;
+            per_shard.at(sharded.shard_of(tuple))++;
+        }
+        for (size_t shard = 0; shard < SHARDS; shard++) {
+            test_err_if(per_shard[shard] < CONNECTIONS / SHARDS * 9 / 10,
+                        "shard " + to_string(shard) + " got only " + to_string(per_shard[shard]) + " connections");
+        }
+    } catch (const exception &e) {
+        cerr << e.what() << endl;
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
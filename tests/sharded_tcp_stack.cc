@@ -0,0 +1,161 @@
+#include "sharded_tcp_stack.hh"
+#include "test_err_if.hh"
+#include "test_should_be.hh"
+#include "util.hh"
+
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <exception>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+// A server with two shards, each with its own SO_REUSEPORT socket, echoes what several clients send.
+// Each connection must stay with the shard whose socket the kernel handed its SYN to, which gets the rest
+// of its segments too, so no segment is forwarded between the shards.
+int main() {
+    try {
+        auto rd = get_random_generator();
+
+        constexpr size_t N_SHARDS = 2;
+        constexpr size_t N_CLIENTS = 8;
+        constexpr size_t PAYLOAD_SIZE = 50000;
+
+        TCPConfig tcp_config;
+        tcp_config.send_capacity = tcp_config.recv_capacity = 16000;
+
+        // one port, shared by all shards
+        Address server_address{"127.0.0.1", 0};
+        vector<TCPOverUDPSocketAdapter> adapters;
+        for (size_t i = 0; i < N_SHARDS; i++) {
+            UDPSocket sock;
+            sock.set_reuseport();
+            sock.bind(server_address);
+            server_address = sock.local_address();
+            adapters.emplace_back(move(sock));
+        }
+        FdAdapterConfig server_config;
+        server_config.source = server_address;
+        TCPOverUDPShardedStack server{move(adapters), tcp_config, server_config};
+        server.listen(server_address.port());
+
+        const uint64_t give_up = timestamp_ms() + 20000;
+        atomic<size_t> finished{0};
+        exception_ptr server_error{};
+        thread server_thread([&] {
+            try {
+                server.run([&](TCPOverUDPShardedStack::Stack &stack, const size_t) {
+                    struct Peer {
+                        TCPOverUDPStack::Stream stream;
+                        string received{};
+                        size_t written{0};
+                        bool closed{false};
+                    };
+                    vector<Peer> peers;
+                    // every shard keeps reading its socket until no shard has connections left, since
+                    // the segments of one shard's connections may arrive at another shard's socket
+                    auto live_connections = [&] {
+                        size_t live = 0;
+                        for (size_t shard = 0; shard < N_SHARDS; shard++) {
+                            live += server.counters(shard).connections_accepted;
+                            live -= server.counters(shard).connections_removed;
+                        }
+                        return live;
+                    };
+                    while (finished.load() < N_CLIENTS or live_connections() > 0) {
+                        test_err_if(timestamp_ms() > give_up, "server did not finish");
+                        stack.wait_next_event(10);
+                        while (auto stream = stack.accept(server_address.port())) {
+                            peers.push_back({move(stream.value())});
+                        }
+                        for (auto &peer : peers) {
+                            if (peer.closed) {
+                                continue;
+                            }
+                            peer.received += peer.stream.read();
+                            if (peer.written < peer.received.size()) {
+                                peer.written += peer.stream.write(peer.received.substr(peer.written));
+                            }
+                            if (peer.stream.eof() and peer.written == peer.received.size()) {
+                                peer.stream.close();
+                                peer.closed = true;
+                                finished++;
+                            }
+                        }
+                    }
+                });
+            } catch (...) {
+                server_error = current_exception();
+            }
+        });
+
+        struct Client {
+            unique_ptr<TCPOverUDPStack> stack;
+            TCPOverUDPStack::Stream stream;
+            string sent{};
+            size_t written{0};
+            string received{};
+        };
+        vector<Client> clients;
+        for (size_t i = 0; i < N_CLIENTS; i++) {
+            UDPSocket sock;
+            sock.bind(Address("127.0.0.1", 0));
+            FdAdapterConfig config;
+            config.source = sock.local_address();
+
+            auto stack = make_unique<TCPOverUDPStack>(TCPOverUDPSocketAdapter(move(sock)), tcp_config, config);
+            auto stream = stack->connect(server_address);
+            string payload(PAYLOAD_SIZE, 0);
+            for (auto &ch : payload) {
+                ch = static_cast<char>(rd());
+            }
+            clients.push_back({move(stack), move(stream), move(payload)});
+        }
+
+        auto clients_done = [&] {
+            for (auto &client : clients) {
+                if (not client.stream.eof()) {
+                    return false;
+                }
+            }
+            return true;
+        };
+        while (not clients_done() and not server_error) {
+            test_err_if(timestamp_ms() > give_up, "clients did not finish");
+            for (auto &client : clients) {
+                client.stack->wait_next_event(0);
+                if (client.written < client.sent.size()) {
+                    client.written += client.stream.write(client.sent.substr(client.written, 8192));
+                    if (client.written == client.sent.size()) {
+                        client.stream.end_input();
+                    }
+                }
+                client.received += client.stream.read();
+            }
+        }
+        server_thread.join();
+        if (server_error) {
+            rethrow_exception(server_error);
+        }
+
+        for (size_t i = 0; i < N_CLIENTS; i++) {
+            test_err_if(clients[i].received != clients[i].sent, "client " + to_string(i) + " got a bad echo");
+        }
+        size_t accepted = 0;
+        for (size_t shard = 0; shard < N_SHARDS; shard++) {
+            accepted += server.counters(shard).connections_accepted;
+            test_should_be(size_t(server.counters(shard).segments_forwarded), size_t(0));
+        }
+        test_should_be(accepted, N_CLIENTS);
+    } catch (const exception &e) {
+        cerr << e.what() << endl;
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
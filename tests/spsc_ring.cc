@@ -0,0 +1,124 @@
+#include "spsc_ring.hh"
+#include "tcp_sponge_socket.hh"
+#include "test_err_if.hh"
+#include "test_should_be.hh"
+#include "util.hh"
+
+#include <cstdint>
+#include <cstdlib>
+#include <exception>
+#include <iostream>
+#include <random>
+#include <string>
+#include <thread>
+
+using namespace std;
+
+static string random_bytes(mt19937 &rd, const size_t len) {
+    string data(len, 0);
+    for (auto &ch : data) {
+        ch = static_cast<char>(rd());
+    }
+    return data;
+}
+
+// A writer thread and a reader thread pass a stream through a small ring in chunks of random sizes,
+// so that both of them keep running into a full or empty ring and waiting for each other.
+static void ring_stream() {
+    auto rd = get_random_generator();
+    const string sent = random_bytes(rd, 4 << 20);
+
+    SPSCRing ring{1000};
+    test_should_be(ring.remaining_capacity(), size_t(1024));
+
+    thread writer([&] {
+        auto writer_rd = get_random_generator();
+        size_t written = 0;
+        while (written < sent.size()) {
+            ring.wait_for_space();
+            const size_t chunk = uniform_int_distribution<size_t>{1, 3000}(writer_rd);
+            written += ring.write(string_view(sent).substr(written, chunk));
+        }
+        ring.end_input();
+    });
+
+    string received;
+    while (not ring.eof()) {
+        ring.wait_for_data();
+        received += ring.read(uniform_int_distribution<size_t>{1, 3000}(rd));
+    }
+    writer.join();
+
+    test_err_if(received != sent, "ring corrupted the stream");
+    test_should_be(ring.write("more"), size_t(4));
+    ring.close_reader();
+    test_should_be(ring.write("ignored"), size_t(0));
+}
+
+// Two TCPSpongeSockets with DataPath::SharedRing, connected over UDP on the loopback interface:
+// the client sends a stream and closes, and the server answers with the number of bytes it got.
+static void socket_stream() {
+    auto rd = get_random_generator();
+    const string sent = random_bytes(rd, 200000);
+
+    TCPConfig tcp_config;
+    tcp_config.rt_timeout = 100;
+    tcp_config.send_capacity = tcp_config.recv_capacity = 16000;
+
+    UDPSocket server_sock;
+    server_sock.bind(Address("127.0.0.1", 0));
+    FdAdapterConfig server_config;
+    server_config.source = server_sock.local_address();
+    FdAdapterConfig client_config;
+    client_config.destination = server_config.source;
+
+    TCPOverUDPSpongeSocket server(TCPOverUDPSocketAdapter(move(server_sock)),
+                                  TCPOverUDPSpongeSocket::DataPath::SharedRing);
+    TCPOverUDPSpongeSocket client(TCPOverUDPSocketAdapter(UDPSocket{}),
+                                  TCPOverUDPSpongeSocket::DataPath::SharedRing);
+
+    string server_received;
+    thread server_thread([&] {
+        server.listen_and_accept(tcp_config, server_config);
+        while (not server.recv_eof()) {
+            server_received += server.recv();
+        }
+        server.send(to_string(server_received.size()));
+        server.end_send();
+        server.wait_until_closed();
+    });
+
+    client.connect(tcp_config, client_config);
+    test_should_be(client.send(sent), sent.size());
+    client.end_send();
+    string reply;
+    while (not client.recv_eof()) {
+        reply += client.recv();
+    }
+    client.wait_until_closed();
+    server_thread.join();
+
+    test_err_if(server_received != sent, "server got a corrupted stream");
+    test_err_if(reply != to_string(sent.size()), "client got a bad reply: " + reply);
+}
+
+int main() {
+    try {
+        ring_stream();
+        socket_stream();
+
+        bool threw = false;
+        try {
+            TCPOverUDPSpongeSocket sock(TCPOverUDPSocketAdapter(UDPSocket{}));
+            sock.send("x");
+        } catch (const runtime_error &) {
+            threw = true;
+        }
+        test_err_if(not threw, "send() should require DataPath::SharedRing");
+    } catch (const exception &e) {
+        cerr << e.what() << endl;
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,235 @@
+#include "router.hh"
+#include "stats.hh"
+#include "tcp_connection.hh"
+#include "test_err_if.hh"
+#include "test_should_be.hh"
+#include "util.hh"
+
+#include <cstdint>
+#include <cstdlib>
+#include <exception>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <vector>
+
+using namespace std;
+
+// Snapshots sum what their sources add, keep labels apart, and print in the Prometheus text format.
+static void snapshots() {
+    StatCounter counter;
+    counter.add();
+    counter.add(4);
+    StatCounter copy{counter};
+    counter.set(1);
+    test_should_be(copy.value(), uint64_t(5));
+    test_should_be(counter.value(), uint64_t(1));
+
+    StatsRegistry registry;
+    StatsSnapshot empty = registry.snapshot();
+    test_should_be(empty.total("sponge_test_total"), uint64_t(0));
+    {
+        const string eth0 = StatsSnapshot::label("interface", "eth0");
+        auto first = registry.add([&](StatsSnapshot &snapshot) {
+            snapshot.add("sponge_test_total", "A test counter", StatsSnapshot::Type::Counter, copy.value(), eth0);
+        });
+        auto second = registry.add([&](StatsSnapshot &snapshot) {
+            snapshot.add("sponge_test_total", "A test counter", StatsSnapshot::Type::Counter, 2, eth0);
+            snapshot.add("sponge_test_total", "A test counter", StatsSnapshot::Type::Counter, 3);
+            snapshot.add("sponge_test_depth", "A test gauge", StatsSnapshot::Type::Gauge, 7);
+        });
+        const StatsSnapshot snapshot = registry.snapshot();
+        test_should_be(snapshot.value("sponge_test_total", eth0), uint64_t(7));
+        test_should_be(snapshot.value("sponge_test_total"), uint64_t(3));
+        test_should_be(snapshot.total("sponge_test_total"), uint64_t(10));
+
+        const string expected =
+            "# HELP sponge_test_depth A test gauge\n"
+            "# TYPE sponge_test_depth gauge\n"
+            "sponge_test_depth 7\n"
+            "# HELP sponge_test_total A test counter\n"
+            "# TYPE sponge_test_total counter\n"
+            "sponge_test_total 3\n"
+            "sponge_test_total{interface=\"eth0\"} 7\n";
+        test_err_if(snapshot.to_prometheus() != expected, "wrong exposition:\n" + snapshot.to_prometheus());
+
+        char path[32] = "/tmp/sponge_stats_XXXXXX";
+        SystemCall("close", close(SystemCall("mkstemp", mkstemp(path))));
+        snapshot.write_prometheus_file(path);
+        ifstream file{path};
+        stringstream contents;
+        contents << file.rdbuf();
+        unlink(path);
+        test_err_if(contents.str() != expected, "wrong file:\n" + contents.str());
+
+        second = StatsRegistry::Registration{};  // unregisters the second source
+        test_should_be(registry.snapshot().total("sponge_test_total"), uint64_t(5));
+    }
+    test_should_be(registry.snapshot().total("sponge_test_total"), uint64_t(0));
+
+    test_err_if(StatsSnapshot::label("name", "a\"b\\c\nd") != "name=\"a\\\"b\\\\c\\nd\"", "label not escaped");
+
+    bool threw = false;
+    try {
+        StatsSnapshot snapshot;
+        snapshot.add("sponge_test", "", StatsSnapshot::Type::Counter, 1);
+        snapshot.add("sponge_test", "", StatsSnapshot::Type::Gauge, 1);
+    } catch (const exception &) {
+        threw = true;
+    }
+    test_err_if(not threw, "a metric was both a counter and a gauge");
+}
+
+// The exporter answers an HTTP request on its socket with a snapshot, and outlives clients that hang up early.
+static void exporter() {
+    StatsRegistry registry;
+    auto registration = registry.add([](StatsSnapshot &snapshot) {
+        snapshot.add("sponge_test_total", "A test counter", StatsSnapshot::Type::Counter, 42);
+    });
+    const string path = "/tmp/sponge_stats_" + to_string(getpid()) + ".sock";
+    PrometheusExporter exporter{registry, path};
+
+    const auto connect_client = [&] {
+        sockaddr_un address{};
+        address.sun_family = AF_UNIX;
+        path.copy(static_cast<char *>(address.sun_path), path.size());
+        FileDescriptor client{SystemCall("socket", ::socket(AF_UNIX, SOCK_STREAM, 0))};
+        SystemCall("connect",
+                   ::connect(client.fd_num(), reinterpret_cast<const sockaddr *>(&address), sizeof(address)));
+        return client;
+    };
+
+    // the reply to a client that has already hung up must not raise SIGPIPE
+    for (size_t i = 0; i < 2; i++) {
+        connect_client().close();
+    }
+
+    for (size_t i = 0; i < 2; i++) {
+        FileDescriptor client = connect_client();
+        client.write("GET /metrics HTTP/1.0\r\n\r\n");
+        string response;
+        while (not client.eof()) {
+            response += client.read();
+        }
+        test_err_if(response.find("HTTP/1.0 200 OK\r\n") != 0, "wrong response: " + response);
+        test_err_if(response.find("\nsponge_test_total 42\n") == string::npos, "metric missing: " + response);
+    }
+}
+
+// Move every segment that `from` has sent to `to`, except that segments with a payload go to `held` if it is given
+static void deliver(TCPConnection &from, TCPConnection &to, vector<TCPSegment> *held = nullptr) {
+    while (not from.segments_out().empty()) {
+        TCPSegment segment = move(from.segments_out().front());
+        from.segments_out().pop();
+        if (held and segment.payload().size() > 0) {
+            held->push_back(move(segment));
+        } else {
+            to.segment_received(segment);
+        }
+    }
+}
+
+// A connection counts what it sends and receives, including retransmissions, duplicate ACKs and
+// out-of-order data.
+static void connections() {
+    TCPConfig config;
+    TCPConnection client{config}, server{config};
+    client.connect();
+    deliver(client, server);
+    deliver(server, client);
+    deliver(client, server);
+    test_err_if(not client.active() or not server.active(), "handshake failed");
+
+    // three segments, of which the first is lost and the other two arrive out of order
+    client.write(string(3 * TCPConfig::MAX_PAYLOAD_SIZE, 'x'));
+    vector<TCPSegment> sent;
+    deliver(client, server, &sent);
+    test_should_be(sent.size(), size_t(3));
+    server.segment_received(sent.at(1));
+    server.segment_received(sent.at(2));
+    test_should_be(server.unassembled_bytes(), 2 * TCPConfig::MAX_PAYLOAD_SIZE);
+    deliver(server, client);  // two duplicate ACKs
+
+    client.tick(config.rt_timeout);  // retransmits the first segment
+    deliver(client, server);
+    deliver(server, client);
+    test_should_be(server.inbound_stream().buffer_size(), 3 * TCPConfig::MAX_PAYLOAD_SIZE);
+
+    StatsSnapshot snapshot;
+    client.collect_stats(snapshot, StatsSnapshot::label("side", "client"));
+    server.collect_stats(snapshot, StatsSnapshot::label("side", "server"));
+    const string client_side = StatsSnapshot::label("side", "client");
+    const string server_side = StatsSnapshot::label("side", "server");
+    test_should_be(snapshot.value("sponge_tcp_retransmissions_total", client_side), uint64_t(1));
+    test_should_be(snapshot.value("sponge_tcp_duplicate_acks_total", client_side), uint64_t(2));
+    test_should_be(snapshot.value("sponge_tcp_payload_bytes_sent_total", client_side),
+                   uint64_t(4 * TCPConfig::MAX_PAYLOAD_SIZE));
+    test_should_be(snapshot.value("sponge_tcp_payload_bytes_received_total", server_side),
+                   uint64_t(3 * TCPConfig::MAX_PAYLOAD_SIZE));
+    test_should_be(snapshot.value("sponge_tcp_out_of_order_bytes_total", server_side),
+                   uint64_t(2 * TCPConfig::MAX_PAYLOAD_SIZE));
+    test_should_be(snapshot.value("sponge_tcp_unassembled_bytes", server_side), uint64_t(0));
+    test_should_be(snapshot.value("sponge_tcp_segments_sent_total", client_side),
+                   snapshot.value("sponge_tcp_segments_received_total", server_side) + 1);  // one was lost
+    test_should_be(snapshot.total("sponge_tcp_resets_sent_total"), uint64_t(0));
+}
+
+// A router counts what it routes and drops, and its interfaces what they send and receive.
+static void router() {
+    Router router;
+    const EthernetAddress router_eth{0x02, 0, 0, 0, 0, 1};
+    const EthernetAddress host_eth{0x02, 0, 0, 0, 0, 2};
+    router.add_interface(AsyncNetworkInterface{router_eth, Address("10.0.0.1", 0)});
+    router.add_route(Address("10.0.0.0", 0).ipv4_numeric(), 8, {}, 0);
+
+    auto receive = [&](const string &dst, const uint8_t ttl) {
+        InternetDatagram dgram;
+        dgram.header().src = Address("10.0.0.2", 0).ipv4_numeric();
+        dgram.header().dst = Address(dst, 0).ipv4_numeric();
+        dgram.header().ttl = ttl;
+        dgram.payload() = string("hello");
+        dgram.header().len = dgram.header().hlen * 4 + dgram.payload().size();
+        EthernetFrame frame;
+        frame.header() = {router_eth, host_eth, EthernetHeader::TYPE_IPv4};
+        frame.payload() = dgram.serialize().concatenate();
+        router.interface(0).recv_frame(frame);
+    };
+    receive("10.0.0.3", 64);
+    receive("10.0.0.3", 64);
+    receive("10.0.0.4", 1);
+    receive("192.168.0.1", 64);
+    EthernetFrame elsewhere;
+    elsewhere.header() = {host_eth, host_eth, EthernetHeader::TYPE_IPv4};
+    router.interface(0).recv_frame(elsewhere);
+    router.route();
+
+    StatsSnapshot snapshot;
+    router.collect_stats(snapshot);
+    const string interface0 = StatsSnapshot::label("interface", "0");
+    test_should_be(snapshot.value("sponge_router_datagrams_routed_total"), uint64_t(2));
+    test_should_be(snapshot.value("sponge_router_ttl_drops_total"), uint64_t(1));
+    test_should_be(snapshot.value("sponge_router_no_route_drops_total"), uint64_t(1));
+    test_should_be(snapshot.value("sponge_interface_datagrams_received_total", interface0), uint64_t(4));
+    test_should_be(snapshot.value("sponge_interface_frames_ignored_total", interface0), uint64_t(1));
+    test_should_be(snapshot.value("sponge_interface_arp_misses_total", interface0), uint64_t(2));
+    test_should_be(snapshot.value("sponge_interface_arp_requests_sent_total", interface0), uint64_t(1));
+    test_should_be(snapshot.value("sponge_interface_datagrams_sent_total", interface0), uint64_t(0));
+}
+
+int main() {
+    try {
+        snapshots();
+        exporter();
+        connections();
+        router();
+    } catch (const exception &e) {
+        cerr << e.what() << endl;
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,153 @@
+#include "tcp_stack.hh"
+#include "test_err_if.hh"
+#include "test_should_be.hh"
+#include "util.hh"
+
+#include <cstdint>
+#include <cstdlib>
+#include <exception>
+#include <iostream>
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+// One server stack accepts connections from two client stacks over loopback UDP. Each client sends a
+// random payload and closes; the server echoes each payload back on the same connection and closes.
+// All three stacks are driven from this thread.
+int main() {
+    try {
+        auto rd = get_random_generator();
+
+        constexpr size_t N_CLIENTS = 2;
+        constexpr size_t PAYLOAD_SIZE = 200000;
+
+        // small windows, so that the bursts from all clients fit in the server's socket buffer
+        TCPConfig tcp_config;
+        tcp_config.send_capacity = tcp_config.recv_capacity = 16000;
+
+        auto make_stack = [&](const Address &address) {
+            UDPSocket sock;
+            sock.bind(address);
+            FdAdapterConfig config;
+            config.source = sock.local_address();
+            return make_unique<TCPOverUDPStack>(TCPOverUDPSocketAdapter(move(sock)), tcp_config, config);
+        };
+
+        auto server = make_stack(Address("127.0.0.1", 0));
+        const Address server_address = server->adapter().config().source;
+        server->listen(server_address.port());
+
+        struct Client {
+            unique_ptr<TCPOverUDPStack> stack;
+            TCPOverUDPStack::Stream stream;
+            string sent{};
+            size_t written{0};
+            string received{};
+        };
+        vector<Client> clients;
+        for (size_t i = 0; i < N_CLIENTS; i++) {
+            auto stack = make_stack(Address("127.0.0.1", 0));
+            auto stream = stack->connect(server_address);
+            string payload(PAYLOAD_SIZE, 0);
+            for (auto &ch : payload) {
+                ch = static_cast<char>(rd());
+            }
+            clients.push_back({move(stack), move(stream), move(payload)});
+        }
+
+        struct Peer {
+            TCPOverUDPStack::Stream stream;
+            string received{};
+            size_t written{0};
+            bool closed{false};
+        };
+        vector<Peer> peers;
+
+        const uint64_t give_up = timestamp_ms() + 20000;
+        auto done = [&] {
+            if (peers.size() != N_CLIENTS) {
+                return false;
+            }
+            for (auto &client : clients) {
+                if (not client.stream.eof()) {
+                    return false;
+                }
+            }
+            return server->connection_count() == 0;
+        };
+
+        while (not done()) {
+            test_err_if(timestamp_ms() > give_up, "transfer did not finish");
+
+            for (auto &client : clients) {
+                client.stack->wait_next_event(0);
+                if (client.written < client.sent.size()) {
+                    client.written += client.stream.write(client.sent.substr(client.written, 8192));
+                    if (client.written == client.sent.size()) {
+                        client.stream.end_input();
+                    }
+                }
+                client.received += client.stream.read();
+            }
+
+            server->wait_next_event(1);
+            while (auto stream = server->accept(server_address.port())) {
+                peers.push_back({move(stream.value())});
+            }
+            for (auto &peer : peers) {
+                if (peer.closed) {
+                    continue;
+                }
+                peer.received += peer.stream.read();
+                if (peer.written < peer.received.size()) {
+                    peer.written += peer.stream.write(peer.received.substr(peer.written, 8192));
+                }
+                if (peer.stream.eof() and peer.written == peer.received.size()) {
+                    peer.stream.close();
+                    peer.closed = true;
+                }
+            }
+        }
+
+        test_should_be(peers.size(), N_CLIENTS);
+        for (size_t i = 0; i < N_CLIENTS; i++) {
+            test_err_if(clients[i].received != clients[i].sent, "client " + to_string(i) + " got a bad echo");
+        }
+
+        // an accepted SYN is counted once: the listener has received just what the client has sent
+        auto listener = make_stack(Address("127.0.0.1", 0));
+        const Address listener_address = listener->adapter().config().source;
+        listener->listen(listener_address.port());
+        auto dialer = make_stack(Address("127.0.0.1", 0));
+        auto dialed = dialer->connect(listener_address);
+        optional<TCPOverUDPStack::Stream> answered;
+        while (not answered) {
+            test_err_if(timestamp_ms() > give_up, "connection was not accepted");
+            dialer->wait_next_event(0);
+            listener->wait_next_event(1);
+            answered = listener->accept(listener_address.port());
+        }
+        test_should_be(uint64_t(listener->counters().segments_received), uint64_t(dialer->counters().segments_sent));
+
+        // a connection to a stack that is not listening is reset
+        auto deaf = make_stack(Address("127.0.0.1", 0));
+        auto stray = make_stack(Address("127.0.0.1", 0));
+        auto refused = stray->connect(deaf->adapter().config().source);
+        while (refused.active()) {
+            test_err_if(timestamp_ms() > give_up, "connection was not refused");
+            stray->wait_next_event(0);
+            deaf->wait_next_event(1);
+        }
+        test_err_if(refused.state() != TCPState::State::RESET, "refused connection is " + refused.state().name());
+        test_should_be(deaf->connection_count(), size_t{0});
+        test_should_be(uint64_t(deaf->counters().segments_received), uint64_t(deaf->counters().resets_sent));
+    } catch (const exception &e) {
+        cerr << e.what() << endl;
+        return 1;
+    }
+
+    return EXIT_SUCCESS;
+}
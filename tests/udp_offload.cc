@@ -0,0 +1,83 @@
+#include "socket.hh"
+#include "test_err_if.hh"
+#include "test_should_be.hh"
+#include "util.hh"
+
+#include <cstdint>
+#include <exception>
+#include <iostream>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+// Sends bursts over loopback with sendto_batch() and sendto_gso(), and checks that
+// recv_batch() gets back every datagram, in order, whether or not the kernel coalesced them.
+int main() {
+    try {
+        auto rd = get_random_generator();
+
+        UDPSocket receiver;
+        receiver.bind(Address("127.0.0.1", 0));
+        const Address destination = receiver.local_address();
+
+        UDPSocket sender;
+        sender.bind(Address("127.0.0.1", 0));
+
+        constexpr size_t N_DATAGRAMS = 40;
+        constexpr size_t SEGMENT_SIZE = 1020;
+
+        vector<string> sent;
+        for (size_t i = 0; i < N_DATAGRAMS; i++) {
+            string payload(i + 1 == N_DATAGRAMS ? SEGMENT_SIZE / 3 : SEGMENT_SIZE, 0);
+            for (auto &ch : payload) {
+                ch = static_cast<char>(rd());
+            }
+            sent.push_back(move(payload));
+        }
+
+        auto receive_all = [&](UDPSocket::RecvBatch &batch) {
+            vector<string> received;
+            while (received.size() < N_DATAGRAMS) {
+                receiver.recv_batch(batch);
+                for (size_t i = 0; i < batch.size(); i++) {
+                    test_should_be(batch.source_address(i) == sender.local_address(), true);
+                    string_view payload = batch.payload(i);
+                    while (not payload.empty()) {
+                        const size_t len = min(batch.segment_size(i), payload.size());
+                        received.emplace_back(payload.substr(0, len));
+                        payload.remove_prefix(len);
+                    }
+                }
+            }
+            test_should_be(received.size(), N_DATAGRAMS);
+            for (size_t i = 0; i < N_DATAGRAMS; i++) {
+                test_err_if(received[i] != sent[i], "datagram " + to_string(i) + " was corrupted");
+            }
+        };
+
+        // sendmmsg/recvmmsg, without offload
+        {
+            UDPSocket::RecvBatch batch{8, 2048};
+            sender.sendto_batch(destination, {sent.begin(), sent.end()});
+            receive_all(batch);
+        }
+
+        // UDP_SEGMENT on send, UDP_GRO on receive
+        {
+            receiver.set_gro(true);
+            UDPSocket::RecvBatch batch{};
+            BufferList burst;
+            for (const auto &payload : sent) {
+                burst.append(string(payload));
+            }
+            sender.sendto_gso(destination, burst, SEGMENT_SIZE);
+            receive_all(batch);
+        }
+    } catch (const exception &e) {
+        cerr << e.what() << endl;
+        return 1;
+    }
+
+    return EXIT_SUCCESS;
+}